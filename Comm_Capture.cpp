@@ -0,0 +1,306 @@
+#include "Comm_Capture.h"
+#include "Comm_EspNow.h"
+#include <LittleFS.h>
+#include <atomic>
+
+// === 設定 ===
+static const char* CAP_OLD = "/cap0.bin";            // 古い方（再生はこちらから）
+static const char* CAP_NEW = "/cap1.bin";            // 書き込み中
+static const uint8_t CAP_VERSION = 1;
+static const size_t FILE_HDR = 8;
+static const size_t REC_HDR = 14;                    // at4 + mac6 + rssi1 + flags1 + len2
+static const size_t CAP_FRAME_MAX = 1470;            // ESP-NOW v2 の最大フレーム長
+static const uint32_t CAP_BUF_SIZE = 16384;          // 2 のべき乗
+static const uint32_t CAP_FLUSH_BYTES = 4096;        // これだけ溜まったら書く
+static const unsigned long CAP_FLUSH_MS = 1000;      // 少なくてもこの間隔で書く
+static const size_t CAP_MIN_BYTES = 16 * 1024;
+static const uint8_t REPLAY_BURST = 4;               // 1回の Tick で流す最大数
+static const unsigned long REPLAY_MAX_GAP_MS = 2000; // これより長い空白は詰める（再起動をまたいだ記録も含む）
+
+// 受信タスク → loop のSPSCリング（head は受信タスク、tail は loop だけが更新する）
+static uint8_t s_buf[CAP_BUF_SIZE];
+static std::atomic<uint32_t> s_head{0};
+static std::atomic<uint32_t> s_tail{0};
+
+static volatile bool s_recording = false;
+static bool s_hooked = false;
+static File s_file;
+static size_t s_fileBytes = 0;
+static size_t s_halfBytes = 0;
+static unsigned long s_flushAt = 0;
+
+static volatile uint32_t s_frames = 0;
+static volatile uint32_t s_dropped = 0;
+static volatile uint16_t s_highWater = 0;
+static uint32_t s_bytesWritten = 0;
+static uint32_t s_rotations = 0;
+
+// 再生（loop のみ）
+static bool s_replaying = false;
+static File s_replayFile;
+static uint8_t s_replayFileIdx = 0;
+static bool s_replayHave = false;
+static bool s_replayFirst = true;
+static uint32_t s_replayPrevAt = 0;
+static unsigned long s_replayDueAt = 0;
+static uint16_t s_replaySpeed = 100;
+static uint32_t s_replayed = 0;
+static uint8_t s_recHdr[REC_HDR];
+static uint8_t s_recData[CAP_FRAME_MAX];
+
+static void fsBegin() {
+  if (!LittleFS.begin(false)) LittleFS.begin(true);
+}
+
+static void ringPut(uint32_t pos, const uint8_t* src, size_t n) {
+  const uint32_t off = pos & (CAP_BUF_SIZE - 1);
+  const size_t first = min((size_t)(CAP_BUF_SIZE - off), n);
+  memcpy(s_buf + off, src, first);
+  if (n > first) memcpy(s_buf, src + first, n - first);
+}
+
+// 受信タスクから: リングへコピーするだけ（入らなければ捨てて数える）
+static void onRawFrame(unsigned long at, const uint8_t* mac, int rssi, const uint8_t* data, size_t len) {
+  if (!s_recording || len > CAP_FRAME_MAX) return;
+  const uint32_t need = REC_HDR + len;
+  const uint32_t head = s_head.load(std::memory_order_relaxed);
+  const uint32_t used = head - s_tail.load(std::memory_order_acquire);
+  if (used + need > CAP_BUF_SIZE) {
+    s_dropped++;
+    return;
+  }
+
+  uint8_t h[REC_HDR];
+  const uint32_t at32 = (uint32_t)at;
+  memcpy(h, &at32, 4);
+  if (mac) memcpy(h + 4, mac, 6);
+  else memset(h + 4, 0, 6);
+  h[10] = (uint8_t)(int8_t)rssi;
+  h[11] = mac ? 1 : 0;
+  const uint16_t len16 = (uint16_t)len;
+  memcpy(h + 12, &len16, 2);
+
+  ringPut(head, h, REC_HDR);
+  ringPut(head + REC_HDR, data, len);
+  s_head.store(head + need, std::memory_order_release);
+
+  s_frames++;
+  if (used + need > s_highWater) s_highWater = (uint16_t)(used + need);
+}
+
+static bool openNew() {
+  s_file = LittleFS.open(CAP_NEW, "w");
+  if (!s_file) return false;
+  const uint8_t hdr[FILE_HDR] = {'T', 'C', 'A', 'P', CAP_VERSION, 0, 0, 0};
+  s_file.write(hdr, FILE_HDR);
+  s_fileBytes = FILE_HDR;
+  return true;
+}
+
+// 書き込み中のファイルを古い方へ回し、いちばん古い記録を捨てる
+static bool rotate() {
+  s_file.close();
+  LittleFS.remove(CAP_OLD);
+  LittleFS.rename(CAP_NEW, CAP_OLD);
+  s_rotations++;
+  return openNew();
+}
+
+// loop から: 溜まった分をまとめて書く。リングにはレコード単位でしか公開されないので、
+// 書く単位の境目は常にレコードの境目になる
+static void flush(unsigned long now, bool force) {
+  const uint32_t tail = s_tail.load(std::memory_order_relaxed);
+  const uint32_t pending = s_head.load(std::memory_order_acquire) - tail;
+  if (pending == 0) return;
+  if (!force && pending < CAP_FLUSH_BYTES && now - s_flushAt < CAP_FLUSH_MS) return;
+  s_flushAt = now;
+
+  if (!s_file) {
+    s_tail.store(tail + pending, std::memory_order_release);
+    return;
+  }
+  if (s_fileBytes + pending > s_halfBytes && s_fileBytes > FILE_HDR && !rotate()) {
+    s_tail.store(tail + pending, std::memory_order_release);
+    return;
+  }
+
+  const uint32_t off = tail & (CAP_BUF_SIZE - 1);
+  const size_t first = min((size_t)(CAP_BUF_SIZE - off), (size_t)pending);
+  size_t written = s_file.write(s_buf + off, first);
+  if (pending > first) written += s_file.write(s_buf, pending - first);
+  s_file.flush();
+  s_tail.store(tail + pending, std::memory_order_release);
+
+  s_fileBytes += written;
+  s_bytesWritten += written;
+}
+
+bool Capture_Start(size_t maxBytes) {
+  if (s_replaying) return false;
+  if (s_recording) Capture_Stop();
+  fsBegin();
+  LittleFS.remove(CAP_OLD);
+  LittleFS.remove(CAP_NEW);
+  s_halfBytes = max(maxBytes, CAP_MIN_BYTES) / 2;
+  if (!openNew()) return false;
+
+  s_tail.store(s_head.load(std::memory_order_acquire), std::memory_order_release);
+  s_frames = 0;
+  s_dropped = 0;
+  s_highWater = 0;
+  s_bytesWritten = 0;
+  s_rotations = 0;
+  s_flushAt = millis();
+  if (!s_hooked) {
+    Comm_SetOnRawFrame(onRawFrame);
+    s_hooked = true;
+  }
+  s_recording = true;
+  return true;
+}
+
+void Capture_Stop() {
+  if (!s_recording) return;
+  s_recording = false;
+  flush(millis(), true);
+  s_file.close();
+}
+
+void Capture_Clear() {
+  Capture_Stop();
+  Capture_StopReplay();
+  fsBegin();
+  LittleFS.remove(CAP_OLD);
+  LittleFS.remove(CAP_NEW);
+}
+
+static bool replayOpenNext() {
+  while (s_replayFileIdx < 2) {
+    const char* path = (s_replayFileIdx++ == 0) ? CAP_OLD : CAP_NEW;
+    if (!LittleFS.exists(path)) continue;
+    s_replayFile = LittleFS.open(path, "r");
+    if (!s_replayFile) continue;
+    uint8_t hdr[FILE_HDR];
+    if (s_replayFile.read(hdr, FILE_HDR) == FILE_HDR && memcmp(hdr, "TCAP", 4) == 0 && hdr[4] == CAP_VERSION) {
+      return true;
+    }
+    s_replayFile.close();
+  }
+  return false;
+}
+
+// 次のレコードを s_recHdr / s_recData へ。途中で切れたレコードはそのファイルの終わりとみなす
+static bool replayReadNext() {
+  for (;;) {
+    if (s_replayFile) {
+      if (s_replayFile.read(s_recHdr, REC_HDR) == REC_HDR) {
+        uint16_t len;
+        memcpy(&len, s_recHdr + 12, 2);
+        if (len <= CAP_FRAME_MAX && s_replayFile.read(s_recData, len) == len) return true;
+      }
+      s_replayFile.close();
+    }
+    if (!replayOpenNext()) return false;
+  }
+}
+
+bool Capture_Replay(uint16_t speedPct) {
+  Capture_Stop();
+  Capture_StopReplay();
+  fsBegin();
+  s_replayFileIdx = 0;
+  if (!replayOpenNext()) return false;
+  s_replaySpeed = speedPct ? speedPct : 100;
+  s_replayHave = false;
+  s_replayFirst = true;
+  s_replayDueAt = millis();
+  s_replayed = 0;
+  s_replaying = true;
+  Comm_SetReplayMode(true);
+  return true;
+}
+
+void Capture_StopReplay() {
+  if (!s_replaying) return;
+  s_replaying = false;
+  s_replayFile.close();
+  Comm_SetReplayMode(false);
+}
+
+// 記録時の間隔どおりに受信経路へ流す
+static void replayTick(unsigned long now) {
+  for (uint8_t i = 0; i < REPLAY_BURST && s_replaying; i++) {
+    if (!s_replayHave) {
+      if (!replayReadNext()) {
+        Serial.printf("[CAP] Replay done: %lu frames\n", (unsigned long)s_replayed);
+        Capture_StopReplay();
+        return;
+      }
+      uint32_t at;
+      memcpy(&at, s_recHdr, 4);
+      uint32_t gap = s_replayFirst ? 0 : at - s_replayPrevAt;
+      if (gap > REPLAY_MAX_GAP_MS) gap = REPLAY_MAX_GAP_MS; // 逆行（再起動）もここで詰める
+      s_replayDueAt += gap * 100UL / s_replaySpeed;
+      s_replayPrevAt = at;
+      s_replayFirst = false;
+      s_replayHave = true;
+    }
+    if ((long)(now - s_replayDueAt) < 0) return;
+
+    uint16_t len;
+    memcpy(&len, s_recHdr + 12, 2);
+    if (!Comm_InjectFrame((s_recHdr[11] & 1) ? s_recHdr + 4 : nullptr, s_recData, len, (int8_t)s_recHdr[10])) {
+      return; // 受信タスクが取り出すまで次の Tick で渡し直す
+    }
+    s_replayed++;
+    s_replayHave = false;
+  }
+}
+
+void Capture_Tick() {
+  const unsigned long now = millis();
+  if (s_recording) flush(now, false);
+  if (s_replaying) replayTick(now);
+}
+
+void Capture_GetStats(CaptureStats& out) {
+  out.recording = s_recording;
+  out.replaying = s_replaying;
+  out.frames = s_frames;
+  out.dropped = s_dropped;
+  out.bytesWritten = s_bytesWritten;
+  out.rotations = s_rotations;
+  out.bufferHighWater = s_highWater;
+  out.replayed = s_replayed;
+}
+
+bool Capture_HandleCommand(const String& line) {
+  if (!line.startsWith("cap")) return false;
+  String arg = line.substring(3);
+  arg.trim();
+
+  if (arg.startsWith("start")) {
+    const long kb = arg.substring(5).toInt();
+    const bool ok = kb > 0 ? Capture_Start((size_t)kb * 1024) : Capture_Start();
+    Serial.printf("[CAP] Start %s\n", ok ? "OK" : "FAILED");
+  } else if (arg == "stop") {
+    Capture_Stop();
+    Serial.println("[CAP] Stopped");
+  } else if (arg.startsWith("replay")) {
+    const long pct = arg.substring(6).toInt();
+    const bool ok = Capture_Replay(pct > 0 ? (uint16_t)min(pct, 10000L) : 100);
+    Serial.printf("[CAP] Replay %s\n", ok ? "started" : "FAILED (no capture)");
+  } else if (arg == "clear") {
+    Capture_Clear();
+    Serial.println("[CAP] Cleared");
+  } else {
+    CaptureStats st;
+    Capture_GetStats(st);
+    Serial.printf("[CAP] %s: %lu frames, dropped %lu, written %lu B, rotations %lu, buffer high-water %u B, replayed %lu\n",
+                  st.recording ? "recording" : (st.replaying ? "replaying" : "idle"),
+                  (unsigned long)st.frames, (unsigned long)st.dropped,
+                  (unsigned long)st.bytesWritten, (unsigned long)st.rotations,
+                  st.bufferHighWater, (unsigned long)st.replayed);
+  }
+  return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <Arduino.h>
+
+// ========== 受信フレームの記録（LittleFS）と再生 ==========
+// Comm_SetOnRawFrame で受けた生フレームを RAM のリングへコピーするだけにし、
+// ファイルへの書き込みは loop の Capture_Tick で行う（受信タスクは待たない）。
+// 記録は2ファイルの交互書き: 片方が上限の半分を超えたら古い方を消して新しいファイルへ移る。
+//
+// ファイル形式（リトルエンディアン）:
+//   先頭 8B: "TCAP" + version(1) + 予約3B
+//   1件ごと: at(uint32, ms) mac[6] rssi(int8) flags(uint8, bit0=macあり) len(uint16) data[len]
+// 再生は古いファイルから順に、記録時の間隔どおり Comm_InjectFrame で受信経路へ流し直す
+// （長い空白は詰める）。再生中は記録せず、Comm_SetReplayMode で実際の受信を捨てて送信も止める
+// （再生したフレームはプロトコルをそのまま通るが、応答は電波に出ない）。
+
+struct CaptureStats {
+  bool     recording;
+  bool     replaying;
+  uint32_t frames;        // 記録したフレーム数
+  uint32_t dropped;       // バッファ満杯で捨てたフレーム数
+  uint32_t bytesWritten;  // ファイルへ書いたバイト数
+  uint32_t rotations;     // ファイルを切り替えた回数
+  uint16_t bufferHighWater;
+  uint32_t replayed;      // 再生で流したフレーム数
+};
+
+// 記録を始める（以前の記録は消す）。maxBytes は2ファイル合計の目安
+bool Capture_Start(size_t maxBytes = 256 * 1024);
+void Capture_Stop();
+
+// 記録を再生する。speedPct=200 で2倍速
+bool Capture_Replay(uint16_t speedPct = 100);
+void Capture_StopReplay();
+
+// 記録ファイルを消す
+void Capture_Clear();
+
+// loop から呼ぶ: バッファの書き出しと再生
+void Capture_Tick();
+
+void Capture_GetStats(CaptureStats& out);
+
+// Serial コマンド "cap start [KB]" / "cap stop" / "cap replay [%]" / "cap clear" / "cap stat"。
+// "cap" で始まらなければ false
+bool Capture_HandleCommand(const String& line);
@@ -5,96 +5,2399 @@
 #include <esp_wifi.h>
 #include <esp_wifi_types.h>
 #include <esp_idf_version.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#if __has_include(<esp_rom_crc.h>)
+#include <esp_rom_crc.h>
+#define COMM_HAVE_ROM_CRC 1
+#endif
+
+// === 設定 ===
+static const uint8_t MAC_BC[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
+static const uint16_t CHUNK_MAX      = 200;     // 1パケットのデータ最大
+static const uint16_t MAX_MSG_BYTES  = 2048;    // 再構成の最大サイズ
+static const uint16_t MAX_CHUNKS     = (MAX_MSG_BYTES + CHUNK_MAX - 1) / CHUNK_MAX;
+static const unsigned long RX_TIMEOUT_MS = 2500; // 受信途中の期限
+
+// 受信キュー（WiFiタスク → 受信タスク）
+static const uint16_t RXQ_SLOTS      = 32;      // 2の累乗
+static const uint16_t RXQ_FRAME_MAX  = 250;     // ESP-NOW v1 の最大ペイロード
+// ESP-NOW v2 の大きなフレーム（1メッセージを分割せずに送る）。数は少ないので別の小さなリングに置く
+#ifdef ESP_NOW_MAX_DATA_LEN_V2
+static const uint16_t BIG_FRAME_MAX  = ESP_NOW_MAX_DATA_LEN_V2;
+#else
+static const uint16_t BIG_FRAME_MAX  = RXQ_FRAME_MAX; // v2 のない IDF: 大きなフレームは使わない
+#endif
+static const uint16_t RXQ_BIG_SLOTS  = 2;       // 2の累乗
+
+// 送信キュー（loop/受信タスク → 送信タスク）。送信完了コールバックで次を送る
+static const uint16_t TXQ_SLOTS      = 32;      // 2の累乗
+static const unsigned long TX_INFLIGHT_TIMEOUT_MS = 50; // 完了通知が来ない場合の見切り
+
+// 送信レートの段（ADAPTIVE 用。遅い → 速い）。6/9M は 11M より遅いので使わない
+struct RateStep { wifi_phy_rate_t rate; uint16_t kbps; };
+static const RateStep RATE_LADDER[] = {
+  {WIFI_PHY_RATE_1M_L, 1000}, {WIFI_PHY_RATE_2M_L, 2000}, {WIFI_PHY_RATE_5M_L, 5500},
+  {WIFI_PHY_RATE_11M_L, 11000}, {WIFI_PHY_RATE_12M, 12000}, {WIFI_PHY_RATE_18M, 18000},
+  {WIFI_PHY_RATE_24M, 24000},
+};
+static const uint8_t RATE_STEPS       = sizeof(RATE_LADDER) / sizeof(RATE_LADDER[0]);
+// 段に使わないレート（FIXED や性能試験で指定できるもの）
+static const RateStep RATE_OTHER[] = {
+  {WIFI_PHY_RATE_6M, 6000}, {WIFI_PHY_RATE_9M, 9000}, {WIFI_PHY_RATE_36M, 36000},
+  {WIFI_PHY_RATE_48M, 48000}, {WIFI_PHY_RATE_54M, 54000},
+  {WIFI_PHY_RATE_LORA_250K, 250}, {WIFI_PHY_RATE_LORA_500K, 500},
+};
+static const uint8_t RATE_WINDOW      = 8;      // 判定に使うユニキャスト送信数
+static const uint8_t RATE_UP_OK       = 8;      // 窓の全部に ACK → 1段上げる
+static const uint8_t RATE_DOWN_OK     = 5;      // ACK がこれ以下 → 1段下げる
+static const uint8_t RATE_FAIL_STREAK = 3;      // 連続失敗なら窓を待たずに下げる
+static const unsigned long RATE_HOLD_MS = 10000; // 下げた後しばらくは上げを試さない
+
+// 送信電力（esp_wifi_set_max_tx_power は 0.25dBm 単位で 8..84）
+static const int8_t TX_POWER_MIN_DBM = 2;
+static const int8_t TX_POWER_MAX_DBM = 20;
+static const unsigned long TX_POWER_TICK_MS = 1000; // データ電力を見直す間隔
+static const uint32_t TX_TASK_STACK  = 3072;
+static const UBaseType_t TX_TASK_PRIO = 3;      // 受信タスクのコールバック中も送信を止めない
+
+// ユニキャスト交換（相手が決まったら ACK 付きで直接送る）
+static const uint8_t PEER_CACHE_SLOTS   = 6;     // esp_now に登録する相手の数（LRU）
+static const uint8_t UNICAST_TRIES      = 3;     // ACK が無いときの送信回数。超えたらブロードキャストへ
+static const unsigned long EXCHANGE_MAX_MS = 5000; // 要求からこれ以上かかった受信は交換時間に数えない
+static_assert(PEER_CACHE_SLOTS + 1 <= ESP_NOW_MAX_TOTAL_PEER_NUM, "peer cache plus broadcast must fit");
+
+// 初対面のハンドシェイク（HELLO → OFFER → DATA → ACK）
+static const unsigned long HS_RETRY_MS   = 250;   // 応答が無いときの送り直し間隔
+static const unsigned long HS_TIMEOUT_MS = 2000;  // これを過ぎたら諦める
+static const uint32_t RX_TASK_STACK  = 6144;
+static const UBaseType_t RX_TASK_PRIO = 2;      // loopTask(1) より少し上
+
+// ビーコン（ハッシュ広告）と要求応答
+// 間隔は Trickle 方式: 何も変わらなければ IMIN から IMAX まで倍々に延ばし、
+// 区間内に既知のビーコンを TRICKLE_K 回以上聞いたら自分の分は送らない
+static const unsigned long TRICKLE_IMIN_MS = 500;
+static const unsigned long TRICKLE_IMAX_MS = 16000;
+static const uint8_t TRICKLE_K             = 2;
+static const unsigned long BEACON_FIXED_MS        = 1000; // Trickle を切ったとき（Comm_SetTrickle(false)）の以前の固定間隔
+static const unsigned long BEACON_FIXED_JITTER_MS = 500;
+
+// TDMA 風のスロット送信（任意）。ビーコンで共有するスーパーフレームを SLOT_COUNT に分け、
+// ブロードキャストのデータ（チャンク列など）は自分のスロットの間だけ送る。
+// 1スロットは 1Mbps で ~850 バイトのチャンク列（5 フレーム, ~14ms）が1本入る長さ。スロットを長くして
+// 何台も同じスロットに入れると、スロットの頭で一斉に競合してランダムな間隔より衝突が増える
+static const uint16_t SUPERFRAME_MS   = 1000;
+static const uint8_t  SLOT_COUNT      = 50;
+static const uint16_t SLOT_MS         = SUPERFRAME_MS / SLOT_COUNT;
+static const uint16_t SLOT_GUARD_MS   = 5;     // スロット末尾は新しいチャンク列を始めない（時計のずれ分）
+static const uint8_t  SLOT_MOVE_MARGIN = 3;    // 自分のスロットが最も空いたスロットよりこれだけ（フレーム/スーパーフレーム）混んでいたら移る
+static const uint8_t  SLOT_MOVE_ODDS  = 4;     // 移れる条件でも 1/N の確率でしか移らない（同じスロットの全員が一斉に移らないように）
+static const uint8_t  SLOT_HOLD_SF    = 4;     // 移った後はこれだけのスーパーフレームは移らない（混み具合の平均が追いつくまで）
+static const uint8_t  SLOT_NONE       = 0xFF;
+static const uint16_t SLOTQ_SLOTS     = 16;    // スロット待ちのブロードキャスト用の送信キュー（2の累乗）
+static const uint8_t LEGACY_FULL_EVERY        = 10;    // 旧ファーム向けに N 回に1回は JSON 全体を送る
+static const unsigned long SERVE_MIN_INTERVAL_MS = 200; // 要求応答の最短間隔（まとめて1回送る）
+static const unsigned long REQUEST_RETRY_MS   = 800;   // 同じハッシュを再要求するまでの間隔
+static const unsigned long KNOWN_TTL_MS       = 60000; // 受信済みとみなす期間（広告を聞くたびに延ばす）
+static const uint8_t HASH_CACHE_SLOTS         = 128;   // 受信済みの LRU。100 台の会場で全員の内容を覚えておける数
+static const uint8_t REQ_SLOTS                = 8;     // 要求中のハッシュ（受信済みの LRU を追い出さないよう別に持つ）
+static const unsigned long DEDUP_WINDOW_MS    = 4000;  // 同じ内容をアプリへ再通知しない期間（既定）
+
+// 欠落チャンクの再送要求（NACK）
+static const unsigned long RX_TICK_MS     = 20;    // 受信タスクの定期チェック周期
+static const unsigned long NACK_DELAY_MS  = 80;    // 最後のチャンクからこれだけ空いたら NACK
+static const uint16_t NACK_JITTER_MS      = 40;    // さらに 0..これだけずらす（他の受信側の NACK を先に聞けるように）
+static const uint8_t NACK_MAX             = 3;     // 1メッセージあたりの NACK 上限
+static const uint8_t NACK_MAX_FEC         = 1;     // 同パリティ付き（パリティで直せなかった分だけ）
+static const unsigned long NACK_WINDOW_MS = 1000;  // NACK の数を制限する窓
+static const uint8_t NACK_PER_SENDER      = 2;     // 窓あたり同じ送信元へ送る NACK の上限
+static const uint8_t NACK_PER_WINDOW      = 4;     // 窓あたり1台が送る NACK の上限
+static const uint8_t NACK_CROWD           = 4;     // 近隣がこれより多いと NACK_CROWD/近隣数 の確率で送り、待ちも延ばす
+static const uint8_t RETX_SLOTS           = 2;     // 再送用に保持する送信済みメッセージ数
+static const unsigned long RETX_TTL_MS    = 3000;  // 再送に応じる期間
+static const unsigned long RETX_HOLDOFF_MS = NACK_DELAY_MS; // 送り直したチャンクはこの間（スロット待ちも足す）は再要求を無視
+
+// 近隣テーブル（MAC のオープンアドレス法。受信ごとに参照するので固定長・確保なし）
+static const uint16_t NEIGHBOR_SLOTS      = 128;   // 2の累乗
+static const uint8_t NEIGHBOR_MAX_PROBE   = 8;     // 線形探索の上限（探索は常に O(1)）
+static const unsigned long NEIGHBOR_TTL_MS = 30000; // これより古い近隣は空き扱い
+static const uint8_t RSSI_EWMA_SHIFT      = 2;     // 平滑化係数 1/4
+static const unsigned long RSSI_ADAPT_MS  = 1000;  // 実効しきい値を見直す間隔
+static const unsigned long ACTIVE_NEIGHBOR_MS = 5000; // 近隣数に数える最終受信からの時間
+
+// XOR パリティによる前方誤り訂正（k チャンクごとに1つのパリティ）
+static const uint8_t FEC_MIN_GROUP  = 3;
+static const uint8_t FEC_MAX_GROUP  = 8;
+static const uint8_t FEC_MAX_GROUPS = 4;   // 1メッセージあたりのパリティ数の上限
+
+// 注目コンテンツの中継（ゴシップ）。受け取った端末が TTL を1減らして1回だけ再送する
+static const uint16_t SEEN_BITS          = 2048;  // 既読集合（Bloom フィルタ）1世代のビット数。2の累乗
+static const uint8_t  SEEN_K             = 3;     // 1キーあたりのビット数
+static const uint16_t SEEN_ROTATE_COUNT  = 128;   // これだけ入れたら世代を替える（誤判定 ~0.5%）
+static const unsigned long SEEN_ROTATE_MS = 120000;
+static const uint8_t  RELAY_PENDING      = 4;     // 再送待ちの最大数
+static const unsigned long RELAY_DELAY_MIN_MS = 20;  // 再送までのランダムな待ち
+static const unsigned long RELAY_DELAY_MAX_MS = 200;
+static const uint8_t  RELAY_SUPPRESS_K   = 2;     // 待っている間に同じものをこれだけ聞いたら送らない
+
+// FNV-1a（途中値から続けて計算できる形）
+static const uint32_t FNV_OFFSET = 2166136261UL;
+static inline uint32_t fnv1a(uint32_t h, const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    h ^= data[i];
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+// CRC32（IEEE, 反射）。実機は ROM のテーブル実装、それ以外はビット単位の代替
+static uint32_t crc32le(uint32_t crc, const uint8_t* data, size_t len) {
+#ifdef COMM_HAVE_ROM_CRC
+  return esp_rom_crc32_le(crc, data, (uint32_t)len);
+#else
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (uint8_t b = 0; b < 8; b++) crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+  }
+  return ~crc;
+#endif
+}
+
+static uint32_t frameCrc(uint8_t type, const uint8_t* payload, size_t len) {
+  return crc32le(crc32le(0, &type, 1), payload, len);
+}
+
+#pragma pack(push,1)
+struct ChunkHdr {
+  uint8_t  tag;    // 'C'
+  uint16_t msgId;  // 送信ごとに++
+  uint16_t total;  // 総チャンク数
+  uint16_t idx;    // 0..total-1
+  uint16_t len;    // このチャンクのデータ長
+};
+
+// パリティチャンクのペイロード先頭（ChunkHdr.idx = total + グループ番号）
+// 旧ファームは idx >= total のチャンクを捨てるので互換性は保たれる
+struct ParityHdr {
+  uint8_t  k;       // グループあたりのデータチャンク数
+  uint16_t msgLen;  // メッセージ全体の長さ（最終チャンク長の復元用）
+};
+
+// バイナリフレーム共通ヘッダ（先頭が '{' / 'C' の旧形式と区別できる magic）
+// v2 からは長さと CRC32（type + ペイロード）を持ち、受信直後に壊れたフレームを捨てられる
+struct FrameHdr {
+  uint8_t  magic;  // FRAME_MAGIC
+  uint8_t  ver;    // FRAME_VERSION
+  uint8_t  type;   // FrameType
+  uint16_t len;    // ヘッダ後のペイロード長
+  uint32_t crc;
+};
+
+// コンテンツフレーム: FrameHdr + ContentHdr + payload
+struct ContentHdr {
+  FrameHdr f;
+  uint8_t  contentType;  // CommContentType
+  uint8_t  flags;
+  uint32_t hash;         // コンテンツ識別子
+  uint16_t len;          // payload 長
+};
+
+// NACK: target が送った msgId のうち missing のチャンクを再送してほしい
+struct NackFrame {
+  FrameHdr f;
+  uint8_t  target[6];
+  uint16_t msgId;
+  uint16_t total;
+  uint32_t missing;      // 欠落チャンクのビットマップ
+};
+
+// ビーコン: 自分のコンテンツのハッシュだけを広告する
+// 後ろへ項目を足していく。受信側は BEACON_MIN_LEN 以上を受け付け、届かなかった項目は既定値のまま
+struct BeaconFrame {
+  FrameHdr f;
+  uint32_t hash;
+  uint16_t len;          // コンテンツ長（参考値）
+  uint8_t  contentType;  // 0 = JSON のみ
+  int8_t   txPower;      // このビーコンの送信電力 dBm（-128 = 不明）
+  uint8_t  caps;         // COMM_CAP_*（0 = v1 のみ）
+  uint16_t sfPhase;      // 送信時のスーパーフレーム内の位置 ms（COMM_CAP_SLOTTED のとき）
+  uint8_t  slot;         // 使っているスロット（SLOT_NONE = スロット送信なし）
+  int8_t   dataPower;    // データフレームの送信電力 dBm（-128 = 不明）。受信側は RSSI をビーコンの電力へ換算する
+  int8_t   rssiThr;      // 送信元の受け入れしきい値 dBm（-128 = なし/不明）。相手はこれに届く電力で送る
+};
+
+// 要求: target が持つ hash のコンテンツを送ってほしい
+struct RequestFrame {
+  FrameHdr f;
+  uint8_t  target[6];
+  uint32_t hash;
+};
+
+// HELLO: 初めて見た target に自分の内容を知らせる（peerHash = 既に持っている相手の内容）
+struct HelloFrame {
+  FrameHdr f;
+  uint8_t  target[6];
+  uint32_t hash;
+  uint32_t peerHash;     // 0 = 持っていない
+};
+
+// OFFER: HELLO への返事。自分の内容と、相手の内容が必要か
+struct OfferFrame {
+  FrameHdr f;
+  uint8_t  target[6];
+  uint32_t hash;
+  uint8_t  need;         // 1 = あなたの DATA を送ってほしい
+};
+
+// ACK: target の DATA（hash）を受け取った
+struct AckFrame {
+  FrameHdr f;
+  uint8_t  target[6];
+  uint32_t hash;
+};
+
+// 中継される注目コンテンツ: RelayHdr + payload。origin + hash で1つのメッセージを表す
+struct RelayHdr {
+  FrameHdr f;
+  uint8_t  origin[6];    // 最初に送った端末
+  uint32_t hash;         // コンテンツ識別子
+  uint8_t  ttl;          // 残りの中継回数（0 なら再送しない）
+  uint8_t  ttl0;         // 送信元が付けた TTL（ホップ数の計算用）
+  uint8_t  contentType;
+  uint8_t  flags;
+  uint16_t len;          // payload 長
+};
+#pragma pack(pop)
+
+static const uint8_t FRAME_MAGIC   = 0xE7;
+static const uint8_t FRAME_VERSION = 2;
+enum FrameType : uint8_t {
+  FRAME_CONTENT = 1,
+  FRAME_BEACON  = 2,
+  FRAME_REQUEST = 3,
+  FRAME_NACK    = 4,
+  FRAME_JSON    = 5,   // 単発JSON（旧形式 '{' の置き換え）
+  FRAME_CHUNK   = 6,   // ChunkHdr + データ（旧形式 'C' の置き換え）
+  FRAME_HELLO   = 7,
+  FRAME_OFFER   = 8,
+  FRAME_ACK     = 9,
+  FRAME_RELAY   = 10,  // RelayHdr + payload（RSSI しきい値に関係なく受ける）
+  FRAME_PERF    = 11,  // 性能試験（ペイロードは Comm_Perf が決める。RSSI しきい値に関係なく受ける）
+};
+static_assert(sizeof(ContentHdr) + COMM_CONTENT_MAX == RXQ_FRAME_MAX, "content frame must fit one packet");
+static_assert(sizeof(RelayHdr) + COMM_FEATURED_MAX == RXQ_FRAME_MAX, "relay frame must fit one packet");
+static_assert(sizeof(FrameHdr) + COMM_PERF_MAX == RXQ_FRAME_MAX, "perf frame must fit one packet");
+static const size_t BEACON_MIN_LEN = offsetof(BeaconFrame, txPower); // 送信電力を持たない初期のビーコン
+
+// 近隣テーブルのエントリ
+struct NeighborEntry {
+  uint8_t  mac[6];
+  bool     used;            // 一度でも使われた（探索の打ち切りに使う）
+  int16_t  rssiQ4;          // RSSI の EWMA（1/16 dBm 単位）
+  int8_t   lastRssi;        // 直近の生の RSSI（-128 = 不明）
+  uint32_t packets;
+  uint32_t lastHash;        // 直近に広告/送信されたコンテンツのハッシュ
+  unsigned long firstSeen;
+  unsigned long lastSeen;
+  // ハンドシェイク（受信タスクのみ参照/更新）
+  uint8_t  hsState;         // HS_IDLE / HS_ACTIVE / HS_DONE
+  bool     hsInitiator;
+  uint8_t  hsWait;          // HS_WAIT_* のビット
+  unsigned long hsStartAt;
+  unsigned long hsLastTxAt;
+  bool     accepted;        // 実効しきい値を越えて受け入れ中（ヒステリシス）
+  uint8_t  pathLoss;        // 経路損失 dB（0 = 不明）。ビーコンの送信電力 - そのビーコンの RSSI
+  uint8_t  caps;            // ビーコンで広告された COMM_CAP_*
+  int8_t   beaconDbm;       // ビーコンで広告された送信電力（-128 = 不明）
+  int8_t   dataDbm;         // 同データフレームの送信電力（-128 = 不明）
+  int8_t   rssiThr;         // 同受け入れしきい値（-128 = なし/不明）
+  // タップ検出（受信タスクが nbMux の中で更新）
+  TapDetector tap;
+  unsigned long tapAt;      // 直近のタップ時刻（0 = なし）
+  // この相手へ送った NACK（受信タスクのみ）
+  unsigned long nackWindowAt;
+  uint8_t  nacksInWindow;
+};
+
+// 受信済みのハッシュ（受信タスクのみ更新）。あふれたら最も使われていないものを捨てる
+struct HashCacheEntry {
+  uint32_t hash;
+  unsigned long lastUse;      // 0 = 空き
+  unsigned long expiresAt;
+  unsigned long deliveredAt;  // 最後にアプリへ通知した時刻（0 = 未通知）
+};
+
+// 要求中のハッシュ（受信タスクのみ更新）。受け取るか期限が切れるまで同じハッシュは要求し直さない
+struct ReqEntry {
+  uint32_t hash;              // 0 = 空き
+  unsigned long retryAt;      // これを過ぎたら再要求できる
+  unsigned long requestedAt;  // 最初に要求した時刻（交換時間の計測用）
+};
+
+// 受信キューのスロット（起動時に確保済み。WiFiタスクはコピーするだけ）
+struct RxPacket {
+  uint8_t  mac[6];
+  bool     hasMac;
+  int8_t   rssi;     // -128 = 不明
+  uint16_t len;
+  unsigned long at;
+  uint8_t  data[RXQ_FRAME_MAX];
+};
+
+struct RxBigPacket {
+  uint8_t  mac[6];
+  bool     hasMac;
+  int8_t   rssi;
+  uint16_t len;
+  unsigned long at;
+  uint8_t  data[BIG_FRAME_MAX];
+};
+
+static const uint16_t INJQ_SLOTS = 4;   // Comm_InjectFrame 用の受信キュー。2の累乗
+
+// 送信キューのスロット。big = データは txBig にある（キューには順番だけ積む）
+struct TxPacket {
+  uint8_t  dest[6];
+  uint16_t len;
+  bool     big;
+  uint8_t  data[RXQ_FRAME_MAX];
+};
+
+// esp_now に登録済みのユニキャスト相手（送信タスクのみ更新）
+struct PeerSlot {
+  uint8_t  mac[6];
+  bool     used;
+  unsigned long lastUse;
+};
+
+// 受信再構成スロット（送信元MAC + msgId ごとに1つ）。
+// 50 台が ~850 バイトを 1.0-1.5 秒ごとに送る群れ（comm_swarm slotting --nodes 50）で、新しい列が届いたときに
+// チャンクを受けている途中（直近 60ms に届いた）の送信元は中央値 1、99% で 9。それに余裕を持たせた数。
+// 1つ ~2.9KB。満杯なら最後のチャンクがいちばん古いものを追い出す（止まった列から先に消える）
+static const uint8_t RX_SLOTS = 12;
+
+struct RxState {
+  bool active = false;
+  uint16_t msgId = 0, total = 0, gotCount = 0, lastLen = 0;
+  uint8_t fromMac[6] = {0};
+  unsigned long startAt = 0;   // 最初のチャンク受信時刻
+  unsigned long lastAt = 0;    // 最後のチャンク受信時刻（LRU/期限判定）
+  unsigned long doneAt = 0;    // 完成した時刻。空いた後も RX_TIMEOUT_MS の間は同じメッセージへの再送を無視する
+  unsigned long lastNackAt = 0;
+  uint16_t nackJitter = 0;
+  uint8_t nackCount = 0;
+  uint32_t got = 0;            // 受信済みチャンクのビットマップ
+  uint32_t hashState = 0;      // 先頭から連続して届いた分までの FNV-1a 途中値
+  uint16_t hashedChunks = 0;
+  uint8_t progress = 0;        // 途中経過の通知: 0 = 未判定 / 1 = 通知中 / 2 = しない
+  uint8_t buf[MAX_MSG_BYTES]{};
+  // FEC
+  uint8_t fecK = 0;
+  uint8_t parityGot = 0;
+  uint16_t msgLen = 0;
+  uint8_t parity[FEC_MAX_GROUPS][CHUNK_MAX];
+};
+static_assert(MAX_CHUNKS <= 32, "got bitmap is 32 bits");
+
+// 送信済み分割メッセージの再送キャッシュ（書き込みは loop、pending は受信タスクも更新）
+struct RetxEntry {
+  uint16_t msgId = 0;
+  uint16_t total = 0;
+  uint16_t len = 0;
+  unsigned long sentAt = 0;
+  bool legacy = false;               // 旧形式 'C' で送ったか
+  uint8_t dest[6];                   // 送信先（ユニキャスト交換なら相手）
+  std::atomic<uint32_t> pending{0};  // NACK で要求されたチャンク
+  uint32_t resent = 0;               // 送り直したばかりのチャンク（loop のみ）
+  unsigned long resentUntil = 0;
+  uint8_t buf[MAX_MSG_BYTES];
+};
+
+// アプリへの通知は受信タスクでは行わず、キューに積んで loop（Comm_Tick）から呼ぶ。
+// 表示などに時間がかかっても受信キューの取り出しと定期処理（NACK・ハンドシェイク・中継など）を止めない。
+// 途中経過は同じストリームの未処理の通知があれば上書きする（先頭からの長さは伸びるだけなので最新だけでよい）
+enum AppEventKind : uint8_t { APP_MESSAGE, APP_CONTENT, APP_PROGRESS };
+static const uint8_t APPQ_SLOTS = 4;
+
+struct AppEvent {
+  uint8_t  kind;
+  uint8_t  type, flags;      // APP_CONTENT
+  bool     complete;         // APP_PROGRESS
+  bool     aborted;          // APP_PROGRESS: 完成せずに中断した
+  uint32_t hash;             // APP_CONTENT: ハッシュ / APP_PROGRESS: ストリーム id
+  unsigned long startedAt;   // APP_PROGRESS
+  uint16_t expectedLen;      // APP_PROGRESS
+  uint16_t len;
+};
+
+struct AppSlot {
+  AppEvent ev;
+  uint8_t  data[MAX_MSG_BYTES];
+};
+
+// 中継の再送待ち
+struct RelayPending {
+  bool     used;
+  uint32_t key;
+  unsigned long fireAt;
+  uint8_t  dups;         // 待っている間に聞いた同じメッセージの数
+  uint16_t len;
+  uint8_t  frame[RXQ_FRAME_MAX];
+};
+
+// ===== 1台分の状態 =====
+// プロトコルの状態はすべてここに置き、以下の関数は s_node が指す1台分だけを触る。
+// 実機では s_deviceNode の1つだけ。ホストでは Comm_NewNode で複数作り、Comm_SelectNode で切り替えて
+// 1つのプロセスで群れを動かす
+struct CommNode {
+  // 無線と時計（Comm_SetTransport で差し替え。nullptr なら ESP-NOW と millis()）
+  const CommTransport* transport = nullptr;
+
+  uint8_t selfMac[6] = {0};
+  uint16_t msgId = 1;
+  CommOnMessageCB onMessage = nullptr;
+  CommOnContentCB onContent = nullptr;
+  CommOnProgressCB onProgress = nullptr;
+  uint8_t fecGroup = 0; // 0 = FEC なし
+  // 受信許可最小RSSI。既定はフィルタ無効（-128）。.ino から Comm_SetMinRssiToAccept() で設定してください。
+  volatile int minRssiAccept = -128;
+
+  // 自分のコンテンツ（loop 側で設定、受信タスクはハッシュだけ参照）
+  String ownJson;
+  uint8_t ownType = 0;
+  uint8_t ownPayload[COMM_CONTENT_MAX];
+  size_t ownLen = 0;
+  volatile uint32_t ownHash = 0;
+  volatile bool serveRequested = false;
+  volatile bool serveUrgent = false; // ハンドシェイクの DATA は間隔制限なしで送る
+  unsigned long lastServeAt = 0;
+  uint8_t serveTo[6] = {0};          // 最初の要求元
+  uint8_t serveRequesters = 0;       // 要求元の数（2 = 複数）
+  portMUX_TYPE serveMux = portMUX_INITIALIZER_UNLOCKED;
+  volatile bool unicast = false;     // ユニキャスト交換モード
+  uint8_t beaconCount = 0;
+
+  // Trickle の状態（区間の更新は loop 側、heard/reset は受信タスクが立てる）
+  bool trickle = true;                 // false = 以前の固定間隔（比較用）
+  unsigned long trickleI = TRICKLE_IMIN_MS;
+  unsigned long trickleEndAt = 0;
+  unsigned long trickleFireAt = 0;
+  bool trickleFired = true;            // 最初の reset で区間を始める
+  volatile uint8_t trickleHeard = 0;   // 今の区間で聞いた既知ハッシュのビーコン数
+  volatile bool trickleReset = false;  // 未知のハッシュを聞いた
+
+  // スロット送信の状態（時計の補正とスロット変更は受信タスク、参照は送信タスクと loop）
+  volatile bool slotting = false;
+  volatile uint32_t sfOffset = 0;      // commNow() + sfOffset がスーパーフレームの時計
+  volatile uint8_t slot = 0;
+  uint16_t slotHeard[SLOT_COUNT] = {0};  // 今のスーパーフレームでスロットごとに聞いた他者のデータフレーム
+  uint16_t slotLoadQ4[SLOT_COUNT] = {0}; // その平均（x16）。自分の時計で見た混み具合なので同期前でも使える
+  uint32_t slotHoldUntil = 0;            // このスーパーフレームまでは移らない
+  bool slotTrainOn = false;              // 送信タスク: slotq のチャンク列を送っている途中
+  uint16_t slotTrainMsgId = 0;
+  uint32_t slotBusyTotal = 0;
+  uint32_t sfIndex = 0;
+  uint32_t sfSyncs = 0;
+  uint32_t reslots = 0;
+  uint32_t slotWaits = 0;
+
+  // 近隣テーブル（更新は受信タスク、API からの読み出しは nbMux で保護）
+  NeighborEntry nb[NEIGHBOR_SLOTS];
+
+  uint8_t hsActive = 0;     // HS_ACTIVE のエントリ数
+  uint32_t hsStarted = 0;
+  uint32_t hsCompleted = 0;
+  uint32_t hsFailed = 0;
+  uint32_t hsLastMs = 0;
+  uint32_t hsAvgMs = 0;     // EWMA（1/8）
+  portMUX_TYPE nbMux = portMUX_INITIALIZER_UNLOCKED;
+  uint32_t rxRssiRejected = 0;
+  CommRssiAdapt rssiAdapt;            // 更新は nbMux の中で
+  volatile int rssiEffective = -128;  // 近隣数で調整した実効しきい値
+  uint16_t activeNeighbors = 0;
+  unsigned long rssiAdaptAt = 0;
+  uint32_t rssiEnters = 0;
+  uint32_t rssiExits = 0;
+  TapParams tapParams;      // 更新は nbMux の中で
+  CommOnTapCB onTap = nullptr;
+  CommOnRawFrameCB onRawFrame = nullptr;
+  CommOnPerfCB onPerf = nullptr;
+  uint32_t taps = 0;
+
+  // 受信済み/要求中のハッシュ（受信タスクのみ更新）
+  HashCacheEntry hashCache[HASH_CACHE_SLOTS];
+  ReqEntry reqs[REQ_SLOTS];
+  unsigned long dedupWindowMs = DEDUP_WINDOW_MS;
+  uint32_t dedupHits = 0;
+  uint32_t dedupMisses = 0;
+
+  // 要求 → 受信 にかかった時間（交換時間）
+  uint32_t exchanges = 0;
+  uint32_t exchangeLastMs = 0;
+  uint32_t exchangeAvgMs = 0;   // EWMA（1/8）
+
+  // 送信側の統計
+  uint32_t txBeacons = 0;
+  uint32_t txRequests = 0;
+  uint32_t txServed = 0;
+  uint32_t txLegacyFull = 0;
+  uint32_t txBeaconsSuppressed = 0;
+
+  // 受信キュー。SPSCリング: head は WiFiタスク、tail は受信タスクだけが更新する
+  RxPacket rxq[RXQ_SLOTS];
+  std::atomic<uint16_t> rxqHead{0};
+  std::atomic<uint16_t> rxqTail{0};
+
+  RxBigPacket rxqBig[RXQ_BIG_SLOTS];
+  std::atomic<uint16_t> rxqBigHead{0};
+  std::atomic<uint16_t> rxqBigTail{0};
+
+  // Comm_InjectFrame で外から渡すフレーム（差し替えた無線の受信と記録の再生）。WiFiタスクのリングとは
+  // 別の SPSC リングにして生産者を1つに保つ（head は Comm_InjectFrame の呼び出し側、tail は受信タスクだけが更新）
+  RxBigPacket injq[INJQ_SLOTS];
+  std::atomic<uint16_t> injqHead{0};
+  std::atomic<uint16_t> injqTail{0};
+
+  // 記録の再生中: 実際の受信は捨て、送信キューにも積まない（再生したフレームへの応答を電波に出さない）
+  volatile bool replayMode = false;
+  volatile uint32_t replayRxIgnored = 0;
+  volatile uint32_t replayTxSuppressed = 0;
+  uint8_t espNowVersion = 1;  // Comm_Init で esp_now_get_version から
+  uint32_t rxLargeFrames = 0;
+  uint32_t txLargeFrames = 0;
+  TaskHandle_t rxTask = nullptr;
+  TaskHandle_t txTask = nullptr;
+
+  // 送信キュー
+  uint8_t txBig[BIG_FRAME_MAX];       // 大きなフレーム1つ分（送信完了まで使用中）
+  volatile bool txBigBusy = false;
+
+  // 複数の送り手（loop/受信タスク）がいるので積むときだけスピンロック。取り出しは送信タスクのみ
+  TxPacket txq[TXQ_SLOTS];
+  uint16_t txqHead = 0;
+  uint16_t txqTail = 0;
+  portMUX_TYPE txqMux = portMUX_INITIALIZER_UNLOCKED;
+  volatile bool txInflight = false;
+  unsigned long txInflightAt = 0;
+
+  // スロット待ちのブロードキャストは別のキューに積む（制御フレームやユニキャストを待たせない）。
+  // 積み方と保護は txq と同じ
+  TxPacket slotq[SLOTQ_SLOTS];
+  uint16_t slotqHead = 0;
+  uint16_t slotqTail = 0;
+
+  // 送信中のフレーム（ユニキャストは ACK が来るまで再送するので完了まで保持）
+  TxPacket txCur;
+  bool txCurValid = false;
+  bool txCurSent = false;          // 送信済みで結果待ち
+  uint8_t txCurTries = 0;
+  unsigned long txWaitMs = 0;      // スロット待ちのとき次に起きるまでの時間
+  volatile bool txLastOk = false;
+
+  // esp_now に登録済みのユニキャスト相手（送信タスクのみ更新）
+  PeerSlot peers[PEER_CACHE_SLOTS];
+
+  // 送信統計
+  volatile uint32_t txFrames = 0;      // esp_now_send に渡したフレーム数
+  volatile uint32_t txFailures = 0;    // 送信失敗（呼び出しエラー/完了通知の失敗）
+  volatile uint32_t txQueueDrops = 0;
+  volatile uint16_t txQueueHighWater = 0;
+  uint32_t txPps = 0;                  // 直近1秒の送信完了数
+  uint32_t txUnicastAcked = 0;
+  uint32_t txUnicastRetries = 0;
+  uint32_t txUnicastFallbacks = 0;
+  uint32_t peerEvictions = 0;
+  uint32_t txDoneInWindow = 0;
+  unsigned long txWindowAt = 0;
+
+  // 送信レート（送信タスクのみ更新。次のフレームを送る前に切り替える）
+  CommRatePolicy ratePolicy;
+  uint8_t rateIdx = 0;
+  uint16_t rateKbps = 1000;
+  // ユニキャストのレート（ADAPTIVE では段に従う）と、ブロードキャスト/ビーコンのレート（ADAPTIVE でも開始段のまま）。
+  // 無線への設定は送信タスクが宛先に合わせて行う
+  volatile wifi_phy_rate_t rateUnicast = WIFI_PHY_RATE_1M_L;
+  volatile wifi_phy_rate_t rateBroadcast = WIFI_PHY_RATE_1M_L;
+  int rateApplied = -1;                  // 無線に設定済みのレート（送信タスクのみ）
+  // 一時的な上書き（性能試験など）。上書き中は全フレームをこのレートで送り、段の状態は触らない
+  volatile bool rateOverride = false;
+  volatile wifi_phy_rate_t rateOverrideRate = WIFI_PHY_RATE_1M_L;
+  uint8_t rateOk = 0, rateN = 0, rateFailStreak = 0;
+  uint8_t rateDeliveryPct = 0;
+  unsigned long rateHoldUntil = 0;
+  uint32_t rateUps = 0;
+  uint32_t rateDowns = 0;
+
+  // 送信電力（設定は loop、データ電力は受信タスク、適用は送信タスク）
+  CommTxPower txPower;
+  volatile bool txPowerSet = false;      // Comm_SetTxPower が呼ばれた
+  volatile int8_t txPowerDataDbm = TX_POWER_MAX_DBM;
+  int8_t txPowerInitDbm = -128;          // Comm_Init 時点の電力（制御しない場合に広告する）
+  int8_t txPowerApplied = -128;
+  unsigned long txPowerTickAt = 0;
+  uint32_t txPowerChanges = 0;
+
+  // 統計（書き込みは WiFiタスクのみ）
+  volatile uint32_t rxFrames = 0;
+  volatile uint32_t rxQueueDrops = 0;
+  volatile uint32_t rxBadFrames = 0;
+  volatile uint16_t rxQueueHighWater = 0;
+
+  // 受信再構成スロット
+  RxState rxSlots[RX_SLOTS];
+
+  // 再構成の統計（受信タスクのみ更新）
+  uint32_t rxCompleted = 0;
+  uint32_t rxEvicted = 0;
+  uint32_t rxTimedOut = 0;
+  uint32_t rxNacksSent = 0;
+  uint32_t rxNacksSuppressed = 0;
+  unsigned long nackWindowAt = 0;
+  uint8_t nacksInWindow = 0;
+  uint32_t rxLastCompleteMs = 0; // 最初のチャンクから完成までの時間
+  uint32_t rxFecRecovered = 0;
+
+  // 送信済み分割メッセージの再送キャッシュ
+  RetxEntry retx[RETX_SLOTS];
+  uint8_t retxNext = 0;
+  uint32_t txRetransmits = 0;
+
+  // アプリへの通知キュー（積むのは受信タスク、取り出すのは loop）
+  AppSlot appq[APPQ_SLOTS];
+  uint8_t appqHead = 0;
+  uint8_t appqTail = 0;
+  portMUX_TYPE appqMux = portMUX_INITIALIZER_UNLOCKED;
+  AppSlot appCur;                  // loop が取り出した1件（コールバック中の data はここを指す）
+  volatile uint32_t appDrops = 0;
+
+  // 既読集合は2世代の Bloom フィルタ（片方が埋まったらもう片方を消して入れ替える）。
+  // 受信タスクと loop（Comm_SendFeatured）が触るので relayMux で守る
+  uint8_t seen[2][SEEN_BITS / 8];
+  uint8_t seenCur = 0;
+  uint16_t seenCount = 0;
+  unsigned long seenAt = 0;
+  portMUX_TYPE relayMux = portMUX_INITIALIZER_UNLOCKED;
+  volatile bool relay = false;
+
+  // 再送待ち（受信タスクのみ）
+  RelayPending relayPending[RELAY_PENDING];
+  uint32_t relayReceived = 0;
+  uint32_t relayForwarded = 0;
+  uint32_t relaySuppressed = 0;
+  uint32_t relayDuplicates = 0;
+  uint32_t relayDropped = 0;
+  uint8_t relayLastHops = 0;
+
+  // 性能試験の大きなフレームの組み立て（送信元タスクのみ）
+  uint8_t perfBig[BIG_FRAME_MAX];
+};
+static CommNode s_deviceNode;
+static CommNode* s_node = &s_deviceNode;
+
+static unsigned long commNow() {
+  return s_node->transport ? s_node->transport->now() : millis();
+}
+
+static uint32_t commRandom() {
+  return s_node->transport ? s_node->transport->random() : esp_random();
+}
+
+static uint16_t sfPhase(unsigned long now) {
+  return (uint16_t)((now + s_node->sfOffset) % SUPERFRAME_MS);
+}
+
+// 自分のスロットに入るまでの ms（今のスロットの残りに trainMs の送信が収まるなら 0）。
+// スロットの半分より長い列はスロットの前半なら始める
+static unsigned long slotWaitMs(unsigned long now, uint16_t trainMs = 0) {
+  const uint16_t into = (uint16_t)((sfPhase(now) + SUPERFRAME_MS - s_node->slot * SLOT_MS) % SUPERFRAME_MS);
+  const uint16_t room = SLOT_MS - SLOT_GUARD_MS;
+  if (into + (trainMs < room / 2 ? trainMs : room / 2) < room) return 0;
+  return SUPERFRAME_MS - into;
+}
+
+// データフレーム（旧形式を含む）か。制御フレームはスロットに関係なくすぐ送る
+static bool slotIsData(const uint8_t* data) {
+  if (data[0] == '{' || data[0] == 'C') return true;
+  if (data[0] != FRAME_MAGIC) return false;
+  const uint8_t type = ((const FrameHdr*)data)->type;
+  return type == FRAME_CHUNK || type == FRAME_JSON || type == FRAME_CONTENT || type == FRAME_RELAY;
+}
+
+// スロットで送る対象: ブロードキャストのデータ（ユニキャストは ACK と再送があるので待たない）
+static bool slotGated(const uint8_t* dest, const uint8_t* data) {
+  return s_node->slotting && memcmp(dest, MAC_BC, 6) == 0 && slotIsData(data);
+}
+
+enum : uint8_t { HS_IDLE = 0, HS_ACTIVE = 1, HS_DONE = 2 }; // DONE は失敗も含む（近隣が期限切れになるまで再開しない）
+enum : uint8_t {
+  HS_WAIT_OFFER = 1,  // HELLO への OFFER 待ち（開始側）
+  HS_WAIT_DATA  = 2,  // 相手の DATA 待ち
+  HS_WAIT_ACK   = 4,  // 自分の DATA への ACK 待ち
+};
+
+// フレームを送信キューへ積む（ブロックしない）。満杯なら false
+static bool txEnqueue(const uint8_t* dest, const uint8_t* data, size_t len) {
+  if (!data || len == 0 || len > BIG_FRAME_MAX) return false;
+  if (s_node->replayMode) {
+    s_node->replayTxSuppressed++;
+    return false;
+  }
+  const bool big = len > RXQ_FRAME_MAX;
+  const bool gated = slotGated(dest, data);
+
+  portENTER_CRITICAL(&s_node->txqMux);
+  const uint16_t depth = gated ? (uint16_t)(s_node->slotqHead - s_node->slotqTail) : (uint16_t)(s_node->txqHead - s_node->txqTail);
+  if (depth >= (gated ? SLOTQ_SLOTS : TXQ_SLOTS) || (big && s_node->txBigBusy)) {
+    portEXIT_CRITICAL(&s_node->txqMux);
+    s_node->txQueueDrops++;
+    return false;
+  }
+  TxPacket& p = gated ? s_node->slotq[s_node->slotqHead & (SLOTQ_SLOTS - 1)] : s_node->txq[s_node->txqHead & (TXQ_SLOTS - 1)];
+  memcpy(p.dest, dest, 6);
+  p.len = (uint16_t)len;
+  p.big = big;
+  if (big) {
+    s_node->txBigBusy = true;
+    memcpy(s_node->txBig, data, len);
+  } else {
+    memcpy(p.data, data, len);
+  }
+  if (gated) {
+    s_node->slotqHead++;
+  } else {
+    s_node->txqHead++;
+    if (depth + 1 > s_node->txQueueHighWater) s_node->txQueueHighWater = depth + 1;
+  }
+  portEXIT_CRITICAL(&s_node->txqMux);
+  if (gated && slotWaitMs(commNow())) s_node->slotWaits++;
+
+  if (s_node->txTask) xTaskNotifyGive(s_node->txTask);
+  return true;
+}
+
+static bool isBroadcast(const uint8_t* mac) {
+  return memcmp(mac, MAC_BC, 6) == 0;
+}
+
+// 送信タスクから: 相手を esp_now に登録する。枠が無ければ最も使っていない相手を外す
+static bool peerEnsure(const uint8_t* mac, unsigned long now) {
+  PeerSlot* victim = nullptr;
+  for (uint8_t i = 0; i < PEER_CACHE_SLOTS; i++) {
+    PeerSlot& p = s_node->peers[i];
+    if (p.used && memcmp(p.mac, mac, 6) == 0) {
+      p.lastUse = now;
+      return true;
+    }
+    if (!victim || (victim->used && (!p.used || (long)(p.lastUse - victim->lastUse) < 0))) victim = &p;
+  }
+  if (victim->used) {
+    if (!s_node->transport) esp_now_del_peer(victim->mac);
+    else if (s_node->transport->delPeer) s_node->transport->delPeer(victim->mac);
+    victim->used = false;
+    s_node->peerEvictions++;
+  }
+  if (s_node->transport) {
+    if (s_node->transport->addPeer && !s_node->transport->addPeer(mac)) return false;
+  } else {
+    esp_now_peer_info_t info{};
+    memcpy(info.peer_addr, mac, 6);
+    info.ifidx = WIFI_IF_STA;
+    info.channel = 0; // 現在のチャネル
+    info.encrypt = false;
+    if (esp_now_add_peer(&info) != ESP_OK && !esp_now_is_peer_exist(mac)) return false;
+  }
+  memcpy(victim->mac, mac, 6);
+  victim->used = true;
+  victim->lastUse = now;
+  return true;
+}
+
+static uint16_t rateKbps(wifi_phy_rate_t rate) {
+  for (uint8_t i = 0; i < RATE_STEPS; i++) {
+    if (RATE_LADDER[i].rate == rate) return RATE_LADDER[i].kbps;
+  }
+  for (const RateStep& r : RATE_OTHER) {
+    if (r.rate == rate) return r.kbps;
+  }
+  return 0; // 表に無いレート（MCS など）
+}
+
+// ユニキャストのレートを決める（ADAPTIVE 以外はブロードキャストも同じ）
+static void rateSet(wifi_phy_rate_t rate) {
+  s_node->rateUnicast = rate;
+  if (s_node->ratePolicy.mode != COMM_RATE_ADAPTIVE) s_node->rateBroadcast = rate;
+  s_node->rateKbps = rateKbps(rate);
+  Serial.printf("TX: Rate %u kbps\n", s_node->rateKbps); // 送信デバッグ
+}
+
+// 送信タスクから: 宛先に合わせてレートを切り替える（同じなら何もしない）。
+// 段を上げ下げする根拠はユニキャストの ACK だけなので、ACK のないブロードキャストは開始段で送る
+static void rateApply(bool unicast) {
+  const wifi_phy_rate_t rate = s_node->rateOverride ? s_node->rateOverrideRate : (unicast ? s_node->rateUnicast : s_node->rateBroadcast);
+  if ((int)rate == s_node->rateApplied) return;
+  s_node->rateApplied = (int)rate; // 失敗しても毎フレーム設定し直さない
+  if (s_node->transport) {
+    if (s_node->transport->setRateKbps) s_node->transport->setRateKbps(rateKbps(rate));
+  } else if (esp_wifi_config_espnow_rate(WIFI_IF_STA, rate) != ESP_OK) {
+    Serial.println("ESP-NOW rate config failed"); // 設定失敗ログ
+  }
+}
+
+// Comm_Init から: 方針に従って最初のレートを設定する
+// 11b/g/n も残しておけば LR 以外の相手からも受信できる（送信は LR のみ届く）
+static void rateEnableLr() {
+  if (!s_node->transport) {
+    esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N | WIFI_PROTOCOL_LR);
+  }
+}
+
+static void rateInit(const CommRatePolicy& policy) {
+  s_node->ratePolicy = policy;
+  switch (policy.mode) {
+  case COMM_RATE_FIXED:
+    rateSet(policy.rate);
+    break;
+  case COMM_RATE_LR:
+    rateEnableLr();
+    rateSet(WIFI_PHY_RATE_LORA_500K);
+    break;
+  case COMM_RATE_ADAPTIVE:
+    s_node->rateIdx = 0;
+    for (uint8_t i = 0; i < RATE_STEPS; i++) {
+      if (RATE_LADDER[i].rate == policy.rate) s_node->rateIdx = i;
+    }
+    s_node->rateBroadcast = RATE_LADDER[s_node->rateIdx].rate;
+    rateSet(RATE_LADDER[s_node->rateIdx].rate);
+    break;
+  default:
+    break;
+  }
+}
+
+// ユニキャスト1回分の結果（リンク層 ACK の有無）で段を上げ下げする。
+// 相手が離れただけでも失敗は数えるが、下げた後は RATE_HOLD_MS の間上げないので往復はしない
+static void rateSample(bool ok, unsigned long now) {
+  if (s_node->ratePolicy.mode != COMM_RATE_ADAPTIVE || s_node->rateOverride) return; // 上書き中の結果は段に関係しない
+  s_node->rateN++;
+  if (ok) {
+    s_node->rateOk++;
+    s_node->rateFailStreak = 0;
+  } else {
+    s_node->rateFailStreak++;
+  }
+
+  int step = 0;
+  if (s_node->rateFailStreak >= RATE_FAIL_STREAK) {
+    step = -1;
+  } else if (s_node->rateN >= RATE_WINDOW) {
+    s_node->rateDeliveryPct = (uint8_t)(s_node->rateOk * 100 / s_node->rateN);
+    if (s_node->rateOk <= RATE_DOWN_OK) step = -1;
+    else if (s_node->rateOk >= RATE_UP_OK && (long)(now - s_node->rateHoldUntil) >= 0) step = 1;
+    s_node->rateN = s_node->rateOk = 0;
+  }
+  if (step == 0) return;
+  s_node->rateN = s_node->rateOk = s_node->rateFailStreak = 0;
+
+  if (step < 0) {
+    s_node->rateHoldUntil = now + RATE_HOLD_MS;
+    if (s_node->rateIdx == 0) return;
+    s_node->rateIdx--;
+    s_node->rateDowns++;
+  } else {
+    if (s_node->rateIdx + 1 >= RATE_STEPS) return;
+    s_node->rateIdx++;
+    s_node->rateUps++;
+  }
+  rateSet(RATE_LADDER[s_node->rateIdx].rate);
+}
+
+static int8_t txPowerBeaconDbm() {
+  return s_node->txPowerSet ? s_node->txPower.beaconDbm : s_node->txPowerInitDbm;
+}
+
+// ビーコンと旧形式（旧ファーム向けの全文）は発見用の電力、それ以外はデータ用。
+// 中継フレームも近くの相手だけに絞らない。受信側も同じ判定で RSSI を換算する
+static bool txPowerIsData(const uint8_t* data) {
+  if (data[0] != FRAME_MAGIC) return false;
+  const uint8_t type = ((const FrameHdr*)data)->type;
+  return type != FRAME_BEACON && type != FRAME_RELAY;
+}
+
+// 送信タスクから: フレームの種類に合わせて電力を切り替える（同じなら何もしない）
+static void txPowerApply(const uint8_t* data) {
+  if (!s_node->txPowerSet) return;
+  const int8_t dbm = txPowerIsData(data) ? s_node->txPowerDataDbm : s_node->txPower.beaconDbm;
+  if (dbm == s_node->txPowerApplied) return;
+  if (s_node->transport) {
+    if (s_node->transport->setTxPower) s_node->transport->setTxPower(dbm);
+  } else if (esp_wifi_set_max_tx_power((int8_t)(dbm * 4)) != ESP_OK) {
+    return;
+  }
+  s_node->txPowerApplied = dbm;
+  s_node->txPowerChanges++;
+}
+
+// 送信直前のビーコンに今のスーパーフレーム位置を書き直す（キューで待った分ずれないように）
+static void slotStampBeacon(TxPacket& p, unsigned long now) {
+  if (!s_node->slotting || p.big || p.len != sizeof(BeaconFrame) || p.data[0] != FRAME_MAGIC) return;
+  BeaconFrame* b = (BeaconFrame*)p.data;
+  if (b->f.type != FRAME_BEACON || !(b->caps & COMM_CAP_SLOTTED)) return;
+  b->sfPhase = sfPhase(now);
+  b->slot = s_node->slot;
+  b->f.crc = frameCrc(FRAME_BEACON, p.data + sizeof(FrameHdr), b->f.len);
+}
+
+// ブロードキャスト1フレームのおおよその送信時間 µs（MAC ヘッダ等 ~43 バイト、プリアンブル、媒体の空き待ちを含む）
+static uint32_t slotFrameUs(uint16_t len) {
+  uint16_t kbps = rateKbps(s_node->rateBroadcast);
+  if (!kbps) kbps = 1000;
+  return (uint32_t)(len + 43) * 8000UL / kbps + 600;
+}
+
+// slotq のフレームが分割メッセージのチャンクなら msgId を返す
+static bool slotChunkId(const TxPacket& p, uint16_t& msgId) {
+  const uint8_t* d = p.big ? s_node->txBig : p.data;
+  const ChunkHdr* h = nullptr;
+  if (d[0] == 'C' && p.len >= sizeof(ChunkHdr)) h = (const ChunkHdr*)d;
+  else if (d[0] == FRAME_MAGIC && p.len >= sizeof(FrameHdr) + sizeof(ChunkHdr) && ((const FrameHdr*)d)->type == FRAME_CHUNK) h = (const ChunkHdr*)(d + sizeof(FrameHdr));
+  if (!h) return false;
+  msgId = h->msgId;
+  return true;
+}
+
+// 送信タスクから: slotq の先頭を送れるまでの ms。チャンク列（先頭から続く同じ msgId）は全体が
+// スロットの残りに収まるときだけ始め、始めた列はスロットの終わりを過ぎても最後まで送る
+// （途中で次のスーパーフレームまで待つと、受信側では 1 秒空いて再構成が NACK やタイムアウトに回る）
+static unsigned long slotTrainWaitMs(unsigned long now) {
+  const uint16_t tail = s_node->slotqTail, head = s_node->slotqHead;
+  uint16_t msgId = 0;
+  const bool chunk = slotChunkId(s_node->slotq[tail & (SLOTQ_SLOTS - 1)], msgId);
+  if (chunk && s_node->slotTrainOn && msgId == s_node->slotTrainMsgId) return 0;
+  uint32_t trainUs = 0;
+  for (uint16_t i = tail; i != head; i++) {
+    const TxPacket& p = s_node->slotq[i & (SLOTQ_SLOTS - 1)];
+    uint16_t id = 0;
+    if (i != tail && !(chunk && slotChunkId(p, id) && id == msgId)) break;
+    trainUs += slotFrameUs(p.len);
+  }
+  return slotWaitMs(now, (uint16_t)((trainUs + 999) / 1000));
+}
+
+// 送信タスクから: 前のフレームの結果を見て、再送するか次を1つ送る
+static void txPump(unsigned long now) {
+  if (s_node->txInflight) {
+    if (now - s_node->txInflightAt < TX_INFLIGHT_TIMEOUT_MS) return;
+    s_node->txInflight = false; // 完了通知が来なかった
+    s_node->txLastOk = false;
+    s_node->txFailures++;
+  }
+  s_node->txWaitMs = 0;
+  for (;;) {
+    if (s_node->txCurValid && s_node->txCurSent) {
+      s_node->txCurSent = false;
+      const bool unicast = !isBroadcast(s_node->txCur.dest);
+      if (unicast) rateSample(s_node->txLastOk, now);
+      if (unicast && !s_node->txLastOk) {
+        if (s_node->txCurTries < UNICAST_TRIES) {
+          s_node->txUnicastRetries++;
+        } else {
+          // ACK が返らない: 相手が離れたとみなしてブロードキャストで届ける
+          memcpy(s_node->txCur.dest, MAC_BC, 6);
+          s_node->txCurTries = 0;
+          s_node->txUnicastFallbacks++;
+        }
+      } else {
+        if (unicast) s_node->txUnicastAcked++;
+        if (s_node->txCur.big) s_node->txBigBusy = false;
+        s_node->txCurValid = false;
+      }
+    }
+    if (!s_node->txCurValid) {
+      // スロット待ちのキューは自分のスロットの間だけ取り出す。それ以外の間も txq は流れる
+      const bool slotPending = s_node->slotqTail != s_node->slotqHead;
+      const unsigned long wait = (slotPending && s_node->slotting) ? slotTrainWaitMs(now) : 0;
+      if (!slotPending) s_node->slotTrainOn = false;
+      if (slotPending && wait == 0) {
+        s_node->txCur = s_node->slotq[s_node->slotqTail & (SLOTQ_SLOTS - 1)];
+        s_node->slotTrainOn = slotChunkId(s_node->txCur, s_node->slotTrainMsgId);
+        portENTER_CRITICAL(&s_node->txqMux);
+        s_node->slotqTail++;
+        portEXIT_CRITICAL(&s_node->txqMux);
+      } else if (s_node->txqTail != s_node->txqHead) {
+        s_node->txCur = s_node->txq[s_node->txqTail & (TXQ_SLOTS - 1)];
+        portENTER_CRITICAL(&s_node->txqMux);
+        s_node->txqTail++;
+        portEXIT_CRITICAL(&s_node->txqMux);
+      } else {
+        s_node->txWaitMs = wait;
+        return;
+      }
+      s_node->txCurValid = true;
+      s_node->txCurTries = 0;
+    }
+    if (!isBroadcast(s_node->txCur.dest) && !peerEnsure(s_node->txCur.dest, now)) {
+      memcpy(s_node->txCur.dest, MAC_BC, 6); // 登録できなければブロードキャスト
+      s_node->txUnicastFallbacks++;
+    }
+    const uint8_t* data = s_node->txCur.big ? s_node->txBig : s_node->txCur.data;
+    slotStampBeacon(s_node->txCur, now);
+    txPowerApply(data);
+    rateApply(!isBroadcast(s_node->txCur.dest));
+    s_node->txCurSent = true;
+    s_node->txCurTries++;
+    s_node->txInflight = true;
+    s_node->txInflightAt = now;
+    const bool sent = s_node->transport ? s_node->transport->send(s_node->txCur.dest, data, s_node->txCur.len)
+                                  : esp_now_send(s_node->txCur.dest, data, s_node->txCur.len) == ESP_OK;
+    s_node->txFrames++;
+    if (sent) return;
+    s_node->txInflight = false;
+    s_node->txLastOk = false;
+    s_node->txFailures++;
+  }
+}
+
+// 送信完了（WiFiタスク）: 次のフレームを送れるよう送信タスクを起こす
+static void txDone(bool ok) {
+  if (!ok) s_node->txFailures++;
+  s_node->txDoneInWindow++;
+  s_node->txLastOk = ok;
+  s_node->txInflight = false;
+  if (s_node->txTask) xTaskNotifyGive(s_node->txTask);
+}
+
+// frame 先頭の FrameHdr（長さと CRC を含む）を埋めて送信キューへ積む
+static bool sendFrame(const uint8_t* dest, uint8_t type, uint8_t* frame, size_t len) {
+  FrameHdr* f = (FrameHdr*)frame;
+  f->magic = FRAME_MAGIC;
+  f->ver   = FRAME_VERSION;
+  f->type  = type;
+  f->len   = (uint16_t)(len - sizeof(FrameHdr));
+  f->crc   = frameCrc(type, frame + sizeof(FrameHdr), f->len);
+  return txEnqueue(dest, frame, len);
+}
+
+// 送信側の1回分（送信タスク、または差し替えた無線では Comm_Poll から）
+static void txStep() {
+  const unsigned long now = commNow();
+  txPump(now);
+
+  if (now - s_node->txWindowAt >= 1000) {
+    s_node->txPps = s_node->txDoneInWindow * 1000UL / (now - s_node->txWindowAt);
+    s_node->txDoneInWindow = 0;
+    s_node->txWindowAt = now;
+  }
+}
+
+// 送信タスク: 完了通知ごとに次のフレームを送る（loop は待たない）
+static void txTaskMain(void*) {
+  for (;;) {
+    const unsigned long wait = s_node->txWaitMs ? min(s_node->txWaitMs, TX_INFLIGHT_TIMEOUT_MS) : TX_INFLIGHT_TIMEOUT_MS;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait));
+    txStep();
+  }
+}
+
+// 受信タスクから: 1件積む（途中経過は同じストリームの未処理分を上書き）。満杯なら捨てて数える
+static void appPost(const AppEvent& ev, const uint8_t* data, size_t len) {
+  portENTER_CRITICAL(&s_node->appqMux);
+  AppSlot* e = nullptr;
+  if (ev.kind == APP_PROGRESS && s_node->appqHead != s_node->appqTail) {
+    AppSlot& last = s_node->appq[(uint8_t)(s_node->appqHead - 1) % APPQ_SLOTS];
+    if (last.ev.kind == APP_PROGRESS && last.ev.hash == ev.hash) e = &last;
+  }
+  if (!e && (uint8_t)(s_node->appqHead - s_node->appqTail) < APPQ_SLOTS) {
+    e = &s_node->appq[s_node->appqHead % APPQ_SLOTS];
+    s_node->appqHead++;
+  }
+  if (e) {
+    e->ev = ev;
+    e->ev.len = (uint16_t)len;
+    if (len) memcpy(e->data, data, len);
+  }
+  portEXIT_CRITICAL(&s_node->appqMux);
+  if (!e) s_node->appDrops++;
+}
+
+static void appPostMessage(const uint8_t* data, size_t len) {
+  if (!s_node->onMessage) return;
+  AppEvent ev{};
+  ev.kind = APP_MESSAGE;
+  appPost(ev, data, len);
+}
+
+static void appPostContent(uint8_t type, uint8_t flags, uint32_t hash, const uint8_t* data, size_t len) {
+  if (!s_node->onContent) return;
+  AppEvent ev{};
+  ev.kind = APP_CONTENT;
+  ev.type = type;
+  ev.flags = flags;
+  ev.hash = hash;
+  appPost(ev, data, len);
+}
+
+// loop から: 溜まった通知をアプリのコールバックへ渡す
+static void appDeliver() {
+  for (;;) {
+    portENTER_CRITICAL(&s_node->appqMux);
+    const bool any = s_node->appqHead != s_node->appqTail;
+    if (any) {
+      const AppSlot& q = s_node->appq[s_node->appqTail % APPQ_SLOTS];
+      s_node->appCur.ev = q.ev;
+      memcpy(s_node->appCur.data, q.data, q.ev.len);
+      s_node->appqTail++;
+    }
+    portEXIT_CRITICAL(&s_node->appqMux);
+    if (!any) return;
+
+    const AppEvent& e = s_node->appCur.ev;
+    if (e.kind == APP_MESSAGE) {
+      if (s_node->onMessage) s_node->onMessage(s_node->appCur.data, e.len);
+    } else if (e.kind == APP_CONTENT) {
+      if (s_node->onContent) s_node->onContent(e.type, e.flags, e.hash, s_node->appCur.data, e.len);
+    } else if (s_node->onProgress) {
+      CommStreamProgress p{};
+      p.id = e.hash;
+      p.data = e.aborted ? nullptr : s_node->appCur.data;
+      p.len = e.len;
+      p.expectedLen = e.expectedLen;
+      p.complete = e.complete;
+      p.startedAt = e.startedAt;
+      s_node->onProgress(p);
+    }
+  }
+}
+
+static uint32_t rxStreamId(const RxState& rx) {
+  return ((uint32_t)rx.fromMac[4] << 24) | ((uint32_t)rx.fromMac[5] << 16) | rx.msgId;
+}
+
+// 途中経過を通知していたメッセージが完成せずに終わったことを知らせる
+static void rxAbortProgress(RxState& rx) {
+  if (rx.progress != 1) return;
+  rx.progress = 2;
+  if (!s_node->onProgress) return;
+  AppEvent ev{};
+  ev.kind = APP_PROGRESS;
+  ev.aborted = true;
+  ev.hash = rxStreamId(rx);
+  ev.startedAt = rx.startAt;
+  appPost(ev, nullptr, 0);
+}
+
+// NACK までの追加の待ち。近隣が多いほど広げ、誰かの NACK（と再送）を先に聞ける機会を増やす
+static uint16_t nackBackoff() {
+  const uint16_t spread = (uint16_t)max(1, s_node->activeNeighbors / NACK_CROWD);
+  return (uint16_t)(commRandom() % ((uint32_t)NACK_JITTER_MS * spread));
+}
+
+// (mac, msgId) に対応するスロットを探す。なければ空き → 期限切れ → 完成済みの記録 → 最古 の順で確保。
+// 完成済みのメッセージ（他の受信側の NACK への再送）なら nullptr
+static RxState* rxSlotFor(const uint8_t* mac_addr, uint16_t msgId, uint16_t total, unsigned long now) {
+  static const uint8_t NO_MAC[6] = {0};
+  const uint8_t* mac = mac_addr ? mac_addr : NO_MAC;
+
+  RxState* sameSender = nullptr;
+  RxState* freeSlot = nullptr;
+  RxState* doneSlot = nullptr;
+  RxState* oldest = nullptr;
+  for (uint8_t i = 0; i < RX_SLOTS; i++) {
+    RxState& r = s_node->rxSlots[i];
+    if (r.active && now - r.lastAt > RX_TIMEOUT_MS) {
+      rxAbortProgress(r);
+      r.active = false;
+      s_node->rxTimedOut++;
+    }
+    if (!r.active) {
+      if (r.doneAt != 0 && now - r.doneAt < RX_TIMEOUT_MS) {
+        if (memcmp(r.fromMac, mac, 6) == 0 && r.msgId == msgId && r.total == total) return nullptr;
+        if (!doneSlot || (long)(r.doneAt - doneSlot->doneAt) < 0) doneSlot = &r;
+        continue;
+      }
+      if (!freeSlot) freeSlot = &r;
+      continue;
+    }
+    if (memcmp(r.fromMac, mac, 6) == 0) {
+      if (r.msgId == msgId && r.total == total) return &r;
+      sameSender = &r; // 同じ送信元の古いメッセージは新しいもので置き換える
+    }
+    if (!oldest || (long)(r.lastAt - oldest->lastAt) < 0) oldest = &r;
+  }
+
+  RxState* slot = sameSender ? sameSender : (freeSlot ? freeSlot : doneSlot);
+  if (!slot) {
+    slot = oldest;
+    s_node->rxEvicted++;
+  }
+  if (slot->active) rxAbortProgress(*slot);
+  Serial.printf("RX: Start Chunked Msg ID=%d Total=%d\n", msgId, total); // 受信デバッグ
+  slot->active = true;
+  slot->msgId = msgId;
+  slot->total = total;
+  slot->gotCount = 0;
+  slot->lastLen = 0;
+  slot->got = 0;
+  slot->hashState = FNV_OFFSET;
+  slot->hashedChunks = 0;
+  slot->progress = 0;
+  slot->nackCount = 0;
+  slot->lastNackAt = 0;
+  slot->nackJitter = nackBackoff();
+  slot->fecK = 0;
+  slot->parityGot = 0;
+  slot->msgLen = 0;
+  slot->startAt = now;
+  slot->doneAt = 0;
+  memcpy(slot->fromMac, mac, 6);
+  return slot;
+}
+
+static bool nbLive(const NeighborEntry& n, unsigned long now) {
+  return n.used && now - n.lastSeen < NEIGHBOR_TTL_MS;
+}
+
+static uint16_t nbHome(const uint8_t* mac) {
+  return (uint16_t)(Comm_Hash32(mac, 6) & (NEIGHBOR_SLOTS - 1));
+}
+
+// 生きている近隣を探す（呼び出し側で nbMux を取る）
+static NeighborEntry* nbFind(const uint8_t* mac, unsigned long now) {
+  const uint16_t home = nbHome(mac);
+  for (uint8_t k = 0; k < NEIGHBOR_MAX_PROBE; k++) {
+    NeighborEntry& n = s_node->nb[(home + k) & (NEIGHBOR_SLOTS - 1)];
+    if (!n.used) return nullptr;
+    if (memcmp(n.mac, mac, 6) == 0) return nbLive(n, now) ? &n : nullptr;
+  }
+  return nullptr;
+}
+
+// 受信タスクから: 近隣を更新して平滑化した RSSI で受け入れ可否を返す。
+// タップを検出したら tapped = true（しきい値に関係なく受け入れる）。
+// dataFrame: 相手がデータ用の電力で送ったフレーム。平滑化とタップ検出にはビーコンの電力へ換算した値を使う
+// （フレームごとに電力が違っても、距離の変化だけが見えるように）
+static bool nbObserve(const uint8_t* mac, int rssi, bool dataFrame, unsigned long now, bool& tapped) {
+  tapped = false;
+  bool isNew = false;
+  bool entered = false;
+  portENTER_CRITICAL(&s_node->nbMux);
+  const uint16_t home = nbHome(mac);
+  NeighborEntry* hit = nullptr;
+  NeighborEntry* victim = nullptr;
+  for (uint8_t k = 0; k < NEIGHBOR_MAX_PROBE; k++) {
+    NeighborEntry& n = s_node->nb[(home + k) & (NEIGHBOR_SLOTS - 1)];
+    if (n.used && memcmp(n.mac, mac, 6) == 0) { hit = &n; break; }
+    if (!n.used) { if (!victim || nbLive(*victim, now)) victim = &n; break; }
+    // 期限切れを優先して再利用、なければ探索範囲で最も古いもの
+    if (!victim || (nbLive(*victim, now) && (!nbLive(n, now) || n.lastSeen < victim->lastSeen))) victim = &n;
+  }
+  NeighborEntry* n = hit;
+  if (n && !nbLive(*n, now)) isNew = true;
+  if (!n) {
+    n = victim;
+    memcpy(n->mac, mac, 6);
+    n->used = true;
+    isNew = true;
+  }
+  if (isNew) {
+    n->rssiQ4 = (int16_t)(rssi * 16);
+    n->packets = 0;
+    n->lastHash = 0;
+    n->firstSeen = now;
+    if (n->hsState == HS_ACTIVE && s_node->hsActive) s_node->hsActive--;
+    n->hsState = HS_IDLE;
+    TapDetector_Reset(n->tap, rssi, now);
+    n->tapAt = 0;
+    n->nackWindowAt = 0;
+    n->nacksInWindow = 0;
+    n->accepted = false;
+    n->pathLoss = 0;
+    n->caps = 0;
+    n->beaconDbm = -128;
+    n->dataDbm = -128;
+    n->rssiThr = -128;
+  } else if (rssi > -128) {
+    int norm = rssi;
+    if (dataFrame && n->beaconDbm != -128 && n->dataDbm != -128) {
+      norm = constrain(rssi + n->beaconDbm - n->dataDbm, -127, 0);
+    }
+    n->rssiQ4 += (int16_t)((norm * 16 - n->rssiQ4) >> RSSI_EWMA_SHIFT);
+    if (TapDetector_Update(n->tap, s_node->tapParams, norm, now)) {
+      n->tapAt = now | 1;
+      tapped = true;
+    }
+  }
+  n->lastRssi = (int8_t)rssi;
+  n->packets++;
+  n->lastSeen = now;
+  // しきい値付近で行ったり来たりしないよう、入るときと出るときで基準を変える
+  if (rssi > -128) {
+    const int smoothed = n->rssiQ4 / 16;
+    const int thr = s_node->rssiEffective;
+    if (n->accepted) {
+      if (smoothed < thr - s_node->rssiAdapt.hysteresisDb && !tapped) {
+        n->accepted = false;
+        s_node->rssiExits++;
+      }
+    } else if (smoothed >= thr || tapped) {
+      n->accepted = true;
+      entered = true;
+      s_node->rssiEnters++;
+    }
+  }
+  const bool accepted = n->accepted;
+  portEXIT_CRITICAL(&s_node->nbMux);
+
+  // 受け入れた近隣が増えたときだけ広告間隔を短く戻す（しきい値の外の相手では戻さない）
+  if (entered || (isNew && rssi <= -128)) s_node->trickleReset = true;
+  if (rssi <= -128) return true;    // RSSI 不明（旧API）はフィルタしない
+  return accepted;
+}
+
+// 受信タスクの定期処理: 直近に聞こえた近隣の数から実効しきい値を決める
+static void rssiAdaptTick(unsigned long now) {
+  if (now - s_node->rssiAdaptAt < RSSI_ADAPT_MS) return;
+  s_node->rssiAdaptAt = now;
+  uint16_t active = 0;
+  portENTER_CRITICAL(&s_node->nbMux);
+  for (uint16_t i = 0; i < NEIGHBOR_SLOTS; i++) {
+    if (s_node->nb[i].used && now - s_node->nb[i].lastSeen < ACTIVE_NEIGHBOR_MS) active++;
+  }
+  const CommRssiAdapt a = s_node->rssiAdapt;
+  portEXIT_CRITICAL(&s_node->nbMux);
+
+  int thr = s_node->minRssiAccept;
+  if (thr > -128) { // フィルタ無効のときは調整しない
+    if (active <= 1) {
+      thr -= a.sparseRelaxDb;
+    } else if (active > a.freeNeighbors) {
+      thr += min((int)(active - a.freeNeighbors) * a.dbPerNeighbor, (int)a.maxRaiseDb);
+    }
+    thr = constrain(thr, -127, 0);
+  }
+  s_node->activeNeighbors = active;
+  s_node->rssiEffective = thr;
+}
+
+// 受信タスクの定期処理: 受け入れ中の相手すべてに届く最小のデータ電力を決める
+static void txPowerTick(unsigned long now) {
+  if (!s_node->txPowerSet || now - s_node->txPowerTickAt < TX_POWER_TICK_MS) return;
+  s_node->txPowerTickAt = now;
+  // 相手ごとに「相手のしきい値 + 経路損失」を求めて最大を取る。しきい値を広告しない相手（旧ファーム）は自分のしきい値で代用
+  const int ownThr = s_node->rssiEffective;
+  int need = -128;
+  bool unknown = false, any = false;
+  portENTER_CRITICAL(&s_node->nbMux);
+  for (uint16_t i = 0; i < NEIGHBOR_SLOTS; i++) {
+    const NeighborEntry& n = s_node->nb[i];
+    if (!nbLive(n, now) || !n.accepted) continue;
+    any = true;
+    const int thr = n.rssiThr != -128 ? n.rssiThr : ownThr;
+    if (n.pathLoss == 0 || thr <= -128) unknown = true;
+    else need = max(need, thr + (int)n.pathLoss);
+  }
+  const CommTxPower cfg = s_node->txPower;
+  portEXIT_CRITICAL(&s_node->nbMux);
+
+  int dbm = cfg.maxDbm;
+  // 相手がいない/経路損失かしきい値が分からない相手がいる間は初対面のフレームが届くよう最大で送る
+  if (cfg.adaptive && any && !unknown) {
+    dbm = constrain(need + cfg.marginDb, (int)cfg.minDbm, (int)cfg.maxDbm);
+  }
+  if (dbm != s_node->txPowerDataDbm) s_node->trickleReset = true; // 相手が RSSI を換算できるよう新しい電力をすぐ広告する
+  s_node->txPowerDataDbm = (int8_t)dbm;
+}
+
+// ビーコンから: 能力・電力・しきい値と、送信電力とそのビーコンの RSSI から経路損失を更新する（受信タスクから）
+static void nbSetBeaconInfo(const uint8_t* mac, const BeaconFrame& b) {
+  if (!mac) return;
+  portENTER_CRITICAL(&s_node->nbMux);
+  const unsigned long now = commNow();
+  NeighborEntry* n = nbFind(mac, now);
+  if (n) {
+    // 換算の幅が変わった（初めて分かった場合を含む）: それまでのサンプルは別の目盛りなので、
+    // 平滑化とタップの基準をこのビーコン（ビーコンの電力なので換算不要）で揃え直す。
+    // しないと、データ用の低い電力で先に届いたフレームからの段差が急接近に見える
+    const int before = (n->beaconDbm != -128 && n->dataDbm != -128) ? n->beaconDbm - n->dataDbm : 0;
+    const int after = (b.txPower != -128 && b.dataPower != -128) ? b.txPower - b.dataPower : 0;
+    if (before != after && n->lastRssi > -128) {
+      const unsigned long firedAt = n->tap.firedAt;
+      TapDetector_Reset(n->tap, n->lastRssi, now);
+      n->tap.firedAt = firedAt;
+      n->rssiQ4 = (int16_t)(n->lastRssi * 16);
+    }
+    n->caps = b.caps;
+    n->beaconDbm = b.txPower;
+    n->dataDbm = b.dataPower;
+    n->rssiThr = b.rssiThr;
+  }
+  if (n && b.txPower != -128 && n->lastRssi > -128) {
+    const int loss = constrain(b.txPower - n->lastRssi, 1, 255);
+    n->pathLoss = n->pathLoss ? (uint8_t)((n->pathLoss * 3 + loss + 2) / 4) : (uint8_t)loss;
+  }
+  portEXIT_CRITICAL(&s_node->nbMux);
+}
+
+// 受信タスクから: スロット送信の相手のビーコンで時計を寄せ合う
+static void slotOnBeacon(const BeaconFrame& b, unsigned long now) {
+  if (!s_node->slotting || !(b.caps & COMM_CAP_SLOTTED) || b.sfPhase >= SUPERFRAME_MS) return;
+  int d = (int)b.sfPhase - (int)sfPhase(now);
+  if (d > SUPERFRAME_MS / 2) d -= SUPERFRAME_MS;
+  else if (d < -(SUPERFRAME_MS / 2)) d += SUPERFRAME_MS;
+  // 両方が半分ずつ寄れば全体が1つの時計にまとまる
+  if (abs(d) > SLOT_GUARD_MS) s_node->sfSyncs++;
+  s_node->sfOffset = (uint32_t)((s_node->sfOffset + SUPERFRAME_MS + d / 2) % SUPERFRAME_MS);
+}
+
+// 受信タスクから: 他者のデータを聞いたスーパーフレーム内の位置（スロット）を数える。
+// スロットを広告しない相手（旧ファーム・ランダム送信）やビーコンを抑えている相手の分も含めて実際の混み具合になる
+static void slotObserve(const uint8_t* data, unsigned long now) {
+  if (!s_node->slotting || !slotIsData(data)) return;
+  const uint8_t k = (uint8_t)(sfPhase(now) / SLOT_MS);
+  if (s_node->slotHeard[k] < 0xFFFF) s_node->slotHeard[k]++;
+  if (k == s_node->slot) s_node->slotBusyTotal++;
+}
+
+// スーパーフレームごとに混み具合の平均を更新し、自分のスロットが最も空いたスロットより
+// SLOT_MOVE_MARGIN 以上混んでいれば、空いたスロットのどれかへ確率 1/SLOT_MOVE_ODDS で移る。
+// 同じスロットでぶつかっている全員が同じ空きへ一斉に移ると、そこでまたぶつかるだけなので散らす
+static void slotRebalance() {
+  uint16_t least = 0xFFFF;
+  for (uint8_t k = 0; k < SLOT_COUNT; k++) {
+    s_node->slotLoadQ4[k] = (uint16_t)((s_node->slotLoadQ4[k] * 3 + min<uint32_t>(s_node->slotHeard[k], 0x0FFF) * 16 + 2) / 4);
+    s_node->slotHeard[k] = 0;
+    if (k != s_node->slot && s_node->slotLoadQ4[k] < least) least = s_node->slotLoadQ4[k];
+  }
+  if ((int32_t)(s_node->sfIndex - s_node->slotHoldUntil) < 0) return;
+  if (s_node->slotLoadQ4[s_node->slot] < least + SLOT_MOVE_MARGIN * 16) return;
+  if (commRandom() % SLOT_MOVE_ODDS) return;
+  uint8_t cand[SLOT_COUNT];
+  uint8_t nCand = 0;
+  for (uint8_t k = 0; k < SLOT_COUNT; k++) {
+    if (k != s_node->slot && s_node->slotLoadQ4[k] <= least + SLOT_MOVE_MARGIN * 8) cand[nCand++] = k;
+  }
+  const uint8_t next = cand[commRandom() % nCand];
+  Serial.printf("TX: Reslot %u -> %u\n", s_node->slot, next); // 送信デバッグ
+  s_node->slot = next;
+  s_node->slotHoldUntil = s_node->sfIndex + SLOT_HOLD_SF;
+  s_node->reslots++;
+}
+
+static void slotTick(unsigned long now) {
+  if (!s_node->slotting) return;
+  const uint32_t sf = (now + s_node->sfOffset) / SUPERFRAME_MS;
+  if (sf == s_node->sfIndex) return;
+  s_node->sfIndex = sf;
+  slotRebalance();
+}
+
+static void nbSetHash(const uint8_t* mac, uint32_t hash) {
+  if (!mac) return;
+  portENTER_CRITICAL(&s_node->nbMux);
+  NeighborEntry* n = nbFind(mac, commNow());
+  if (n) n->lastHash = hash;
+  portEXIT_CRITICAL(&s_node->nbMux);
+}
+
+static void nbCopy(const NeighborEntry& n, CommNeighbor& out) {
+  memcpy(out.mac, n.mac, 6);
+  out.rssi      = (int8_t)(n.rssiQ4 / 16);
+  out.lastRssi  = n.lastRssi;
+  out.packets   = n.packets;
+  out.lastHash  = n.lastHash;
+  out.firstSeen = n.firstSeen;
+  out.lastSeen  = n.lastSeen;
+  out.accepted  = n.accepted;
+  out.pathLoss  = n.pathLoss;
+  out.caps      = n.caps;
+}
+
+static bool hashCacheLive(const HashCacheEntry& e, unsigned long now) {
+  return e.lastUse != 0 && (long)(now - e.expiresAt) < 0;
+}
+
+// 期限内のエントリを探す（見つかれば使用時刻を更新）
+static HashCacheEntry* hashCacheFind(uint32_t hash, unsigned long now) {
+  for (uint8_t i = 0; i < HASH_CACHE_SLOTS; i++) {
+    HashCacheEntry& e = s_node->hashCache[i];
+    if (e.hash != hash || !hashCacheLive(e, now)) continue;
+    e.lastUse = now | 1; // 0 は空きの印
+    return &e;
+  }
+  return nullptr;
+}
+
+// 受信済みとして登録/更新。なければ 空き → 期限切れ → 最も使われていないもの の順で置き換える
+static HashCacheEntry* hashCachePut(uint32_t hash, unsigned long now) {
+  HashCacheEntry* e = nullptr;
+  for (uint8_t i = 0; i < HASH_CACHE_SLOTS; i++) {
+    HashCacheEntry& c = s_node->hashCache[i];
+    if (c.lastUse != 0 && c.hash == hash) { e = &c; break; }
+    if (!e || (hashCacheLive(*e, now) && (!hashCacheLive(c, now) || (long)(c.lastUse - e->lastUse) < 0))) e = &c;
+  }
+  if (e->hash != hash || e->lastUse == 0) e->deliveredAt = 0;
+  e->hash = hash;
+  e->lastUse = now | 1;
+  e->expiresAt = now + KNOWN_TTL_MS;
+  return e;
+}
+
+static ReqEntry* reqFind(uint32_t hash) {
+  for (uint8_t i = 0; i < REQ_SLOTS; i++) {
+    if (s_node->reqs[i].hash == hash && hash != 0) return &s_node->reqs[i];
+  }
+  return nullptr;
+}
+
+// 要求中として登録する。満杯なら再要求できるもののうち最も古く要求したものを置き換える（なければ登録しない）
+static ReqEntry* reqPut(uint32_t hash, unsigned long now) {
+  ReqEntry* e = reqFind(hash);
+  if (!e) {
+    for (uint8_t i = 0; i < REQ_SLOTS; i++) {
+      ReqEntry& r = s_node->reqs[i];
+      if (r.hash == 0) { e = &r; break; }
+      if ((long)(now - r.retryAt) >= 0 && (!e || (long)(r.requestedAt - e->requestedAt) < 0)) e = &r;
+    }
+    if (!e) return nullptr;
+    e->hash = hash;
+    e->requestedAt = now | 1;
+  }
+  e->retryAt = now + REQUEST_RETRY_MS;
+  return e;
+}
+
+// 生きている近隣のどれかが hash を広告/送信しているか
+static bool nbAdvertises(uint32_t hash, unsigned long now) {
+  bool found = false;
+  portENTER_CRITICAL(&s_node->nbMux);
+  for (uint16_t i = 0; i < NEIGHBOR_SLOTS && !found; i++) {
+    found = nbLive(s_node->nb[i], now) && s_node->nb[i].lastHash == hash;
+  }
+  portEXIT_CRITICAL(&s_node->nbMux);
+  return found;
+}
+
+// 通知済みの内容の繰り返しか: 窓内か、窓を過ぎても近隣がまだ同じ内容を広告している間
+// （旧ファーム向けの全文や他の台の要求への応答で同じ内容が何度届いても、内容が変わるまで1回だけ通知する）
+static bool dedupIsRepeat(const HashCacheEntry* e, unsigned long now) {
+  if (!e || e->deliveredAt == 0) return false;
+  return now - e->deliveredAt < s_node->dedupWindowMs || nbAdvertises(e->hash, now);
+}
+
+// アプリへ通知する前の重複判定。繰り返しなら false
+static bool dedupAccept(uint32_t hash, unsigned long now) {
+  HashCacheEntry* e = hashCacheFind(hash, now);
+  if (dedupIsRepeat(e, now)) {
+    e->expiresAt = now + KNOWN_TTL_MS;
+    s_node->dedupHits++;
+    return false;
+  }
+  s_node->dedupMisses++;
+  e = hashCachePut(hash, now);
+  e->deliveredAt = now | 1;
+  ReqEntry* r = reqFind(hash);
+  if (r) {
+    if (now - r->requestedAt < EXCHANGE_MAX_MS) {
+      s_node->exchangeLastMs = now - r->requestedAt;
+      s_node->exchangeAvgMs = s_node->exchanges ? (s_node->exchangeAvgMs * 7 + s_node->exchangeLastMs) / 8 : s_node->exchangeLastMs;
+      s_node->exchanges++;
+    }
+    r->hash = 0;
+  }
+  return true;
+}
+
+static void sendRequest(const uint8_t* target, uint32_t hash) {
+  RequestFrame r;
+  memcpy(r.target, target, 6);
+  r.hash    = hash;
+  sendFrame(s_node->unicast ? target : MAC_BC, FRAME_REQUEST, (uint8_t*)&r, sizeof(r));
+  s_node->txRequests++;
+}
+
+static void sendNack(const RxState& rx) {
+  NackFrame n;
+  memcpy(n.target, rx.fromMac, 6);
+  n.msgId   = rx.msgId;
+  n.total   = rx.total;
+  const uint32_t all = (rx.total >= 32) ? 0xFFFFFFFFUL : ((1UL << rx.total) - 1);
+  n.missing = all & ~rx.got;
+  sendFrame(s_node->unicast ? rx.fromMac : MAC_BC, FRAME_NACK, (uint8_t*)&n, sizeof(n));
+  s_node->rxNacksSent++;
+}
+
+// NACK で取り直す価値があるか。要求中の内容への応答（ブロードキャストで複数の要求元へ送られる）は
+// NACK ではなく再要求で取り直す（送信元が SERVE_MIN_INTERVAL_MS ごとにまとめて1回送る）
+static bool rxNackWanted(const RxState& r, unsigned long now) {
+  uint32_t lastHash = 0;
+  portENTER_CRITICAL(&s_node->nbMux);
+  const NeighborEntry* n = nbFind(r.fromMac, now);
+  if (n) lastHash = n->lastHash;
+  portEXIT_CRITICAL(&s_node->nbMux);
+  return lastHash == 0 || !reqFind(lastHash);
+}
+
+// 窓あたりの上限（1台全体と送信元ごと）に収まれば数えて true
+static bool nackBudget(const uint8_t* mac, unsigned long now) {
+  if (now - s_node->nackWindowAt >= NACK_WINDOW_MS) {
+    s_node->nackWindowAt = now;
+    s_node->nacksInWindow = 0;
+  }
+  if (s_node->nacksInWindow >= NACK_PER_WINDOW) return false;
+  bool ok = true;
+  portENTER_CRITICAL(&s_node->nbMux);
+  NeighborEntry* n = nbFind(mac, now);
+  if (n) {
+    if (now - n->nackWindowAt >= NACK_WINDOW_MS) {
+      n->nackWindowAt = now;
+      n->nacksInWindow = 0;
+    }
+    ok = n->nacksInWindow < NACK_PER_SENDER;
+    if (ok) n->nacksInWindow++;
+  }
+  portEXIT_CRITICAL(&s_node->nbMux);
+  if (ok) s_node->nacksInWindow++;
+  return ok;
+}
+
+// 受信タスクの定期処理: 途中で止まったメッセージに NACK を送る。
+// 近隣が多いときは確率で見送り（見送った台は他の台の NACK への再送を待つ）、送った数も窓ごとに抑える
+static void rxCheckStalled(unsigned long now) {
+  static const uint8_t NO_MAC[6] = {0};
+  for (uint8_t i = 0; i < RX_SLOTS; i++) {
+    RxState& r = s_node->rxSlots[i];
+    if (!r.active || r.gotCount >= r.total) continue;
+    if (memcmp(r.fromMac, NO_MAC, 6) == 0) continue; // 送信元不明
+    if (r.nackCount >= (r.fecK ? NACK_MAX_FEC : NACK_MAX)) continue; // パリティ付きは1回だけ
+    const unsigned long wait = NACK_DELAY_MS + r.nackJitter;
+    if (now - r.lastAt < wait || now - r.lastNackAt < wait) continue;
+    if (!rxNackWanted(r, now)) {
+      r.nackCount = NACK_MAX; // このメッセージには送らない
+      s_node->rxNacksSuppressed++;
+      continue;
+    }
+    r.lastNackAt = now;
+    r.nackJitter = nackBackoff();
+    const uint16_t crowd = s_node->activeNeighbors;
+    if ((crowd > NACK_CROWD && commRandom() % crowd >= NACK_CROWD) || !nackBudget(r.fromMac, now)) {
+      s_node->rxNacksSuppressed++;
+      continue;
+    }
+    Serial.printf("RX: NACK Msg ID=%d got=%d/%d\n", r.msgId, r.gotCount, r.total); // 受信デバッグ
+    sendNack(r);
+    r.nackCount++;
+  }
+}
+
+// 他の受信側の NACK が自分の欠けた分を全部含んでいれば、自分の NACK は送らずに待つ（再送は全員に届く）
+static void nackSuppress(const NackFrame* n, unsigned long now) {
+  for (uint8_t i = 0; i < RX_SLOTS; i++) {
+    RxState& r = s_node->rxSlots[i];
+    if (!r.active || r.gotCount >= r.total || r.msgId != n->msgId || r.total != n->total) continue;
+    if (memcmp(r.fromMac, n->target, 6) != 0) continue;
+    const uint32_t all = (r.total >= 32) ? 0xFFFFFFFFUL : ((1UL << r.total) - 1);
+    if ((all & ~r.got & ~n->missing) != 0) return;
+    r.lastNackAt = now;
+    s_node->rxNacksSuppressed++;
+    return;
+  }
+}
+
+// NACK受信: 自分が最近送ったメッセージなら再送対象に積む（送信は loop 側）
+static void onNack(const NackFrame* n) {
+  if (memcmp(n->target, s_node->selfMac, 6) != 0) {
+    nackSuppress(n, commNow());
+    return;
+  }
+  for (uint8_t i = 0; i < RETX_SLOTS; i++) {
+    RetxEntry& e = s_node->retx[i];
+    if (e.total == 0 || e.msgId != n->msgId || e.total != n->total) continue;
+    if (commNow() - e.sentAt > RETX_TTL_MS) return;
+    e.pending.fetch_or(n->missing, std::memory_order_relaxed);
+    return;
+  }
+}
+
+// ビーコン受信: 持っていないハッシュなら送信元に要求する
+static void onBeacon(const uint8_t* mac_addr, const BeaconFrame* b) {
+  if (!mac_addr) return;
+  nbSetHash(mac_addr, b->hash);
+  nbSetBeaconInfo(mac_addr, *b);
+  slotOnBeacon(*b, commNow());
+  const unsigned long now = commNow();
+  if (b->hash == s_node->ownHash) {
+    if (s_node->trickleHeard < 255) s_node->trickleHeard++; // 同じ内容を広告している相手がいる
+    return;
+  }
+  // 受信済みでも相手の内容は自分の広告の代わりにならないので、抑制には数えない。
+  // 相手が同じ内容を広告し続けている間は受信済みのままにする（期限で取り直さない）
+  HashCacheEntry* e = hashCacheFind(b->hash, now);
+  if (e) {
+    e->expiresAt = now + KNOWN_TTL_MS;
+    return;
+  }
+  // 相手の新しい内容は要求で取りに行く。自分の広告が古くなるわけではないので区間は短く戻さない
+  // （戻すと群れでは知らないハッシュが絶えず、全台が最短区間のまま広告し続ける）
+  const ReqEntry* r = reqFind(b->hash);
+  if (r && (long)(now - r->retryAt) < 0) return; // 要求済み（REQUEST_RETRY_MS 後に再要求）
+  if (!reqPut(b->hash, now)) return;             // 要求中が満杯: 次のビーコンで
+
+  Serial.printf("RX: Beacon hash=%08lX (unknown) -> request\n", (unsigned long)b->hash); // 受信デバッグ
+  sendRequest(mac_addr, b->hash);
+}
+
+// 自分のコンテンツを mac へ送るよう loop 側に頼む（要求元が1台ならユニキャストできる）
+static void serveRequest(const uint8_t* mac_addr, bool urgent) {
+  portENTER_CRITICAL(&s_node->serveMux);
+  if (!mac_addr) {
+    s_node->serveRequesters = 2; // 送信元不明: ブロードキャストで応える
+  } else if (s_node->serveRequesters == 0) {
+    memcpy(s_node->serveTo, mac_addr, 6);
+    s_node->serveRequesters = 1;
+  } else if (memcmp(s_node->serveTo, mac_addr, 6) != 0) {
+    s_node->serveRequesters = 2;
+  }
+  portEXIT_CRITICAL(&s_node->serveMux);
+  if (urgent) s_node->serveUrgent = true;
+  s_node->serveRequested = true;
+}
+
+// 要求受信: 自分宛てで現在のコンテンツなら loop 側で送る
+static void onRequest(const uint8_t* mac_addr, const RequestFrame* r) {
+  if (memcmp(r->target, s_node->selfMac, 6) != 0) return;
+  if (r->hash != s_node->ownHash) return;
+  serveRequest(mac_addr, false);
+}
+
+// ===== 初対面のハンドシェイク =====
+// 開始側 A: HELLO → 応答側 B: OFFER (+ DATA) → A: DATA（必要なら）+ ACK → B: ACK
+// 両方が相手の内容を1往復で持てる。状態は近隣テーブルに持ち、受信タスクだけが触る
+static bool hashKnown(uint32_t hash, unsigned long now) {
+  return hashCacheFind(hash, now) != nullptr;
+}
+
+static void sendHello(const uint8_t* mac, uint32_t peerHash) {
+  HelloFrame h;
+  memcpy(h.target, mac, 6);
+  h.hash = s_node->ownHash;
+  h.peerHash = peerHash;
+  sendFrame(s_node->unicast ? mac : MAC_BC, FRAME_HELLO, (uint8_t*)&h, sizeof(h));
+}
+
+static void sendOffer(const uint8_t* mac, bool need) {
+  OfferFrame o;
+  memcpy(o.target, mac, 6);
+  o.hash = s_node->ownHash;
+  o.need = need ? 1 : 0;
+  sendFrame(s_node->unicast ? mac : MAC_BC, FRAME_OFFER, (uint8_t*)&o, sizeof(o));
+}
+
+static void sendAck(const uint8_t* mac, uint32_t hash) {
+  AckFrame a;
+  memcpy(a.target, mac, 6);
+  a.hash = hash;
+  sendFrame(s_node->unicast ? mac : MAC_BC, FRAME_ACK, (uint8_t*)&a, sizeof(a));
+}
+
+static bool hsTapRecent(const NeighborEntry& n, unsigned long now) {
+  return n.tapAt != 0 && now - n.tapAt < HS_TIMEOUT_MS;
+}
+
+static void hsSetActive(NeighborEntry& n, bool initiator, unsigned long now) {
+  if (n.hsState != HS_ACTIVE) {
+    s_node->hsActive++;
+    s_node->hsStarted++;
+    n.hsStartAt = now;
+  }
+  n.hsState = HS_ACTIVE;
+  n.hsInitiator = initiator;
+  n.hsWait = 0;
+  n.hsLastTxAt = now;
+}
+
+static void hsCheckDone(NeighborEntry& n, unsigned long now) {
+  if (n.hsState != HS_ACTIVE || n.hsWait != 0) return;
+  n.hsState = HS_DONE;
+  if (s_node->hsActive) s_node->hsActive--;
+  s_node->hsLastMs = now - n.hsStartAt;
+  s_node->hsAvgMs = s_node->hsCompleted ? (s_node->hsAvgMs * 7 + s_node->hsLastMs) / 8 : s_node->hsLastMs;
+  s_node->hsCompleted++;
+  Serial.printf("RX: Handshake done in %lu ms\n", (unsigned long)s_node->hsLastMs); // 受信デバッグ
+}
+
+// 初めて見た近隣（RSSI しきい値を通過済み）に HELLO を送る。
+// 自分のコンテンツが無ければ始めない（相手が持っていれば相手の HELLO かビーコン → 要求で受け取る）
+static void hsStart(const uint8_t* mac, unsigned long now) {
+  if (s_node->ownHash == 0) return;
+  NeighborEntry* n = nbFind(mac, now);
+  if (!n || n->hsState != HS_IDLE) return;
+  hsSetActive(*n, true, now);
+  n->hsWait = HS_WAIT_OFFER;
+  sendHello(mac, hashKnown(n->lastHash, now) && !hsTapRecent(*n, now) ? n->lastHash : 0);
+}
+
+// タップ: 交換済みの相手でもハンドシェイクをやり直し、相手の内容を重複抑制なしで受け取り直す
+static void onTap(const uint8_t* mac, int rssi, unsigned long now) {
+  s_node->taps++;
+  Serial.printf("RX: Tap from %02X:%02X:%02X:%02X:%02X:%02X (%d dBm)\n",
+                mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], rssi); // 受信デバッグ
+  NeighborEntry* n = nbFind(mac, now);
+  if (!n) return;
+  HashCacheEntry* e = n->lastHash ? hashCacheFind(n->lastHash, now) : nullptr;
+  if (e) e->deliveredAt = 0;
+  if (n->hsState == HS_DONE) n->hsState = HS_IDLE;
+  hsStart(mac, now);
+  if (s_node->onTap) s_node->onTap(mac, rssi);
+}
+
+static void onHello(const uint8_t* mac_addr, const HelloFrame* h) {
+  if (!mac_addr || memcmp(h->target, s_node->selfMac, 6) != 0) return;
+  const unsigned long now = commNow();
+  NeighborEntry* n = nbFind(mac_addr, now);
+  if (!n) return;
+  // 同時に HELLO を送り合ったら MAC の小さい方が開始側のまま
+  if (n->hsState == HS_ACTIVE && n->hsInitiator && (n->hsWait & HS_WAIT_OFFER)
+      && memcmp(s_node->selfMac, mac_addr, 6) < 0) return;
+
+  hsSetActive(*n, false, now);
+  // こちらもタップ直後なら、知っている内容でももう一度受け取る
+  const bool need = h->hash != 0 && (!hashKnown(h->hash, now) || hsTapRecent(*n, now));
+  if (need) n->hsWait |= HS_WAIT_DATA;
+  if (s_node->ownHash != 0 && h->peerHash != s_node->ownHash) {
+    n->hsWait |= HS_WAIT_ACK;
+    serveRequest(mac_addr, true); // OFFER と一緒に DATA をすぐ送る
+  }
+  sendOffer(mac_addr, need);
+  hsCheckDone(*n, now);
+}
+
+static void onOffer(const uint8_t* mac_addr, const OfferFrame* o) {
+  if (!mac_addr || memcmp(o->target, s_node->selfMac, 6) != 0) return;
+  const unsigned long now = commNow();
+  NeighborEntry* n = nbFind(mac_addr, now);
+  if (!n || n->hsState != HS_ACTIVE) return;
+  if (!(n->hsWait & HS_WAIT_OFFER)) {
+    // 再送された OFFER: こちらの DATA が届いていない
+    if (o->need && (n->hsWait & HS_WAIT_ACK)) serveRequest(mac_addr, true);
+    return;
+  }
+  n->hsWait &= ~HS_WAIT_OFFER;
+  if (o->hash != 0 && !hashKnown(o->hash, now)) n->hsWait |= HS_WAIT_DATA;
+  if (o->need && s_node->ownHash != 0) {
+    n->hsWait |= HS_WAIT_ACK;
+    serveRequest(mac_addr, true);
+  }
+  hsCheckDone(*n, now);
+}
+
+static void onAck(const uint8_t* mac_addr, const AckFrame* a) {
+  if (!mac_addr || memcmp(a->target, s_node->selfMac, 6) != 0 || a->hash != s_node->ownHash) return;
+  const unsigned long now = commNow();
+  NeighborEntry* n = nbFind(mac_addr, now);
+  if (!n || n->hsState != HS_ACTIVE) return;
+  n->hsWait &= ~HS_WAIT_ACK;
+  hsCheckDone(*n, now);
+}
+
+// 内容を受け取ったとき（重複も含む）: ハンドシェイク中の相手なら ACK を返す
+static void hsOnData(const uint8_t* mac_addr, uint32_t hash) {
+  if (!mac_addr) return;
+  const unsigned long now = commNow();
+  NeighborEntry* n = nbFind(mac_addr, now);
+  if (!n || n->hsState == HS_IDLE) return;
+  if (n->hsState == HS_DONE && now - n->hsStartAt > HS_TIMEOUT_MS) return; // 定期送信には ACK しない
+  sendAck(mac_addr, hash);
+  if (n->hsState != HS_ACTIVE) return;
+  n->hsWait &= ~HS_WAIT_DATA;
+  hsCheckDone(*n, now);
+}
+
+// 受信タスクの定期処理: 返事が無いハンドシェイクを送り直す/諦める
+static void hsTick(unsigned long now) {
+  if (s_node->hsActive == 0) return;
+  for (uint16_t i = 0; i < NEIGHBOR_SLOTS; i++) {
+    NeighborEntry& n = s_node->nb[i];
+    if (n.hsState != HS_ACTIVE) continue;
+    if (now - n.hsStartAt > HS_TIMEOUT_MS || !nbLive(n, now)) {
+      n.hsState = HS_DONE;
+      if (s_node->hsActive) s_node->hsActive--;
+      s_node->hsFailed++;
+      continue;
+    }
+    if (now - n.hsLastTxAt < HS_RETRY_MS) continue;
+    n.hsLastTxAt = now;
+    if (n.hsWait & HS_WAIT_OFFER) {
+      sendHello(n.mac, hashKnown(n.lastHash, now) ? n.lastHash : 0);
+    } else if (n.hsWait & HS_WAIT_DATA) {
+      sendOffer(n.mac, true); // まだ DATA が来ない
+    } else if (n.hsWait & HS_WAIT_ACK) {
+      serveRequest(n.mac, true);
+    }
+  }
+}
+
+// チャンク i の長さ（最終チャンクは msgLen から求める）
+static size_t chunkLen(const RxState& rx, uint16_t i) {
+  if (i != rx.total - 1) return CHUNK_MAX;
+  return rx.msgLen - (size_t)i * CHUNK_MAX;
+}
+
+// 先頭から連続して揃ったチャンクをハッシュに取り込む（完成時に全体を読み直さない）
+static void rxAdvanceHash(RxState& rx) {
+  while (rx.hashedChunks < rx.total && (rx.got & (1UL << rx.hashedChunks))) {
+    const uint16_t i = rx.hashedChunks;
+    const size_t n = (i == rx.total - 1) ? rx.lastLen : CHUNK_MAX;
+    rx.hashState = fnv1a(rx.hashState, rx.buf + (size_t)i * CHUNK_MAX, n);
+    rx.hashedChunks++;
+  }
+}
+
+// 送信元が通知済みの内容を広告していれば途中経過は出さない（完成時に重複で捨てられるため）
+static bool rxProgressWanted(const uint8_t* mac, unsigned long now) {
+  if (!mac) return true;
+  uint32_t lastHash = 0;
+  portENTER_CRITICAL(&s_node->nbMux);
+  const NeighborEntry* n = nbFind(mac, now);
+  if (n) lastHash = n->lastHash;
+  portEXIT_CRITICAL(&s_node->nbMux);
+  if (lastHash == 0) return true;
+  const HashCacheEntry* e = hashCacheFind(lastHash, now);
+  return !dedupIsRepeat(e, now);
+}
+
+// 先頭から連続して揃った部分が伸びたらアプリへ渡す（受信しながら描画するため）
+static void rxNotifyProgress(RxState& rx, const uint8_t* mac, uint16_t hashedBefore, unsigned long now) {
+  if (!s_node->onProgress || rx.progress == 2 || rx.hashedChunks == hashedBefore) return;
+  if (rx.progress == 0) rx.progress = rxProgressWanted(mac, now) ? 1 : 2;
+  if (rx.progress != 1) return;
+
+  AppEvent ev{};
+  ev.kind = APP_PROGRESS;
+  ev.complete = (rx.hashedChunks == rx.total);
+  ev.hash = rxStreamId(rx);
+  ev.startedAt = rx.startAt;
+  ev.expectedLen = (uint16_t)((size_t)rx.total * CHUNK_MAX);
+  const size_t len = ev.complete ? (size_t)(rx.total - 1) * CHUNK_MAX + rx.lastLen
+                                 : (size_t)rx.hashedChunks * CHUNK_MAX;
+  appPost(ev, rx.buf, len);
+}
+
+// グループ内の欠落がちょうど1つならパリティから復元する
+static void fecRecover(RxState& rx, uint8_t group) {
+  if (!rx.fecK || group >= FEC_MAX_GROUPS || !(rx.parityGot & (1u << group))) return;
+  const uint16_t first = (uint16_t)group * rx.fecK;
+  const uint16_t last = (uint16_t)min<uint16_t>(first + rx.fecK, rx.total);
 
-// === 設定 ===
-static const uint8_t MAC_BC[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
-static const uint16_t CHUNK_MAX      = 200;     // 1パケットのデータ最大
-static const uint16_t MAX_MSG_BYTES  = 2048;    // 再構成の最大サイズ
-static const uint16_t MAX_CHUNKS     = (MAX_MSG_BYTES + CHUNK_MAX - 1) / CHUNK_MAX;
-static const unsigned long RX_TIMEOUT_MS = 2500; // 受信途中の期限
+  int missing = -1;
+  for (uint16_t i = first; i < last; i++) {
+    if (rx.got & (1UL << i)) continue;
+    if (missing >= 0) return; // 2つ以上欠けていたら復元できない
+    missing = i;
+  }
+  if (missing < 0) return;
 
-#pragma pack(push,1)
-struct ChunkHdr {
-  uint8_t  tag;    // 'C'
-  uint16_t msgId;  // 送信ごとに++
-  uint16_t total;  // 総チャンク数
-  uint16_t idx;    // 0..total-1
-  uint16_t len;    // このチャンクのデータ長
-};
-#pragma pack(pop)
+  uint8_t tmp[CHUNK_MAX];
+  memcpy(tmp, rx.parity[group], CHUNK_MAX);
+  for (uint16_t i = first; i < last; i++) {
+    if (i == missing) continue;
+    const uint8_t* src = rx.buf + (size_t)i * CHUNK_MAX;
+    const size_t n = chunkLen(rx, i);
+    for (size_t b = 0; b < n; b++) tmp[b] ^= src[b];
+  }
+  const size_t n = chunkLen(rx, (uint16_t)missing);
+  memcpy(rx.buf + (size_t)missing * CHUNK_MAX, tmp, n);
+  rx.got |= 1UL << missing;
+  rx.gotCount++;
+  if (missing == rx.total - 1) rx.lastLen = (uint16_t)n;
+  s_node->rxFecRecovered++;
+  Serial.printf("RX: FEC recovered chunk %d of Msg ID=%d\n", missing, rx.msgId); // 受信デバッグ
+}
 
-static uint8_t s_selfMac[6] = {0};
-static uint16_t s_msgId = 1;
-static CommOnMessageCB s_onMessage = nullptr;
-static volatile int s_lastRssi = -128; // 未取得/非対応時は -128 を保持
-// 受信許可最小RSSI。既定はフィルタ無効（-128）。.ino から Comm_SetMinRssiToAccept() で設定してください。
-static volatile int s_minRssiAccept = -128;
+// ===== 注目コンテンツの中継 =====
+static uint32_t relayKey(const uint8_t* origin, uint32_t hash) {
+  return fnv1a(fnv1a(FNV_OFFSET, origin, 6), (const uint8_t*)&hash, sizeof(hash));
+}
 
-// 受信再構成バッファ
-static struct RxState {
-  bool active = false;
-  uint16_t msgId = 0, total = 0, gotCount = 0, lastLen = 0;
-  uint8_t fromMac[6] = {0};
-  unsigned long startAt = 0;
-  bool got[(MAX_MSG_BYTES + CHUNK_MAX - 1) / CHUNK_MAX]{};
-  uint8_t buf[MAX_MSG_BYTES]{};
-} s_rx;
+// i 番目のビット位置（2つのハッシュの線形結合。h2 は奇数）
+static uint16_t seenBit(uint32_t key, uint8_t i) {
+  const uint32_t h2 = ((key >> 16) | (key << 16)) * 0x9E3779B1u | 1;
+  return (uint16_t)((key + i * h2) & (SEEN_BITS - 1));
+}
+
+// 既読なら true、未読なら既読にして false
+static bool seenTestAndAdd(uint32_t key, unsigned long now) {
+  bool seen = false;
+  portENTER_CRITICAL(&s_node->relayMux);
+  for (uint8_t g = 0; g < 2 && !seen; g++) {
+    bool all = true;
+    for (uint8_t i = 0; i < SEEN_K && all; i++) {
+      const uint16_t b = seenBit(key, i);
+      all = s_node->seen[g][b >> 3] & (1 << (b & 7));
+    }
+    seen = all;
+  }
+  if (!seen) {
+    if (s_node->seenCount >= SEEN_ROTATE_COUNT || now - s_node->seenAt > SEEN_ROTATE_MS) {
+      s_node->seenCur ^= 1;
+      memset(s_node->seen[s_node->seenCur], 0, sizeof(s_node->seen[s_node->seenCur]));
+      s_node->seenCount = 0;
+      s_node->seenAt = now;
+    }
+    for (uint8_t i = 0; i < SEEN_K; i++) {
+      const uint16_t b = seenBit(key, i);
+      s_node->seen[s_node->seenCur][b >> 3] |= (uint8_t)(1 << (b & 7));
+    }
+    s_node->seenCount++;
+  }
+  portEXIT_CRITICAL(&s_node->relayMux);
+  return seen;
+}
+
+// 中継フレーム受信: 初めてならアプリへ渡し、中継が有効なら少し待ってから TTL-1 で送り直す
+static void onRelay(const uint8_t* data, int len) {
+  const RelayHdr* r = (const RelayHdr*)data;
+  if (memcmp(r->origin, s_node->selfMac, 6) == 0) return; // 自分が出したものが戻ってきた
+  const unsigned long now = commNow();
+  const uint32_t key = relayKey(r->origin, r->hash);
+
+  if (seenTestAndAdd(key, now)) {
+    s_node->relayDuplicates++;
+    for (uint8_t i = 0; i < RELAY_PENDING; i++) {
+      RelayPending& q = s_node->relayPending[i];
+      if (q.used && q.key == key && ++q.dups >= RELAY_SUPPRESS_K) {
+        q.used = false; // 周りが十分に送っている
+        s_node->relaySuppressed++;
+      }
+    }
+    return;
+  }
+
+  s_node->relayReceived++;
+  s_node->relayLastHops = (uint8_t)(r->ttl0 >= r->ttl ? r->ttl0 - r->ttl + 1 : 1);
+  Serial.printf("RX: Featured type=%u (%u bytes) hash=%08lX hops=%u\n",
+                r->contentType, r->len, (unsigned long)r->hash, s_node->relayLastHops); // 受信デバッグ
+  if (dedupAccept(r->hash, now)) {
+    appPostContent(r->contentType, r->flags | COMM_FLAG_FEATURED, r->hash, data + sizeof(RelayHdr), r->len);
+  }
+
+  if (!s_node->relay || r->ttl == 0) return;
+  RelayPending* slot = nullptr;
+  for (uint8_t i = 0; i < RELAY_PENDING && !slot; i++) {
+    if (!s_node->relayPending[i].used) slot = &s_node->relayPending[i];
+  }
+  if (!slot) {
+    s_node->relayDropped++;
+    return;
+  }
+  slot->used = true;
+  slot->key = key;
+  slot->dups = 0;
+  slot->fireAt = now + RELAY_DELAY_MIN_MS + commRandom() % (RELAY_DELAY_MAX_MS - RELAY_DELAY_MIN_MS);
+  slot->len = (uint16_t)len;
+  memcpy(slot->frame, data, len);
+  ((RelayHdr*)slot->frame)->ttl--;
+}
+
+// 受信タスクの定期処理: 待ち時間が過ぎた中継を送る
+static void relayTick(unsigned long now) {
+  for (uint8_t i = 0; i < RELAY_PENDING; i++) {
+    RelayPending& q = s_node->relayPending[i];
+    if (!q.used || (long)(now - q.fireAt) < 0) continue;
+    q.used = false;
+    if (sendFrame(MAC_BC, FRAME_RELAY, q.frame, q.len)) s_node->relayForwarded++;
+  }
+}
+
+// 単発JSON（旧形式 '{' / FRAME_JSON のペイロード）
+static void handleJson(const uint8_t* mac_addr, const uint8_t* data, int len) {
+  Serial.printf("RX: Single JSON (%d bytes)\n", len); // 受信デバッグ
+  const uint32_t hash = Comm_Hash32(data, (size_t)len);
+  nbSetHash(mac_addr, hash);
+  hsOnData(mac_addr, hash);
+  if (!dedupAccept(hash, commNow())) return;
+  appPostMessage(data, (size_t)len);
+}
+
+// チャンク（旧形式 'C' / FRAME_CHUNK のペイロード）。idx >= total はパリティ
+static void handleChunk(const uint8_t* mac_addr, const uint8_t* data, int len) {
+  if (len < (int)sizeof(ChunkHdr) || data[0] != 'C') return;
+  const ChunkHdr* h = (const ChunkHdr*)data;
+  if (h->total == 0 || h->total > MAX_CHUNKS) return;
+  if ((int)(sizeof(ChunkHdr) + h->len) != len) return;
+
+  const bool isParity = (h->idx >= h->total);
+  uint8_t group = 0;
+  if (isParity) {
+    if (h->len != sizeof(ParityHdr) + CHUNK_MAX) return;
+    const ParityHdr* ph = (const ParityHdr*)(data + sizeof(ChunkHdr));
+    group = (uint8_t)(h->idx - h->total);
+    if (ph->k < FEC_MIN_GROUP || ph->k > FEC_MAX_GROUP || group >= FEC_MAX_GROUPS) return;
+    if ((size_t)group * ph->k >= h->total) return;
+    if (ph->msgLen <= (size_t)(h->total - 1) * CHUNK_MAX || ph->msgLen > (size_t)h->total * CHUNK_MAX
+        || ph->msgLen > MAX_MSG_BYTES) return;
+  } else {
+    if (h->len > CHUNK_MAX) return;
+    if ((size_t)h->idx * CHUNK_MAX + h->len > MAX_MSG_BYTES) return;
+  }
+
+  const unsigned long now = commNow();
+  RxState* rx = rxSlotFor(mac_addr, h->msgId, h->total, now);
+  if (!rx) return;
+  rx->lastAt = now;
+
+  if (isParity) {
+    const ParityHdr* ph = (const ParityHdr*)(data + sizeof(ChunkHdr));
+    if (!(rx->parityGot & (1u << group))) {
+      memcpy(rx->parity[group], data + sizeof(ChunkHdr) + sizeof(ParityHdr), CHUNK_MAX);
+      rx->parityGot |= (uint8_t)(1u << group);
+      rx->fecK = ph->k;
+      rx->msgLen = ph->msgLen;
+    }
+  } else {
+    const uint32_t bit = 1UL << h->idx;
+    if (!(rx->got & bit)) {
+      memcpy(rx->buf + (size_t)h->idx * CHUNK_MAX, data + sizeof(ChunkHdr), h->len);
+      rx->got |= bit;
+      rx->gotCount++;
+      if (h->idx == h->total - 1) rx->lastLen = h->len;
+    }
+    if (rx->fecK) group = (uint8_t)(h->idx / rx->fecK);
+  }
+  const uint16_t hashedBefore = rx->hashedChunks;
+  fecRecover(*rx, group);
+  rxAdvanceHash(*rx);
+  rxNotifyProgress(*rx, mac_addr, hashedBefore, now);
+
+  if (rx->gotCount == rx->total && rx->lastLen > 0) {
+    Serial.println("RX: All Chunks Received"); // 受信デバッグ
+    size_t fullLen = (size_t)(rx->total - 1) * CHUNK_MAX + rx->lastLen;
+    rx->active = false;
+    rx->doneAt = now | 1;
+    s_node->rxCompleted++;
+    s_node->rxLastCompleteMs = now - rx->startAt;
+    const uint32_t hash = rx->hashState; // 受信しながら計算済み
+    nbSetHash(mac_addr, hash);
+    hsOnData(mac_addr, hash);
+    if (!dedupAccept(hash, now)) {
+      rxAbortProgress(*rx);
+      return;
+    }
+    appPostMessage(rx->buf, fullLen);
+  }
+}
 
-// 共通の受信処理本体（mac アドレスは任意）
+// 共通の受信処理本体（mac アドレスは任意）。形式と CRC は onRecv で確認済み
 static void handleRecv(const uint8_t* mac_addr, const uint8_t* data, int len) {
   if (!data || len <= 0) return;
-  if (mac_addr && memcmp(mac_addr, s_selfMac, 6) == 0) return; // 自送信は無視
+  if (mac_addr && memcmp(mac_addr, s_node->selfMac, 6) == 0) return; // 自送信は無視
 
   // ★変更: 受信データの中身を少し表示する
-  Serial.printf("[%lu] [RX] Recv packet len=%d | ", millis(), len);
+  Serial.printf("[%lu] [RX] Recv packet len=%d | ", commNow(), len);
   for(int i=0; i<min(len, 20); i++) { // 先頭20バイトを表示
       Serial.printf("%02X ", data[i]);
   }
   Serial.println("..."); // 改行
 
-  // 1) 単発JSON（先頭'{'）
+  // 1) 旧形式: 単発JSON（先頭'{'）/ チャンク（先頭'C'）
   if (data[0] == '{') {
-    Serial.printf("RX: Single JSON (%d bytes)\n", len); // 受信デバッグ
-    if (s_onMessage) s_onMessage(data, (size_t)len);
+    handleJson(mac_addr, data, len);
+    return;
+  }
+  if (data[0] == 'C') {
+    handleChunk(mac_addr, data, len);
     return;
   }
 
-  // 2) チャンク（先頭 'C'）
-  if ((uint8_t)data[0] != 'C' || len < (int)sizeof(ChunkHdr)) return;
-  const ChunkHdr* h = (const ChunkHdr*)data;
-  if (h->len > CHUNK_MAX || h->total == 0 || h->total > MAX_CHUNKS || h->idx >= h->total) return;
+  // 2) v2 フレーム（先頭 FRAME_MAGIC）
+  if (data[0] != FRAME_MAGIC || len < (int)sizeof(FrameHdr)) return;
+  const FrameHdr* f = (const FrameHdr*)data;
+  const uint8_t* payload = data + sizeof(FrameHdr);
+  const int plen = len - (int)sizeof(FrameHdr);
+  if (f->type == FRAME_JSON) {
+    handleJson(mac_addr, payload, plen);
+  } else if (f->type == FRAME_CHUNK) {
+    handleChunk(mac_addr, payload, plen);
+  } else if (f->type == FRAME_CONTENT) {
+    if (len < (int)sizeof(ContentHdr)) return;
+    const ContentHdr* c = (const ContentHdr*)data;
+    if ((int)(sizeof(ContentHdr) + c->len) != len) return;
+    Serial.printf("RX: Content type=%u (%u bytes) hash=%08lX\n",
+                  c->contentType, c->len, (unsigned long)c->hash); // 受信デバッグ
+    nbSetHash(mac_addr, c->hash);
+    hsOnData(mac_addr, c->hash);
+    if (!dedupAccept(c->hash, commNow())) return;
+    appPostContent(c->contentType, c->flags, c->hash, data + sizeof(ContentHdr), c->len);
+  } else if (f->type == FRAME_BEACON) {
+    if (len < (int)BEACON_MIN_LEN) return;
+    BeaconFrame b;
+    b.txPower = -128;
+    b.caps = 0;
+    b.sfPhase = 0;
+    b.slot = SLOT_NONE;
+    b.dataPower = -128;
+    b.rssiThr = -128;
+    memcpy(&b, data, min((size_t)len, sizeof(b)));
+    onBeacon(mac_addr, &b);
+  } else if (f->type == FRAME_REQUEST) {
+    if (len != (int)sizeof(RequestFrame)) return;
+    onRequest(mac_addr, (const RequestFrame*)data);
+  } else if (f->type == FRAME_NACK) {
+    if (len != (int)sizeof(NackFrame)) return;
+    onNack((const NackFrame*)data);
+  } else if (f->type == FRAME_HELLO) {
+    if (len != (int)sizeof(HelloFrame)) return;
+    onHello(mac_addr, (const HelloFrame*)data);
+  } else if (f->type == FRAME_OFFER) {
+    if (len != (int)sizeof(OfferFrame)) return;
+    onOffer(mac_addr, (const OfferFrame*)data);
+  } else if (f->type == FRAME_ACK) {
+    if (len != (int)sizeof(AckFrame)) return;
+    onAck(mac_addr, (const AckFrame*)data);
+  } else if (f->type == FRAME_RELAY) {
+    if (len < (int)sizeof(RelayHdr)) return;
+    if ((int)(sizeof(RelayHdr) + ((const RelayHdr*)data)->len) != len) return;
+    onRelay(data, len);
+  } else if (f->type == FRAME_PERF) {
+    if (s_node->onPerf && mac_addr) s_node->onPerf(mac_addr, payload, plen);
+  }
+}
 
-  bool needInit = (!s_rx.active)
-               || (mac_addr && memcmp(s_rx.fromMac, mac_addr, 6) != 0)
-               || (s_rx.msgId != h->msgId)
-               || (millis() - s_rx.startAt > RX_TIMEOUT_MS);
+// RSSI しきい値の外からも受けるフレーム（中継と性能試験）
+static bool isFarFrame(const uint8_t* data, int len) {
+  if (len < (int)sizeof(FrameHdr) || data[0] != FRAME_MAGIC) return false;
+  const uint8_t type = ((const FrameHdr*)data)->type;
+  return type == FRAME_RELAY || type == FRAME_PERF;
+}
 
-  if (needInit) {
-    Serial.printf("RX: Start Chunked Msg ID=%d Total=%d\n", h->msgId, h->total); // 受信デバッグ
-    s_rx = RxState{}; // reset struct
-    s_rx.active = true;
-    s_rx.msgId = h->msgId;
-    s_rx.total = h->total;
-    if (mac_addr) memcpy(s_rx.fromMac, mac_addr, 6);
+// WiFiタスクから: 数サイクルで判定できる形式チェック。壊れた/無関係なフレームはキューに入れない
+static bool frameLooksValid(const uint8_t* data, int len) {
+  if (!data || len <= 0 || len > BIG_FRAME_MAX) return false;
+  if (data[0] == FRAME_MAGIC) {
+    if (len < (int)sizeof(FrameHdr)) return false;
+    const FrameHdr* f = (const FrameHdr*)data;
+    if (f->ver != FRAME_VERSION || f->len != len - (int)sizeof(FrameHdr)) return false;
+    return f->crc == frameCrc(f->type, data + sizeof(FrameHdr), f->len);
   }
-  s_rx.startAt = millis();
+  // 旧形式（CRC なし）は長さの整合だけ確認する
+  if (data[0] == '{') {
+    int end = len - 1;
+    while (end > 0 && (data[end] == '\n' || data[end] == '\r' || data[end] == ' ')) end--;
+    return data[end] == '}';
+  }
+  if (data[0] == 'C') {
+    if (len < (int)sizeof(ChunkHdr)) return false;
+    return (int)(sizeof(ChunkHdr) + ((const ChunkHdr*)data)->len) == len;
+  }
+  return false;
+}
 
-  if ((int)(sizeof(ChunkHdr) + h->len) != len) return;
-  size_t off = (size_t)h->idx * CHUNK_MAX;
-  if (off + h->len > sizeof(s_rx.buf)) return;
+// RxPacket / RxBigPacket 共通: スロットへ書き込む
+template <typename P>
+static void rxFill(P& p, const uint8_t* mac_addr, const uint8_t* data, int len, int rssi) {
+  p.hasMac = (mac_addr != nullptr);
+  if (mac_addr) memcpy(p.mac, mac_addr, 6);
+  p.rssi = (int8_t)rssi;
+  p.len = (uint16_t)len;
+  p.at = commNow();
+  memcpy(p.data, data, len);
+}
+
+// WiFiタスクから呼ばれる: フレームをスロットへコピーして受信タスクを起こすだけ
+static void enqueueRecv(const uint8_t* mac_addr, const uint8_t* data, int len, int rssi) {
+  if (s_node->replayMode) {
+    s_node->replayRxIgnored++;
+    return;
+  }
+  s_node->rxFrames++;
+  if (!frameLooksValid(data, len)) {
+    s_node->rxBadFrames++;
+    return;
+  }
 
-  if (!s_rx.got[h->idx]) {
-    memcpy(s_rx.buf + off, data + sizeof(ChunkHdr), h->len);
-    s_rx.got[h->idx] = true;
-    s_rx.gotCount++;
-    if (h->idx == h->total - 1) s_rx.lastLen = h->len;
+  if (len > RXQ_FRAME_MAX) {
+    const uint16_t head = s_node->rxqBigHead.load(std::memory_order_relaxed);
+    if ((uint16_t)(head - s_node->rxqBigTail.load(std::memory_order_acquire)) >= RXQ_BIG_SLOTS) {
+      s_node->rxQueueDrops++;
+      return;
+    }
+    rxFill(s_node->rxqBig[head & (RXQ_BIG_SLOTS - 1)], mac_addr, data, len, rssi);
+    s_node->rxqBigHead.store((uint16_t)(head + 1), std::memory_order_release);
+    if (s_node->rxTask) xTaskNotifyGive(s_node->rxTask);
+    return;
   }
 
-  if (s_rx.gotCount == s_rx.total && s_rx.lastLen > 0) {
-    Serial.println("RX: All Chunks Received"); // 受信デバッグ
-    size_t fullLen = (size_t)(s_rx.total - 1) * CHUNK_MAX + s_rx.lastLen;
-    if (s_onMessage) s_onMessage(s_rx.buf, fullLen);
-    s_rx.active = false;
+  const uint16_t head = s_node->rxqHead.load(std::memory_order_relaxed);
+  const uint16_t tail = s_node->rxqTail.load(std::memory_order_acquire);
+  if ((uint16_t)(head - tail) >= RXQ_SLOTS) {
+    s_node->rxQueueDrops++; // 満杯: 新しいフレームを捨てる
+    return;
+  }
+
+  rxFill(s_node->rxq[head & (RXQ_SLOTS - 1)], mac_addr, data, len, rssi);
+  s_node->rxqHead.store((uint16_t)(head + 1), std::memory_order_release);
+
+  const uint16_t depth = (uint16_t)(head + 1 - tail);
+  if (depth > s_node->rxQueueHighWater) s_node->rxQueueHighWater = depth;
+
+  if (s_node->rxTask) xTaskNotifyGive(s_node->rxTask);
+}
+
+// 受信タスクから: キューから取り出した1フレームを処理する
+template <typename P>
+static void rxProcess(const P& p) {
+  if (s_node->onRawFrame) s_node->onRawFrame(p.at, p.hasMac ? p.mac : nullptr, p.rssi, p.data, p.len);
+  bool tapped = false;
+  // 近さの判定は1サンプルではなく近隣ごとに平滑化した RSSI で行う
+  if (!p.hasMac || memcmp(p.mac, s_node->selfMac, 6) == 0) {
+    handleRecv(p.hasMac ? p.mac : nullptr, p.data, p.len);
+  } else if (nbObserve(p.mac, p.rssi, txPowerIsData(p.data), p.at, tapped)) {
+    slotObserve(p.data, p.at);
+    handleRecv(p.mac, p.data, p.len);
+    if (tapped) onTap(p.mac, p.rssi, p.at);
+    else hsStart(p.mac, p.at); // しきい値内で初めて受けた近隣: 次の定期広告を待たずに交換を始める
+  } else if (isFarFrame(p.data, p.len)) {
+    handleRecv(p.mac, p.data, p.len); // 中継と性能試験は遠くの相手からも受ける
+  } else {
+    s_node->rxRssiRejected++;
+  }
+}
+
+// 受信側の1回分: キューを空にしてから定期処理（受信タスク、または Comm_Poll から）
+static void rxStep() {
+  uint16_t tail = s_node->rxqTail.load(std::memory_order_relaxed);
+  while (tail != s_node->rxqHead.load(std::memory_order_acquire)) {
+    rxProcess(s_node->rxq[tail & (RXQ_SLOTS - 1)]);
+    tail++;
+    s_node->rxqTail.store(tail, std::memory_order_release);
+  }
+  uint16_t bigTail = s_node->rxqBigTail.load(std::memory_order_relaxed);
+  while (bigTail != s_node->rxqBigHead.load(std::memory_order_acquire)) {
+    rxProcess(s_node->rxqBig[bigTail & (RXQ_BIG_SLOTS - 1)]);
+    s_node->rxLargeFrames++;
+    bigTail++;
+    s_node->rxqBigTail.store(bigTail, std::memory_order_release);
+  }
+  uint16_t injTail = s_node->injqTail.load(std::memory_order_relaxed);
+  while (injTail != s_node->injqHead.load(std::memory_order_acquire)) {
+    rxProcess(s_node->injq[injTail & (INJQ_SLOTS - 1)]);
+    injTail++;
+    s_node->injqTail.store(injTail, std::memory_order_release);
+  }
+  const unsigned long now = commNow();
+  rxCheckStalled(now);
+  hsTick(now);
+  rssiAdaptTick(now);
+  txPowerTick(now);
+  slotTick(now);
+  relayTick(now);
+}
+
+// 受信タスク: 再構成とアプリへの通知はすべてここで行う
+static void rxTaskMain(void*) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(RX_TICK_MS));
+    rxStep();
   }
 }
 
@@ -102,47 +2405,71 @@ static void handleRecv(const uint8_t* mac_addr, const uint8_t* data, int len) {
 #if defined(ESP_IDF_VERSION_MAJOR) && (ESP_IDF_VERSION_MAJOR >= 5)
 // 新API (IDF v5 系): 型は wifi_tx_info_t / esp_now_recv_info
 static void onSent(const wifi_tx_info_t* info, esp_now_send_status_t status) {
-  (void)info; (void)status;
+  (void)info;
+  txDone(status == ESP_NOW_SEND_SUCCESS);
 }
 static void onRecv(const esp_now_recv_info* info, const uint8_t* data, int len) {
   const uint8_t* mac = (info && info->src_addr) ? info->src_addr : nullptr;
-  // RSSIを取得（利用可能な場合）
-  if (info && info->rx_ctrl) {
-    s_lastRssi = (int)info->rx_ctrl->rssi; // dBm
-    if (s_lastRssi < s_minRssiAccept) {
-      return;
-    }
-  } else {
-    s_lastRssi = -128;
-  }
-  handleRecv(mac, data, len);
+  // RSSIを取得（利用可能な場合）。しきい値判定は受信タスクの近隣テーブルで行う
+  const int rssi = (info && info->rx_ctrl) ? (int)info->rx_ctrl->rssi : -128;
+  enqueueRecv(mac, data, len, rssi);
 }
 #else
 // 旧API: 型は MAC アドレスポインタ
 static void onSent(const uint8_t* mac_addr, esp_now_send_status_t status) {
-  (void)mac_addr; (void)status;
+  (void)mac_addr;
+  txDone(status == ESP_NOW_SEND_SUCCESS);
 }
 static void onRecv(const uint8_t* mac_addr, const uint8_t* data, int len) {
   // 旧APIではRSSIが渡されないため不明扱い
-  s_lastRssi = -128;
-  handleRecv(mac_addr, data, len);
+  enqueueRecv(mac_addr, data, len, -128);
 }
 #endif
 
-void Comm_Init(int wifiChannel) {
+void Comm_Init(int wifiChannel, const CommRatePolicy& rate) {
+  if (s_node->transport) {
+    // 差し替えた無線: WiFi/ESP-NOW もタスクも使わず、Comm_Poll で進める
+    if (s_node->transport->getMac) s_node->transport->getMac(s_node->selfMac);
+    s_node->espNowVersion = 1;
+    if (s_node->transport->espNowVersion && s_node->transport->espNowVersion() >= 2 && BIG_FRAME_MAX > RXQ_FRAME_MAX) {
+      s_node->espNowVersion = 2;
+    }
+    rateInit(rate);
+    s_node->txPowerInitDbm = TX_POWER_MAX_DBM;
+    return;
+  }
+
   WiFi.mode(WIFI_STA);
   esp_wifi_set_channel(wifiChannel, WIFI_SECOND_CHAN_NONE);
-  esp_wifi_get_mac(WIFI_IF_STA, s_selfMac);
+  esp_wifi_get_mac(WIFI_IF_STA, s_node->selfMac);
+
+  if (!s_node->rxTask) {
+    xTaskCreatePinnedToCore(rxTaskMain, "comm_rx", RX_TASK_STACK, nullptr,
+                            RX_TASK_PRIO, &s_node->rxTask, ARDUINO_RUNNING_CORE);
+  }
+  if (!s_node->txTask) {
+    xTaskCreatePinnedToCore(txTaskMain, "comm_tx", TX_TASK_STACK, nullptr,
+                            TX_TASK_PRIO, &s_node->txTask, ARDUINO_RUNNING_CORE);
+  }
 
   if (esp_now_init() != ESP_OK) {
     Serial.println("ESP-NOW Init Failed"); // 初期化失敗ログ
     return;
   }
   Serial.printf("ESP-NOW Init Success. MAC: %02X:%02X:%02X:%02X:%02X:%02X\n", 
-                s_selfMac[0], s_selfMac[1], s_selfMac[2], s_selfMac[3], s_selfMac[4], s_selfMac[5]); // 初期化成功ログ
+                s_node->selfMac[0], s_node->selfMac[1], s_node->selfMac[2], s_node->selfMac[3], s_node->selfMac[4], s_node->selfMac[5]); // 初期化成功ログ
 
   esp_now_register_send_cb(onSent);
   esp_now_register_recv_cb(onRecv);
+#ifdef ESP_NOW_MAX_DATA_LEN_V2
+  uint32_t ver = 1;
+  if (esp_now_get_version(&ver) == ESP_OK && ver >= 2) s_node->espNowVersion = 2;
+#endif
+  Serial.printf("ESP-NOW version %u (max payload %u)\n", s_node->espNowVersion,
+                s_node->espNowVersion >= 2 ? BIG_FRAME_MAX : RXQ_FRAME_MAX); // 初期化ログ
+  rateInit(rate);
+  int8_t q = 0;
+  if (esp_wifi_get_max_tx_power(&q) == ESP_OK) s_node->txPowerInitDbm = (int8_t)(q / 4);
 
   if (!esp_now_is_peer_exist(MAC_BC)) {
     esp_now_peer_info_t p{};
@@ -154,56 +2481,598 @@ void Comm_Init(int wifiChannel) {
   }
 }
 
+void Comm_SetTransport(const CommTransport* t) {
+  s_node->transport = t;
+}
+
+CommNode* Comm_NewNode() {
+  return new CommNode();
+}
+
+void Comm_DeleteNode(CommNode* node) {
+  if (!node || node == &s_deviceNode) return;
+  if (s_node == node) s_node = &s_deviceNode;
+  delete node;
+}
+
+void Comm_SelectNode(CommNode* node) {
+  s_node = node ? node : &s_deviceNode;
+}
+
+bool Comm_InjectFrame(const uint8_t mac[6], const uint8_t* data, size_t len, int rssi) {
+  if (!frameLooksValid(data, (int)len)) {
+    s_node->rxFrames++;
+    s_node->rxBadFrames++;
+    return true; // 渡し直しても同じなので受け取ったことにする
+  }
+  const uint16_t head = s_node->injqHead.load(std::memory_order_relaxed);
+  if ((uint16_t)(head - s_node->injqTail.load(std::memory_order_acquire)) >= INJQ_SLOTS) return false;
+  s_node->rxFrames++;
+  rxFill(s_node->injq[head & (INJQ_SLOTS - 1)], mac, data, (int)len, rssi);
+  s_node->injqHead.store((uint16_t)(head + 1), std::memory_order_release);
+  if (s_node->rxTask) xTaskNotifyGive(s_node->rxTask);
+  return true;
+}
+
+void Comm_SetReplayMode(bool enable) {
+  s_node->replayMode = enable;
+}
+
+void Comm_NotifySent(bool ok) {
+  txDone(ok);
+}
+
+void Comm_Poll() {
+  rxStep();
+  txStep();
+}
+
 void Comm_SetMinRssiToAccept(int dbm) {
-  s_minRssiAccept = dbm;
+  s_node->minRssiAccept = dbm;
+  s_node->rssiEffective = dbm;
+  s_node->rssiAdaptAt = 0; // 次の受信タスクの周期で近隣数を反映
+}
+
+void Comm_SetRssiAdapt(const CommRssiAdapt& a) {
+  portENTER_CRITICAL(&s_node->nbMux);
+  s_node->rssiAdapt = a;
+  portEXIT_CRITICAL(&s_node->nbMux);
+  s_node->rssiAdaptAt = 0;
 }
 
 void Comm_SetOnMessage(CommOnMessageCB cb) {
-  s_onMessage = cb;
+  s_node->onMessage = cb;
 }
 
-void Comm_SendJsonBroadcast(const String& json) {
+void Comm_SetFecGroup(uint8_t k) {
+  if (k != 0) k = constrain(k, FEC_MIN_GROUP, FEC_MAX_GROUP);
+  s_node->fecGroup = k;
+}
+
+void Comm_SetOnContent(CommOnContentCB cb) {
+  s_node->onContent = cb;
+}
+
+void Comm_SetOnProgress(CommOnProgressCB cb) {
+  s_node->onProgress = cb;
+}
+
+void Comm_SetUnicastExchange(bool enable) {
+  s_node->unicast = enable;
+}
+
+uint32_t Comm_Hash32(const uint8_t* data, size_t len) {
+  return fnv1a(FNV_OFFSET, data, len);
+}
+
+void Comm_SetDedupWindow(unsigned long ms) {
+  s_node->dedupWindowMs = ms;
+}
+
+void Comm_SetTrickle(bool enable) {
+  s_node->trickle = enable;
+  s_node->trickleReset = true;   // Trickle に戻すときは最短区間から
+  s_node->trickleFireAt = commNow(); // 固定間隔はすぐ最初の1回を出す
+}
+
+void Comm_SetTapParams(const TapParams& p) {
+  portENTER_CRITICAL(&s_node->nbMux);
+  s_node->tapParams = p;
+  portEXIT_CRITICAL(&s_node->nbMux);
+}
+
+void Comm_SetTxPower(const CommTxPower& p) {
+  CommTxPower c = p;
+  c.maxDbm    = constrain(c.maxDbm, TX_POWER_MIN_DBM, TX_POWER_MAX_DBM);
+  c.minDbm    = constrain(c.minDbm, TX_POWER_MIN_DBM, c.maxDbm);
+  c.beaconDbm = constrain(c.beaconDbm, TX_POWER_MIN_DBM, TX_POWER_MAX_DBM);
+  portENTER_CRITICAL(&s_node->nbMux);
+  s_node->txPower = c;
+  portEXIT_CRITICAL(&s_node->nbMux);
+  s_node->txPowerDataDbm = c.maxDbm; // 次の見直しまでは最大
+  s_node->txPowerTickAt = 0;
+  s_node->txPowerSet = true;
+}
+
+void Comm_SetRelay(bool enable) {
+  s_node->relay = enable;
+}
+
+bool Comm_SendFeatured(uint8_t type, uint8_t flags, uint32_t hash,
+                       const uint8_t* payload, size_t len, uint8_t ttl) {
+  if (!payload || len == 0 || len > COMM_FEATURED_MAX) return false;
+  uint8_t frame[sizeof(RelayHdr) + COMM_FEATURED_MAX];
+  RelayHdr* r = (RelayHdr*)frame;
+  memcpy(r->origin, s_node->selfMac, 6);
+  r->hash        = hash;
+  r->ttl         = ttl;
+  r->ttl0        = ttl;
+  r->contentType = type;
+  r->flags       = flags;
+  r->len         = (uint16_t)len;
+  memcpy(frame + sizeof(RelayHdr), payload, len);
+  seenTestAndAdd(relayKey(s_node->selfMac, hash), commNow());
+  return sendFrame(MAC_BC, FRAME_RELAY, frame, sizeof(RelayHdr) + len);
+}
+
+void Comm_SetSlotting(bool enable) {
+  if (enable && !s_node->slotting) {
+    s_node->slot = (uint8_t)(Comm_Hash32(s_node->selfMac, 6) % SLOT_COUNT);
+    memset(s_node->slotHeard, 0, sizeof(s_node->slotHeard));
+    memset(s_node->slotLoadQ4, 0, sizeof(s_node->slotLoadQ4));
+  }
+  s_node->slotting = enable;
+}
+
+void Comm_SetOnTap(CommOnTapCB cb) {
+  s_node->onTap = cb;
+}
+
+void Comm_SetOnRawFrame(CommOnRawFrameCB cb) {
+  s_node->onRawFrame = cb;
+}
+
+void Comm_SetOnPerf(CommOnPerfCB cb) {
+  s_node->onPerf = cb;
+}
+
+void Comm_SetRatePolicy(const CommRatePolicy& rate) {
+  if (rate.mode == COMM_RATE_DEFAULT) {
+    s_node->ratePolicy = rate;
+    rateSet(WIFI_PHY_RATE_1M_L); // ESP-NOW の既定
+  } else {
+    rateInit(rate);
+  }
+}
+
+CommRatePolicy Comm_GetRatePolicy() {
+  return s_node->ratePolicy;
+}
+
+void Comm_SetRateOverride(const CommRatePolicy* rate) {
+  if (!rate || rate->mode == COMM_RATE_DEFAULT || rate->mode == COMM_RATE_ADAPTIVE) {
+    s_node->rateOverride = false;
+    return;
+  }
+  if (rate->mode == COMM_RATE_LR) {
+    rateEnableLr();
+    s_node->rateOverrideRate = WIFI_PHY_RATE_LORA_500K;
+  } else {
+    s_node->rateOverrideRate = rate->rate;
+  }
+  s_node->rateOverride = true;
+}
+
+void Comm_GetStats(CommStats& out) {
+  const uint16_t head = s_node->rxqHead.load(std::memory_order_acquire);
+  const uint16_t tail = s_node->rxqTail.load(std::memory_order_acquire);
+  out.rxFrames         = s_node->rxFrames;
+  out.rxQueueDrops     = s_node->rxQueueDrops;
+  out.rxBadFrames      = s_node->rxBadFrames;
+  out.rxQueueDepth     = (uint16_t)(head - tail);
+  out.rxQueueHighWater = s_node->rxQueueHighWater;
+  out.rxQueueSlots     = RXQ_SLOTS;
+  out.rxChunkedCompleted = s_node->rxCompleted;
+  out.rxChunkedEvicted   = s_node->rxEvicted;
+  out.rxChunkedTimedOut  = s_node->rxTimedOut;
+  out.txBeacons          = s_node->txBeacons;
+  out.txRequests         = s_node->txRequests;
+  out.txServed           = s_node->txServed;
+  out.txLegacyFull       = s_node->txLegacyFull;
+  out.txBeaconsSuppressed = s_node->txBeaconsSuppressed;
+  out.beaconIntervalMs   = s_node->trickleI;
+  out.rxNacksSent        = s_node->rxNacksSent;
+  out.rxNacksSuppressed  = s_node->rxNacksSuppressed;
+  out.rxChunkedLastMs    = s_node->rxLastCompleteMs;
+  out.rxFecRecovered     = s_node->rxFecRecovered;
+  portENTER_CRITICAL(&s_node->txqMux);
+  out.txQueueDepth       = (uint16_t)(s_node->txqHead - s_node->txqTail + s_node->slotqHead - s_node->slotqTail);
+  portEXIT_CRITICAL(&s_node->txqMux);
+  out.txQueueHighWater   = s_node->txQueueHighWater;
+  out.txQueueDrops       = s_node->txQueueDrops;
+  out.txFrames           = s_node->txFrames;
+  out.txFailures         = s_node->txFailures;
+  out.txPacketsPerSec    = s_node->txPps;
+  out.txRetransmits      = s_node->txRetransmits;
+  out.neighbors          = (uint16_t)Comm_GetNeighbors(nullptr, 0);
+  out.rxRssiRejected     = s_node->rxRssiRejected;
+  out.rssiThreshold      = (int16_t)s_node->rssiEffective;
+  out.activeNeighbors    = s_node->activeNeighbors;
+  out.rssiEnters         = s_node->rssiEnters;
+  out.rssiExits          = s_node->rssiExits;
+  out.dedupHits          = s_node->dedupHits;
+  out.dedupMisses        = s_node->dedupMisses;
+  out.unicastExchange    = s_node->unicast;
+  out.exchanges          = s_node->exchanges;
+  out.exchangeLastMs     = s_node->exchangeLastMs;
+  out.exchangeAvgMs      = s_node->exchangeAvgMs;
+  out.txUnicastAcked     = s_node->txUnicastAcked;
+  out.txUnicastRetries   = s_node->txUnicastRetries;
+  out.txUnicastFallbacks = s_node->txUnicastFallbacks;
+  out.peerEvictions      = s_node->peerEvictions;
+  out.hsStarted          = s_node->hsStarted;
+  out.hsCompleted        = s_node->hsCompleted;
+  out.hsFailed           = s_node->hsFailed;
+  out.hsLastMs           = s_node->hsLastMs;
+  out.hsAvgMs            = s_node->hsAvgMs;
+  out.taps               = s_node->taps;
+  out.txRateKbps         = s_node->rateOverride ? rateKbps(s_node->rateOverrideRate) : s_node->rateKbps;
+  out.txRateUps          = s_node->rateUps;
+  out.txRateDowns        = s_node->rateDowns;
+  out.txRateDeliveryPct  = s_node->rateDeliveryPct;
+  out.txPowerDataDbm     = s_node->txPowerSet ? s_node->txPowerDataDbm : s_node->txPowerInitDbm;
+  out.txPowerBeaconDbm   = txPowerBeaconDbm();
+  out.txPowerChanges     = s_node->txPowerChanges;
+  out.espNowVersion      = s_node->espNowVersion;
+  out.txLargeFrames      = s_node->txLargeFrames;
+  out.rxLargeFrames      = s_node->rxLargeFrames;
+  out.slotting           = s_node->slotting;
+  out.slot               = s_node->slot;
+  out.slotWaits          = s_node->slotWaits;
+  out.slotBusy           = s_node->slotBusyTotal;
+  out.slotReslots        = s_node->reslots;
+  out.sfSyncs            = s_node->sfSyncs;
+  out.relay              = s_node->relay;
+  out.relayReceived      = s_node->relayReceived;
+  out.relayForwarded     = s_node->relayForwarded;
+  out.relaySuppressed    = s_node->relaySuppressed;
+  out.relayDuplicates    = s_node->relayDuplicates;
+  out.relayDropped       = s_node->relayDropped;
+  out.relayLastHops      = s_node->relayLastHops;
+  out.appDrops           = s_node->appDrops;
+  out.replayRxIgnored    = s_node->replayRxIgnored;
+  out.replayTxSuppressed = s_node->replayTxSuppressed;
+}
+
+size_t Comm_GetNeighbors(CommNeighbor* out, size_t max) {
+  const unsigned long now = commNow();
+  size_t n = 0;
+  portENTER_CRITICAL(&s_node->nbMux);
+  for (uint16_t i = 0; i < NEIGHBOR_SLOTS; i++) {
+    if (!nbLive(s_node->nb[i], now)) continue;
+    if (out && n < max) nbCopy(s_node->nb[i], out[n]);
+    n++;
+  }
+  portEXIT_CRITICAL(&s_node->nbMux);
+  return n;
+}
+
+bool Comm_GetNeighbor(const uint8_t mac[6], CommNeighbor& out) {
+  if (!mac) return false;
+  portENTER_CRITICAL(&s_node->nbMux);
+  const NeighborEntry* n = nbFind(mac, commNow());
+  if (n) nbCopy(*n, out);
+  portEXIT_CRITICAL(&s_node->nbMux);
+  return n != nullptr;
+}
+
+// legacy = true なら旧ファームが読める 'C' 形式、false なら FRAME_CHUNK で包む
+static void sendChunk(const uint8_t* dest, const uint8_t* msg, size_t L, uint16_t msgId, uint16_t total, uint16_t i, bool legacy) {
+  uint8_t frame[sizeof(FrameHdr) + sizeof(ChunkHdr) + CHUNK_MAX];
+  uint8_t* packet = legacy ? frame : frame + sizeof(FrameHdr);
+  size_t off = (size_t)i * CHUNK_MAX;
+  uint16_t n = (uint16_t)min((size_t)CHUNK_MAX, L - off);
+
+  ChunkHdr* h = (ChunkHdr*)packet;
+  h->tag   = 'C';//分割ですよフラグ
+  h->msgId = msgId;
+  h->total = total;
+  h->idx   = i;
+  h->len   = n;
+
+  memcpy(packet + sizeof(ChunkHdr), msg + off, n);
+  if (legacy) {
+    txEnqueue(dest, packet, sizeof(ChunkHdr) + n);
+  } else {
+    sendFrame(dest, FRAME_CHUNK, frame, sizeof(FrameHdr) + sizeof(ChunkHdr) + n);
+  }
+}
+
+// グループ g のデータチャンクを XOR したパリティを送る（短いチャンクは 0 埋め扱い）
+static void sendParity(const uint8_t* msg, size_t L, uint16_t msgId, uint16_t total, uint16_t g, bool legacy) {
+  uint8_t frame[sizeof(FrameHdr) + sizeof(ChunkHdr) + sizeof(ParityHdr) + CHUNK_MAX];
+  uint8_t* packet = legacy ? frame : frame + sizeof(FrameHdr);
+  ChunkHdr* h = (ChunkHdr*)packet;
+  h->tag   = 'C';
+  h->msgId = msgId;
+  h->total = total;
+  h->idx   = total + g;
+  h->len   = sizeof(ParityHdr) + CHUNK_MAX;
+
+  ParityHdr* ph = (ParityHdr*)(packet + sizeof(ChunkHdr));
+  ph->k      = s_node->fecGroup;
+  ph->msgLen = (uint16_t)L;
+
+  uint8_t* x = packet + sizeof(ChunkHdr) + sizeof(ParityHdr);
+  memset(x, 0, CHUNK_MAX);
+  const uint16_t first = g * s_node->fecGroup;
+  const uint16_t last = (uint16_t)min<uint16_t>(first + s_node->fecGroup, total);
+  for (uint16_t i = first; i < last; i++) {
+    const size_t off = (size_t)i * CHUNK_MAX;
+    const size_t n = min((size_t)CHUNK_MAX, L - off);
+    for (size_t b = 0; b < n; b++) x[b] ^= msg[off + b];
+  }
+  if (legacy) {
+    txEnqueue(MAC_BC, packet, sizeof(frame) - sizeof(FrameHdr));
+  } else {
+    sendFrame(MAC_BC, FRAME_CHUNK, frame, sizeof(frame));
+  }
+}
+
+// NACK で要求されたチャンクだけを送り直す
+static void serviceRetransmits() {
+  for (uint8_t k = 0; k < RETX_SLOTS; k++) {
+    RetxEntry& e = s_node->retx[k];
+    if (e.total == 0) continue;
+    uint32_t pending = e.pending.exchange(0, std::memory_order_relaxed);
+    if (!pending) continue;
+    const unsigned long now = commNow();
+    if (now - e.sentAt > RETX_TTL_MS) continue;
+    // 送り直したばかりのチャンクへの NACK は、再送を聞く前に出されたもの。同じチャンクを何度も流さない
+    if ((long)(now - e.resentUntil) >= 0) e.resent = 0;
+    pending &= ~e.resent;
+    if (!pending) continue;
+    e.resent |= pending;
+    e.resentUntil = now + RETX_HOLDOFF_MS
+                  + ((s_node->slotting && isBroadcast(e.dest)) ? slotWaitMs(now) : 0);
+    for (uint16_t i = 0; i < e.total; i++) {
+      if (!(pending & (1UL << i))) continue;
+      sendChunk(e.dest, e.buf, e.len, e.msgId, e.total, i, e.legacy);
+      s_node->txRetransmits++;
+    }
+    Serial.printf("[%lu] [TX] Retransmit Msg ID=%d mask=%08lX\n", commNow(), e.msgId, (unsigned long)pending);
+  }
+}
+
+// 相手が大きなフレームを受けられるか（自分も相手も v2。ブロードキャストは v1 の相手がいるので使わない）
+static bool peerTakesLargeFrames(const uint8_t* dest) {
+  if (s_node->espNowVersion < 2 || isBroadcast(dest)) return false;
+  portENTER_CRITICAL(&s_node->nbMux);
+  const NeighborEntry* n = nbFind(dest, commNow());
+  const bool ok = n && (n->caps & COMM_CAP_LARGE_FRAME);
+  portEXIT_CRITICAL(&s_node->nbMux);
+  return ok;
+}
+
+static void sendJson(const String& json, bool legacy, const uint8_t* dest) {
   const size_t L = json.length();
   if (L == 0) return;
 
   // デバッグ: 送信チャンネルとデータ長を表示
-  uint8_t primaryChan;
+  uint8_t primaryChan = 0;
   wifi_second_chan_t secondChan;
-  esp_wifi_get_channel(&primaryChan, &secondChan);
+  if (!s_node->transport) esp_wifi_get_channel(&primaryChan, &secondChan);
   
   // ★変更: タイムスタンプ付きで送信開始ログ
-  Serial.printf("[%lu] [TX] Start Broadcast %u bytes on CH %u\n", millis(), (unsigned)L, primaryChan);
+  Serial.printf("[%lu] [TX] Start Broadcast %u bytes on CH %u\n", commNow(), (unsigned)L, primaryChan);
 
-  if (L <= 250) {// 単発送信
-    esp_now_send(MAC_BC, (const uint8_t*)json.c_str(), L);
-    Serial.printf("[%lu] [TX] End Broadcast (Single)\n", millis());
+  if (legacy && L <= RXQ_FRAME_MAX) {// 単発送信（旧形式）
+    txEnqueue(dest, (const uint8_t*)json.c_str(), L);
+    Serial.printf("[%lu] [TX] End Broadcast (Single)\n", commNow());
+    return;
+  }
+  if (!legacy && L > RXQ_FRAME_MAX - sizeof(FrameHdr) && L <= BIG_FRAME_MAX - sizeof(FrameHdr)
+      && peerTakesLargeFrames(dest)) {// 単発送信（ESP-NOW v2 の相手へ分割せずに）
+    uint8_t frame[BIG_FRAME_MAX];
+    memcpy(frame + sizeof(FrameHdr), json.c_str(), L);
+    if (sendFrame(dest, FRAME_JSON, frame, sizeof(FrameHdr) + L)) {
+      s_node->txLargeFrames++;
+      Serial.printf("[%lu] [TX] End Unicast (Single v2)\n", commNow());
+      return;
+    }
+  }
+  if (!legacy && L <= RXQ_FRAME_MAX - sizeof(FrameHdr)) {// 単発送信
+    uint8_t frame[RXQ_FRAME_MAX];
+    memcpy(frame + sizeof(FrameHdr), json.c_str(), L);
+    sendFrame(dest, FRAME_JSON, frame, sizeof(FrameHdr) + L);
+    Serial.printf("[%lu] [TX] End Broadcast (Single)\n", commNow());
     return;
   }
   // 分割送信
   const uint16_t total = (L + CHUNK_MAX - 1) / CHUNK_MAX;
   if (total > MAX_CHUNKS) return;
 
-  const uint16_t myId = s_msgId++;
-  if (s_msgId == 0) s_msgId = 1;
+  const uint16_t myId = s_node->msgId++;
+  if (s_node->msgId == 0) s_node->msgId = 1;
+
+  // 再送キャッシュへ保存（NACK が来たら欠けたチャンクだけ送り直す）
+  RetxEntry& e = s_node->retx[s_node->retxNext];
+  s_node->retxNext = (s_node->retxNext + 1) % RETX_SLOTS;
+  e.total = 0; // 書き換え中は NACK を受け付けない
+  e.pending.store(0, std::memory_order_relaxed);
+  e.resent = 0;
+  memcpy(e.buf, json.c_str(), L);
+  e.msgId = myId;
+  e.len = (uint16_t)L;
+  e.sentAt = commNow();
+  e.legacy = legacy;
+  memcpy(e.dest, dest, 6);
+  e.total = total;
 
-  uint8_t packet[sizeof(ChunkHdr) + CHUNK_MAX];
   for (uint16_t i = 0; i < total; i++) {
     // Serial.printf("Sending chunk %u/%u\n", i + 1, total); // ログ抑制
-    size_t off = (size_t)i * CHUNK_MAX;
-    uint16_t n = (uint16_t)min((size_t)CHUNK_MAX, L - off);
+    sendChunk(dest, e.buf, L, myId, total, i, legacy);
+  }
+  if (s_node->fecGroup && isBroadcast(dest)) { // ユニキャストは ACK で再送されるのでパリティ不要
+    const uint16_t groups = (total + s_node->fecGroup - 1) / s_node->fecGroup;
+    for (uint16_t g = 0; g < groups && g < FEC_MAX_GROUPS; g++) {
+      sendParity(e.buf, L, myId, total, g, legacy);
+    }
+  }
+  // ★追加: 送信完了ログ
+  Serial.printf("[%lu] [TX] End Broadcast (Chunked)\n", commNow());
+}
+
+void Comm_SendJsonBroadcast(const String& json) {
+  sendJson(json, false, MAC_BC);
+}
+
+
+static bool sendContent(const uint8_t* dest, uint8_t type, uint8_t flags, uint32_t hash,
+                        const uint8_t* payload, size_t len) {
+  if (!payload || len == 0 || len > COMM_CONTENT_MAX) return false;
+
+  uint8_t packet[sizeof(ContentHdr) + COMM_CONTENT_MAX];
+  ContentHdr* c = (ContentHdr*)packet;
+  c->contentType = type;
+  c->flags       = flags;
+  c->hash        = hash;
+  c->len         = (uint16_t)len;
+  memcpy(packet + sizeof(ContentHdr), payload, len);
+
+  sendFrame(dest, FRAME_CONTENT, packet, sizeof(ContentHdr) + len);
+  Serial.printf("[%lu] [TX] Content type=%u (%u bytes)%s\n", commNow(), type, (unsigned)len,
+                isBroadcast(dest) ? "" : " unicast");
+  return true;
+}
+
+bool Comm_SendContentBroadcast(uint8_t type, uint8_t flags, uint32_t hash,
+                               const uint8_t* payload, size_t len) {
+  return sendContent(MAC_BC, type, flags, hash, payload, len);
+}
 
-    ChunkHdr* h = (ChunkHdr*)packet;
-    h->tag   = 'C';//分割ですよフラグ
-    h->msgId = myId;
-    h->total = total;
-    h->idx   = i;
-    h->len   = n;
+bool Comm_SendPerf(const uint8_t dest[6], const uint8_t* data, size_t len) {
+  if (!dest || !data || len == 0) return false;
+  if (len <= COMM_PERF_MAX) {
+    uint8_t frame[sizeof(FrameHdr) + COMM_PERF_MAX];
+    memcpy(frame + sizeof(FrameHdr), data, len);
+    return sendFrame(dest, FRAME_PERF, frame, sizeof(FrameHdr) + len);
+  }
+  // 大きなフレームは送信側（試験の送信元タスク）だけが使うので固定のバッファで組み立てる
+  if (sizeof(FrameHdr) + len > BIG_FRAME_MAX || !peerTakesLargeFrames(dest)) return false;
+  uint8_t* big = s_node->perfBig;
+  memcpy(big + sizeof(FrameHdr), data, len);
+  return sendFrame(dest, FRAME_PERF, big, sizeof(FrameHdr) + len);
+}
 
-    memcpy(packet + sizeof(ChunkHdr), json.c_str() + off, n);
-    esp_now_send(MAC_BC, packet, sizeof(ChunkHdr) + n);
-    delay(3);
+void Comm_SetOwnContent(const String& json, uint8_t type, const uint8_t* payload, size_t len) {
+  s_node->ownJson = json;
+  s_node->ownType = 0;
+  s_node->ownLen = 0;
+  if (type != 0 && payload && len > 0 && len <= COMM_CONTENT_MAX) {
+    s_node->ownType = type;
+    s_node->ownLen = len;
+    memcpy(s_node->ownPayload, payload, len);
+  }
+  s_node->ownHash = Comm_Hash32((const uint8_t*)json.c_str(), json.length());
+  s_node->trickleReset = true; // 変更はすぐに広告する
+}
+
+static void sendOwnContent(const uint8_t* dest) {
+  if (s_node->ownType != 0) {
+    sendContent(dest, s_node->ownType, 0, s_node->ownHash, s_node->ownPayload, s_node->ownLen);
+  } else {
+    sendJson(s_node->ownJson, false, dest);
+  }
+}
+
+// Trickle の新しい区間を始める。送信時刻は区間の後半からランダムに選ぶ
+static void trickleStart(unsigned long now, unsigned long interval) {
+  s_node->trickleI = interval;
+  s_node->trickleEndAt = now + interval;
+  s_node->trickleFireAt = now + interval / 2 + (commRandom() % (interval / 2));
+  s_node->trickleFired = false;
+  s_node->trickleHeard = 0;
+}
+
+static void sendBeacon() {
+  BeaconFrame b;
+  b.hash         = s_node->ownHash;
+  b.len          = (uint16_t)(s_node->ownType != 0 ? s_node->ownLen : s_node->ownJson.length());
+  b.contentType  = s_node->ownType;
+  b.txPower      = txPowerBeaconDbm();
+  b.dataPower    = s_node->txPowerSet ? s_node->txPowerDataDbm : s_node->txPowerInitDbm;
+  b.rssiThr      = (int8_t)max((int)s_node->rssiEffective, -128);
+  b.caps         = s_node->espNowVersion >= 2 ? COMM_CAP_LARGE_FRAME : 0;
+  b.sfPhase      = 0;
+  b.slot         = SLOT_NONE;
+  if (s_node->slotting) {
+    b.caps    |= COMM_CAP_SLOTTED;
+    b.sfPhase  = sfPhase(commNow());
+    b.slot     = s_node->slot;
+  }
+  sendFrame(MAC_BC, FRAME_BEACON, (uint8_t*)&b, sizeof(b));
+  s_node->txBeacons++;
+}
+
+// N 回に1回はビーコン非対応の旧ファーム向けに JSON 全体を旧形式で送る
+static void sendBeaconOrLegacy() {
+  if (++s_node->beaconCount % LEGACY_FULL_EVERY == 0) {
+    sendJson(s_node->ownJson, true, MAC_BC);
+    s_node->txLegacyFull++;
+  } else {
+    sendBeacon();
   }
-  // ★追加: 送信完了ログ
-  Serial.printf("[%lu] [TX] End Broadcast (Chunked)\n", millis());
 }
 
+void Comm_Tick() {
+  appDeliver();
+  serviceRetransmits();
+
+  if (s_node->ownJson.isEmpty()) return;
+  const unsigned long now = commNow();
+
+  // 要求があればまとめて1回だけ送る（複数の要求元が同じブロードキャストで受け取る）
+  if (s_node->serveRequested && (s_node->serveUrgent || now - s_node->lastServeAt >= SERVE_MIN_INTERVAL_MS)) {
+    s_node->serveRequested = false;
+    s_node->serveUrgent = false;
+    s_node->lastServeAt = now;
+    uint8_t dest[6];
+    memcpy(dest, MAC_BC, 6);
+    portENTER_CRITICAL(&s_node->serveMux);
+    if (s_node->unicast && s_node->serveRequesters == 1) memcpy(dest, s_node->serveTo, 6);
+    s_node->serveRequesters = 0;
+    portEXIT_CRITICAL(&s_node->serveMux);
+    sendOwnContent(dest);
+    s_node->txServed++;
+  }
+
+  if (!s_node->trickle) {
+    // 以前の固定間隔: 抑制も区間の伸び縮みもせず、新しい隣人や内容の変化でも前倒ししない
+    s_node->trickleReset = false;
+    if ((long)(now - s_node->trickleFireAt) >= 0) {
+      s_node->trickleFireAt = now + BEACON_FIXED_MS + commRandom() % BEACON_FIXED_JITTER_MS;
+      s_node->trickleI = BEACON_FIXED_MS;
+      sendBeaconOrLegacy();
+    }
+    return;
+  }
+
+  if (s_node->trickleReset) {
+    s_node->trickleReset = false;
+    if (s_node->trickleI != TRICKLE_IMIN_MS || s_node->trickleFired) trickleStart(now, TRICKLE_IMIN_MS);
+  }
+
+  if (!s_node->trickleFired && (long)(now - s_node->trickleFireAt) >= 0) {
+    s_node->trickleFired = true;
+    if (s_node->trickleHeard >= TRICKLE_K) {
+      s_node->txBeaconsSuppressed++; // 周りが十分広告している
+    } else {
+      sendBeaconOrLegacy();
+    }
+  }
+
+  if ((long)(now - s_node->trickleEndAt) >= 0) {
+    trickleStart(now, min(s_node->trickleI * 2, TRICKLE_IMAX_MS));
+  }
+}
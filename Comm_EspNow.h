@@ -1,19 +1,332 @@
 #pragma once
 #include <Arduino.h>
+#include <esp_wifi_types.h>
+#include "Tap_Detector.h"
 
 // 完成JSONを通知するコールバック型
 using CommOnMessageCB = void (*)(const uint8_t* data, size_t len);
 
-// 初期化（WiFi STA + 指定チャネル + ESP-NOW準備 + ブロードキャストpeer追加）
-void Comm_Init(int wifiChannel);
+// バイナリコンテンツの種類
+enum CommContentType : uint8_t {
+  COMM_CONTENT_IMAGE_RGB = 1,  // DISP_W*DISP_H*3 バイトのRGB
+  COMM_CONTENT_TEXT      = 2,  // UTF-8 テキスト
+  COMM_CONTENT_IMAGE_PACKED = 3, // Image_Codec で符号化したRGB
+};
 
-// 完成メッセージのハンドラ登録
+// ビーコンで広告する能力
+enum CommCaps : uint8_t {
+  COMM_CAP_LARGE_FRAME = 0x01,  // ESP-NOW v2: 250 バイトを超えるフレームを受けられる
+  COMM_CAP_SLOTTED     = 0x02,  // スロット送信中（ビーコンにスーパーフレームの時計とスロットを載せる）
+};
+
+// 1フレームに載るバイナリコンテンツの最大長
+static const size_t COMM_CONTENT_MAX = 233;
+
+// 中継で届く注目コンテンツの最大長
+static const size_t COMM_FEATURED_MAX = 225;
+
+// 性能試験フレームのペイロード最大長（ESP-NOW v2 の相手へのユニキャストは COMM_PERF_MAX_LARGE まで）
+static const size_t COMM_PERF_MAX = 241;
+static const size_t COMM_PERF_MAX_LARGE = 1461;
+
+// CommOnContentCB の flags: 中継で届いた注目コンテンツ（送信元が付けた flags に OR される）
+static const uint8_t COMM_FLAG_FEATURED = 0x80;
+
+// バイナリコンテンツを通知するコールバック型
+// hash は送信側が付けたコンテンツ識別子（元JSONの Comm_Hash32）
+using CommOnContentCB = void (*)(uint8_t type, uint8_t flags, uint32_t hash,
+                                 const uint8_t* payload, size_t len);
+
+// 分割メッセージの受信途中経過（先頭から連続して届いた部分）
+struct CommStreamProgress {
+  uint32_t id;              // 送信元とメッセージ番号から作る識別子
+  const uint8_t* data;      // 受信中のバッファ先頭。nullptr = 完成せずに中断した
+  size_t len;               // 先頭から連続して届いたバイト数
+  size_t expectedLen;       // 総チャンク数から見積もった最大長
+  bool complete;            // 全チャンクが揃った（直後に CommOnMessageCB が呼ばれる）
+  unsigned long startedAt;  // 最初のチャンクを受け取った millis()
+};
+using CommOnProgressCB = void (*)(const CommStreamProgress& p);
+
+// ESP-NOW の送信レート（PHY レート）の方針。ADAPTIVE 以外は全フレーム共通
+enum CommRateMode : uint8_t {
+  COMM_RATE_DEFAULT  = 0,  // 設定しない（1Mbps）
+  COMM_RATE_FIXED    = 1,  // rate に固定
+  COMM_RATE_LR       = 2,  // Long Range（LR 対応の ESP32 同士のみ届く。広い会場で距離が足りないとき）
+  COMM_RATE_ADAPTIVE = 3,  // 既知の相手へのユニキャストの到達率で段を上げ下げ（ユニキャスト交換モードで有効）。
+                           // ブロードキャストとビーコンは開始段のまま
+};
+struct CommRatePolicy {
+  CommRateMode mode = COMM_RATE_DEFAULT;
+  wifi_phy_rate_t rate = WIFI_PHY_RATE_1M_L;  // FIXED のレート / ADAPTIVE の開始段（段に無ければ最も遅い段）
+};
+
+// 初期化（WiFi STA + 指定チャネル + ESP-NOW準備 + ブロードキャストpeer追加 + 送信レート）
+void Comm_Init(int wifiChannel, const CommRatePolicy& rate = CommRatePolicy());
+
+// 無線と時計の差し替え（ホスト上で複数台の動作を仮想の媒体・時計で回すため）。
+// Comm_Init より前に設定すると、Comm_Init は WiFi/ESP-NOW もタスクも使わない。
+// 受信は Comm_InjectFrame、送信結果は Comm_NotifySent で渡し、処理は Comm_Poll で進める。
+// nullptr（既定）なら ESP-NOW と millis()/esp_random() を使う
+struct CommTransport {
+  bool (*send)(const uint8_t dest[6], const uint8_t* data, size_t len);  // true なら後で Comm_NotifySent
+  unsigned long (*now)();                                                // [ms]
+  uint32_t (*random)();
+  // 以下は任意（nullptr なら何もしない）
+  void (*getMac)(uint8_t mac[6]);
+  bool (*addPeer)(const uint8_t mac[6]);
+  void (*delPeer)(const uint8_t mac[6]);
+  void (*setTxPower)(int8_t dbm);
+  void (*setRateKbps)(uint16_t kbps);
+  uint8_t (*espNowVersion)();   // 1 / 2（nullptr なら 1）。2 なら v2 の相手へ大きなフレームで送る
+};
+void Comm_SetTransport(const CommTransport* t);
+
+// 通信の状態は1台分ずつ CommNode にまとまっている（既定は端末自身の1台で、実機ではこれだけを使う）。
+// ホストで複数台を1つのプロセスに置くときは Comm_NewNode で作り、Comm_SelectNode で切り替えてから
+// Comm_SetTransport・Comm_Init を含む各 Comm_* を呼ぶ。コールバックは選択中の台の処理から呼ばれる。
+// 切り替えは Comm_* の呼び出しの外で行うこと（タスクを使う実機の1台とは併用しない）
+struct CommNode;
+CommNode* Comm_NewNode();
+void Comm_DeleteNode(CommNode* node);
+void Comm_SelectNode(CommNode* node);  // nullptr で端末自身の1台に戻す
+
+// 差し替えた無線から: 受信したフレームを渡す / 送信の結果を渡す（ESP-NOW のコールバック相当）。
+// Comm_InjectFrame は WiFiタスクの受信キューとは別のキュー（4フレーム）に積む。呼び出し元は1つのタスクだけにすること。
+// 満杯なら false（受信タスク/Comm_Poll が取り出した後に渡し直す）。
+// ESP-NOW のままでも記録の再生に使えるが、その間は Comm_SetReplayMode で実際の受信と送信を止める
+bool Comm_InjectFrame(const uint8_t mac[6], const uint8_t* data, size_t len, int rssi);
+void Comm_NotifySent(bool ok);
+
+// 記録の再生モード（既定は無効）。有効な間は実際に受信したフレームを捨て、何も送信しない
+// （再生したフレームに応えたビーコン・要求・データを電波に出さない）。プロトコルの処理はそのまま動く
+void Comm_SetReplayMode(bool enable);
+
+// 差し替えた無線で: 受信タスクと送信タスクの1回分をその場で実行する
+void Comm_Poll();
+
+// 完成メッセージのハンドラ登録（受信タスクがキューに積み、loop の Comm_Tick から呼ばれる）
 void Comm_SetOnMessage(CommOnMessageCB cb);
 
-// JSON文字列をブロードキャスト送信（必要に応じて分割）
+// 分割送信に XOR パリティを付ける（k データチャンクごとに1パリティ、3..8）。0 で無効（既定）
+void Comm_SetFecGroup(uint8_t k);
+
+// バイナリコンテンツのハンドラ登録（Comm_Tick から呼ばれる）
+void Comm_SetOnContent(CommOnContentCB cb);
+
+// 分割メッセージの途中経過ハンドラ登録（Comm_Tick から呼ばれる）。
+// data はコールバックの中だけ有効。loop が遅れた間の途中経過はまとめて最新の1回になる。
+// 最近通知済みの内容を広告している送信元からは呼ばれない
+void Comm_SetOnProgress(CommOnProgressCB cb);
+
+// ユニキャスト交換モード。有効にすると要求/NACK と要求への応答を相手に直接送り、
+// リンク層の ACK と再送を使う（相手は LRU で esp_now に登録）。ACK が無ければブロードキャストに戻す。
+// 発見（ビーコン）と複数台からの要求への応答は常にブロードキャスト
+void Comm_SetUnicastExchange(bool enable);
+
+// JSON文字列をブロードキャスト送信（必要に応じて分割）。送信キューに積むだけでブロックしない
 void Comm_SendJsonBroadcast(const String& json);
 
+// バイナリコンテンツを1フレームでブロードキャスト送信。COMM_CONTENT_MAX を超える場合は false
+bool Comm_SendContentBroadcast(uint8_t type, uint8_t flags, uint32_t hash,
+                               const uint8_t* payload, size_t len);
+
+// 自分のコンテンツを登録。以後 Comm_Tick() がハッシュだけをビーコンで広告し、
+// 持っていない相手から要求されたときだけ本体を送る。
+// json は旧ファーム向けの送信とハッシュ計算に使う。type=0 なら JSON のまま送る。
+void Comm_SetOwnContent(const String& json, uint8_t type, const uint8_t* payload, size_t len);
+
+// loop から呼ぶ: 受信したメッセージ/コンテンツ/途中経過のコールバック、
+// ビーコン送信、要求への応答、NACK された欠落チャンクの再送（自分のコンテンツがなくても呼ぶ）
+void Comm_Tick();
+
+// コンテンツ識別用ハッシュ（FNV-1a 32bit）
+uint32_t Comm_Hash32(const uint8_t* data, size_t len);
+
+// 同じハッシュの内容を再通知しない期間（既定 4000ms）。期間を過ぎても、近隣がその内容を広告している間は
+// 再通知しない（内容が変わるかタップするまで1回だけ）。重複は String を作る前に捨てる
+void Comm_SetDedupWindow(unsigned long ms);
+
+// ビーコンの間隔を Trickle で決めるか（既定は有効）。false にすると以前と同じ 1.0〜1.5 秒の固定間隔で、
+// 周りのビーコンを聞いても抑制しない（群れの大きさごとのエアタイムを比べるため）
+void Comm_SetTrickle(bool enable);
+
 
 
 // 受信許可する最小RSSIしきい値(dBm)。既定は -40。
+// 送信元ごとに平滑化した RSSI と比べる（1パケットの揺れでは切り替わらない）
 void Comm_SetMinRssiToAccept(int dbm);
+
+// しきい値の自動調整。近隣が多いほど上げ（混雑時は本当に近い相手だけ）、
+// 1台以下なら下げる（まばらな場所で取りこぼさない）。
+// 相手ごとに「受け入れ中」を持ち、実効しきい値 - hysteresisDb を下回るまで外さない
+struct CommRssiAdapt {
+  uint8_t hysteresisDb  = 4;   // 受け入れ → 拒否に戻るまでの余裕 [dB]
+  uint8_t freeNeighbors = 3;   // この台数までは基準のまま
+  uint8_t dbPerNeighbor = 2;   // それを超えた1台ごとに上げる [dB]
+  uint8_t maxRaiseDb    = 12;  // 上げ幅の上限 [dB]
+  uint8_t sparseRelaxDb = 5;   // 近隣1台以下のとき下げる [dB]
+};
+void Comm_SetRssiAdapt(const CommRssiAdapt& a);
+
+// 送信電力の制御。受信側でしきい値を使って捨てる代わりに、送信側で届く範囲を絞る。
+// adaptive: 受け入れ中の相手それぞれについて、ビーコンに載った相手の送信電力と受信 RSSI から
+// 経路損失を求め、相手に「相手のしきい値（ビーコンで広告）+ marginDb」で届く最小の電力でデータを送る
+// （経路損失が分からない相手がいる/相手がいないときは maxDbm）。ビーコンは beaconDbm で送る。
+// ビーコンにはデータの電力も載せ、受信側は近隣の RSSI をビーコンの電力へ換算して平滑化・タップ検出に使う。
+// 呼ばなければ電力は変更しない
+struct CommTxPower {
+  bool    adaptive  = true;
+  int8_t  maxDbm    = 20;  // 2..20
+  int8_t  minDbm    = 2;
+  int8_t  beaconDbm = 20;  // ビーコンと旧ファーム向けの全文送信
+  uint8_t marginDb  = 6;   // 相手の受信しきい値に上乗せする余裕
+};
+void Comm_SetTxPower(const CommTxPower& p);
+
+// 注目コンテンツ（主催者のお知らせ画像など）を多段中継で会場全体へ広げる。
+// origin（自分の MAC）+ hash で識別し、受け取った端末は最初の1回だけアプリへ渡して、
+// 中継が有効なら 20..200ms のランダムな待ちの後に TTL を1減らして送り直す（待っている間に
+// 同じものを2回聞いたら送らない）。中継フレームは RSSI しきい値に関係なく受け、ビーコンの電力で送る
+bool Comm_SendFeatured(uint8_t type, uint8_t flags, uint32_t hash,
+                       const uint8_t* payload, size_t len, uint8_t ttl);
+
+// 他の端末の注目コンテンツを中継するか（既定は無効。受け取って表示するのは常に行う）
+void Comm_SetRelay(bool enable);
+
+// スロット送信（既定は無効）。ビーコンで共有する 1 秒のスーパーフレームを 20ms の 50 スロットに分け、
+// ブロードキャストのデータは MAC のハッシュで決めた自分のスロットの間だけ送る。チャンク列はスロットの残りに
+// 収まるときだけ始め、始めたら途中で止めない。
+// 待っているブロードキャストは別の送信キュー（16 フレーム）に積むので、制御フレームとユニキャストは待たない。
+// スロットごとに聞こえた他者のデータを数え、自分のスロットが目立って混んでいれば空いたスロットへ確率的に移る
+void Comm_SetSlotting(bool enable);
+
+// 性能試験（Comm_Perf）用のフレーム。通常のフレームと同じ形式・送信キュー・受信経路を通り、
+// 中継と同じく RSSI しきい値に関係なく受ける。コールバックは受信タスクから呼ばれる
+using CommOnPerfCB = void (*)(const uint8_t mac[6], const uint8_t* data, size_t len);
+void Comm_SetOnPerf(CommOnPerfCB cb);
+// 送信キューへ積む。長すぎる/キューが満杯なら false
+bool Comm_SendPerf(const uint8_t dest[6], const uint8_t* data, size_t len);
+
+// 動作中に送信レートの方針を変える / 今の方針を得る（ADAPTIVE の段は開始段からやり直す）
+void Comm_SetRatePolicy(const CommRatePolicy& rate);
+CommRatePolicy Comm_GetRatePolicy();
+
+// 一時的に全フレームを rate（FIXED/LR）で送る（試験の間だけなど）。nullptr で元の方針へ戻る。
+// 上書き中も ADAPTIVE の段と到達率の記録はそのまま残り、上書き中の送信結果は数えない
+void Comm_SetRateOverride(const CommRatePolicy* rate);
+
+// 受信した生フレームを見るコールバック型（受信タスクから、RSSI での選別より前に呼ばれる）。
+// mac は送信元が分からなければ nullptr。ブロックしないこと（記録などはバッファへコピーするだけにする）
+using CommOnRawFrameCB = void (*)(unsigned long at, const uint8_t* mac, int rssi,
+                                  const uint8_t* data, size_t len);
+void Comm_SetOnRawFrame(CommOnRawFrameCB cb);
+
+// タップ（RSSI の急な立ち上がり → 安定）を検出したときのコールバック型（受信タスクから呼ばれる）
+using CommOnTapCB = void (*)(const uint8_t mac[6], int rssi);
+
+// タップ検出のパラメータ（既定は TapParams の初期値）
+void Comm_SetTapParams(const TapParams& p);
+
+// タップのハンドラ登録。検出時は次の定期広告を待たずにその相手と交換をやり直し、
+// 重複抑制の期間内でも相手の内容をもう一度通知する
+void Comm_SetOnTap(CommOnTapCB cb);
+
+// 近隣テーブルの1件（最近フレームを受け取った送信元）
+struct CommNeighbor {
+  uint8_t  mac[6];
+  int8_t   rssi;           // 平滑化した RSSI (dBm)
+  int8_t   lastRssi;       // 直近の生の RSSI（-128 = 不明）
+  uint32_t packets;        // 受信フレーム数
+  uint32_t lastHash;       // 直近に広告/送信されたコンテンツのハッシュ（0 = 不明）
+  unsigned long firstSeen; // millis()
+  unsigned long lastSeen;  // millis()
+  bool     accepted;       // しきい値を越えて受け入れ中
+  uint8_t  pathLoss;       // ビーコンから求めた経路損失 [dB]（0 = 不明）
+  uint8_t  caps;           // ビーコンで広告された COMM_CAP_*
+};
+
+// 生きている近隣を最大 max 件 out にコピーし、総数を返す（out = nullptr で数だけ）
+size_t Comm_GetNeighbors(CommNeighbor* out, size_t max);
+
+// 指定 MAC の近隣を取得。見つからなければ false
+bool Comm_GetNeighbor(const uint8_t mac[6], CommNeighbor& out);
+
+// 受信系の統計（キューあふれの確認用）
+struct CommStats {
+  uint32_t rxFrames;          // WiFiタスクで受け取ったフレーム数
+  uint32_t rxQueueDrops;      // キュー満杯で捨てたフレーム数
+  uint32_t rxBadFrames;       // 形式/長さ/CRC が合わず受信直後に捨てたフレーム数
+  uint16_t rxQueueDepth;      // 現在のキュー使用数
+  uint16_t rxQueueHighWater;  // キュー使用数の最大値
+  uint16_t rxQueueSlots;      // キューのスロット数
+  uint32_t rxChunkedCompleted; // 再構成できた分割メッセージ数
+  uint32_t rxChunkedEvicted;   // スロット不足で追い出した途中メッセージ数
+  uint32_t rxChunkedTimedOut;  // 期限切れで破棄した途中メッセージ数
+  uint32_t txBeacons;          // 送信したビーコン数
+  uint32_t txRequests;         // 送信した要求数
+  uint32_t txServed;           // 要求に応じてコンテンツを送った回数
+  uint32_t txLegacyFull;       // 旧ファーム向けに JSON 全体を送った回数
+  uint32_t txBeaconsSuppressed; // 周囲のビーコンが十分で送らなかった回数
+  uint32_t beaconIntervalMs;   // 現在の Trickle 区間長（固定間隔のときは 1000）
+  uint32_t rxNacksSent;        // 欠落チャンクの再送要求を送った回数
+  uint32_t rxNacksSuppressed;  // NACK を見送った回数（他の受信側の同じ NACK・パリティ付き・要求中・混雑・上限）
+  uint32_t rxChunkedLastMs;    // 直近の分割メッセージが完成するまでの時間
+  uint32_t rxFecRecovered;     // パリティから復元したチャンク数
+  uint16_t txQueueDepth;       // 送信キューの現在の使用数
+  uint16_t txQueueHighWater;   // 送信キュー使用数の最大値
+  uint32_t txQueueDrops;       // 送信キュー満杯で捨てたフレーム数
+  uint32_t txFrames;           // 送信したフレーム数
+  uint32_t txFailures;         // 送信失敗数
+  uint32_t txPacketsPerSec;    // 直近1秒の送信完了数
+  uint32_t txRetransmits;      // NACK に応じて再送したチャンク数
+  uint16_t neighbors;          // 近隣テーブルの生きているエントリ数
+  uint32_t rxRssiRejected;     // 平滑化 RSSI がしきい値未満で捨てたフレーム数
+  int16_t  rssiThreshold;      // 今の実効しきい値 (dBm)
+  uint16_t activeNeighbors;    // しきい値の調整に使った近隣数（直近 5 秒）
+  uint32_t rssiEnters;         // 拒否 → 受け入れ に変わった回数
+  uint32_t rssiExits;          // 受け入れ → 拒否 に変わった回数
+  uint32_t dedupHits;          // 重複として通知しなかった回数
+  uint32_t dedupMisses;        // 新しい内容としてアプリへ通知した回数
+  bool     unicastExchange;    // ユニキャスト交換モードか
+  uint32_t exchanges;          // 要求した内容を受け取れた回数
+  uint32_t exchangeLastMs;     // 直近の 要求 → 受信 の時間
+  uint32_t exchangeAvgMs;      // 同平均（EWMA）
+  uint32_t txUnicastAcked;     // ACK が返ったユニキャストフレーム数
+  uint32_t txUnicastRetries;   // ACK が無く送り直した回数
+  uint32_t txUnicastFallbacks; // ブロードキャストに切り替えたフレーム数
+  uint32_t peerEvictions;      // 枠が足りず esp_now から外した相手の数
+  uint32_t hsStarted;          // 初対面ハンドシェイクの開始数（開始側/応答側）
+  uint32_t hsCompleted;        // 双方の内容がそろったハンドシェイク数
+  uint32_t hsFailed;           // 期限切れで諦めたハンドシェイク数
+  uint32_t hsLastMs;           // 直近のハンドシェイク所要時間
+  uint32_t hsAvgMs;            // 同平均（EWMA）
+  uint32_t taps;               // 検出したタップ数
+  uint16_t txRateKbps;         // 今のユニキャストの送信レート [kbps]
+  uint32_t txRateUps;          // ADAPTIVE で上げた回数
+  uint32_t txRateDowns;        // ADAPTIVE で下げた回数
+  uint8_t  txRateDeliveryPct;  // 直近の判定窓でのユニキャスト到達率 [%]
+  int8_t   txPowerDataDbm;     // データの送信電力 [dBm]
+  int8_t   txPowerBeaconDbm;   // ビーコンの送信電力 [dBm]
+  uint32_t txPowerChanges;     // 送信電力を切り替えた回数
+  uint8_t  espNowVersion;      // 1 / 2（2 なら v2 の相手へ大きなフレームで送る）
+  uint32_t txLargeFrames;      // 分割せずに1フレームで送ったメッセージ数（v2）
+  uint32_t rxLargeFrames;      // 受け取った 250 バイト超のフレーム数
+  bool     slotting;           // スロット送信中か
+  uint8_t  slot;               // 自分のスロット
+  uint32_t slotWaits;          // スロットまで待たせたフレーム数
+  uint32_t slotBusy;           // 自分のスロット中に聞いた他者のデータ（衝突の目安）
+  uint32_t slotReslots;        // スロットを移った回数
+  uint32_t sfSyncs;            // ビーコンで時計を補正した回数
+  bool     relay;              // 中継が有効か
+  uint32_t relayReceived;      // 初めて受け取った注目コンテンツ数
+  uint32_t relayForwarded;     // 中継した数
+  uint32_t relaySuppressed;    // 周りが送ったので中継をやめた数
+  uint32_t relayDuplicates;    // 既読として捨てた数
+  uint32_t relayDropped;       // 再送待ちがいっぱいで中継できなかった数
+  uint8_t  relayLastHops;      // 直近に受け取った注目コンテンツのホップ数
+  uint32_t appDrops;           // loop が取り出す前に通知キュー（4件）があふれて捨てた通知数
+  uint32_t replayRxIgnored;    // 再生モード中に捨てた実際の受信フレーム数
+  uint32_t replayTxSuppressed; // 再生モード中に送らなかったフレーム数
+};
+void Comm_GetStats(CommStats& out);
@@ -0,0 +1,391 @@
+#include "Comm_Perf.h"
+#include <algorithm>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// === 設定 ===
+static const uint32_t PERF_TASK_STACK = 4096;
+static const UBaseType_t PERF_TASK_PRIO = 1;       // loopTask と同じ（受信/送信タスクの邪魔をしない）
+static const uint16_t PERF_RTT_MAX = 1024;         // RTT の標本数（超えたら reservoir で入れ替える）
+static const uint16_t PERF_PPS_MAX = 1000;
+static const unsigned long PERF_DRAIN_MS = 500;    // 送信後、遅れたフレームとエコーを待つ
+static const unsigned long PERF_END_RETRY_MS = 200;
+static const uint8_t PERF_END_TRIES = 5;
+
+static const uint8_t MAC_BC[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+// FRAME_PERF のペイロード
+enum PerfOp : uint8_t {
+  PERF_DATA   = 1,
+  PERF_ECHO   = 2,  // DATA のヘッダをそのまま返す
+  PERF_END    = 3,  // 送信元 → sink: 集計を返して
+  PERF_REPORT = 4,
+};
+static const uint8_t PERF_FLAG_UNICAST = 0x01;  // 応答も送信元へユニキャストで返す
+
+#pragma pack(push,1)
+struct PerfHdr {
+  uint8_t  op;
+  uint8_t  session;    // 試験ごとに変える（sink はこれが変わったら数え直す）
+  uint8_t  echoEvery;
+  uint8_t  flags;
+  uint32_t seq;
+  uint32_t sentUs;     // 送信元の micros()
+};
+struct PerfReport {
+  PerfHdr  h;
+  uint32_t received;
+  uint32_t bytes;
+  uint32_t spanUs;     // 最初と最後の受信の間
+  uint32_t jitterUs;
+  uint32_t outOfOrder;
+};
+#pragma pack(pop)
+static_assert(sizeof(PerfHdr) == 12, "PerfParams.size minimum is documented as 12");
+
+// 送信元（perf タスクと受信タスクが触る）
+static TaskHandle_t s_task = nullptr;
+static volatile bool s_running = false;
+static volatile bool s_stop = false;
+static PerfParams s_params;
+static uint8_t s_session = 0;
+static uint8_t s_txBuf[COMM_PERF_MAX_LARGE];
+static uint32_t s_rtt[PERF_RTT_MAX];
+static volatile uint32_t s_echoes = 0;
+static volatile bool s_reportGot = false;
+static PerfReport s_report;
+static PerfResult s_result{};
+
+// 受け側（受信タスクのみ）
+static bool s_sink = false;
+static bool s_hooked = false;
+static uint8_t s_sinkSession = 0;
+static uint32_t s_sinkReceived = 0;
+static uint32_t s_sinkBytes = 0;
+static uint32_t s_sinkFirstUs = 0;
+static uint32_t s_sinkLastUs = 0;
+static uint32_t s_sinkNextSeq = 0;
+static uint32_t s_sinkOutOfOrder = 0;
+static int32_t  s_sinkPrevTransit = 0;
+static uint32_t s_sinkJitterQ4 = 0;  // 1/16 us
+
+static const uint8_t* replyDest(const uint8_t* mac, const PerfHdr& h) {
+  return (h.flags & PERF_FLAG_UNICAST) ? mac : MAC_BC;
+}
+
+static void sinkOnData(const uint8_t* mac, const PerfHdr& h, size_t len) {
+  const uint32_t now = micros();
+  if (h.session != s_sinkSession || s_sinkReceived == 0) {
+    s_sinkSession = h.session;
+    s_sinkReceived = 0;
+    s_sinkBytes = 0;
+    s_sinkFirstUs = now;
+    s_sinkNextSeq = 0;
+    s_sinkOutOfOrder = 0;
+    s_sinkJitterQ4 = 0;
+    s_sinkPrevTransit = (int32_t)(now - h.sentUs);
+  }
+  s_sinkReceived++;
+  s_sinkBytes += len;
+  s_sinkLastUs = now;
+  if (h.seq < s_sinkNextSeq) s_sinkOutOfOrder++;
+  else s_sinkNextSeq = h.seq + 1;
+
+  // 到着間隔のジッタ: 時計のずれは差を取ると消える
+  const int32_t transit = (int32_t)(now - h.sentUs);
+  const uint32_t d = (uint32_t)abs(transit - s_sinkPrevTransit);
+  s_sinkPrevTransit = transit;
+  s_sinkJitterQ4 += d - ((s_sinkJitterQ4 + 8) >> 4);
+
+  if (h.echoEvery && h.seq % h.echoEvery == 0) {
+    PerfHdr e = h;
+    e.op = PERF_ECHO;
+    Comm_SendPerf(replyDest(mac, h), (const uint8_t*)&e, sizeof(e));
+  }
+}
+
+static void sinkOnEnd(const uint8_t* mac, const PerfHdr& h) {
+  PerfReport r{};
+  r.h = h;
+  r.h.op = PERF_REPORT;
+  if (h.session == s_sinkSession) {
+    r.received   = s_sinkReceived;
+    r.bytes      = s_sinkBytes;
+    r.spanUs     = s_sinkLastUs - s_sinkFirstUs;
+    r.jitterUs   = s_sinkJitterQ4 >> 4;
+    r.outOfOrder = s_sinkOutOfOrder;
+  }
+  Comm_SendPerf(replyDest(mac, h), (const uint8_t*)&r, sizeof(r));
+}
+
+// 受信タスクから
+static void onPerf(const uint8_t mac[6], const uint8_t* data, size_t len) {
+  if (len < sizeof(PerfHdr)) return;
+  PerfHdr h;
+  memcpy(&h, data, sizeof(h));
+
+  switch (h.op) {
+  case PERF_DATA:
+    if (s_sink) sinkOnData(mac, h, len);
+    break;
+  case PERF_END:
+    if (s_sink) sinkOnEnd(mac, h);
+    break;
+  case PERF_ECHO:
+    if (s_running && h.session == s_session) {
+      const uint32_t rtt = micros() - h.sentUs;
+      const uint32_t n = s_echoes;
+      if (n < PERF_RTT_MAX) {
+        s_rtt[n] = rtt;
+      } else {
+        const uint32_t j = esp_random() % (n + 1);
+        if (j < PERF_RTT_MAX) s_rtt[j] = rtt;
+      }
+      s_echoes = n + 1;
+    }
+    break;
+  case PERF_REPORT:
+    if (s_running && h.session == s_session && len >= sizeof(PerfReport) && !s_reportGot) {
+      memcpy(&s_report, data, sizeof(s_report));
+      s_reportGot = true;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void hook() {
+  if (s_hooked) return;
+  Comm_SetOnPerf(onPerf);
+  s_hooked = true;
+}
+
+static uint32_t percentile(const uint32_t* sorted, uint32_t n, uint32_t pct) {
+  if (n == 0) return 0;
+  return sorted[min(n - 1, (n * pct + 99) / 100 - 1)];
+}
+
+static void printResult(const PerfResult& r) {
+  Serial.printf("[PERF] sent %lu (not queued %lu), received %lu, loss %lu.%lu%%, out of order %lu, throughput %lu kbps\n",
+                (unsigned long)r.sent, (unsigned long)r.notQueued, (unsigned long)r.received,
+                (unsigned long)(r.lossPermille / 10), (unsigned long)(r.lossPermille % 10),
+                (unsigned long)r.outOfOrder, (unsigned long)r.throughputKbps);
+  Serial.printf("[PERF] RTT p50 %lu us, p90 %lu us, p99 %lu us, max %lu us (%lu echoes), jitter %lu us%s\n",
+                (unsigned long)r.rttP50Us, (unsigned long)r.rttP90Us, (unsigned long)r.rttP99Us,
+                (unsigned long)r.rttMaxUs, (unsigned long)r.echoes, (unsigned long)r.jitterUs,
+                r.reported ? "" : " (no report from sink)");
+}
+
+// 送信元タスク: 一定間隔で送り、終わったら sink の集計を受け取って結果をまとめる
+static void perfTaskMain(void*) {
+  const PerfParams p = s_params;
+  const bool unicast = memcmp(p.dest, MAC_BC, 6) != 0;
+  if (p.rate.mode != COMM_RATE_DEFAULT) Comm_SetRateOverride(&p.rate); // ADAPTIVE の段は保ったまま
+
+  for (size_t i = sizeof(PerfHdr); i < p.size; i++) s_txBuf[i] = (uint8_t)i;
+  PerfHdr h{};
+  h.op = PERF_DATA;
+  h.session = s_session;
+  h.echoEvery = p.echoEvery;
+  h.flags = unicast ? PERF_FLAG_UNICAST : 0;
+
+  uint32_t sent = 0, notQueued = 0;
+  const uint32_t intervalUs = 1000000UL / p.pps;
+  const uint32_t tickUs = portTICK_PERIOD_MS * 1000UL;
+  const uint32_t durationUs = (uint32_t)p.seconds * 1000000UL;
+  const uint32_t t0 = micros();
+  uint32_t next = t0;
+  while (!s_stop && micros() - t0 < durationUs) {
+    h.sentUs = micros();
+    memcpy(s_txBuf, &h, sizeof(h));
+    if (Comm_SendPerf(p.dest, s_txBuf, p.size)) sent++;
+    else notQueued++;
+    h.seq++;
+
+    next += intervalUs;
+    const int32_t wait = (int32_t)(next - micros());
+    if (wait < -1000000) {
+      next = micros(); // 1秒以上遅れたら追いかけない
+      continue;
+    }
+    // tick 単位で待てる分はブロックし、端数は譲りながら待つ（tick に満たない待ちで
+    // そのまま送ると pps を超える）
+    if (wait >= (int32_t)tickUs) vTaskDelay(wait / tickUs);
+    while (!s_stop && (int32_t)(next - micros()) > 0) taskYIELD();
+  }
+
+  vTaskDelay(pdMS_TO_TICKS(PERF_DRAIN_MS));
+  h.op = PERF_END;
+  for (uint8_t i = 0; i < PERF_END_TRIES && !s_reportGot && !s_stop; i++) {
+    Comm_SendPerf(p.dest, (const uint8_t*)&h, sizeof(h));
+    vTaskDelay(pdMS_TO_TICKS(PERF_END_RETRY_MS));
+  }
+  if (p.rate.mode != COMM_RATE_DEFAULT) Comm_SetRateOverride(nullptr);
+
+  PerfResult r{};
+  r.valid = true;
+  r.reported = s_reportGot;
+  r.sent = sent;
+  r.notQueued = notQueued;
+  if (r.reported) {
+    r.received = s_report.received;
+    r.outOfOrder = s_report.outOfOrder;
+    r.jitterUs = s_report.jitterUs;
+    if (s_report.spanUs > 0) r.throughputKbps = (uint32_t)((uint64_t)s_report.bytes * 8000ULL / s_report.spanUs);
+  }
+  if (sent > 0) r.lossPermille = sent > r.received ? (uint32_t)((uint64_t)(sent - r.received) * 1000 / sent) : 0;
+
+  // ここから先はエコーを数えない（s_running を下ろす前に件数を固定する）
+  s_running = false;
+  r.echoes = s_echoes;
+  const uint32_t n = min(r.echoes, (uint32_t)PERF_RTT_MAX);
+  std::sort(s_rtt, s_rtt + n);
+  r.rttP50Us = percentile(s_rtt, n, 50);
+  r.rttP90Us = percentile(s_rtt, n, 90);
+  r.rttP99Us = percentile(s_rtt, n, 99);
+  r.rttMaxUs = n ? s_rtt[n - 1] : 0;
+  s_result = r;
+  printResult(r);
+
+  s_task = nullptr;
+  vTaskDelete(nullptr);
+}
+
+bool Perf_Start(const PerfParams& p) {
+  if (s_running) return false;
+  const size_t maxSize = memcmp(p.dest, MAC_BC, 6) != 0 ? COMM_PERF_MAX_LARGE : COMM_PERF_MAX;
+  if (p.size < sizeof(PerfHdr) || p.size > maxSize || p.pps == 0 || p.pps > PERF_PPS_MAX || p.seconds == 0) {
+    return false;
+  }
+  hook();
+  s_params = p;
+  s_session++;
+  s_echoes = 0;
+  s_reportGot = false;
+  s_stop = false;
+  s_running = true;
+  if (xTaskCreatePinnedToCore(perfTaskMain, "perf", PERF_TASK_STACK, nullptr,
+                              PERF_TASK_PRIO, &s_task, ARDUINO_RUNNING_CORE) != pdPASS) {
+    s_running = false;
+    return false;
+  }
+  return true;
+}
+
+void Perf_Stop() {
+  s_stop = true;
+}
+
+bool Perf_IsRunning() {
+  return s_running;
+}
+
+bool Perf_GetResult(PerfResult& out) {
+  if (s_running || !s_result.valid) return false;
+  out = s_result;
+  return true;
+}
+
+void Perf_SetSink(bool enable) {
+  hook();
+  s_sink = enable;
+}
+
+static bool parseRate(const String& s, CommRatePolicy& out) {
+  static const struct { const char* name; wifi_phy_rate_t rate; } RATES[] = {
+    {"1", WIFI_PHY_RATE_1M_L},  {"2", WIFI_PHY_RATE_2M_L},  {"5.5", WIFI_PHY_RATE_5M_L},
+    {"11", WIFI_PHY_RATE_11M_L}, {"6", WIFI_PHY_RATE_6M},   {"9", WIFI_PHY_RATE_9M},
+    {"12", WIFI_PHY_RATE_12M},  {"18", WIFI_PHY_RATE_18M},  {"24", WIFI_PHY_RATE_24M},
+    {"36", WIFI_PHY_RATE_36M},  {"48", WIFI_PHY_RATE_48M},  {"54", WIFI_PHY_RATE_54M},
+  };
+  if (s == "lr") {
+    out.mode = COMM_RATE_LR;
+    return true;
+  }
+  for (const auto& r : RATES) {
+    if (s == r.name) {
+      out.mode = COMM_RATE_FIXED;
+      out.rate = r.rate;
+      return true;
+    }
+  }
+  return false;
+}
+
+// RSSI の最も強い近隣
+static bool nearestNeighbor(uint8_t mac[6]) {
+  CommNeighbor nb[16];
+  const size_t n = Comm_GetNeighbors(nb, 16);
+  int best = -1;
+  for (size_t i = 0; i < n; i++) {
+    if (best < 0 || nb[i].rssi > nb[best].rssi) best = (int)i;
+  }
+  if (best < 0) return false;
+  memcpy(mac, nb[best].mac, 6);
+  return true;
+}
+
+static bool parseDest(const String& s, uint8_t mac[6]) {
+  if (s == "bc") {
+    memcpy(mac, MAC_BC, 6);
+    return true;
+  }
+  if (s == "uc") return nearestNeighbor(mac);
+  unsigned int b[6];
+  if (sscanf(s.c_str(), "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6) return false;
+  for (int i = 0; i < 6; i++) mac[i] = (uint8_t)b[i];
+  return true;
+}
+
+// 空白区切りの i 番目（0 始まり）
+static String argAt(const String& line, int i) {
+  int start = 0;
+  for (;;) {
+    while (start < (int)line.length() && line[start] == ' ') start++;
+    int end = line.indexOf(' ', (unsigned int)start);
+    if (end < 0) end = line.length();
+    if (i-- == 0) return line.substring(start, end);
+    if (end >= (int)line.length()) return String();
+    start = end;
+  }
+}
+
+bool Perf_HandleCommand(const String& line) {
+  if (!line.startsWith("perf")) return false;
+  const String cmd = argAt(line, 1);
+
+  if (cmd == "sink") {
+    Perf_SetSink(argAt(line, 2) != "off");
+    Serial.printf("[PERF] Sink %s\n", s_sink ? "on" : "off");
+  } else if (cmd == "run") {
+    PerfParams p;
+    if (!parseDest(argAt(line, 2), p.dest)) {
+      Serial.println("[PERF] Usage: perf run <bc|uc|MAC> [size] [pps] [sec] [rate] [echoEvery]");
+      return true;
+    }
+    String v;
+    if ((v = argAt(line, 3)).length()) p.size = (uint16_t)v.toInt();
+    if ((v = argAt(line, 4)).length()) p.pps = (uint16_t)v.toInt();
+    if ((v = argAt(line, 5)).length()) p.seconds = (uint16_t)v.toInt();
+    if ((v = argAt(line, 6)).length() && !parseRate(v, p.rate)) {
+      Serial.printf("[PERF] Unknown rate: %s\n", v.c_str());
+      return true;
+    }
+    if ((v = argAt(line, 7)).length()) p.echoEvery = (uint8_t)v.toInt();
+    const bool ok = Perf_Start(p);
+    Serial.printf("[PERF] %s %02X:%02X:%02X:%02X:%02X:%02X %u B x %u pkt/s x %u s: %s\n",
+                  memcmp(p.dest, MAC_BC, 6) ? "Unicast" : "Broadcast",
+                  p.dest[0], p.dest[1], p.dest[2], p.dest[3], p.dest[4], p.dest[5],
+                  p.size, p.pps, p.seconds, ok ? "started" : "FAILED");
+  } else if (cmd == "stop") {
+    const bool running = s_running;
+    Perf_Stop();
+    Serial.println(running ? "[PERF] Stopping (result follows)" : "[PERF] Not running");
+  } else {
+    PerfResult r;
+    if (Perf_GetResult(r)) printResult(r);
+    else Serial.println(s_running ? "[PERF] Running" : "[PERF] No result");
+  }
+  return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <Arduino.h>
+#include "Comm_EspNow.h"
+
+// ========== ESP-NOW の性能試験（iperf 風） ==========
+// 送信元が FRAME_PERF を一定の間隔で送り、受け側（sink）が数えて一部をエコーする。
+// 通常のフレームと同じ形式・送信キュー・受信タスクを通るので、実際の経路での数字になる。
+// 終了後、送信元が sink の集計を受け取り、スループット・損失・RTT のパーセンタイル・ジッタを出す。
+// ブロードキャスト試験では範囲内の sink がすべて応答するので、sink は1台だけにする。
+
+struct PerfParams {
+  uint8_t  dest[6];            // 相手の MAC（FF:FF:FF:FF:FF:FF でブロードキャスト）
+  uint16_t size      = 100;    // 1フレームのペイロード [B]（12..COMM_PERF_MAX、v2 の相手なら COMM_PERF_MAX_LARGE まで）
+  uint16_t pps       = 50;     // 送信頻度 [フレーム/s]（1..1000、1ms 単位で送る）
+  uint16_t seconds   = 10;     // 送信する時間 [s]
+  uint8_t  echoEvery = 1;      // sink が N フレームごとにエコー（RTT 用。0 でエコーなし）
+  CommRatePolicy rate;         // 試験中の送信レート（COMM_RATE_DEFAULT なら今の設定のまま）
+};
+
+struct PerfResult {
+  bool     valid;              // 1回以上完了した
+  bool     reported;           // sink の集計を受け取れた
+  uint32_t sent;               // 送信キューへ積めた数
+  uint32_t notQueued;          // 積めなかった数（キューが満杯、または相手が大きなフレームを受けない）
+  uint32_t received;           // sink が受けた数
+  uint32_t outOfOrder;         // sink で順番が逆になった数
+  uint32_t lossPermille;       // (sent - received) / sent [‰]
+  uint32_t throughputKbps;     // sink の最初と最後の受信の間の実効スループット
+  uint32_t echoes;             // 受け取ったエコー数
+  uint32_t rttP50Us, rttP90Us, rttP99Us, rttMaxUs;
+  uint32_t jitterUs;           // sink で測った到着間隔のジッタ（RFC 3550 の式）
+};
+
+// 送信元として試験を始める（別タスクで動き、終わると Serial に結果を出す）。実行中なら false
+bool Perf_Start(const PerfParams& p);
+void Perf_Stop();
+bool Perf_IsRunning();
+bool Perf_GetResult(PerfResult& out);
+
+// 受け側として応答するか（既定は無効）
+void Perf_SetSink(bool enable);
+
+// Serial コマンド:
+//   "perf sink on|off"
+//   "perf run <bc|uc|MAC> [size] [pps] [sec] [rate] [echoEvery]"
+//       uc = RSSI の最も強い近隣へユニキャスト、rate = 1/2/5.5/11/6/9/12/18/24/36/48/54/lr（Mbps）
+//   "perf stop" / "perf"（前回の結果）
+// "perf" で始まらなければ false
+bool Perf_HandleCommand(const String& line);
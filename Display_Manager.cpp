@@ -117,6 +117,21 @@ bool ShowRGB_Animated(const uint8_t* rgb, size_t n, unsigned long display_ms) {
   return true;
 }
 
+void DrawRGBRange(const uint8_t* rgb, size_t fromPixel, size_t toPixel) {
+  if (!rgb) return;
+  if (toPixel > (size_t)(DISP_W * DISP_H)) toPixel = DISP_W * DISP_H;
+  if (fromPixel >= toPixel) return;
+
+  s_matrix.setRotation(3);
+  s_matrix.setBrightness(GLOBAL_BRIGHTNESS);
+
+  for (size_t p = fromPixel; p < toPixel; ++p) {
+    size_t i = p * 3;
+    s_matrix.drawPixel(p % DISP_W, p / DISP_W, s_matrix.Color(rgb[i + 1], rgb[i], rgb[i + 2]));
+  }
+  s_matrix.show();
+}
+
 // ========== 公開API：表示状態管理 ==========
 bool IsActive() {
   return (s_until_ms != 0) && (millis() < s_until_ms);
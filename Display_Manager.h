@@ -33,6 +33,7 @@ namespace DisplayManager {
   void AllOn(uint8_t r, uint8_t g, uint8_t b);
   bool ShowRGB(const uint8_t* rgb, size_t n, unsigned long display_ms);
   bool ShowRGB_Animated(const uint8_t* rgb, size_t n, unsigned long display_ms); // アニメーション付き
+  void DrawRGBRange(const uint8_t* rgb, size_t fromPixel, size_t toPixel); // 受信途中の画像を追記描画（ガードは変更しない）
 
   // 全点灯
   void AllOnGreen(uint8_t brightness);
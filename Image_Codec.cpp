@@ -0,0 +1,140 @@
+#include "Image_Codec.h"
+#include <string.h>
+
+namespace {
+    static constexpr size_t kMaxPalette = IMAGE_CODEC_PIXELS;
+
+    struct Indexed {
+        uint8_t palette[kMaxPalette * 3];
+        uint8_t index[IMAGE_CODEC_PIXELS];
+        size_t colors;
+    };
+
+    // 画素を色番号へ変換（出現順にパレットへ登録）
+    static void buildPalette(const uint8_t* rgb, Indexed& ix) {
+        ix.colors = 0;
+        for (size_t p = 0; p < IMAGE_CODEC_PIXELS; p++) {
+            const uint8_t* c = rgb + p * 3;
+            size_t k = 0;
+            while (k < ix.colors && memcmp(ix.palette + k * 3, c, 3) != 0) k++;
+            if (k == ix.colors) {
+                memcpy(ix.palette + k * 3, c, 3);
+                ix.colors++;
+            }
+            ix.index[p] = (uint8_t)k;
+        }
+    }
+
+    // 最大長 maxRun で区切ったときのラン数
+    static size_t countRuns(const Indexed& ix, size_t maxRun) {
+        size_t runs = 0;
+        size_t p = 0;
+        while (p < IMAGE_CODEC_PIXELS) {
+            size_t r = 1;
+            while (p + r < IMAGE_CODEC_PIXELS && r < maxRun && ix.index[p + r] == ix.index[p]) r++;
+            p += r;
+            runs++;
+        }
+        return runs;
+    }
+
+    static size_t writePalette(const Indexed& ix, uint8_t mode, uint8_t* out) {
+        out[0] = mode;
+        out[1] = (uint8_t)ix.colors;
+        memcpy(out + 2, ix.palette, ix.colors * 3);
+        return 2 + ix.colors * 3;
+    }
+
+    static bool readPalette(const uint8_t* in, size_t len, size_t maxColors,
+                            const uint8_t*& palette, size_t& colors, size_t& pos) {
+        if (len < 2) return false;
+        colors = in[1];
+        if (colors == 0 || colors > maxColors) return false;
+        pos = 2 + colors * 3;
+        if (pos > len) return false;
+        palette = in + 2;
+        return true;
+    }
+
+    static bool fillRun(uint8_t* rgb, size_t& p, const uint8_t* palette, size_t colors,
+                        size_t idx, size_t run) {
+        if (idx >= colors || p + run > IMAGE_CODEC_PIXELS) return false;
+        for (size_t i = 0; i < run; i++, p++) memcpy(rgb + p * 3, palette + idx * 3, 3);
+        return true;
+    }
+}
+
+size_t ImageCodec_Encode(const uint8_t* rgb, size_t n, uint8_t* out, size_t cap) {
+    if (!rgb || !out || n != IMAGE_CODEC_RGB_BYTES) return 0;
+
+    Indexed ix;
+    buildPalette(rgb, ix);
+
+    const size_t rawSize = 1 + IMAGE_CODEC_RGB_BYTES;
+    const size_t pal4Size = (ix.colors <= 16) ? 2 + ix.colors * 3 + countRuns(ix, 16) : SIZE_MAX;
+    const size_t pal8Size = 2 + ix.colors * 3 + countRuns(ix, 64) * 2;
+
+    if (pal4Size < rawSize && pal4Size <= pal8Size) {
+        if (pal4Size > cap) return 0;
+        size_t o = writePalette(ix, IMAGE_CODEC_PAL4_RLE, out);
+        size_t p = 0;
+        while (p < IMAGE_CODEC_PIXELS) {
+            size_t r = 1;
+            while (p + r < IMAGE_CODEC_PIXELS && r < 16 && ix.index[p + r] == ix.index[p]) r++;
+            out[o++] = (uint8_t)(((r - 1) << 4) | ix.index[p]);
+            p += r;
+        }
+        return o;
+    }
+
+    if (pal8Size < rawSize) {
+        if (pal8Size > cap) return 0;
+        size_t o = writePalette(ix, IMAGE_CODEC_PAL8_RLE, out);
+        size_t p = 0;
+        while (p < IMAGE_CODEC_PIXELS) {
+            size_t r = 1;
+            while (p + r < IMAGE_CODEC_PIXELS && r < 64 && ix.index[p + r] == ix.index[p]) r++;
+            out[o++] = ix.index[p];
+            out[o++] = (uint8_t)(r - 1);
+            p += r;
+        }
+        return o;
+    }
+
+    if (rawSize > cap) return 0;
+    out[0] = IMAGE_CODEC_RAW;
+    memcpy(out + 1, rgb, IMAGE_CODEC_RGB_BYTES);
+    return rawSize;
+}
+
+bool ImageCodec_Decode(const uint8_t* in, size_t len, uint8_t* rgb) {
+    if (!in || !rgb || len < 1) return false;
+
+    const uint8_t* palette = nullptr;
+    size_t colors = 0, pos = 0, p = 0;
+
+    switch (in[0]) {
+    case IMAGE_CODEC_RAW:
+        if (len != 1 + IMAGE_CODEC_RGB_BYTES) return false;
+        memcpy(rgb, in + 1, IMAGE_CODEC_RGB_BYTES);
+        return true;
+
+    case IMAGE_CODEC_PAL4_RLE:
+        if (!readPalette(in, len, 16, palette, colors, pos)) return false;
+        for (; pos < len; pos++) {
+            if (!fillRun(rgb, p, palette, colors, in[pos] & 0x0F, (in[pos] >> 4) + 1)) return false;
+        }
+        return p == IMAGE_CODEC_PIXELS;
+
+    case IMAGE_CODEC_PAL8_RLE:
+        if (!readPalette(in, len, kMaxPalette, palette, colors, pos)) return false;
+        if ((len - pos) % 2 != 0) return false;
+        for (; pos < len; pos += 2) {
+            if (!fillRun(rgb, p, palette, colors, in[pos], (size_t)in[pos + 1] + 1)) return false;
+        }
+        return p == IMAGE_CODEC_PIXELS;
+
+    default:
+        return false;
+    }
+}
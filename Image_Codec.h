@@ -0,0 +1,31 @@
+#ifndef IMAGE_CODEC_H_
+#define IMAGE_CODEC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ========== 8x8 RGB 画像の圧縮コーデック ==========
+// パレット + ランレングスで符号化し、生データより大きくなる場合は生データのまま格納する。
+// 先頭1バイトがモード:
+//   IMAGE_CODEC_RAW      : RGB 192バイトがそのまま続く
+//   IMAGE_CODEC_PAL4_RLE : 色数P(1..16), パレット P*3, ラン列 [(長さ-1)<<4 | 色番号] (長さ 1..16)
+//   IMAGE_CODEC_PAL8_RLE : 色数P(1..64), パレット P*3, ラン列 [色番号, 長さ-1]     (長さ 1..64)
+// デコードは固定長バッファへ直接書き込み、ヒープは使わない。
+
+static const size_t IMAGE_CODEC_PIXELS    = 8 * 8;                  // DISP_W * DISP_H
+static const size_t IMAGE_CODEC_RGB_BYTES = IMAGE_CODEC_PIXELS * 3;  // 192
+static const size_t IMAGE_CODEC_MAX_BYTES = 1 + IMAGE_CODEC_RGB_BYTES; // 最悪ケース（RAW）
+
+enum ImageCodecMode : uint8_t {
+  IMAGE_CODEC_RAW      = 0,
+  IMAGE_CODEC_PAL4_RLE = 1,
+  IMAGE_CODEC_PAL8_RLE = 2,
+};
+
+// rgb(IMAGE_CODEC_RGB_BYTES) を符号化して out に書く。戻り値は書いたバイト数（失敗時 0）
+size_t ImageCodec_Encode(const uint8_t* rgb, size_t n, uint8_t* out, size_t cap);
+
+// 符号化データを rgb(IMAGE_CODEC_RGB_BYTES) に復元。不正データなら false
+bool ImageCodec_Decode(const uint8_t* in, size_t len, uint8_t* rgb);
+
+#endif // IMAGE_CODEC_H_
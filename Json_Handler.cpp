@@ -92,7 +92,7 @@ bool saveJsonToPath(const char* path, const String& jsonString) {
     return written == jsonString.length();
 }
 
-bool loadDisplayFromJsonString(const String& jsonString) {
+bool parseDisplayJson(const String& jsonString, String& flag, String& text, std::vector<uint8_t>& rgb) {
     if (jsonString.isEmpty()) return false;
     StaticJsonDocument<2048> doc;
     DeserializationError err = deserializeJson(doc, jsonString);
@@ -100,28 +100,71 @@ bool loadDisplayFromJsonString(const String& jsonString) {
     JsonObject obj = doc.as<JsonObject>();
     if (!obj) return false;
 
-    displayFlag = obj["flag"] | "";
+    flag = obj["flag"] | "";
 
-    if (displayFlag == "text") {
-        displayText = obj["text"] | "";
-        rgbData.clear();
+    if (flag == "text") {
+        text = obj["text"] | "";
+        rgb.clear();
         return true;
-    } else if (displayFlag == "image" || displayFlag == "emoji") {
-        displayText.clear();
-        rgbData.clear();
+    } else if (flag == "image" || flag == "emoji") {
+        text.clear();
+        rgb.clear();
         JsonArray arr = obj["rgb"];
         if (!arr.isNull()) {
-            for (auto v : arr) rgbData.push_back((uint8_t)v.as<int>());
+            rgb.reserve(arr.size());
+            for (auto v : arr) rgb.push_back((uint8_t)v.as<int>());
         }
         return true;
     } else {
         // 未知のフラグ
-        displayText.clear();
-        rgbData.clear();
+        text.clear();
+        rgb.clear();
         return false;
     }
 }
 
+bool loadDisplayFromJsonString(const String& jsonString) {
+    return parseDisplayJson(jsonString, displayFlag, displayText, rgbData);
+}
+
+bool loadDisplayFromRgb(const uint8_t* rgb, size_t n) {
+    if (!rgb || n < (size_t)(DISP_W * DISP_H * 3)) return false;
+    displayFlag = "image";
+    displayText.clear();
+    rgbData.assign(rgb, rgb + n);
+    return true;
+}
+
+bool loadDisplayFromText(const char* text, size_t n) {
+    if (!text || n == 0) return false;
+    displayFlag = "text";
+    displayText = String(text, n);
+    rgbData.clear();
+    return true;
+}
+
+String displayToJsonString() {
+    String out;
+    if (displayFlag == "text") {
+        StaticJsonDocument<JSON_OBJECT_SIZE(2)> doc;
+        doc["flag"] = "text";
+        doc["text"] = displayText.c_str();
+        serializeJson(doc, out);
+        return out;
+    }
+    // 画像は数値の羅列なので直接組み立てる（192要素のドキュメントを作らない）
+    out.reserve(32 + rgbData.size() * 4);
+    out += "{\"flag\":\"";
+    out += displayFlag;
+    out += "\",\"rgb\":[";
+    for (size_t i = 0; i < rgbData.size(); i++) {
+        if (i) out += ',';
+        out += (unsigned)rgbData[i];
+    }
+    out += "]}";
+    return out;
+}
+
 String loadJsonFromPath(const char* path, size_t maxBytes) {
     if (!LittleFS.begin(false)) LittleFS.begin(true);
     if (!LittleFS.exists(path)) return String();
@@ -134,6 +177,39 @@ String loadJsonFromPath(const char* path, size_t maxBytes) {
     return s;
 }
 
+void rgbStreamReset(RgbStreamDecoder& d) {
+    d.pos = 0;
+    d.state = 0;
+    d.match = 0;
+    d.value = -1;
+    d.count = 0;
+}
+
+size_t rgbStreamFeed(RgbStreamDecoder& d, const uint8_t* json, size_t len) {
+    static const char kKey[] = "\"rgb\"";
+    for (; d.pos < len && d.state != 3; d.pos++) {
+        const char c = (char)json[d.pos];
+        if (d.state == 0) {
+            if (c == kKey[d.match]) d.match++;
+            else d.match = (c == kKey[0]) ? 1 : 0;
+            if (d.match == sizeof(kKey) - 1) d.state = 1;
+        } else if (d.state == 1) {
+            if (c == '[') d.state = 2;
+            else if (c != ':' && c != ' ' && c != '\n' && c != '\r' && c != '\t') { d.state = 0; d.match = 0; }
+        } else {
+            if (c >= '0' && c <= '9') {
+                if (d.value < 0) d.value = 0;
+                if (d.value < 1000) d.value = d.value * 10 + (c - '0');
+                continue;
+            }
+            if (d.value >= 0 && d.count < sizeof(d.rgb)) d.rgb[d.count++] = (uint8_t)min(d.value, 255);
+            d.value = -1;
+            if (c == ']' || d.count >= sizeof(d.rgb)) d.state = 3;
+        }
+    }
+    return d.count / 3;
+}
+
 bool performDisplay(bool animate, unsigned long display_ms, bool textLoop) {
     String flag = displayFlag;
     if (flag.isEmpty()) return false;
@@ -5,6 +5,7 @@
 #include <LittleFS.h>
 #include <ArduinoJson.h>
 #include <vector>
+#include "Display_Manager.h"
 
 // ========== 受信インボックス（RAMリングバッファ） ==========
 // 直近N件だけRAMに保持（フラッシュ書き込み寿命に影響しない）
@@ -36,7 +37,28 @@ extern std::vector<uint8_t> rgbData;
 bool loadDisplayFromLittleFS(const char* path = "/data.json");
 bool saveJsonToPath(const char* path, const String& jsonString);
 bool loadDisplayFromJsonString(const String& jsonString);
+// 表示データを変更せずにJSONを解析（送信用バイナリ作成など）
+bool parseDisplayJson(const String& jsonString, String& flag, String& text, std::vector<uint8_t>& rgb);
+// バイナリ受信したRGB/テキストをそのまま表示データへ反映（JSONパースなし）
+bool loadDisplayFromRgb(const uint8_t* rgb, size_t n);
+bool loadDisplayFromText(const char* text, size_t n);
+// 現在の表示データをJSON文字列化（インボックス保存用）
+String displayToJsonString();
 String loadJsonFromPath(const char* path, size_t maxBytes = 2048);
 bool performDisplay(bool animate = false, unsigned long display_ms = 3000, bool textLoop = true);
 
+// ========== 受信途中のJSONから "rgb" 配列を逐次取り出す ==========
+// ArduinoJson は完成した文書しか読めないので、届いた分だけ数値を拾う小さな状態機械
+struct RgbStreamDecoder {
+	size_t pos;      // 次に読む位置
+	uint8_t state;   // 0: キー探索 / 1: '[' 待ち / 2: 配列内 / 3: 終了
+	uint8_t match;   // "\"rgb\"" と一致した文字数
+	int value;       // 読み途中の数値（-1 = なし）
+	size_t count;    // 取り出したバイト数
+	uint8_t rgb[DISP_W * DISP_H * 3];
+};
+void rgbStreamReset(RgbStreamDecoder& d);
+// json の先頭 len バイトのうち未読の部分を読み進め、揃ったピクセル数を返す
+size_t rgbStreamFeed(RgbStreamDecoder& d, const uint8_t* json, size_t len);
+
 #endif // JSON_HANDLER_H_
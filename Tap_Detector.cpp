@@ -0,0 +1,55 @@
+#include "Tap_Detector.h"
+
+namespace {
+    static constexpr unsigned long kMaxGapMs = 10000;  // これ以上空いたら基準を揃え直す
+}
+
+void TapDetector_Reset(TapDetector& d, int rssi, unsigned long now) {
+    d.fastQ4 = (int16_t)(rssi * 16);
+    d.baseQ4 = d.fastQ4;
+    d.phase = 0;
+    d.lastAt = now;
+    d.phaseAt = 0;
+    d.firedAt = 0;
+}
+
+bool TapDetector_Update(TapDetector& d, const TapParams& p, int rssi, unsigned long now) {
+    const unsigned long dt = now - d.lastAt;
+    d.lastAt = now;
+
+    // 間隔が空きすぎたら傾きは分からないので、速い EWMA も基準も今の値から始め直す
+    // （EWMA を途中まで寄せただけだと、残りの追いつきが次のサンプルで立ち上がりに見える）
+    if (dt > kMaxGapMs) {
+        d.fastQ4 = (int16_t)(rssi * 16);
+        d.baseQ4 = d.fastQ4;
+        d.phase = 0;
+        return false;
+    }
+    d.fastQ4 = (int16_t)(d.fastQ4 + ((rssi * 16 - d.fastQ4) >> 1));
+
+    int32_t base = d.baseQ4 + (int32_t)p.leakDbPerSec * 16 * (int32_t)dt / 1000;
+    if (base > d.fastQ4) base = d.fastQ4;
+    d.baseQ4 = (int16_t)base;
+
+    const bool above = d.fastQ4 >= p.plateauDbm * 16;
+    if (d.phase == 0) {
+        if (above && d.fastQ4 - d.baseQ4 >= p.riseDb * 16) {
+            d.phase = 1;
+            d.phaseAt = now;
+        }
+        return false;
+    }
+
+    if (!above) {
+        d.phase = 0;
+        return false;
+    }
+    if (now - d.phaseAt < p.plateauMs) return false;
+
+    // 同じ接近で何度も出さないよう基準を今の値へ揃える
+    d.phase = 0;
+    d.baseQ4 = d.fastQ4;
+    if (d.firedAt != 0 && now - d.firedAt < p.cooldownMs) return false;
+    d.firedAt = now | 1;
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef TAP_DETECTOR_H_
+#define TAP_DETECTOR_H_
+
+#include <stdint.h>
+
+// ========== RSSI の「タップ」（急接近）検出 ==========
+// 相手ごとの RSSI 列から「急な立ち上がり → しきい値以上で安定」を見つける。
+// - fast: 受信ごとの速い EWMA（1/16 dB 固定小数）
+// - base: 下がるときは即追従、上がるときは leakDbPerSec でしか追いつかない基準
+// fast - base が riseDb を超えたら「急接近」。ゆっくり近づいた場合は base が追いつくので出ない。
+// その後 plateauMs の間 plateauDbm 以上を保てばタップとして1回だけ true を返す。
+// 1サンプル O(1)・数バイトの状態で、Arduino に依存しない（記録した RSSI 列をそのまま流せる）。
+
+struct TapParams {
+  uint8_t  riseDb       = 12;    // 基準からの立ち上がり [dB]
+  uint8_t  leakDbPerSec = 20;    // 基準が上へ追いつく速さ [dB/s]
+  int8_t   plateauDbm   = -65;   // 安定とみなす最低 RSSI [dBm]
+  uint16_t plateauMs    = 120;   // 安定が続くべき時間 [ms]
+  uint16_t cooldownMs   = 3000;  // 同じ相手での再検出を抑える時間 [ms]
+};
+
+struct TapDetector {
+  int16_t fastQ4;          // 速い EWMA（1/16 dB）
+  int16_t baseQ4;          // 基準（1/16 dB）
+  uint8_t phase;           // 0: 待機 / 1: 安定待ち
+  unsigned long lastAt;    // 前回サンプル時刻
+  unsigned long phaseAt;   // 安定待ちに入った時刻
+  unsigned long firedAt;   // 前回検出時刻（0 = なし）
+};
+
+// 最初のサンプルで初期化（立ち上がり 0 から始める）
+void TapDetector_Reset(TapDetector& d, int rssi, unsigned long now);
+
+// 1サンプル進める。タップを検出した瞬間だけ true
+bool TapDetector_Update(TapDetector& d, const TapParams& p, int rssi, unsigned long now);
+
+#endif // TAP_DETECTOR_H_
@@ -0,0 +1,120 @@
+#include "Frame_Rig.h"
+#include <string.h>
+#include <Arduino.h>
+
+FrameRig* FrameRig::s_current = nullptr;
+
+const CommTransport FrameRig::kTransport = {
+    &FrameRig::tSend, &FrameRig::tNow, &FrameRig::tRandom,
+    &FrameRig::tGetMac, nullptr, nullptr, nullptr, nullptr, nullptr,
+};
+
+FrameRig::FrameRig(size_t nodes) : nodes_(nodes) {
+    s_current = this;
+    hostMillis = &FrameRig::tNow;
+    for (size_t i = 0; i < nodes_.size(); i++) {
+        Node& node = nodes_[i];
+        node.comm = Comm_NewNode();
+        const uint8_t mac[6] = {0x02, 'R', 'I', 'G', (uint8_t)(i >> 8), (uint8_t)i};
+        memcpy(node.mac, mac, 6);
+    }
+}
+
+FrameRig::~FrameRig() {
+    Comm_SelectNode(nullptr);
+    for (Node& node : nodes_) Comm_DeleteNode(node.comm);
+    if (s_current == this) {
+        s_current = nullptr;
+        hostMillis = nullptr;
+    }
+}
+
+void FrameRig::select(size_t i) {
+    cur_ = i;
+    Comm_SelectNode(nodes_[i].comm);
+}
+
+void FrameRig::init() {
+    for (size_t i = 0; i < nodes_.size(); i++) {
+        select(i);
+        Comm_SetTransport(&kTransport);
+        Comm_Init(1, CommRatePolicy());
+    }
+}
+
+// 1回分の送受信と、送ったフレームの送信結果
+void FrameRig::pump(size_t i) {
+    select(i);
+    Comm_Poll();
+    if (nodes_[i].notify) {
+        nodes_[i].notify = false;
+        Comm_NotifySent(true);
+    }
+}
+
+std::vector<FrameRig::Frame> FrameRig::drain(size_t i, unsigned long maxMs) {
+    Node& node = nodes_[i];
+    node.sent.clear();
+    size_t idle = 0;
+    for (unsigned long ms = 0; ms < maxMs && idle < 50; ms++) {
+        const size_t before = node.sent.size();
+        pump(i);
+        pump(i);
+        idle = node.sent.size() == before ? idle + 1 : 0;
+        now_++;
+    }
+    std::vector<Frame> out;
+    out.swap(node.sent);
+    return out;
+}
+
+void FrameRig::deliver(size_t to, size_t from, const Frame& frame, int rssi) {
+    select(to);
+    while (!Comm_InjectFrame(nodes_[from].mac, frame.data(), frame.size(), rssi)) pump(to);
+    pump(to);
+    Comm_Tick();   // 完成したメッセージをアプリへ渡す（loop が毎回呼ぶのと同じ）
+    nodes_[to].sent.clear();
+}
+
+void FrameRig::advance(unsigned long ms) {
+    for (unsigned long t = 0; t < ms; t++) {
+        for (size_t i = 0; i < nodes_.size(); i++) {
+            pump(i);
+            Comm_Tick();
+            nodes_[i].sent.clear();
+        }
+        now_++;
+    }
+}
+
+bool FrameRig::isChunk(const Frame& f) {
+    if (f.empty()) return false;
+    if (f[0] == 'C') return true;
+    return f.size() > 2 && f[0] == 0xE7 && f[2] == 6;   // FRAME_MAGIC / FRAME_CHUNK
+}
+
+bool FrameRig::tSend(const uint8_t dest[6], const uint8_t* data, size_t len) {
+    (void)dest;
+    Node& node = s_current->nodes_[s_current->cur_];
+    if (node.notify) return false;
+    node.sent.emplace_back(data, data + len);
+    node.notify = true;
+    return true;
+}
+
+unsigned long FrameRig::tNow() {
+    return s_current->now_;
+}
+
+uint32_t FrameRig::tRandom() {
+    // xorshift32（台の数や呼ぶ順に関係なく決まった列）
+    uint32_t& x = s_current->rng_;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+void FrameRig::tGetMac(uint8_t mac[6]) {
+    memcpy(mac, s_current->nodes_[s_current->cur_].mac, 6);
+}
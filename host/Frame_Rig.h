@@ -0,0 +1,61 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "../Comm_EspNow.h"
+
+// ========== 媒体を通さずにフレームを渡すホストの台 ==========
+// Swarm_Sim と違い、送ったフレームは電波に出さず台ごとに溜めるだけ（送信は常に成功）。
+// 溜めたフレームを好きな順番・回数で別の台の Comm_InjectFrame へ渡せるので、
+// 順不同・重複・複数の送信元の混在といった受信側の再構成をそのまま試せる。
+// 時計は全台共通で、advance() で進める。
+
+class FrameRig {
+ public:
+  using Frame = std::vector<uint8_t>;
+
+  explicit FrameRig(size_t nodes);
+  ~FrameRig();
+  FrameRig(const FrameRig&) = delete;
+  FrameRig& operator=(const FrameRig&) = delete;
+
+  static FrameRig* current() { return s_current; }
+  size_t cur() const { return cur_; }
+  size_t size() const { return nodes_.size(); }
+  const uint8_t* mac(size_t i) const { return nodes_[i].mac; }
+  unsigned long now() const { return now_; }
+
+  void select(size_t i);                  // 以後の Comm_* は i 番の台に対して
+  void init();                            // 全台を Comm_Init
+
+  // i 番の送信キューが空になるまで送らせ、送ったフレームを返す（送信元の時計は進める）
+  std::vector<Frame> drain(size_t i, unsigned long maxMs = 500);
+  // from 番が送ったフレームを to 番の受信経路へ渡して処理させる（Comm_Tick まで回すのでコールバックも出る）
+  void deliver(size_t to, size_t from, const Frame& frame, int rssi = -40);
+  // 時計を進めて全台の Comm_Poll / Comm_Tick を回す
+  void advance(unsigned long ms);
+  // フレームのうち分割メッセージのチャンク（FRAME_CHUNK / 旧形式 'C'）か
+  static bool isChunk(const Frame& f);
+
+ private:
+  struct Node {
+    CommNode* comm = nullptr;
+    uint8_t mac[6];
+    bool notify = false;
+    std::vector<Frame> sent;
+  };
+
+  static FrameRig* s_current;
+  static const CommTransport kTransport;
+  static bool tSend(const uint8_t dest[6], const uint8_t* data, size_t len);
+  static unsigned long tNow();
+  static uint32_t tRandom();
+  static void tGetMac(uint8_t mac[6]);
+
+  void pump(size_t i);
+
+  std::vector<Node> nodes_;
+  unsigned long now_ = 1000;
+  size_t cur_ = 0;
+  uint32_t rng_ = 1;
+};
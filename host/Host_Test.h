@@ -0,0 +1,24 @@
+#pragma once
+// ホストテスト用の最小限のチェック（失敗を数えて main の戻り値にする）
+#include <stdio.h>
+
+static int s_testFailures = 0;
+
+#define CHECK(cond)                                                              \
+  do {                                                                           \
+    if (!(cond)) {                                                               \
+      printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);            \
+      s_testFailures++;                                                          \
+    }                                                                            \
+  } while (0)
+
+#define RUN_TEST(fn)                                                             \
+  do {                                                                           \
+    const int before = s_testFailures;                                           \
+    fn();                                                                        \
+    printf("%s %s\n", s_testFailures == before ? "PASS" : "FAIL", #fn);          \
+  } while (0)
+
+static inline int testResult() {
+  return s_testFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include "Image_Fixtures.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include "Replay_Host.h"
+#include "../Image_Codec.h"
+
+namespace {
+    static bool readLines(const char* path, std::vector<std::string>& lines) {
+        FILE* fp = fopen(path, "rb");
+        if (!fp) return false;
+        char buf[256];
+        while (fgets(buf, sizeof(buf), fp)) {
+            std::string s = buf;
+            while (!s.empty() && (s.back() == '\n' || s.back() == '\r')) s.pop_back();
+            if (!s.empty() && s[0] != '#') lines.push_back(s);
+        }
+        fclose(fp);
+        return true;
+    }
+
+    // "pal .=000000 Y=FFC800" → 文字ごとの色
+    static bool parsePalette(const std::string& line, uint8_t colors[256][3], bool used[256]) {
+        memset(used, 0, 256);
+        size_t i = 3;
+        while (i < line.size()) {
+            while (i < line.size() && line[i] == ' ') i++;
+            if (i >= line.size()) break;
+            if (i + 8 > line.size() || line[i + 1] != '=') return false;
+            const uint8_t key = (uint8_t)line[i];
+            const unsigned long v = strtoul(line.substr(i + 2, 6).c_str(), nullptr, 16);
+            colors[key][0] = (uint8_t)(v >> 16);
+            colors[key][1] = (uint8_t)(v >> 8);
+            colors[key][2] = (uint8_t)v;
+            used[key] = true;
+            i += 8;
+        }
+        return true;
+    }
+}
+
+bool Fixture_LoadEmoji(const char* path, std::vector<FixtureImage>& out) {
+    std::vector<std::string> lines;
+    if (!readLines(path, lines)) return false;
+    bool ok = true;
+    for (size_t at = 0; at < lines.size();) {
+        if (lines[at].compare(0, 6, "image ") != 0) {
+            ok = false;
+            at++;
+            continue;
+        }
+        FixtureImage img;
+        img.name = lines[at].substr(6);
+        uint8_t colors[256][3];
+        bool used[256];
+        bool good = at + 9 < lines.size() && lines[at + 1].compare(0, 4, "pal ") == 0 &&
+                    parsePalette(lines[at + 1], colors, used);
+        for (size_t y = 0; good && y < 8; y++) {
+            const std::string& row = lines[at + 2 + y];
+            good = row.size() == 8;
+            for (size_t x = 0; good && x < 8; x++) {
+                const uint8_t key = (uint8_t)row[x];
+                good = used[key];
+                if (good) img.rgb.insert(img.rgb.end(), colors[key], colors[key] + 3);
+            }
+        }
+        if (good) out.push_back(img);
+        ok = ok && good;
+        at += 10;
+    }
+    return ok;
+}
+
+bool Fixture_LoadJsonImage(const char* path, FixtureImage& out) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return false;
+    std::string json;
+    for (int c; (c = fgetc(fp)) != EOF;) json += (char)c;
+    fclose(fp);
+    std::string flag, text;
+    const char* slash = strrchr(path, '/');
+    out.name = slash ? slash + 1 : path;
+    return Replay_ParseDisplayJson(json, flag, text, out.rgb) && out.rgb.size() == IMAGE_CODEC_RGB_BYTES;
+}
+
+FixtureImage Fixture_Gradient(uint32_t seed) {
+    std::mt19937 rng(seed);
+    const int r0 = (int)(rng() % 128), g0 = (int)(rng() % 128), b0 = (int)(rng() % 128);
+    FixtureImage img;
+    img.name = "gradient" + std::to_string(seed);
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            img.rgb.push_back((uint8_t)(r0 + x * 14 + (int)(rng() % 3)));
+            img.rgb.push_back((uint8_t)(g0 + y * 14));
+            img.rgb.push_back((uint8_t)(b0 + (x + y) * 7));
+        }
+    }
+    return img;
+}
+
+FixtureImage Fixture_Noise(uint32_t seed) {
+    std::mt19937 rng(seed);
+    FixtureImage img;
+    img.name = "noise" + std::to_string(seed);
+    for (size_t i = 0; i < IMAGE_CODEC_RGB_BYTES; i++) img.rgb.push_back((uint8_t)rng());
+    return img;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// ========== Image_Codec のテスト・ベンチマーク用の画像 ==========
+struct FixtureImage {
+  std::string name;
+  std::vector<uint8_t> rgb;    // 8x8 RGB（192 バイト）
+};
+
+// fixtures/emoji8x8.txt の形式（"image 名前" / "pal 文字=RRGGBB ..." / 8 行の画素）を読む。
+// 読めない画像があれば false（読めた分は out に入る）
+bool Fixture_LoadEmoji(const char* path, std::vector<FixtureImage>& out);
+
+// data/*.json の表示 JSON（flag = image / emoji）から画像を読む
+bool Fixture_LoadJsonImage(const char* path, FixtureImage& out);
+
+// 写真に近い画像: 色数の多いなめらかなグラデーション（seed で変える）
+FixtureImage Fixture_Gradient(uint32_t seed);
+
+// 最悪ケース: 全画素がばらばらの色
+FixtureImage Fixture_Noise(uint32_t seed);
@@ -0,0 +1,144 @@
+#include "Replay_Host.h"
+#include <LittleFS.h>
+#include "Swarm_Sim.h"
+#include "../Image_Codec.h"
+
+namespace {
+    static constexpr unsigned long kStepMs = 100;
+    static constexpr unsigned long kDrainMs = 3000;   // 最後のフレームの後、組み立て途中の分を待つ
+
+    static ReplayResult* s_out = nullptr;
+    static unsigned long s_startMs = 0;
+
+    static size_t skipSpace(const std::string& s, size_t i) {
+        while (i < s.size() && (s[i] == ' ' || s[i] == '\n' || s[i] == '\r' || s[i] == '\t')) i++;
+        return i;
+    }
+
+    // "key": の値の先頭の位置（なければ npos）
+    static size_t valueOf(const std::string& json, const char* key) {
+        const std::string quoted = std::string("\"") + key + "\"";
+        for (size_t at = json.find(quoted); at != std::string::npos; at = json.find(quoted, at + 1)) {
+            const size_t colon = skipSpace(json, at + quoted.size());
+            if (colon < json.size() && json[colon] == ':') return skipSpace(json, colon + 1);
+        }
+        return std::string::npos;
+    }
+
+    static bool readString(const std::string& json, size_t i, std::string& out) {
+        out.clear();
+        if (i >= json.size() || json[i] != '"') return false;
+        for (i++; i < json.size(); i++) {
+            char c = json[i];
+            if (c == '"') return true;
+            if (c == '\\' && i + 1 < json.size()) {
+                c = json[++i];
+                if (c == 'n') c = '\n';
+                else if (c == 't') c = '\t';
+            }
+            out += c;
+        }
+        return false;
+    }
+
+    static void onMessage(const uint8_t* data, size_t len) {
+        ReplayShown s{};
+        s.atMs = millis() - s_startMs;
+        s.bytes = len;
+        s.ok = Replay_ParseDisplayJson(std::string((const char*)data, len), s.flag, s.text, s.rgb);
+        s_out->shown.push_back(std::move(s));
+    }
+
+    // .ino の OnContentReceived と同じ分け方
+    static void onContent(uint8_t type, uint8_t flags, uint32_t hash, const uint8_t* payload, size_t len) {
+        (void)flags;
+        (void)hash;
+        ReplayShown s{};
+        s.atMs = millis() - s_startMs;
+        s.content = true;
+        s.type = type;
+        s.bytes = len;
+        if (type == COMM_CONTENT_IMAGE_RGB) {
+            s.ok = len >= IMAGE_CODEC_RGB_BYTES;
+            if (s.ok) s.rgb.assign(payload, payload + len);
+        } else if (type == COMM_CONTENT_IMAGE_PACKED) {
+            s.rgb.resize(IMAGE_CODEC_RGB_BYTES);
+            s.ok = ImageCodec_Decode(payload, len, s.rgb.data());
+            if (!s.ok) s.rgb.clear();
+        } else if (type == COMM_CONTENT_TEXT) {
+            s.ok = len > 0;
+            s.text.assign((const char*)payload, len);
+        }
+        if (s.ok) s.flag = s.rgb.empty() ? "text" : "image";
+        s_out->shown.push_back(std::move(s));
+    }
+
+    static void replayLoop(SwarmSim&, size_t) {
+        Capture_Tick();
+    }
+}
+
+bool Replay_ParseDisplayJson(const std::string& json, std::string& flag, std::string& text, std::vector<uint8_t>& rgb) {
+    flag.clear();
+    text.clear();
+    rgb.clear();
+    const size_t first = skipSpace(json, 0);
+    const size_t last = json.find_last_not_of(" \n\r\t");
+    if (first >= json.size() || json[first] != '{' || json[last] != '}') return false;
+
+    size_t at = valueOf(json, "flag");
+    if (at != std::string::npos) readString(json, at, flag);
+    if (flag == "text") {
+        at = valueOf(json, "text");
+        if (at != std::string::npos) readString(json, at, text);
+        return true;
+    }
+    if (flag != "image" && flag != "emoji") return false;
+
+    at = valueOf(json, "rgb");
+    if (at == std::string::npos || json[at] != '[') return true;
+    int value = -1;
+    for (at++; at < json.size(); at++) {
+        const char c = json[at];
+        if (c >= '0' && c <= '9') {
+            value = (value < 0 ? 0 : value * 10) + (c - '0');
+            continue;
+        }
+        if (value >= 0) rgb.push_back((uint8_t)value);
+        value = -1;
+        if (c == ']') break;
+    }
+    return true;
+}
+
+bool Replay_Run(const char* dir, const uint8_t* mac, uint16_t speedPct, ReplayResult& out) {
+    out = ReplayResult();
+    SimConfig cfg;
+    cfg.nodes = 1;
+    cfg.bootSpreadMs = 0;
+    SwarmSim sim(cfg);
+    if (mac) sim.setMac(0, mac);
+    sim.select(0);
+    Comm_SetOnMessage(onMessage);
+    Comm_SetOnContent(onContent);
+    sim.init();
+    sim.setLoop(replayLoop);
+
+    LittleFS.root = dir;
+    s_out = &out;
+    s_startMs = millis();
+    if (!Capture_Replay(speedPct)) {
+        s_out = nullptr;
+        return false;
+    }
+    do {
+        sim.run(kStepMs);
+        Capture_GetStats(out.capture);
+    } while (out.capture.replaying);
+    sim.run(kDrainMs);
+
+    out.durationMs = millis() - s_startMs;
+    Comm_GetStats(out.comm);
+    s_out = nullptr;
+    return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "../Comm_Capture.h"
+#include "../Comm_EspNow.h"
+
+// ========== 記録（TCAP）のホストでの再生 ==========
+// 実機の "cap replay" と同じ Comm_Capture の再生を、仮想の時計で動く1台の Comm_EspNow に流す。
+// LittleFS.root のディレクトリにある /cap0.bin → /cap1.bin を読み、受信経路（Comm_InjectFrame →
+// 分割の組み立て・FEC・コンテンツ）を通って完成したものを、.ino の OnMessageReceived / OnContentReceived と
+// 同じ規則で表示データ（flag / text / 8x8 RGB）にする。
+// 表示データを作るところ（Image_Codec の復号、parseDisplayJson と同じ規則の JSON 読み取り）までで、
+// LED への描画はしない（Json_Handler / Display_Manager は ArduinoJson と NeoMatrix が要るのでホストではビルドしない）。
+
+// 表示に渡るはずだったもの1件
+struct ReplayShown {
+  unsigned long atMs;          // 再生を始めてからの時刻
+  bool content;                // true: バイナリコンテンツ / false: JSON メッセージ
+  uint8_t type;                // content のときの COMM_CONTENT_*
+  bool ok;                     // 表示データにできた（false なら .ino では「未対応」/「JSONパース失敗」）
+  std::string flag;            // "image" / "emoji" / "text" など
+  std::string text;
+  std::vector<uint8_t> rgb;    // 画像なら DISP_W * DISP_H * 3
+  size_t bytes;                // 受け取ったメッセージ/ペイロードの長さ
+};
+
+struct ReplayResult {
+  std::vector<ReplayShown> shown;
+  CaptureStats capture;
+  CommStats comm;
+  unsigned long durationMs;
+};
+
+// dir の記録を再生する。mac を渡すとその MAC の台として受ける（記録した実機の MAC にすると、
+// その台宛てのユニキャストや NACK の宛先判定が実機と同じになる）。記録がなければ false
+bool Replay_Run(const char* dir, const uint8_t* mac, uint16_t speedPct, ReplayResult& out);
+
+// JSON を parseDisplayJson と同じ規則で表示データにする（flag が text / image / emoji 以外なら false）
+bool Replay_ParseDisplayJson(const std::string& json, std::string& flag, std::string& text, std::vector<uint8_t>& rgb);
@@ -0,0 +1,325 @@
+#include "Swarm_Sim.h"
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <esp_now.h>
+
+namespace {
+    // 802.11b（DSSS と LR）と 11g（OFDM）のスロット時間・DIFS・最小競合窓（ブロードキャストは窓を広げない）
+    struct Dcf { uint32_t slotUs, difsUs, cwMin; };
+    static constexpr Dcf kDcfDsss = {20, 50, 31};
+    static constexpr Dcf kDcfOfdm = {9, 34, 15};
+    static constexpr uint32_t kCcaUs = 4;          // これより前に始まった送信だけが聞こえる
+    static constexpr uint32_t kMacOverhead = 43;   // MAC ヘッダ + ESP-NOW のベンダー要素 + FCS
+    static constexpr uint64_t kAirKeepUs = 60000;  // 終わった送信を衝突判定のために残す時間（最長のフレームより長く）
+    static constexpr int kNoiseMarginDb = 10;      // 感度よりこれだけ弱い干渉まで数える
+    static const uint8_t kBroadcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    static constexpr size_t kV1MaxLen = ESP_NOW_MAX_DATA_LEN;   // v1 の最大ペイロード
+}
+
+SwarmSim* SwarmSim::s_current = nullptr;
+
+const CommTransport SwarmSim::kTransport = {
+    &SwarmSim::tSend, &SwarmSim::tNow, &SwarmSim::tRandom,
+    &SwarmSim::tGetMac, &SwarmSim::tAddPeer, nullptr,
+    &SwarmSim::tSetTxPower, &SwarmSim::tSetRateKbps, &SwarmSim::tEspNowVersion,
+};
+
+SwarmSim::SwarmSim(const SimConfig& cfg) : cfg_(cfg), nodes_(cfg.nodes), rng_(cfg.seed) {
+    s_current = this;
+    hostMillis = &SwarmSim::tNow;   // 通信層の外（Comm_Capture など）の millis() も選んだ台の時計にする
+    const size_t n = nodes_.size();
+    const size_t side = (size_t)ceil(sqrt((double)n));
+    std::uniform_real_distribution<float> pos(0.0f, cfg_.areaM);
+    for (size_t i = 0; i < n; i++) {
+        Node& node = nodes_[i];
+        node.comm = Comm_NewNode();
+        const uint8_t mac[6] = {0x02, 'S', 'I', 'M', (uint8_t)(i >> 8), (uint8_t)i};
+        memcpy(node.mac, mac, 6);
+        node.txDbm = cfg_.txDbm;
+        node.version = i < cfg_.espNowVersion.size() ? cfg_.espNowVersion[i] : 1;
+        node.clockOffsetMs = cfg_.bootSpreadMs ? rng_() % cfg_.bootSpreadMs : 0;
+        if (cfg_.grid) {
+            node.x = (float)(i % side) * cfg_.areaM;
+            node.y = (float)(i / side) * cfg_.areaM;
+        } else {
+            node.x = pos(rng_);
+            node.y = pos(rng_);
+        }
+    }
+    shadow_.assign(n * n, 0.0f);
+    std::normal_distribution<float> sh(0.0f, cfg_.shadowDb);
+    for (size_t a = 0; a < n; a++) {
+        for (size_t b = a + 1; b < n; b++) {
+            const float v = cfg_.shadowDb > 0 ? sh(rng_) : 0.0f;
+            shadow_[a * n + b] = v;
+            shadow_[b * n + a] = v;
+        }
+    }
+    loss_.assign(n * n, 0);
+    for (size_t i = 0; i < n; i++) updateLinks(i);
+}
+
+// i 番の台に関わるリンクの経路損失（シャドウイング込み）を計算し直す
+void SwarmSim::updateLinks(size_t i) {
+    const size_t n = nodes_.size();
+    for (size_t j = 0; j < n; j++) {
+        const float d = std::max(distance(i, j), 1.0f);
+        const float loss = cfg_.refLossDb + 10.0f * cfg_.pathLossExp * log10f(d) - shadow_[i * n + j];
+        loss_[i * n + j] = loss_[j * n + i] = (int16_t)lroundf(loss);
+    }
+}
+
+SwarmSim::~SwarmSim() {
+    Comm_SelectNode(nullptr);
+    for (Node& node : nodes_) Comm_DeleteNode(node.comm);
+    if (s_current == this) {
+        s_current = nullptr;
+        hostMillis = nullptr;
+    }
+}
+
+void SwarmSim::setMac(size_t i, const uint8_t mac[6]) {
+    memcpy(nodes_[i].mac, mac, 6);
+}
+
+void SwarmSim::place(size_t i, float x, float y) {
+    nodes_[i].x = x;
+    nodes_[i].y = y;
+    updateLinks(i);
+}
+
+void SwarmSim::select(size_t i) {
+    cur_ = i;
+    Comm_SelectNode(nodes_[i].comm);
+}
+
+void SwarmSim::init() {
+    for (size_t i = 0; i < nodes_.size(); i++) {
+        select(i);
+        Comm_SetTransport(&kTransport);
+        Comm_Init(1, cfg_.rate);
+    }
+}
+
+void SwarmSim::run(unsigned long ms) {
+    for (unsigned long i = 0; i < ms; i++) stepMs();
+}
+
+int SwarmSim::macIndex(const uint8_t* mac) const {
+    if (mac[0] != 0x02 || mac[1] != 'S' || mac[2] != 'I' || mac[3] != 'M') return -1;
+    const size_t i = ((size_t)mac[4] << 8) | mac[5];
+    return i < nodes_.size() ? (int)i : -1;
+}
+
+float SwarmSim::distance(size_t a, size_t b) const {
+    const float dx = nodes_[a].x - nodes_[b].x;
+    const float dy = nodes_[a].y - nodes_[b].y;
+    return sqrtf(dx * dx + dy * dy);
+}
+
+int SwarmSim::linkRssi(size_t rx, size_t tx) const {
+    return nodes_[tx].txDbm - loss_[rx * nodes_.size() + tx];
+}
+
+uint32_t SwarmSim::random() {
+    return (uint32_t)rng_();
+}
+
+uint32_t Sim_Percentile(std::vector<uint32_t> v, unsigned p) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[((size_t)p * (v.size() - 1) + 50) / 100];
+}
+
+// ===== 媒体 =====
+static bool isDsss(uint16_t kbps) {
+    return kbps <= 2000 || kbps == 5500 || kbps == 11000;   // 11b と LR
+}
+
+uint32_t SwarmSim::airtimeUs(size_t len, uint16_t kbps) const {
+    const uint32_t preambleUs = isDsss(kbps) ? 192 : 20;
+    return preambleUs + (uint32_t)(((len + kMacOverhead) * 8 * 1000 + kbps - 1) / kbps);
+}
+
+// 送信を始める時刻になった: 媒体が空いていれば電波に出す。埋まっていれば、聞こえ始めるまでに数えた分だけ
+// バックオフを減らし、空いてから DIFS 後に残りを数え直す（802.11 の DCF と同じくカウンタを凍結する）
+void SwarmSim::startTx(size_t i) {
+    Node& node = nodes_[i];
+    uint64_t busyFrom = UINT64_MAX, busyUntil = 0;
+    for (const Tx& t : air_) {
+        if (t.ended || t.src == i || t.endUs <= node.startUs || t.startUs + kCcaUs > node.startUs) continue;
+        if (linkRssi(i, t.src) >= cfg_.carrierSenseDbm) {
+            busyFrom = std::min(busyFrom, t.startUs);
+            busyUntil = std::max(busyUntil, t.endUs);
+        }
+    }
+    if (busyUntil) {
+        const Dcf& dcf = isDsss(node.rateKbps) ? kDcfDsss : kDcfOfdm;
+        const uint32_t counted = busyFrom > node.countFromUs ? (uint32_t)((busyFrom - node.countFromUs) / dcf.slotUs) : 0;
+        node.backoff -= std::min(node.backoff, counted);
+        if (node.backoff == 0) node.backoff = 1 + random() % dcf.cwMin;   // 空きを待っていた送信は引き直す
+        node.countFromUs = busyUntil + dcf.difsUs;
+        node.startUs = node.countFromUs + node.backoff * dcf.slotUs;
+        medium_.deferrals++;
+        return;
+    }
+    node.pending = false;
+    node.onAir = true;
+    const uint32_t us = airtimeUs(node.frame.size(), node.rateKbps);
+    air_.push_back(Tx{i, node.startUs, node.startUs + us, false});
+
+    const uint8_t* f = node.frame.data();
+    const uint8_t type = (f[0] == 0xE7 && node.frame.size() > 2 && f[2] < 16) ? f[2] : 0;
+    medium_.frames++;
+    medium_.airtimeUs += us;
+    medium_.framesByType[type]++;
+    medium_.airtimeUsByType[type] += us;
+    node.stats.txFrames++;
+    node.stats.airtimeUs += us;
+}
+
+// 送信が終わった: 聞こえた台ごとに受けられたかを決め、送信元に結果を返す
+void SwarmSim::endTx(Tx& tx) {
+    tx.ended = true;
+    Node& src = nodes_[tx.src];
+    const bool bcast = memcmp(src.dest, kBroadcast, 6) == 0;
+    const int destIdx = bcast ? -1 : macIndex(src.dest);
+    std::normal_distribution<float> fading(0.0f, cfg_.fadingDb);
+    std::uniform_real_distribution<float> pct(0.0f, 100.0f);
+    bool acked = false;
+    overlap_.clear();
+    for (const Tx& o : air_) {
+        if (&o != &tx && o.startUs < tx.endUs && o.endUs > tx.startUs) overlap_.push_back(o.src);
+    }
+
+    for (size_t r = 0; r < nodes_.size(); r++) {
+        if (r == tx.src || (!bcast && (int)r != destIdx)) continue;
+        const int rssi = linkRssi(r, tx.src) + (cfg_.fadingDb > 0 ? (int)lroundf(fading(rng_)) : 0);
+        if (rssi < cfg_.sensitivityDbm) continue;
+        if (src.frame.size() > kV1MaxLen && nodes_[r].version < 2) {
+            medium_.oversize++;
+            continue;
+        }
+        if (std::find(overlap_.begin(), overlap_.end(), r) != overlap_.end()) {
+            medium_.halfDuplex++;   // 自分が送信中だった
+            continue;
+        }
+        bool collided = false;
+        for (const size_t o : overlap_) {
+            const int p = linkRssi(r, o);
+            if (p >= cfg_.sensitivityDbm - kNoiseMarginDb && rssi - p < cfg_.captureDb) {
+                collided = true;
+                break;
+            }
+        }
+        if (collided) {
+            medium_.collisions++;
+            nodes_[r].stats.collisions++;
+            continue;
+        }
+        if (cfg_.lossPct > 0 && pct(rng_) < cfg_.lossPct) {
+            medium_.lost++;
+            continue;
+        }
+        Inbound in;
+        memcpy(in.mac, src.mac, 6);
+        in.rssi = std::max(rssi, -127);
+        in.data = src.frame;
+        nodes_[r].inbox.push_back(std::move(in));
+        nodes_[r].stats.rxFrames++;
+        medium_.receptions++;
+        if ((int)r == destIdx) acked = true;
+    }
+
+    src.onAir = false;
+    src.notify = true;
+    src.notifyOk = bcast || acked;
+}
+
+// 1ms 分: その間の送信の開始/終了を時刻順に処理してから、各台を1回ずつ動かす
+void SwarmSim::stepMs() {
+    const uint64_t end = nowUs_ + 1000;
+    for (;;) {
+        size_t startIdx = nodes_.size();
+        uint64_t startAt = end;
+        for (size_t i = 0; i < nodes_.size(); i++) {
+            if (nodes_[i].pending && nodes_[i].startUs < startAt) {
+                startAt = nodes_[i].startUs;
+                startIdx = i;
+            }
+        }
+        Tx* ending = nullptr;
+        for (Tx& t : air_) {
+            if (!t.ended && t.endUs <= startAt && t.endUs < end && (!ending || t.endUs < ending->endUs)) ending = &t;
+        }
+        if (ending) endTx(*ending);
+        else if (startIdx < nodes_.size()) startTx(startIdx);
+        else break;
+    }
+    nowUs_ = end;
+    air_.erase(std::remove_if(air_.begin(), air_.end(),
+                              [&](const Tx& t) { return t.ended && t.endUs + kAirKeepUs < nowUs_; }),
+               air_.end());
+
+    for (size_t i = 0; i < nodes_.size(); i++) {
+        Node& node = nodes_[i];
+        select(i);
+        if (node.notify) {
+            node.notify = false;
+            Comm_NotifySent(node.notifyOk);
+        }
+        for (const Inbound& in : node.inbox) {
+            while (!Comm_InjectFrame(in.mac, in.data.data(), in.data.size(), in.rssi)) Comm_Poll();
+        }
+        node.inbox.clear();
+        Comm_Poll();
+        Comm_Tick();
+        if (loop_) loop_(*this, i);
+    }
+}
+
+// ===== 台から見た無線（Comm_SetTransport） =====
+bool SwarmSim::tSend(const uint8_t dest[6], const uint8_t* data, size_t len) {
+    SwarmSim* sim = s_current;
+    Node& node = sim->nodes_[sim->cur_];
+    if (node.pending || node.onAir || node.notify) return false;
+    if (len > kV1MaxLen && node.version < 2) return false;   // esp_now_send がエラーを返す
+    memcpy(node.dest, dest, 6);
+    node.frame.assign(data, data + len);
+    node.pending = true;
+    const Dcf& dcf = isDsss(node.rateKbps) ? kDcfDsss : kDcfOfdm;
+    node.countFromUs = sim->nowUs_ + sim->random() % 1000 + dcf.difsUs;   // この 1ms のどこかで送ろうとする
+    node.backoff = sim->random() % (dcf.cwMin + 1);
+    node.startUs = node.countFromUs + node.backoff * dcf.slotUs;
+    return true;
+}
+
+unsigned long SwarmSim::tNow() {
+    return s_current->now() + s_current->nodes_[s_current->cur_].clockOffsetMs;
+}
+
+uint32_t SwarmSim::tRandom() {
+    return s_current->random();
+}
+
+void SwarmSim::tGetMac(uint8_t mac[6]) {
+    memcpy(mac, s_current->nodes_[s_current->cur_].mac, 6);
+}
+
+bool SwarmSim::tAddPeer(const uint8_t mac[6]) {
+    (void)mac;
+    return true;
+}
+
+void SwarmSim::tSetTxPower(int8_t dbm) {
+    s_current->nodes_[s_current->cur_].txDbm = dbm;
+}
+
+void SwarmSim::tSetRateKbps(uint16_t kbps) {
+    s_current->nodes_[s_current->cur_].rateKbps = kbps;
+}
+
+uint8_t SwarmSim::tEspNowVersion() {
+    return s_current->nodes_[s_current->cur_].version;
+}
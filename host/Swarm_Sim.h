@@ -0,0 +1,157 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <random>
+#include <vector>
+#include "../Comm_EspNow.h"
+
+// ========== ホスト上の仮想の媒体と群れのシミュレータ ==========
+// 1つのプロセスに Comm_EspNow を N 台分（CommNode）置き、共通の仮想時計で 1ms ずつ進める。
+// 媒体のモデル:
+// - 2D 位置からの対数距離の経路損失（1m で refLossDb、指数 pathLossExp）+ リンクごとの固定のシャドウイング
+//   + フレームごとのフェージング。受信感度に届かないフレームは聞こえない
+// - 送信は実際のレートのエアタイムを占有する。送信前にキャリアセンス（DIFS + 凍結するランダムバックオフ）
+// - 時間が重なったフレームは、受信側で captureDb 以上強くなければ両方とも壊れる（衝突）。送信中は受信できない
+// - それとは別に lossPct の割合で一様に落とす
+// - ユニキャストは宛先が受け取れたときだけ送信成功（MAC 層の再送はモデルにしない）
+// - ESP-NOW v1 の台は 250 バイトを超えるフレームを送れず、受けても捨てる
+// 各台は Comm_SetTransport で媒体につながり、1ms ごとに受信の注入 → Comm_Poll → Comm_Tick の順で動く。
+
+struct SimConfig {
+  uint16_t nodes         = 10;
+  float    areaM         = 20.0f;    // 配置する正方形の一辺 [m]（grid なら格子の間隔）
+  bool     grid          = false;    // 格子状に並べる
+  float    lossPct       = 0.0f;     // 媒体とは別に一様に落とす割合 [%]
+  float    refLossDb     = 40.0f;    // 1m での経路損失
+  float    pathLossExp   = 3.0f;
+  float    shadowDb      = 4.0f;     // リンクごとのシャドウイングの標準偏差
+  float    fadingDb      = 2.0f;     // フレームごとのフェージングの標準偏差
+  int      sensitivityDbm = -94;
+  int      carrierSenseDbm = -92;   // プリアンブルを検出できる強さ（感度の少し上）
+  int      captureDb     = 10;
+  int8_t   txDbm         = 20;       // Comm_SetTxPower を使わない台の送信電力
+  uint32_t bootSpreadMs  = 60000;    // 各台の時計（起動からの時間）を 0..この範囲でずらす
+  uint32_t seed          = 1;
+  CommRatePolicy rate;
+  std::vector<uint8_t> espNowVersion;   // 台ごとの ESP-NOW のバージョン 1 / 2（足りない分は 1）
+};
+
+// 媒体全体の統計
+struct SimMediumStats {
+  uint32_t frames = 0;           // 電波に出たフレーム
+  uint64_t airtimeUs = 0;        // その合計エアタイム
+  uint32_t receptions = 0;       // 受信できたフレーム（台ごとに数える）
+  uint32_t collisions = 0;       // 感度には届いたが重なりで壊れた
+  uint32_t lost = 0;             // lossPct で落とした
+  uint32_t halfDuplex = 0;       // 自分が送信中で受けられなかった
+  uint32_t deferrals = 0;        // キャリアセンスで送信を遅らせた回数
+  uint32_t oversize = 0;         // v1 の台が受けられない大きさで捨てた
+  uint32_t framesByType[16] = {0};     // FrameType ごと（0 = 旧形式）
+  uint64_t airtimeUsByType[16] = {0};
+};
+
+struct SimNodeStats {
+  uint32_t txFrames = 0;
+  uint64_t airtimeUs = 0;
+  uint32_t rxFrames = 0;
+  uint32_t collisions = 0;
+};
+
+class SwarmSim;
+using SimLoopFn = void (*)(SwarmSim& sim, size_t node);
+
+class SwarmSim {
+ public:
+  explicit SwarmSim(const SimConfig& cfg);
+  ~SwarmSim();
+  SwarmSim(const SwarmSim&) = delete;
+  SwarmSim& operator=(const SwarmSim&) = delete;
+
+  // コールバックの中で「どの台か」を知るため（同時に存在するのは1つだけ）
+  static SwarmSim* current() { return s_current; }
+  size_t cur() const { return cur_; }
+
+  size_t size() const { return nodes_.size(); }
+  void place(size_t i, float x, float y);       // init() より前に位置を変える
+  void setMac(size_t i, const uint8_t mac[6]);  // init() より前に MAC を変える（記録した実機として再生するなど）
+  void select(size_t i);                        // 以後の Comm_* は i 番の台に対して
+  void init();                                  // 全台を媒体につないで Comm_Init
+  void setLoop(SimLoopFn fn) { loop_ = fn; }    // 各台の番で Comm_Tick の後に呼ぶ（.ino の loop 相当）
+  void run(unsigned long ms);                   // 仮想時計を進める
+  unsigned long now() const { return (unsigned long)(nowUs_ / 1000); }   // 媒体の時計（各台の時計とは別）
+
+  const uint8_t* mac(size_t i) const { return nodes_[i].mac; }
+  int macIndex(const uint8_t* mac) const;       // 見つからなければ -1
+  float distance(size_t a, size_t b) const;
+  int linkRssi(size_t rx, size_t tx) const;     // フェージングを除いた平均の RSSI
+  bool inRange(size_t rx, size_t tx) const { return linkRssi(rx, tx) >= cfg_.sensitivityDbm; }
+  uint32_t random();
+
+  const SimConfig& config() const { return cfg_; }
+  const SimMediumStats& medium() const { return medium_; }
+  const SimNodeStats& nodeStats(size_t i) const { return nodes_[i].stats; }
+
+ private:
+  struct Inbound {
+    uint8_t mac[6];
+    int rssi;
+    std::vector<uint8_t> data;
+  };
+  struct Node {
+    CommNode* comm = nullptr;
+    uint8_t mac[6];
+    float x = 0, y = 0;
+    int8_t txDbm = 20;
+    uint16_t rateKbps = 1000;
+    uint8_t version = 1;         // ESP-NOW のバージョン
+    unsigned long clockOffsetMs = 0;
+    bool pending = false;        // send から電波に出るまで
+    bool onAir = false;
+    uint64_t startUs = 0;        // 送り始める予定（キャリアセンスで延びる）
+    uint64_t countFromUs = 0;    // バックオフを数え始めた時刻
+    uint32_t backoff = 0;        // 残りのバックオフのスロット数
+    uint8_t dest[6];
+    std::vector<uint8_t> frame;
+    bool notify = false;         // 送信結果を次の番で渡す
+    bool notifyOk = false;
+    std::vector<Inbound> inbox;
+    SimNodeStats stats;
+  };
+  struct Tx {
+    size_t src;
+    uint64_t startUs, endUs;
+    bool ended;
+  };
+
+  static SwarmSim* s_current;
+  static const CommTransport kTransport;
+  static bool tSend(const uint8_t dest[6], const uint8_t* data, size_t len);
+  static unsigned long tNow();
+  static uint32_t tRandom();
+  static void tGetMac(uint8_t mac[6]);
+  static bool tAddPeer(const uint8_t mac[6]);
+  static void tSetTxPower(int8_t dbm);
+  static void tSetRateKbps(uint16_t kbps);
+  static uint8_t tEspNowVersion();
+
+  uint32_t airtimeUs(size_t len, uint16_t kbps) const;
+  void updateLinks(size_t i);
+  void startTx(size_t i);
+  void endTx(Tx& tx);
+  void stepMs();
+
+  SimConfig cfg_;
+  std::vector<Node> nodes_;
+  std::vector<float> shadow_;   // nodes × nodes（対称）
+  std::vector<int16_t> loss_;   // 同経路損失 dB
+  std::vector<Tx> air_;
+  std::vector<size_t> overlap_; // endTx の作業用: 時間が重なった送信の送信元
+  SimMediumStats medium_;
+  std::mt19937 rng_;
+  uint64_t nowUs_ = 0;
+  size_t cur_ = 0;
+  SimLoopFn loop_ = nullptr;
+};
+
+// 値の列の p 百分位（0..100）。空なら 0
+uint32_t Sim_Percentile(std::vector<uint32_t> v, unsigned p);
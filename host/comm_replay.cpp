@@ -0,0 +1,96 @@
+// 実機で記録した受信フレーム（Comm_Capture の TCAP）をホストで再生し、受信経路と表示データまで通す
+//   comm_replay DIR [--mac AA:BB:CC:DD:EE:FF] [--speed PCT] [--ppm OUTDIR] [--log]
+// DIR には実機の LittleFS から取り出した cap0.bin / cap1.bin を置く。
+//   --mac    記録した台の MAC として受ける（その台宛てのユニキャスト・NACK の扱いが実機と同じになる）
+//   --speed  再生速度 [%]（既定 100。記録時の間隔は 2 秒までに詰める）
+//   --ppm    表示されるはずだった画像を OUTDIR/NNN.ppm に書く
+//   --log    通信層の Serial ログを出す
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "Replay_Host.h"
+
+namespace {
+    static bool parseMac(const char* s, uint8_t mac[6]) {
+        unsigned v[6];
+        if (sscanf(s, "%x:%x:%x:%x:%x:%x", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 6) return false;
+        for (int i = 0; i < 6; i++) mac[i] = (uint8_t)v[i];
+        return true;
+    }
+
+    static bool writePpm(const std::string& path, const std::vector<uint8_t>& rgb) {
+        FILE* fp = fopen(path.c_str(), "wb");
+        if (!fp) return false;
+        fprintf(fp, "P6\n8 8\n255\n");
+        const bool ok = fwrite(rgb.data(), 1, rgb.size(), fp) == rgb.size();
+        fclose(fp);
+        return ok;
+    }
+
+    static int usage() {
+        fprintf(stderr, "usage: comm_replay DIR [--mac AA:BB:CC:DD:EE:FF] [--speed PCT] [--ppm OUTDIR] [--log]\n");
+        return 2;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) return usage();
+    const char* dir = argv[1];
+    uint8_t mac[6];
+    bool haveMac = false;
+    uint16_t speed = 100;
+    std::string ppmDir;
+    for (int i = 2; i < argc; i++) {
+        const std::string a = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (a == "--mac" && hasValue) {
+            if (!parseMac(argv[++i], mac)) return usage();
+            haveMac = true;
+        } else if (a == "--speed" && hasValue) {
+            speed = (uint16_t)constrain(atol(argv[++i]), 1L, 10000L);
+        } else if (a == "--ppm" && hasValue) {
+            ppmDir = argv[++i];
+        } else if (a == "--log") {
+            HostSerial::enabled = true;
+        } else {
+            return usage();
+        }
+    }
+
+    ReplayResult r;
+    if (!Replay_Run(dir, haveMac ? mac : nullptr, speed, r)) {
+        fprintf(stderr, "no capture in %s (cap0.bin / cap1.bin)\n", dir);
+        return 1;
+    }
+
+    size_t images = 0, failed = 0;
+    for (size_t i = 0; i < r.shown.size(); i++) {
+        const ReplayShown& s = r.shown[i];
+        printf("%7lu ms  %-7s %4zu B  ", s.atMs, s.content ? "content" : "json", s.bytes);
+        if (!s.ok) {
+            failed++;
+            printf(s.content ? "unsupported type %u\n" : "parse failed\n", s.type);
+            continue;
+        }
+        if (s.rgb.empty()) {
+            printf("%s \"%s\"\n", s.flag.c_str(), s.text.c_str());
+            continue;
+        }
+        printf("%s %zu B rgb", s.flag.c_str(), s.rgb.size());
+        if (!ppmDir.empty() && s.rgb.size() == 8 * 8 * 3) {
+            char name[32];
+            snprintf(name, sizeof(name), "/%03zu.ppm", images);
+            if (writePpm(ppmDir + name, s.rgb)) printf(" -> %s%s", ppmDir.c_str(), name);
+        }
+        images++;
+        printf("\n");
+    }
+
+    const CommStats& st = r.comm;
+    printf("replayed %lu frames in %lu ms: %zu delivered (%zu images, %zu failed)\n",
+           (unsigned long)r.capture.replayed, r.durationMs, r.shown.size(), images, failed);
+    printf("comm: rx %lu, bad %lu, chunked completed %lu, evicted %lu, timed out %lu, fec recovered %lu\n",
+           (unsigned long)st.rxFrames, (unsigned long)st.rxBadFrames, (unsigned long)st.rxChunkedCompleted,
+           (unsigned long)st.rxChunkedEvicted, (unsigned long)st.rxChunkedTimedOut, (unsigned long)st.rxFecRecovered);
+    return 0;
+}
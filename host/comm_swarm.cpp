@@ -0,0 +1,777 @@
+// 群れのシミュレーション（Comm_EspNow を N 台分、仮想の媒体と時計で動かして統計を出す）
+//   comm_swarm [scenario] [--nodes N] [--area M] [--grid] [--loss PCT] [--seconds S] [--seed N] [--per-node]
+//              [--period MS] [--fec K] [--unicast]
+// scenario:
+//   exchange  各台が自分のコンテンツ（~850 バイトの JSON）を広告し、ビーコン → 要求 → 応答で交換する（既定）。
+//             --unicast で要求と応答をユニキャスト（Comm_SetUnicastExchange）にする
+//   v2        ユニキャスト交換を全台 v1（分割）・全台 v2（1フレーム）・半分ずつで、損失 0/10/20/30%
+//             （--loss なら その値だけ）で比べる（既定 20 台・30 秒）
+//   unicast   exchange をブロードキャストとユニキャストで 5/20/50 台（--nodes なら その台数だけ）ずつ動かし、
+//             相手ごとの受信と台ごとの完了の時間の p50/p90 を比べる（既定 30 秒）
+//   slotting  各台が 1.0〜1.5 秒ごとに ~850 バイトの JSON を分割ブロードキャストする。
+//             今のランダムな間隔のままと、スロット送信（Comm_SetSlotting）を同じ条件で比べる
+//             （既定 100 台・40m・50 秒。--period で送る間隔を変える）
+//   nack      1台が ~850 バイトを約 2 秒ごとに送り、損失 0/10/20/30%（--loss なら その値だけ）で
+//             受信側が完成するまでの時間と NACK の数を測る（既定 11 台・10m）
+//   fec       nack と同じ負荷で、XOR パリティ（Comm_SetFecGroup、--fec K で間隔、既定 4）のあり/なしを
+//             損失 0/5/10/20/30% で比べ、再送なしで完成する割合を独立な損失のモデルと並べる（既定 60 秒）
+//   relay     格子の角の1台が注目コンテンツ（Comm_SendFeatured）を数回出し、中継あり/なしで
+//             届いた台の割合・届くまでの時間・エアタイムを比べる（既定 200 台・間隔 60m の格子）
+//   trickle   exchange と同じ交換を 2〜200 台（--nodes なら その台数だけ）で、Trickle のビーコンと
+//             以前の固定間隔（1.0〜1.5 秒、Comm_SetTrickle(false)）で比べ、1台あたりのエアタイムを出す（既定 30m・60 秒）
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+#include "Swarm_Sim.h"
+
+namespace {
+    struct Options {
+        std::string scenario = "exchange";
+        SimConfig sim;
+        unsigned long seconds = 20;
+        bool perNode = false;
+        bool unicast = false;                     // exchange: 要求と応答をユニキャストにする
+        unsigned long periodMs = 1250;            // slotting: 1台が送る平均の間隔（±20%）
+        uint8_t fecGroup = 4;                     // fec: 比べるパリティの間隔
+        bool nodesSet = false, areaSet = false, lossSet = false, secondsSet = false;   // シナリオごとの既定値を使うか
+    };
+
+    static constexpr int kReliableMarginDb = 6;   // 平均 RSSI が感度よりこれだけ強い相手を「届くはず」とみなす
+
+    static void printMedium(const SimMediumStats& m, unsigned long ms) {
+        printf("medium: %lu frames, airtime %.1f ms (%.1f%% of the channel), receptions %lu, "
+               "collisions %lu, lost %lu, half-duplex %lu, deferrals %lu\n",
+               (unsigned long)m.frames, m.airtimeUs / 1000.0, ms ? m.airtimeUs / (ms * 10.0) : 0.0,
+               (unsigned long)m.receptions, (unsigned long)m.collisions, (unsigned long)m.lost,
+               (unsigned long)m.halfDuplex, (unsigned long)m.deferrals);
+        static const char* const kTypes[12] = {"legacy", "content", "beacon", "request", "nack", "json",
+                                               "chunk", "hello", "offer", "ack", "relay", "perf"};
+        printf("by type:");
+        for (int t = 0; t < 12; t++) {
+            if (m.framesByType[t]) printf(" %s %lu (%.1f ms)", kTypes[t], (unsigned long)m.framesByType[t],
+                                          m.airtimeUsByType[t] / 1000.0);
+        }
+        printf("\n");
+    }
+
+    static void printLatency(const char* what, const std::vector<uint32_t>& v) {
+        printf("%s [ms]: n=%zu p50 %lu  p90 %lu  max %lu\n", what, v.size(),
+               (unsigned long)Sim_Percentile(v, 50), (unsigned long)Sim_Percentile(v, 90),
+               (unsigned long)Sim_Percentile(v, 100));
+    }
+
+    // ===== exchange =====
+    // got[受信側][送信元] = 最初に受け取った時刻 + 1（0 = 未受信）、deliveries = アプリへ通知された回数（重複を含む）
+    static std::vector<std::vector<unsigned long>> s_got;
+    static std::vector<std::vector<uint32_t>> s_deliveries;
+
+    static void onExchangeMessage(const uint8_t* data, size_t len) {
+        SwarmSim* sim = SwarmSim::current();
+        const std::string json((const char*)data, len);
+        const size_t at = json.find("\"id\":");
+        if (at == std::string::npos) return;
+        const size_t from = (size_t)atoi(json.c_str() + at + 5);
+        auto& row = s_got[sim->cur()];
+        if (from >= row.size()) return;
+        if (row[from] == 0) row[from] = sim->now() + 1;
+        s_deliveries[sim->cur()][from]++;
+    }
+
+    static std::string exchangeJson(size_t i) {
+        char head[64];
+        snprintf(head, sizeof(head), "{\"id\":%zu,\"name\":\"node%zu\",\"rgbData\":\"", i, i);
+        std::string json = head;
+        while (json.size() < 840) json += "0123456789abcdef";
+        return json + "\"}";
+    }
+
+    static void setupExchange(SwarmSim& sim, bool unicast) {
+        const size_t n = sim.size();
+        s_got.assign(n, std::vector<unsigned long>(n, 0));
+        s_deliveries.assign(n, std::vector<uint32_t>(n, 0));
+        for (size_t i = 0; i < n; i++) {
+            sim.select(i);
+            Comm_SetOnMessage(onExchangeMessage);
+        }
+        sim.init();
+        for (size_t i = 0; i < n; i++) {
+            sim.select(i);
+            const std::string json = exchangeJson(i);
+            Comm_SetUnicastExchange(unicast);
+            Comm_SetOwnContent(String(json.c_str()), 0, nullptr, 0);
+        }
+    }
+
+    static int runExchange(const Options& opt) {
+        SwarmSim sim(opt.sim);
+        const size_t n = sim.size();
+        setupExchange(sim, opt.unicast);
+        const unsigned long ms = opt.seconds * 1000;
+        sim.run(ms);
+
+        size_t pairs = 0, delivered = 0, complete = 0, deliveries = 0;
+        std::vector<uint32_t> pairLatency, nodeLatency;
+        if (opt.perNode) printf("node  got/expected  complete[ms]  tx  airtime[ms]  collisions\n");
+        for (size_t r = 0; r < n; r++) {
+            size_t expected = 0, got = 0;
+            unsigned long last = 0;
+            for (size_t s = 0; s < n; s++) {
+                if (s == r || sim.linkRssi(r, s) < opt.sim.sensitivityDbm + kReliableMarginDb) continue;
+                expected++;
+                if (s_got[r][s]) {
+                    got++;
+                    deliveries += s_deliveries[r][s];
+                    pairLatency.push_back((uint32_t)(s_got[r][s] - 1));
+                    last = std::max(last, s_got[r][s] - 1);
+                }
+            }
+            pairs += expected;
+            delivered += got;
+            if (got == expected) {
+                complete++;
+                nodeLatency.push_back((uint32_t)last);
+            }
+            if (opt.perNode) {
+                const SimNodeStats& st = sim.nodeStats(r);
+                printf("%4zu  %3zu/%-3zu       %8s  %5lu  %9.1f  %10lu\n", r, got, expected,
+                       got == expected ? std::to_string(last).c_str() : "-", (unsigned long)st.txFrames,
+                       st.airtimeUs / 1000.0, (unsigned long)st.collisions);
+            }
+        }
+        printf("exchange: %zu nodes, area %.0f m%s, loss %.0f%%, %lu s%s\n", n, opt.sim.areaM,
+               opt.sim.grid ? " grid" : "", opt.sim.lossPct, opt.seconds, opt.unicast ? ", unicast" : "");
+        printf("delivered %zu/%zu pairs (%.1f%%), nodes complete %zu/%zu\n", delivered, pairs,
+               pairs ? 100.0 * delivered / pairs : 100.0, complete, n);
+        printLatency("first receipt of each neighbor's content", pairLatency);
+        printLatency("per-node completion", nodeLatency);
+        uint32_t requests = 0, served = 0, dedupHits = 0;
+        for (size_t i = 0; i < n; i++) {
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            requests += st.txRequests;
+            served += st.txServed;
+            dedupHits += st.dedupHits;
+        }
+        printf("deliveries per delivered pair %.2f, requests %lu, served %lu, dedup hits %lu\n",
+               delivered ? (double)deliveries / delivered : 0.0, (unsigned long)requests, (unsigned long)served,
+               (unsigned long)dedupHits);
+        printMedium(sim.medium(), ms);
+        return 0;
+    }
+
+    // ===== trickle =====
+    // 台数ごとに同じ配置・同じ種で Trickle と固定間隔を比べる。adv はビーコンと旧ファーム向けの全文
+    // （10 回に1回）の分で、間隔の決め方が直接変えるのはここ。total は要求・応答・ハンドシェイクを含む全部
+    static void runTrickleOnce(const Options& opt, uint16_t nodes, bool trickle, unsigned long ms) {
+        SimConfig cfg = opt.sim;
+        cfg.nodes = nodes;
+        SwarmSim sim(cfg);
+        const size_t n = sim.size();
+        setupExchange(sim, false);
+        for (size_t i = 0; i < n; i++) {
+            sim.select(i);
+            Comm_SetTrickle(trickle);
+        }
+        sim.run(ms);
+
+        size_t pairs = 0, delivered = 0;
+        for (size_t r = 0; r < n; r++) {
+            for (size_t s = 0; s < n; s++) {
+                if (s == r || sim.linkRssi(r, s) < cfg.sensitivityDbm + kReliableMarginDb) continue;
+                pairs++;
+                delivered += s_got[r][s] != 0;
+            }
+        }
+        uint32_t beacons = 0;
+        for (size_t i = 0; i < n; i++) {
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            beacons += st.txBeacons + st.txLegacyFull;
+        }
+        const SimMediumStats& m = sim.medium();
+        const double perDevS = (double)n * ms / 1000.0;
+        const uint64_t adv = m.airtimeUsByType[2] + m.airtimeUsByType[0];
+        printf("%5u  %-7s %8.1f%% %12.2f %13.2f %15.2f %9.1f%% %10.1f%%\n", nodes, trickle ? "trickle" : "fixed",
+               pairs ? 100.0 * delivered / pairs : 100.0, beacons / perDevS, adv / 1000.0 / perDevS,
+               m.airtimeUs / 1000.0 / perDevS, m.airtimeUs / (ms * 10.0),
+               m.receptions + m.collisions ? 100.0 * m.collisions / (m.receptions + m.collisions) : 0.0);
+    }
+
+    static int runTrickle(Options opt) {
+        if (!opt.areaSet) opt.sim.areaM = 30;
+        if (!opt.secondsSet) opt.seconds = 60;
+        const unsigned long ms = opt.seconds * 1000;
+        std::vector<uint16_t> counts = {2, 5, 10, 20, 50, 100, 200};
+        if (opt.nodesSet) counts = {opt.sim.nodes};
+        printf("trickle: ~850 B content per node, area %.0f m%s, loss %.0f%%, %lu s\n", opt.sim.areaM,
+               opt.sim.grid ? " grid" : "", opt.sim.lossPct, opt.seconds);
+        printf("nodes  beacons delivered  adv/dev/s  adv[ms/s/dev]  total[ms/s/dev]  channel  collisions\n");
+        for (uint16_t nodes : counts) {
+            runTrickleOnce(opt, nodes, true, ms);
+            runTrickleOnce(opt, nodes, false, ms);
+        }
+        printf("adv = beacons + legacy full JSON (every %dth); fixed = the earlier 1.0-1.5 s beacon period without suppression\n", 10);
+        return 0;
+    }
+
+    // ===== unicast =====
+    // 同じ配置・同じ種でブロードキャストとユニキャストの交換を比べる。ユニキャストは宛先だけが受け、
+    // 宛先が受けられたときだけ ACK が返る（Swarm_Sim のモデル）
+    // 届くはずの組（平均 RSSI が感度 + kReliableMarginDb 以上）の受信と、全部そろった台の完了の時間
+    struct ExchangeTally {
+        size_t pairs = 0, delivered = 0;
+        std::vector<uint32_t> pairLatency, nodeLatency;
+    };
+
+    static ExchangeTally tallyExchange(const SwarmSim& sim) {
+        ExchangeTally t;
+        const size_t n = sim.size();
+        for (size_t r = 0; r < n; r++) {
+            size_t expected = 0, got = 0;
+            unsigned long last = 0;
+            for (size_t s = 0; s < n; s++) {
+                if (s == r || sim.linkRssi(r, s) < sim.config().sensitivityDbm + kReliableMarginDb) continue;
+                expected++;
+                if (!s_got[r][s]) continue;
+                got++;
+                t.pairLatency.push_back((uint32_t)(s_got[r][s] - 1));
+                last = std::max(last, s_got[r][s] - 1);
+            }
+            t.pairs += expected;
+            t.delivered += got;
+            if (got == expected) t.nodeLatency.push_back((uint32_t)last);
+        }
+        return t;
+    }
+
+    static void runUnicastOnce(const Options& opt, uint16_t nodes, bool unicast, unsigned long ms) {
+        SimConfig cfg = opt.sim;
+        cfg.nodes = nodes;
+        SwarmSim sim(cfg);
+        const size_t n = sim.size();
+        setupExchange(sim, unicast);
+        sim.run(ms);
+
+        const ExchangeTally t = tallyExchange(sim);
+        uint32_t acked = 0, retries = 0, fallbacks = 0;
+        for (size_t i = 0; i < n; i++) {
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            acked += st.txUnicastAcked;
+            retries += st.txUnicastRetries;
+            fallbacks += st.txUnicastFallbacks;
+        }
+        printf("%5u  %-9s %8.1f%% %8lu %8lu  %4zu/%-4zu %8lu %8lu %11.1f %7lu %7lu %9lu\n", nodes,
+               unicast ? "unicast" : "broadcast", t.pairs ? 100.0 * t.delivered / t.pairs : 100.0,
+               (unsigned long)Sim_Percentile(t.pairLatency, 50), (unsigned long)Sim_Percentile(t.pairLatency, 90),
+               t.nodeLatency.size(), n, (unsigned long)Sim_Percentile(t.nodeLatency, 50),
+               (unsigned long)Sim_Percentile(t.nodeLatency, 90), sim.medium().airtimeUs / 1000.0,
+               (unsigned long)acked, (unsigned long)retries, (unsigned long)fallbacks);
+    }
+
+    static int runUnicast(Options opt) {
+        if (!opt.secondsSet) opt.seconds = 30;
+        const unsigned long ms = opt.seconds * 1000;
+        std::vector<uint16_t> counts = {5, 20, 50};
+        if (opt.nodesSet) counts = {opt.sim.nodes};
+        printf("unicast: ~850 B content per node, area %.0f m%s, loss %.0f%%, %lu s\n", opt.sim.areaM,
+               opt.sim.grid ? " grid" : "", opt.sim.lossPct, opt.seconds);
+        printf("nodes  mode      delivered  pair p50  pair p90  complete  node p50  node p90  airtime[ms]   acked retries fallbacks\n");
+        for (uint16_t nodes : counts) {
+            runUnicastOnce(opt, nodes, false, ms);
+            runUnicastOnce(opt, nodes, true, ms);
+        }
+        printf("pair = first receipt of each neighbor's content, node = last of them (nodes that got all); times in ms "
+               "from the start\nthe medium has no MAC-layer retries, so retries/fallbacks are the ones Comm_EspNow makes\n");
+        return 0;
+    }
+
+    // ===== v2 =====
+    // ユニキャスト交換で、全台 v1（分割）・全台 v2（1フレーム）・半分ずつ（v2 同士だけ1フレーム、
+    // v1 の相手へは分割に戻る）を比べる。大きなフレームはブロードキャストには使わないので交換はユニキャスト
+    static const char* const kVersionMixes[3] = {"v1", "v2", "mixed"};
+
+    static void runV2Once(const Options& opt, int mix, float lossPct, unsigned long ms) {
+        SimConfig cfg = opt.sim;
+        cfg.lossPct = lossPct;
+        cfg.espNowVersion.assign(cfg.nodes, 1);
+        for (size_t i = 0; i < cfg.nodes; i++) {
+            if (mix == 1 || (mix == 2 && i % 2 == 0)) cfg.espNowVersion[i] = 2;
+        }
+        SwarmSim sim(cfg);
+        const size_t n = sim.size();
+        setupExchange(sim, true);
+        sim.run(ms);
+
+        const ExchangeTally t = tallyExchange(sim);
+        // 混在のとき、版の違う組（v1 の相手へ分割に戻す）だけの受信の割合
+        size_t crossPairs = 0, crossGot = 0;
+        for (size_t r = 0; r < n; r++) {
+            for (size_t s = 0; s < n; s++) {
+                if (s == r || cfg.espNowVersion[r] == cfg.espNowVersion[s]) continue;
+                if (sim.linkRssi(r, s) < cfg.sensitivityDbm + kReliableMarginDb) continue;
+                crossPairs++;
+                crossGot += s_got[r][s] != 0;
+            }
+        }
+        uint32_t large = 0, fallbacks = 0;
+        for (size_t i = 0; i < n; i++) {
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            large += st.txLargeFrames;
+            fallbacks += st.txUnicastFallbacks;
+        }
+        const SimMediumStats& m = sim.medium();
+        char cross[16] = "-";
+        if (crossPairs) snprintf(cross, sizeof(cross), "%.1f%%", 100.0 * crossGot / crossPairs);
+        printf("%4.0f%%  %-5s %8.1f%% %7s  %4zu/%-4zu %8lu %8lu %7lu %7lu %11.1f %9lu\n", lossPct, kVersionMixes[mix],
+               t.pairs ? 100.0 * t.delivered / t.pairs : 100.0, cross, t.nodeLatency.size(), n,
+               (unsigned long)Sim_Percentile(t.nodeLatency, 50), (unsigned long)Sim_Percentile(t.nodeLatency, 90),
+               (unsigned long)large, (unsigned long)m.framesByType[6], m.airtimeUs / 1000.0, (unsigned long)fallbacks);
+    }
+
+    static int runV2(Options opt) {
+        if (!opt.nodesSet) opt.sim.nodes = 20;
+        if (!opt.secondsSet) opt.seconds = 30;
+        const unsigned long ms = opt.seconds * 1000;
+        std::vector<float> losses = {0, 10, 20, 30};
+        if (opt.lossSet) losses = {opt.sim.lossPct};
+        printf("v2: unicast exchange of ~850 B per node, %u nodes, area %.0f m%s, %lu s\n", opt.sim.nodes,
+               opt.sim.areaM, opt.sim.grid ? " grid" : "", opt.seconds);
+        printf(" loss  mode  delivered  x-ver  complete  node p50  node p90   large  chunks  airtime[ms] fallbacks\n");
+        for (float loss : losses) {
+            for (int mix = 0; mix < 3; mix++) runV2Once(opt, mix, loss, ms);
+        }
+        printf("mixed = even nodes v2, odd nodes v1; x-ver = delivered pairs between a v1 and a v2 node; "
+               "large = messages sent as one v2 frame; node times in ms from the start\n");
+        return 0;
+    }
+
+    // ===== 分割ブロードキャストの負荷 =====
+    // 各台が一定の間隔で {"id":送信元,"seq":番号,...} を Comm_SendJsonBroadcast で送り、受信側が完成した時刻を記録する
+    // NACK を送れるのは最後のチャンクから 80ms 後（Comm_EspNow.cpp の NACK_DELAY_MS）。それより早く完成したものは再送なし
+    static const unsigned long kFirstPassMs = 80;
+
+    struct LoadParams {
+        size_t senders = 0;              // 送る台（先頭から）。0 = 全台
+        bool slotting = false;
+        uint8_t fecGroup = 0;            // Comm_SetFecGroup
+        unsigned long periodMinMs = 1000, periodMaxMs = 1500;
+        size_t jsonBytes = 850;
+        unsigned long warmupMs = 20000;  // これより前に送ったものは数えない（スロットの時計合わせ・初対面のハンドシェイク）
+        unsigned long drainMs = 3000;    // 最後にこれだけは送らずに待つ
+    };
+    struct LoadResult {
+        size_t sent = 0, expected = 0, completed = 0;
+        size_t firstPass = 0;   // 再送なしで完成した数
+        std::vector<uint32_t> latency;
+        SimMediumStats medium;
+        SimMediumStats window;  // 数える区間（warmupMs 以降）の分。衝突率とエアタイム率はこちらで見る
+        CommStats total = {};   // 全台の合計（数のフィールドだけ意味がある）
+    };
+
+    struct LoadState {
+        LoadParams p;
+        unsigned long endMs = 0;
+        std::vector<unsigned long> nextAt;
+        std::vector<uint32_t> seq;
+        std::map<uint64_t, unsigned long> sentAt;                // (送信元, seq) → 送った時刻（数える分だけ）
+        std::vector<std::map<uint64_t, unsigned long>> doneAt;  // 受信側ごと
+    };
+    static LoadState s_load;
+
+    static uint64_t loadKey(size_t from, uint32_t seq) {
+        return ((uint64_t)from << 32) | seq;
+    }
+
+    static void onLoadMessage(const uint8_t* data, size_t len) {
+        SwarmSim* sim = SwarmSim::current();
+        const std::string json((const char*)data, len);
+        const size_t id = json.find("\"id\":"), sq = json.find("\"seq\":");
+        if (id == std::string::npos || sq == std::string::npos) return;
+        const uint64_t key = loadKey((size_t)atoi(json.c_str() + id + 5), (uint32_t)atoi(json.c_str() + sq + 6));
+        s_load.doneAt[sim->cur()].emplace(key, sim->now());
+    }
+
+    static void loadLoop(SwarmSim& sim, size_t i) {
+        if (s_load.p.senders && i >= s_load.p.senders) return;
+        const unsigned long now = sim.now();
+        if (now < s_load.nextAt[i] || now + s_load.p.drainMs >= s_load.endMs) return;
+        const LoadParams& p = s_load.p;
+        s_load.nextAt[i] = now + p.periodMinMs + sim.random() % (p.periodMaxMs - p.periodMinMs + 1);
+        const uint32_t seq = s_load.seq[i]++;
+        char head[64];
+        snprintf(head, sizeof(head), "{\"id\":%zu,\"seq\":%u,\"rgbData\":\"", i, (unsigned)seq);
+        std::string json = head;
+        while (json.size() + 2 < p.jsonBytes) json += "0123456789abcdef";
+        json.resize(p.jsonBytes - 2);
+        json += "\"}";
+        Comm_SendJsonBroadcast(String(json.c_str()));
+        if (now >= p.warmupMs) s_load.sentAt.emplace(loadKey(i, seq), now);
+    }
+
+    static LoadResult runLoad(const SimConfig& cfg, const LoadParams& p, unsigned long ms) {
+        SwarmSim sim(cfg);
+        const size_t n = sim.size();
+        s_load = LoadState();
+        s_load.p = p;
+        s_load.endMs = ms;
+        s_load.seq.assign(n, 0);
+        s_load.doneAt.assign(n, {});
+        s_load.nextAt.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            s_load.nextAt[i] = sim.random() % p.periodMaxMs;
+            sim.select(i);
+            Comm_SetOnMessage(onLoadMessage);
+        }
+        sim.init();
+        for (size_t i = 0; i < n; i++) {
+            sim.select(i);
+            // ビーコン（スロットの時計）を出すために自分のコンテンツを持たせる。全台同じ内容にして、
+            // コンテンツの交換（要求・応答）がブロードキャストの負荷に混ざらないようにする
+            Comm_SetOwnContent(String("{\"id\":\"swarm\"}"), 0, nullptr, 0);
+            Comm_SetSlotting(p.slotting);
+            Comm_SetFecGroup(p.fecGroup);
+        }
+        sim.setLoop(loadLoop);
+        sim.run(p.warmupMs);
+        const SimMediumStats warm = sim.medium();
+        sim.run(ms - p.warmupMs);
+
+        LoadResult r;
+        for (const auto& m : s_load.sentAt) {
+            const size_t from = (size_t)(m.first >> 32);
+            r.sent++;
+            for (size_t to = 0; to < n; to++) {
+                if (to == from || sim.linkRssi(to, from) < cfg.sensitivityDbm + kReliableMarginDb) continue;
+                r.expected++;
+                const auto d = s_load.doneAt[to].find(m.first);
+                if (d == s_load.doneAt[to].end()) continue;
+                r.completed++;
+                r.latency.push_back((uint32_t)(d->second - m.second));
+                if (d->second - m.second < kFirstPassMs) r.firstPass++;
+            }
+        }
+        r.medium = sim.medium();
+        r.window = r.medium;
+        r.window.airtimeUs -= warm.airtimeUs;
+        r.window.receptions -= warm.receptions;
+        r.window.collisions -= warm.collisions;
+        for (size_t i = 0; i < n; i++) {
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            r.total.txQueueDrops += st.txQueueDrops;
+            r.total.rxNacksSent += st.rxNacksSent;
+            r.total.rxNacksSuppressed += st.rxNacksSuppressed;
+            r.total.txRetransmits += st.txRetransmits;
+            r.total.rxChunkedEvicted += st.rxChunkedEvicted;
+            r.total.rxChunkedTimedOut += st.rxChunkedTimedOut;
+            r.total.rxFecRecovered += st.rxFecRecovered;
+            r.total.slotWaits += st.slotWaits;
+            r.total.slotReslots += st.slotReslots;
+            r.total.sfSyncs += st.sfSyncs;
+        }
+        return r;
+    }
+
+    // ===== nack =====
+    // 1台が ~850 バイト（5 チャンク）を約 2 秒ごとにブロードキャストし、残りの台が受け取るまでの時間を一様な損失ごとに測る
+    static int runNack(Options opt) {
+        if (!opt.nodesSet) opt.sim.nodes = 11;
+        if (!opt.areaSet) opt.sim.areaM = 10;
+        const unsigned long ms = opt.seconds * 1000;
+        std::vector<float> losses = {0, 10, 20, 30};
+        if (opt.lossSet) losses = {opt.sim.lossPct};
+        printf("nack: 1 sender, %u receivers, area %.0f m, %lu s, ~850 B chunked broadcast every 1.6-2.4 s\n",
+               opt.sim.nodes - 1, opt.sim.areaM, opt.seconds);
+        printf("loss  expected    done  first-pass  p50[ms]  p90[ms]  max[ms]  nacks  retransmits\n");
+        for (float loss : losses) {
+            SimConfig cfg = opt.sim;
+            cfg.lossPct = loss;
+            LoadParams p;
+            p.senders = 1;
+            p.periodMinMs = 1600;
+            p.periodMaxMs = 2400;
+            p.warmupMs = 3000;
+            const LoadResult r = runLoad(cfg, p, ms);
+            printf("%3.0f%% %9zu %6.1f%% %10.1f%% %8lu %8lu %8lu %6lu %12lu\n", loss, r.expected,
+                   r.expected ? 100.0 * r.completed / r.expected : 100.0,
+                   r.expected ? 100.0 * r.firstPass / r.expected : 100.0,
+                   (unsigned long)Sim_Percentile(r.latency, 50), (unsigned long)Sim_Percentile(r.latency, 90),
+                   (unsigned long)Sim_Percentile(r.latency, 100), (unsigned long)r.total.rxNacksSent,
+                   (unsigned long)r.total.txRetransmits);
+        }
+        printf("first-pass = completed within %lu ms of the send, before any NACK could be answered\n", kFirstPassMs);
+        return 0;
+    }
+
+    // ===== fec =====
+    // nack と同じ負荷（1台が ~850 バイト = 5 チャンクを約 2 秒ごと）で、XOR パリティ（Comm_SetFecGroup）の
+    // あり/なしを損失ごとに比べる。first-pass（再送なしで完成）が FEC で直せた分だけ上がるはず。
+    // model は損失が独立なときの first-pass の確率: なしは (1-p)^5、k=4 なら [4+1] と [1+1] の各グループで
+    // 落ちたのが高々1つ
+    static const unsigned kLoadChunks = 5;
+
+    static double fecModel(double p, uint8_t k) {
+        double all = 1.0;
+        for (unsigned first = 0; first < kLoadChunks; first += (k ? k : kLoadChunks)) {
+            const unsigned n = std::min(kLoadChunks - first, k ? (unsigned)k : kLoadChunks);
+            const double ok = pow(1 - p, n + (k ? 1 : 0));
+            all *= k ? ok + (n + 1) * p * pow(1 - p, n) : ok;
+        }
+        return all;
+    }
+
+    static int runFec(Options opt) {
+        if (!opt.nodesSet) opt.sim.nodes = 11;
+        if (!opt.areaSet) opt.sim.areaM = 10;
+        if (!opt.secondsSet) opt.seconds = 60;
+        const unsigned long ms = opt.seconds * 1000;
+        std::vector<float> losses = {0, 5, 10, 20, 30};
+        if (opt.lossSet) losses = {opt.sim.lossPct};
+        printf("fec: 1 sender, %u receivers, area %.0f m, %lu s, ~850 B (%u chunks) every 1.6-2.4 s, parity every %u chunks\n",
+               opt.sim.nodes - 1, opt.sim.areaM, opt.seconds, kLoadChunks, opt.fecGroup);
+        printf("loss  fec  expected  first-pass   model    done  p90[ms]  recovered  nacks  retransmits  chunk airtime\n");
+        for (float loss : losses) {
+            for (uint8_t k : {(uint8_t)0, opt.fecGroup}) {
+                SimConfig cfg = opt.sim;
+                cfg.lossPct = loss;
+                LoadParams p;
+                p.senders = 1;
+                p.fecGroup = k;
+                p.periodMinMs = 1600;
+                p.periodMaxMs = 2400;
+                p.warmupMs = 3000;
+                const LoadResult r = runLoad(cfg, p, ms);
+                printf("%3.0f%% %4s %9zu %10.1f%% %6.1f%% %6.1f%% %8lu %10lu %6lu %12lu %11.1f ms\n", loss,
+                       k ? std::to_string(k).c_str() : "off", r.expected,
+                       r.expected ? 100.0 * r.firstPass / r.expected : 100.0, 100.0 * fecModel(loss / 100.0, k),
+                       r.expected ? 100.0 * r.completed / r.expected : 100.0,
+                       (unsigned long)Sim_Percentile(r.latency, 90), (unsigned long)r.total.rxFecRecovered,
+                       (unsigned long)r.total.rxNacksSent, (unsigned long)r.total.txRetransmits,
+                       r.medium.airtimeUsByType[6] / 1000.0);
+            }
+        }
+        printf("first-pass = completed within %lu ms of the send, before any NACK could be answered\n", kFirstPassMs);
+        return 0;
+    }
+
+    // ===== slotting =====
+    // 全台が送る負荷で、ランダムな間隔のままとスロット送信を同じ種で比べる
+    static void printLoadRow(const char* mode, const LoadResult& r, unsigned long ms) {
+        const SimMediumStats& m = r.window;
+        const uint32_t attempts = m.receptions + m.collisions;
+        printf("%-8s %6zu %9zu %6.1f%% %10.1f%% %8lu %8lu %8.1f%%\n", mode, r.sent, r.expected,
+               r.expected ? 100.0 * r.completed / r.expected : 100.0,
+               attempts ? 100.0 * m.collisions / attempts : 0.0,
+               (unsigned long)Sim_Percentile(r.latency, 50), (unsigned long)Sim_Percentile(r.latency, 90),
+               ms ? m.airtimeUs / (ms * 10.0) : 0.0);
+    }
+
+    static void printLoadCounters(const char* mode, const LoadResult& r) {
+        const CommStats& t = r.total;
+        printf("%s: nacks %lu (suppressed %lu), retransmits %lu, tx queue drops %lu, evicted %lu, timed out %lu, "
+               "slot waits %lu, reslots %lu, clock syncs %lu\n", mode,
+               (unsigned long)t.rxNacksSent, (unsigned long)t.rxNacksSuppressed, (unsigned long)t.txRetransmits,
+               (unsigned long)t.txQueueDrops, (unsigned long)t.rxChunkedEvicted, (unsigned long)t.rxChunkedTimedOut,
+               (unsigned long)t.slotWaits, (unsigned long)t.slotReslots, (unsigned long)t.sfSyncs);
+    }
+
+    static int runSlotting(Options opt) {
+        if (!opt.nodesSet) opt.sim.nodes = 100;
+        if (!opt.areaSet) opt.sim.areaM = 40;
+        if (!opt.secondsSet) opt.seconds = 50;
+        const unsigned long ms = opt.seconds * 1000;
+        printf("slotting: %u nodes, area %.0f m%s, loss %.0f%%, %lu s, ~850 B chunked broadcast every 1.0-1.5 s\n",
+               opt.sim.nodes, opt.sim.areaM, opt.sim.grid ? " grid" : "", opt.sim.lossPct, opt.seconds);
+        printf("mode       sent  expected  done  collisions  p50[ms]  p90[ms]  airtime\n");
+        LoadParams p;
+        p.periodMinMs = opt.periodMs * 4 / 5;
+        p.periodMaxMs = opt.periodMs * 6 / 5;
+        const LoadResult jitter = runLoad(opt.sim, p, ms);
+        printLoadRow("random", jitter, ms - p.warmupMs);
+        p.slotting = true;
+        const LoadResult slotted = runLoad(opt.sim, p, ms);
+        printLoadRow("slotted", slotted, ms - p.warmupMs);
+        printf("collisions = receptions lost to overlap / (received + lost to overlap)\n");
+        printf("collisions and airtime from %lu s on, the same window the messages are counted in "
+               "(before that the first-contact handshakes dominate)\n", p.warmupMs / 1000);
+        printLoadCounters("random", jitter);
+        printLoadCounters("slotted", slotted);
+        return 0;
+    }
+
+    // ===== relay =====
+    static const uint8_t kRelayTtl = 8;
+    static const uint32_t kRelayItems = 5;            // 注目コンテンツを出す回数
+    static const unsigned long kRelayFirstMs = 2000;
+    static const unsigned long kRelayEveryMs = 5000;
+
+    struct RelayState {
+        std::vector<unsigned long> sentAt;                  // [item]
+        std::vector<std::vector<long>> gotMs;               // [台][item] 出してから届くまで、-1 = 届かない
+    };
+    static RelayState s_relay;
+
+    static void onRelayContent(uint8_t, uint8_t flags, uint32_t hash, const uint8_t*, size_t) {
+        if (!(flags & COMM_FLAG_FEATURED) || hash >= s_relay.sentAt.size()) return;
+        SwarmSim* sim = SwarmSim::current();
+        long& got = s_relay.gotMs[sim->cur()][hash];
+        if (got < 0) got = (long)(sim->now() - s_relay.sentAt[hash]);
+    }
+
+    static void relayLoop(SwarmSim& sim, size_t i) {
+        const uint32_t item = (uint32_t)s_relay.sentAt.size();
+        if (i != 0 || item >= kRelayItems || sim.now() < kRelayFirstMs + item * kRelayEveryMs) return;
+        uint8_t payload[200];
+        memset(payload, (int)item, sizeof(payload));
+        s_relay.sentAt.push_back(sim.now());
+        Comm_SendFeatured(1, 0, item, payload, sizeof(payload), kRelayTtl); // hash = 何回目か
+    }
+
+    // 0 番から、届くはずのリンク（平均 RSSI が感度 + 余裕以上）をたどった最短のホップ数。-1 = たどれない
+    static std::vector<int> relayHops(const SwarmSim& sim) {
+        std::vector<int> hops(sim.size(), -1);
+        std::queue<size_t> q;
+        hops[0] = 0;
+        q.push(0);
+        while (!q.empty()) {
+            const size_t a = q.front();
+            q.pop();
+            for (size_t b = 0; b < sim.size(); b++) {
+                if (hops[b] >= 0 || sim.linkRssi(b, a) < sim.config().sensitivityDbm + kReliableMarginDb) continue;
+                hops[b] = hops[a] + 1;
+                q.push(b);
+            }
+        }
+        return hops;
+    }
+
+    static void runRelayOnce(const Options& opt, bool relay, unsigned long ms) {
+        SwarmSim sim(opt.sim);
+        s_relay = RelayState();
+        s_relay.gotMs.assign(sim.size(), std::vector<long>(kRelayItems, -1));
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            Comm_SetOnContent(onRelayContent);
+        }
+        sim.init();
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            Comm_SetRelay(relay);
+        }
+        sim.setLoop(relayLoop);
+        sim.run(ms);
+
+        // 中継の届く範囲: TTL を使い切るまで（出した台 + kRelayTtl 回の中継）
+        const std::vector<int> hops = relayHops(sim);
+        size_t reachable = 0, got = 0;
+        int maxHops = 0;
+        std::vector<uint32_t> latency;
+        for (size_t i = 1; i < sim.size(); i++) {
+            if (hops[i] < 0 || hops[i] > kRelayTtl + 1) continue;
+            if (hops[i] > maxHops) maxHops = hops[i];
+            for (uint32_t k = 0; k < s_relay.sentAt.size(); k++) {
+                reachable++;
+                if (s_relay.gotMs[i][k] < 0) continue;
+                got++;
+                latency.push_back((uint32_t)s_relay.gotMs[i][k]);
+            }
+        }
+        uint32_t forwarded = 0, suppressed = 0, dropped = 0;
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            forwarded += st.relayForwarded;
+            suppressed += st.relaySuppressed;
+            dropped += st.relayDropped;
+        }
+        const SimMediumStats& m = sim.medium();
+        const unsigned items = (unsigned)s_relay.sentAt.size();
+        printf("%-5s %6.1f%% %8lu %8lu %8lu %12.1f %11.1f %10.1f %11.1f\n", relay ? "on" : "off",
+               reachable ? 100.0 * got / reachable : 0.0, (unsigned long)Sim_Percentile(latency, 50),
+               (unsigned long)Sim_Percentile(latency, 90), (unsigned long)Sim_Percentile(latency, 100),
+               items ? m.airtimeUs / 1000.0 / items : 0.0, items ? m.airtimeUsByType[10] / 1000.0 / items : 0.0,
+               items ? (double)forwarded / items : 0.0, items ? (double)suppressed / items : 0.0);
+        printMedium(m, ms);
+        if (relay) {
+            printf("reachable within %u hops: %zu of %zu nodes (farthest %d hops), relay queue drops %lu\n",
+                   kRelayTtl + 1, reachable / (items ? items : 1), sim.size() - 1, maxHops, (unsigned long)dropped);
+        }
+    }
+
+    static int runRelay(Options opt) {
+        if (!opt.nodesSet) opt.sim.nodes = 200;
+        if (!opt.areaSet) opt.sim.areaM = 60;
+        opt.sim.grid = true;
+        const unsigned long ms = kRelayFirstMs + kRelayItems * kRelayEveryMs;
+        printf("relay: %u nodes on a %.0f m grid, loss %.0f%%, %u featured items (200 B, TTL %u) from a corner node\n",
+               opt.sim.nodes, opt.sim.areaM, opt.sim.lossPct, (unsigned)kRelayItems, kRelayTtl);
+        printf("relay  cover  p50[ms]  p90[ms]  max[ms]  airtime/item  relay/item  fwd/item  suppr/item\n");
+        runRelayOnce(opt, false, ms);
+        runRelayOnce(opt, true, ms);
+        printf("cover = deliveries / (items x nodes reachable from the origin over links >= sensitivity + %d dB); "
+               "airtime in ms\n", kReliableMarginDb);
+        return 0;
+    }
+
+    static void usage() {
+        fprintf(stderr, "usage: comm_swarm [exchange|slotting|nack|fec|relay|trickle|unicast|v2] [--nodes N] [--area M] [--grid] "
+                        "[--loss PCT] [--seconds S] [--seed N] [--per-node] [--period MS] [--fec K] [--unicast]\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        const std::string a = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (a == "--nodes" && hasValue) {
+            opt.sim.nodes = (uint16_t)atoi(argv[++i]);
+            opt.nodesSet = true;
+        } else if (a == "--area" && hasValue) {
+            opt.sim.areaM = (float)atof(argv[++i]);
+            opt.areaSet = true;
+        }
+        else if (a == "--grid") opt.sim.grid = true;
+        else if (a == "--loss" && hasValue) {
+            opt.sim.lossPct = (float)atof(argv[++i]);
+            opt.lossSet = true;
+        } else if (a == "--seconds" && hasValue) {
+            opt.seconds = (unsigned long)atol(argv[++i]);
+            opt.secondsSet = true;
+        }
+        else if (a == "--period" && hasValue) opt.periodMs = (unsigned long)atol(argv[++i]);
+        else if (a == "--fec" && hasValue) opt.fecGroup = (uint8_t)constrain(atoi(argv[++i]), 3, 8);
+        else if (a == "--seed" && hasValue) opt.sim.seed = (uint32_t)atol(argv[++i]);
+        else if (a == "--per-node") opt.perNode = true;
+        else if (a == "--unicast") opt.unicast = true;
+        else if (a[0] != '-') opt.scenario = a;
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (opt.scenario == "exchange") return runExchange(opt);
+    if (opt.scenario == "slotting") return runSlotting(opt);
+    if (opt.scenario == "nack") return runNack(opt);
+    if (opt.scenario == "fec") return runFec(opt);
+    if (opt.scenario == "relay") return runRelay(opt);
+    if (opt.scenario == "trickle") return runTrickle(opt);
+    if (opt.scenario == "unicast") return runUnicast(opt);
+    if (opt.scenario == "v2") return runV2(opt);
+    usage();
+    return 2;
+}
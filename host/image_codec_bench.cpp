@@ -0,0 +1,113 @@
+// 8x8 画像のコーデック（Image_Codec）の圧縮率と速さ
+//   image_codec_bench [--iterations N] [files...]
+// files は fixtures/emoji8x8.txt の形式か data/*.json の表示 JSON。省略時は fixtures/emoji8x8.txt と
+// data/data.json に、写真に近いグラデーション 8 枚とノイズ 2 枚を足したもの
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "Image_Fixtures.h"
+#include "../Image_Codec.h"
+
+namespace {
+    struct Group {
+        const char* name;
+        std::vector<FixtureImage> images;
+    };
+
+    static const char* modeName(uint8_t m) {
+        return m == IMAGE_CODEC_RAW ? "raw" : (m == IMAGE_CODEC_PAL4_RLE ? "pal4" : "pal8");
+    }
+
+    static double secondsSince(std::chrono::steady_clock::time_point t0) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+    static volatile size_t s_sink;   // 結果を使ったことにして、ループを消させない
+
+    static bool endsWith(const std::string& s, const char* suffix) {
+        const size_t n = strlen(suffix);
+        return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+    }
+
+    static void runGroup(const Group& g, unsigned iterations) {
+        if (g.images.empty()) return;
+        size_t packedTotal = 0, maxPacked = 0;
+        printf("== %s ==\n", g.name);
+        std::vector<std::vector<uint8_t>> packed;
+        for (const FixtureImage& img : g.images) {
+            std::vector<uint8_t> out(IMAGE_CODEC_MAX_BYTES);
+            out.resize(ImageCodec_Encode(img.rgb.data(), img.rgb.size(), out.data(), out.size()));
+            uint8_t back[IMAGE_CODEC_RGB_BYTES];
+            const bool ok = !out.empty() && ImageCodec_Decode(out.data(), out.size(), back) &&
+                            memcmp(back, img.rgb.data(), sizeof(back)) == 0;
+            printf("  %-12s %-4s %3zu B  %5.1f%%%s\n", img.name.c_str(), out.empty() ? "-" : modeName(out[0]),
+                   out.size(), 100.0 * out.size() / IMAGE_CODEC_RGB_BYTES, ok ? "" : "  ROUND TRIP FAILED");
+            packedTotal += out.size();
+            if (out.size() > maxPacked) maxPacked = out.size();
+            packed.push_back(out);
+        }
+
+        uint8_t out[IMAGE_CODEC_MAX_BYTES];
+        auto t0 = std::chrono::steady_clock::now();
+        for (unsigned it = 0; it < iterations; it++) {
+            for (const FixtureImage& img : g.images) s_sink += ImageCodec_Encode(img.rgb.data(), img.rgb.size(), out, sizeof(out));
+        }
+        const double enc = secondsSince(t0);
+        uint8_t rgb[IMAGE_CODEC_RGB_BYTES];
+        t0 = std::chrono::steady_clock::now();
+        for (unsigned it = 0; it < iterations; it++) {
+            for (const std::vector<uint8_t>& p : packed) s_sink += ImageCodec_Decode(p.data(), p.size(), rgb) ? rgb[it % sizeof(rgb)] : 0;
+        }
+        const double dec = secondsSince(t0);
+
+        const double n = (double)g.images.size();
+        const double images = n * iterations;
+        printf("  %zu images: avg %.1f B (max %zu B), ratio %.1f%% of raw\n", g.images.size(), packedTotal / n,
+               maxPacked, 100.0 * packedTotal / (n * IMAGE_CODEC_RGB_BYTES));
+        printf("  encode %.2f us/image (%.1f MB/s of RGB), decode %.2f us/image (%.1f MB/s of RGB)\n",
+               enc * 1e6 / images, images * IMAGE_CODEC_RGB_BYTES / enc / 1e6,
+               dec * 1e6 / images, images * IMAGE_CODEC_RGB_BYTES / dec / 1e6);
+    }
+}
+
+int main(int argc, char** argv) {
+    unsigned iterations = 20000;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        const std::string a = argv[i];
+        if (a == "--iterations" && i + 1 < argc) iterations = (unsigned)atol(argv[++i]);
+        else if (a[0] == '-') {
+            fprintf(stderr, "usage: image_codec_bench [--iterations N] [files...]\n");
+            return 2;
+        } else files.push_back(a);
+    }
+
+    Group emoji{"emoji", {}}, photo{"photo-like", {}}, noise{"noise (worst case)", {}};
+    if (files.empty()) {
+        files.push_back(FIXTURE_DIR "/emoji8x8.txt");
+        files.push_back(DATA_DIR "/data.json");
+        for (uint32_t s = 1; s <= 8; s++) photo.images.push_back(Fixture_Gradient(s));
+        for (uint32_t s = 1; s <= 2; s++) noise.images.push_back(Fixture_Noise(s));
+    }
+    for (const std::string& f : files) {
+        if (endsWith(f, ".json")) {
+            FixtureImage img;
+            if (!Fixture_LoadJsonImage(f.c_str(), img)) {
+                fprintf(stderr, "%s: not an 8x8 image JSON\n", f.c_str());
+                return 1;
+            }
+            photo.images.push_back(img);
+        } else if (!Fixture_LoadEmoji(f.c_str(), emoji.images)) {
+            fprintf(stderr, "%s: unreadable fixture\n", f.c_str());
+            return 1;
+        }
+    }
+
+    runGroup(emoji, iterations);
+    runGroup(photo, iterations);
+    runGroup(noise, iterations);
+    return 0;
+}
@@ -0,0 +1,137 @@
+// 複数の送信元のチャンクが混ざって届いたときの受信側の再構成（媒体を通さない）
+//   reassembly_bench [--senders N[,N...]] [--rounds R] [--loss PCT] [--order rr|random] [--bytes B] [--seed S]
+// 各ラウンドで全送信元が1つずつメッセージを送り、そのチャンクを混ぜて 1ms に1つずつ受信側へ渡す。
+//   rr      送信元を順番に1チャンクずつ（全員が同時に送り始めた形）
+//   random  送信元ごとの順番は保ったまま、どの送信元の次のチャンクが来るかはランダム
+// --loss は各チャンクを独立に落とす（NACK への再送は渡さないので、落ちたメッセージは完成しない）。
+// 完成率・追い出し（RX_SLOTS を超えた分）・期限切れを送信元の数ごとに出す
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "Frame_Rig.h"
+
+namespace {
+    using Frame = FrameRig::Frame;
+
+    struct Options {
+        std::vector<size_t> senders = {1, 2, 4, 8, 12, 13, 16, 24};
+        unsigned rounds = 20;
+        float lossPct = 0;
+        bool random = false;
+        size_t bytes = 850;
+        uint32_t seed = 1;
+    };
+
+    static std::set<std::string> s_got;
+
+    static void onMessage(const uint8_t* data, size_t len) {
+        if (FrameRig::current()->cur() == 0) s_got.emplace((const char*)data, len);
+    }
+
+    static std::string message(size_t from, unsigned round, size_t bytes) {
+        std::string json = "{\"from\":" + std::to_string(from) + ",\"round\":" + std::to_string(round) + ",\"d\":\"";
+        while (json.size() < bytes - 2) json += "0123456789abcdef";
+        json.resize(bytes - 2);
+        return json + "\"}";
+    }
+
+    struct Result {
+        size_t expected = 0, completed = 0, chunks = 0, dropped = 0;
+        CommStats st;
+    };
+
+    static Result run(size_t n, const Options& opt) {
+        FrameRig rig(1 + n);
+        for (size_t i = 0; i <= n; i++) {
+            rig.select(i);
+            Comm_SetOnMessage(onMessage);
+            Comm_SetDedupWindow(0);
+        }
+        rig.init();
+        s_got.clear();
+        std::mt19937 rng(opt.seed);
+        Result r;
+        std::vector<std::string> sent;
+
+        for (unsigned round = 0; round < opt.rounds; round++) {
+            std::vector<std::vector<Frame>> chunks(n + 1);
+            for (size_t s = 1; s <= n; s++) {
+                sent.push_back(message(s, round, opt.bytes));
+                rig.select(s);
+                Comm_SendJsonBroadcast(String(sent.back().c_str()));
+                for (Frame& f : rig.drain(s)) {
+                    if (FrameRig::isChunk(f)) chunks[s].push_back(std::move(f));
+                }
+            }
+            std::vector<size_t> next(n + 1, 0);
+            for (size_t left = n; left > 0;) {
+                for (size_t k = 0; k < n; k++) {
+                    const size_t s = opt.random ? 1 + rng() % n : 1 + k;
+                    if (next[s] >= chunks[s].size()) continue;
+                    const Frame& f = chunks[s][next[s]++];
+                    if (next[s] == chunks[s].size()) left--;
+                    r.chunks++;
+                    if (opt.lossPct > 0 && rng() % 10000 < opt.lossPct * 100) {
+                        r.dropped++;
+                    } else {
+                        rig.deliver(0, s, f);
+                    }
+                    rig.advance(1);
+                    if (opt.random) break;
+                }
+            }
+            rig.advance(3000);   // 次のラウンドまでに残った受信途中は期限切れになる
+        }
+
+        r.expected = sent.size();
+        for (const std::string& m : sent) r.completed += s_got.count(m);
+        rig.select(0);
+        Comm_GetStats(r.st);
+        return r;
+    }
+
+    static std::vector<size_t> parseList(const char* s) {
+        std::vector<size_t> v;
+        for (const char* p = s; *p;) {
+            v.push_back((size_t)strtoul(p, (char**)&p, 10));
+            if (*p == ',') p++;
+            else if (*p) break;
+        }
+        return v;
+    }
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        const std::string a = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (a == "--senders" && hasValue) opt.senders = parseList(argv[++i]);
+        else if (a == "--rounds" && hasValue) opt.rounds = (unsigned)atol(argv[++i]);
+        else if (a == "--loss" && hasValue) opt.lossPct = (float)atof(argv[++i]);
+        else if (a == "--order" && hasValue) opt.random = std::string(argv[++i]) == "random";
+        else if (a == "--bytes" && hasValue) opt.bytes = (size_t)constrain(atol(argv[++i]), 300L, 4000L);
+        else if (a == "--seed" && hasValue) opt.seed = (uint32_t)atol(argv[++i]);
+        else {
+            fprintf(stderr, "usage: reassembly_bench [--senders N[,N...]] [--rounds R] [--loss PCT] "
+                            "[--order rr|random] [--bytes B] [--seed S]\n");
+            return 2;
+        }
+    }
+
+    printf("%zu-byte messages, %u rounds, order %s, loss %.0f%%\n", opt.bytes, opt.rounds,
+           opt.random ? "random" : "round-robin", opt.lossPct);
+    printf("senders  messages  completed  rate     chunks  dropped  evicted  timed-out\n");
+    for (size_t n : opt.senders) {
+        if (n == 0) continue;
+        const Result r = run(n, opt);
+        printf("%7zu  %8zu  %9zu  %5.1f%%  %6zu  %7zu  %7lu  %9lu\n", n, r.expected, r.completed,
+               r.expected ? 100.0 * r.completed / r.expected : 0.0, r.chunks, r.dropped,
+               (unsigned long)r.st.rxChunkedEvicted, (unsigned long)r.st.rxChunkedTimedOut);
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+#pragma once
+// ホストビルド用の Arduino の代わり（通信層とコーデックが使う分だけ）
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+
+using std::min;
+using std::max;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+class String {
+ public:
+  String() {}
+  String(const char* s) : s_(s ? s : "") {}
+  String(const std::string& s) : s_(s) {}
+  unsigned int length() const { return (unsigned int)s_.size(); }
+  bool isEmpty() const { return s_.empty(); }
+  const char* c_str() const { return s_.c_str(); }
+  bool startsWith(const char* p) const { return s_.compare(0, strlen(p), p) == 0; }
+  String substring(unsigned int from) const { return from < s_.size() ? String(s_.substr(from)) : String(); }
+  long toInt() const { return atol(s_.c_str()); }
+  void trim() {
+    const size_t a = s_.find_first_not_of(" \t\r\n");
+    if (a == std::string::npos) {
+      s_.clear();
+      return;
+    }
+    s_ = s_.substr(a, s_.find_last_not_of(" \t\r\n") + 1 - a);
+  }
+  bool operator==(const String& o) const { return s_ == o.s_; }
+  bool operator==(const char* o) const { return s_ == o; }
+  bool operator!=(const String& o) const { return s_ != o.s_; }
+  String& operator+=(const String& o) { s_ += o.s_; return *this; }
+  String& operator+=(const char* o) { s_ += o; return *this; }
+ private:
+  std::string s_;
+};
+
+// Serial への出力は既定で捨てる（HostSerial::enabled で stdout へ出す）
+class HostSerial {
+ public:
+  static inline bool enabled = false;
+  void begin(unsigned long) {}
+  int printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    if (!enabled) return 0;
+    va_list ap;
+    va_start(ap, fmt);
+    const int n = vprintf(fmt, ap);
+    va_end(ap);
+    return n;
+  }
+  size_t println(const char* s = "") { return enabled ? (size_t)::printf("%s\n", s) : 0; }
+  size_t println(const String& s) { return println(s.c_str()); }
+  size_t print(const char* s) { return enabled ? (size_t)::printf("%s", s) : 0; }
+  size_t print(const String& s) { return print(s.c_str()); }
+};
+inline HostSerial Serial;
+
+// 設定されていればその時計を使う（Swarm_Sim が仮想時計を入れる）
+inline unsigned long (*hostMillis)() = nullptr;
+
+inline unsigned long millis() {
+  if (hostMillis) return hostMillis();
+  static const auto start = std::chrono::steady_clock::now();
+  return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+inline uint32_t esp_random() {
+  static std::mt19937 rng(12345);
+  return (uint32_t)rng();
+}
+
+#define ARDUINO_RUNNING_CORE 1
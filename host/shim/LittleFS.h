@@ -0,0 +1,60 @@
+#pragma once
+// ホストビルド用の LittleFS の代わり: LittleFS.root の下のファイルをそのまま読み書きする
+// （実機から取り出した /cap0.bin などをディレクトリに置けば、同じパスで開ける）
+#include <stdio.h>
+#include <string>
+#include <sys/stat.h>
+#include "Arduino.h"
+
+class File {
+ public:
+  File() {}
+  explicit File(FILE* fp) : fp_(fp) {}
+  File(const File&) = delete;
+  File& operator=(const File&) = delete;
+  File(File&& o) noexcept : fp_(o.fp_) { o.fp_ = nullptr; }
+  File& operator=(File&& o) noexcept {
+    if (this != &o) {
+      close();
+      fp_ = o.fp_;
+      o.fp_ = nullptr;
+    }
+    return *this;
+  }
+  ~File() { close(); }
+
+  explicit operator bool() const { return fp_ != nullptr; }
+  size_t read(uint8_t* buf, size_t n) { return fp_ ? fread(buf, 1, n, fp_) : 0; }
+  int read() { return fp_ ? fgetc(fp_) : -1; }
+  size_t write(const uint8_t* buf, size_t n) { return fp_ ? fwrite(buf, 1, n, fp_) : 0; }
+  void flush() { if (fp_) fflush(fp_); }
+  void close() {
+    if (fp_) fclose(fp_);
+    fp_ = nullptr;
+  }
+
+ private:
+  FILE* fp_ = nullptr;
+};
+
+class LittleFSClass {
+ public:
+  std::string root = ".";   // 実機の "/" にあたるディレクトリ
+
+  bool begin(bool formatOnFail = false) {
+    (void)formatOnFail;
+    struct stat st;
+    return stat(root.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+  }
+  File open(const char* path, const char* mode) { return File(fopen(full(path).c_str(), mode[0] == 'w' ? "wb" : "rb")); }
+  bool exists(const char* path) {
+    struct stat st;
+    return stat(full(path).c_str(), &st) == 0;
+  }
+  bool remove(const char* path) { return ::remove(full(path).c_str()) == 0; }
+  bool rename(const char* from, const char* to) { return ::rename(full(from).c_str(), full(to).c_str()) == 0; }
+
+ private:
+  std::string full(const char* path) const { return root + (path[0] == '/' ? "" : "/") + path; }
+};
+inline LittleFSClass LittleFS;
@@ -0,0 +1,12 @@
+#pragma once
+// ホストビルド用: 無線は使わない（Comm_SetTransport で差し替える）
+#include <Arduino.h>
+#include "esp_wifi.h"
+
+#define WIFI_STA 1
+
+class WiFiClass {
+ public:
+  bool mode(int) { return false; }
+};
+inline WiFiClass WiFi;
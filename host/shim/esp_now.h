@@ -0,0 +1,35 @@
+#pragma once
+// ホストビルド用: ESP-NOW の呼び出しはすべて失敗を返す（Comm_SetTransport で差し替える）
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_wifi_types.h"
+
+#define ESP_NOW_ETH_ALEN 6
+#define ESP_NOW_MAX_DATA_LEN 250
+#define ESP_NOW_MAX_DATA_LEN_V2 1470
+#define ESP_NOW_MAX_TOTAL_PEER_NUM 20
+
+typedef enum { ESP_NOW_SEND_SUCCESS = 0, ESP_NOW_SEND_FAIL } esp_now_send_status_t;
+typedef struct {
+  uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+  uint8_t channel;
+  wifi_interface_t ifidx;
+  bool encrypt;
+} esp_now_peer_info_t;
+typedef struct esp_now_recv_info {
+  uint8_t* src_addr;
+  uint8_t* des_addr;
+  wifi_pkt_rx_ctrl_t* rx_ctrl;
+} esp_now_recv_info_t;
+typedef void (*esp_now_send_cb_t)(const wifi_tx_info_t*, esp_now_send_status_t);
+typedef void (*esp_now_recv_cb_t)(const esp_now_recv_info_t*, const uint8_t*, int);
+
+inline esp_err_t esp_now_init() { return ESP_FAIL; }
+inline esp_err_t esp_now_register_send_cb(esp_now_send_cb_t) { return ESP_FAIL; }
+inline esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t) { return ESP_FAIL; }
+inline esp_err_t esp_now_send(const uint8_t*, const uint8_t*, size_t) { return ESP_FAIL; }
+inline bool esp_now_is_peer_exist(const uint8_t*) { return false; }
+inline esp_err_t esp_now_add_peer(const esp_now_peer_info_t*) { return ESP_FAIL; }
+inline esp_err_t esp_now_del_peer(const uint8_t*) { return ESP_FAIL; }
+inline esp_err_t esp_now_get_version(uint32_t*) { return ESP_FAIL; }
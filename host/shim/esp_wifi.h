@@ -0,0 +1,11 @@
+#pragma once
+#include "esp_err.h"
+#include "esp_wifi_types.h"
+
+inline esp_err_t esp_wifi_set_channel(uint8_t, wifi_second_chan_t) { return ESP_FAIL; }
+inline esp_err_t esp_wifi_get_channel(uint8_t*, wifi_second_chan_t*) { return ESP_FAIL; }
+inline esp_err_t esp_wifi_get_mac(wifi_interface_t, uint8_t*) { return ESP_FAIL; }
+inline esp_err_t esp_wifi_config_espnow_rate(wifi_interface_t, wifi_phy_rate_t) { return ESP_FAIL; }
+inline esp_err_t esp_wifi_set_protocol(wifi_interface_t, uint8_t) { return ESP_FAIL; }
+inline esp_err_t esp_wifi_set_max_tx_power(int8_t) { return ESP_FAIL; }
+inline esp_err_t esp_wifi_get_max_tx_power(int8_t*) { return ESP_FAIL; }
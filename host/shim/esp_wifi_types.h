@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+
+typedef enum { WIFI_IF_STA = 0, WIFI_IF_AP } wifi_interface_t;
+typedef enum { WIFI_SECOND_CHAN_NONE = 0, WIFI_SECOND_CHAN_ABOVE, WIFI_SECOND_CHAN_BELOW } wifi_second_chan_t;
+typedef enum {
+  WIFI_PHY_RATE_1M_L = 0x00, WIFI_PHY_RATE_2M_L = 0x01, WIFI_PHY_RATE_5M_L = 0x02, WIFI_PHY_RATE_11M_L = 0x03,
+  WIFI_PHY_RATE_2M_S = 0x05, WIFI_PHY_RATE_5M_S = 0x06, WIFI_PHY_RATE_11M_S = 0x07,
+  WIFI_PHY_RATE_48M = 0x08, WIFI_PHY_RATE_24M = 0x09, WIFI_PHY_RATE_12M = 0x0A, WIFI_PHY_RATE_6M = 0x0B,
+  WIFI_PHY_RATE_54M = 0x0C, WIFI_PHY_RATE_36M = 0x0D, WIFI_PHY_RATE_18M = 0x0E, WIFI_PHY_RATE_9M = 0x0F,
+  WIFI_PHY_RATE_LORA_250K = 0x29, WIFI_PHY_RATE_LORA_500K = 0x2A,
+} wifi_phy_rate_t;
+
+typedef struct {
+  signed rssi : 8;
+} wifi_pkt_rx_ctrl_t;
+
+typedef struct {
+  const uint8_t* des_addr;
+  const uint8_t* src_addr;
+} wifi_tx_info_t;
+
+#define WIFI_PROTOCOL_11B 1
+#define WIFI_PROTOCOL_11G 2
+#define WIFI_PROTOCOL_11N 4
+#define WIFI_PROTOCOL_LR  8
@@ -0,0 +1,199 @@
+// 受信フレームの記録（Comm_Capture）とホストでの再生のテスト
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <LittleFS.h>
+#include "Host_Test.h"
+#include "Replay_Host.h"
+#include "Swarm_Sim.h"
+#include "../Image_Codec.h"
+
+namespace {
+    static std::string s_dir;
+
+    // 2色の顔（パレット + ランレングスで小さくなる）
+    static std::vector<uint8_t> faceImage() {
+        std::vector<uint8_t> rgb(IMAGE_CODEC_RGB_BYTES);
+        for (size_t p = 0; p < IMAGE_CODEC_PIXELS; p++) {
+            const size_t x = p % 8, y = p / 8;
+            const bool eye = (y == 2 && (x == 2 || x == 5)) || (y == 5 && x >= 2 && x <= 5);
+            rgb[p * 3 + 0] = eye ? 0 : 255;
+            rgb[p * 3 + 1] = eye ? 0 : 200;
+            rgb[p * 3 + 2] = eye ? 0 : 40;
+        }
+        return rgb;
+    }
+
+    static std::vector<uint8_t> stripeImage() {
+        std::vector<uint8_t> rgb(IMAGE_CODEC_RGB_BYTES);
+        for (size_t i = 0; i < rgb.size(); i++) rgb[i] = (uint8_t)((i / 24) * 30);
+        return rgb;
+    }
+
+    static std::string imageJson(const char* id, const std::vector<uint8_t>& rgb) {
+        std::string json = std::string("{\"id\":\"") + id + "\",\"flag\":\"image\",\"rgb\":[";
+        for (size_t i = 0; i < rgb.size(); i++) json += (i ? "," : "") + std::to_string(rgb[i]);
+        return json + "]}";
+    }
+
+    // 実機側（記録する台）で表示に渡ったもの
+    static std::vector<std::vector<uint8_t>> s_live;
+
+    static void onLiveMessage(const uint8_t* data, size_t len) {
+        if (SwarmSim::current()->cur() != 2) return;
+        std::string flag, text;
+        std::vector<uint8_t> rgb;
+        if (Replay_ParseDisplayJson(std::string((const char*)data, len), flag, text, rgb)) s_live.push_back(rgb);
+    }
+
+    static void onLiveContent(uint8_t type, uint8_t, uint32_t, const uint8_t* payload, size_t len) {
+        if (SwarmSim::current()->cur() != 2 || type != COMM_CONTENT_IMAGE_PACKED) return;
+        std::vector<uint8_t> rgb(IMAGE_CODEC_RGB_BYTES);
+        if (ImageCodec_Decode(payload, len, rgb.data())) s_live.push_back(rgb);
+    }
+
+    static void recordLoop(SwarmSim&, size_t i) {
+        if (i == 2) Capture_Tick();
+    }
+
+    static bool contains(const std::vector<ReplayShown>& shown, const std::vector<uint8_t>& rgb, bool content) {
+        for (const ReplayShown& s : shown) {
+            if (s.ok && s.content == content && s.rgb == rgb) return true;
+        }
+        return false;
+    }
+
+    // 0 番は JSON の画像（分割送信）、1 番は符号化した画像（コンテンツ）を持ち、2 番が受信を記録する。
+    // 記録を別の1台で再生すると、同じ画像が同じ経路で表示データになる
+    static uint8_t s_recorderMac[6];
+
+    static void testRecordedExchangeReplaysToSameImages() {
+        const std::vector<uint8_t> face = faceImage(), stripes = stripeImage();
+        {
+            SimConfig cfg;
+            cfg.nodes = 3;
+            cfg.areaM = 5;
+            SwarmSim sim(cfg);
+            memcpy(s_recorderMac, sim.mac(2), 6);
+            for (size_t i = 0; i < sim.size(); i++) {
+                sim.select(i);
+                Comm_SetOnMessage(onLiveMessage);
+                Comm_SetOnContent(onLiveContent);
+            }
+            sim.init();
+            sim.setLoop(recordLoop);
+            sim.select(2);
+            LittleFS.root = s_dir;
+            CHECK(Capture_Start(64 * 1024));
+
+            sim.select(0);
+            Comm_SetOwnContent(String(imageJson("a", face).c_str()), 0, nullptr, 0);
+            sim.select(1);
+            uint8_t packed[IMAGE_CODEC_MAX_BYTES];
+            const size_t n = ImageCodec_Encode(stripes.data(), stripes.size(), packed, sizeof(packed));
+            CHECK(n > 0);
+            Comm_SetOwnContent(String(imageJson("b", stripes).c_str()), COMM_CONTENT_IMAGE_PACKED, packed, n);
+            sim.run(10000);
+
+            sim.select(2);
+            Capture_Stop();
+        }
+        CaptureStats rec;
+        Capture_GetStats(rec);
+        CHECK(rec.frames > 0);
+        CHECK(rec.dropped == 0);
+        CHECK(rec.bytesWritten > rec.frames * 14);
+        CHECK(s_live.size() >= 2);
+
+        ReplayResult r;
+        CHECK(Replay_Run(s_dir.c_str(), s_recorderMac, 100, r));
+        CHECK(r.capture.replayed == rec.frames);
+        CHECK(!r.capture.replaying);
+        CHECK(contains(r.shown, face, false));
+        CHECK(contains(r.shown, stripes, true));
+        for (const ReplayShown& s : r.shown) CHECK(s.ok);
+        CHECK(r.shown.size() == s_live.size());
+    }
+
+    // 速く再生しても同じものが届く（記録時の間隔を縮めるだけ）
+    static void testFastReplayDeliversTheSame() {
+        ReplayResult normal, fast;
+        CHECK(Replay_Run(s_dir.c_str(), s_recorderMac, 100, normal));
+        CHECK(Replay_Run(s_dir.c_str(), s_recorderMac, 400, fast));
+        CHECK(fast.shown.size() == normal.shown.size());
+        CHECK(fast.capture.replayed == normal.capture.replayed);
+        if (!fast.shown.empty() && !normal.shown.empty()) CHECK(fast.shown.back().atMs < normal.shown.back().atMs);
+    }
+
+    // 最後のレコードが途中で切れていても、そこまでは再生する
+    static void testTruncatedCaptureStopsAtLastWholeRecord() {
+        const std::string path = s_dir + "/cap1.bin";
+        FILE* fp = fopen(path.c_str(), "rb");
+        CHECK(fp != nullptr);
+        if (!fp) return;
+        std::vector<uint8_t> data;
+        for (int c; (c = fgetc(fp)) != EOF;) data.push_back((uint8_t)c);
+        fclose(fp);
+
+        ReplayResult whole;
+        CHECK(Replay_Run(s_dir.c_str(), s_recorderMac, 400, whole));
+        fp = fopen(path.c_str(), "wb");
+        fwrite(data.data(), 1, data.size() - 5, fp);
+        fclose(fp);
+        ReplayResult cut;
+        CHECK(Replay_Run(s_dir.c_str(), s_recorderMac, 400, cut));
+        CHECK(cut.capture.replayed + 1 == whole.capture.replayed);
+
+        // ヘッダが壊れたファイルは読まない
+        fp = fopen(path.c_str(), "r+b");
+        fputc('X', fp);
+        fclose(fp);
+        ReplayResult bad;
+        const bool haveOld = LittleFS.exists("/cap0.bin");
+        CHECK(Replay_Run(s_dir.c_str(), s_recorderMac, 400, bad) == haveOld);
+        CHECK(bad.capture.replayed == 0 || haveOld);
+    }
+
+    static void testNoCaptureIsAnError() {
+        ReplayResult r;
+        CHECK(!Replay_Run("/nonexistent-capture-dir", nullptr, 100, r));
+    }
+
+    static void testDisplayJsonRules() {
+        std::string flag, text;
+        std::vector<uint8_t> rgb;
+        CHECK(Replay_ParseDisplayJson("{\"flag\":\"text\",\"text\":\"hi \\\"you\\\"\"}", flag, text, rgb));
+        CHECK(flag == "text" && text == "hi \"you\"" && rgb.empty());
+        CHECK(Replay_ParseDisplayJson("{ \"flag\" : \"emoji\", \"rgb\" : [1, 2,3] }", flag, text, rgb));
+        CHECK(rgb.size() == 3 && rgb[2] == 3);
+        CHECK(!Replay_ParseDisplayJson("{\"flag\":\"video\"}", flag, text, rgb));
+        CHECK(!Replay_ParseDisplayJson("{\"flag\":\"image\",\"rgb\":[1,2", flag, text, rgb));
+
+        FILE* fp = fopen(DATA_DIR "/data.json", "rb");
+        CHECK(fp != nullptr);
+        if (!fp) return;
+        std::string json;
+        for (int c; (c = fgetc(fp)) != EOF;) json += (char)c;
+        fclose(fp);
+        CHECK(Replay_ParseDisplayJson(json, flag, text, rgb));
+        CHECK(flag == "image" && rgb.size() == IMAGE_CODEC_RGB_BYTES);
+    }
+}
+
+int main() {
+    char tmpl[] = "/tmp/test_capture.XXXXXX";
+    if (!mkdtemp(tmpl)) return 1;
+    s_dir = tmpl;
+    RUN_TEST(testRecordedExchangeReplaysToSameImages);
+    RUN_TEST(testFastReplayDeliversTheSame);
+    RUN_TEST(testTruncatedCaptureStopsAtLastWholeRecord);
+    RUN_TEST(testNoCaptureIsAnError);
+    RUN_TEST(testDisplayJsonRules);
+    remove((s_dir + "/cap0.bin").c_str());
+    remove((s_dir + "/cap1.bin").c_str());
+    rmdir(s_dir.c_str());
+    return testResult();
+}
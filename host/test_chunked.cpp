@@ -0,0 +1,157 @@
+// 分割メッセージの再構成・NACK の再送のテスト（仮想の媒体の上で）
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "Host_Test.h"
+#include "Swarm_Sim.h"
+
+namespace {
+    // 0 番が ~850 バイト（5 チャンク）を一定の間隔でブロードキャストし、受信側ごとに完成までの時間を記録する
+    struct Burst {
+        unsigned long periodMs = 2000;
+        uint32_t count = 10;
+        uint8_t fecGroup = 0;
+        std::vector<unsigned long> sentAt;
+        std::vector<std::vector<long>> doneMs;   // [受信側][seq]、-1 = 未完成
+    };
+    static Burst s_burst;
+
+    static void onMessage(const uint8_t* data, size_t len) {
+        const std::string json((const char*)data, len);
+        const size_t at = json.find("\"seq\":");
+        if (at == std::string::npos) return;
+        const uint32_t seq = (uint32_t)atoi(json.c_str() + at + 6);
+        SwarmSim* sim = SwarmSim::current();
+        auto& row = s_burst.doneMs[sim->cur()];
+        if (seq < row.size() && row[seq] < 0) row[seq] = (long)(sim->now() - s_burst.sentAt[seq]);
+    }
+
+    static void burstLoop(SwarmSim& sim, size_t i) {
+        const uint32_t seq = (uint32_t)s_burst.sentAt.size();
+        if (i != 0 || seq >= s_burst.count || sim.now() < 1000 + seq * s_burst.periodMs) return;
+        std::string json = "{\"seq\":" + std::to_string(seq) + ",\"rgbData\":\"";
+        while (json.size() < 848) json += "0123456789abcdef";
+        json += "\"}";
+        s_burst.sentAt.push_back(sim.now());
+        Comm_SendJsonBroadcast(String(json.c_str()));
+    }
+
+    static void runBurst(SwarmSim& sim) {
+        s_burst.sentAt.clear();
+        s_burst.doneMs.assign(sim.size(), std::vector<long>(s_burst.count, -1));
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            Comm_SetOnMessage(onMessage);
+        }
+        sim.init();
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            Comm_SetOwnContent(String("{\"id\":\"same\"}"), 0, nullptr, 0); // 交換は起こさない
+            Comm_SetFecGroup(s_burst.fecGroup);
+        }
+        sim.setLoop(burstLoop);
+        sim.run(1000 + s_burst.count * s_burst.periodMs + 3000);
+    }
+
+    static CommStats statsOf(SwarmSim& sim, size_t i) {
+        sim.select(i);
+        CommStats st;
+        Comm_GetStats(st);
+        return st;
+    }
+
+    // 20% の損失でも NACK で欠けたチャンクだけ送り直し、ほぼ全部が 1 秒以内に完成する
+    static void testNackCompletesUnderLoss() {
+        SimConfig cfg;
+        cfg.nodes = 6;
+        cfg.areaM = 5;
+        cfg.lossPct = 20;
+        SwarmSim sim(cfg);
+        s_burst = Burst();
+        runBurst(sim);
+
+        size_t expected = 0, done = 0, firstPass = 0;
+        for (size_t r = 1; r < sim.size(); r++) {
+            for (long ms : s_burst.doneMs[r]) {
+                expected++;
+                if (ms < 0) continue;
+                done++;
+                CHECK(ms < 1000);
+                if (ms < 80) firstPass++;
+            }
+        }
+        printf("  20%% loss: %zu/%zu complete, %zu without retransmission\n", done, expected, firstPass);
+        CHECK(expected == 5 * 10);
+        CHECK(done * 100 >= expected * 90);
+        CHECK(firstPass < done);                 // 再送で完成したものがある
+        const CommStats tx = statsOf(sim, 0);
+        CHECK(tx.txRetransmits > 0);
+        // 欠けたチャンクだけ: 再送は 1 回の送信（5 チャンク）× 受信側の数 よりずっと少ない
+        CHECK(tx.txRetransmits < s_burst.count * 5);
+    }
+
+    // 完成した受信側は、他の受信側のための再送チャンクで受信をやり直さない（NACK を出さない）
+    static void testCompletedReceiverIgnoresRetransmits() {
+        SimConfig cfg;
+        cfg.nodes = 6;
+        cfg.areaM = 5;
+        cfg.lossPct = 20;
+        cfg.seed = 3;
+        SwarmSim sim(cfg);
+        s_burst = Burst();
+        runBurst(sim);
+
+        uint32_t nacks = 0, completed = 0;
+        for (size_t r = 1; r < sim.size(); r++) {
+            const CommStats st = statsOf(sim, r);
+            nacks += st.rxNacksSent;
+            completed += st.rxChunkedCompleted;
+        }
+        // 1 メッセージにつき受信側ごとに高々 NACK_MAX (3) 回
+        CHECK(nacks <= 3 * 5 * s_burst.count);
+        // 同じメッセージを 2 度組み立てない（自分のコンテンツの交換は起こしていない）
+        CHECK(completed <= 5 * s_burst.count);
+    }
+
+    // パリティ（4 チャンクごと）があると、20% の損失でも再送を待たずに完成する割合がはっきり上がる
+    // （独立な損失なら 5 チャンクで 33% → 71%）。同じ種で 20 回ずつ送って比べる
+    static size_t firstPassWith(uint8_t fecGroup, uint32_t& recovered) {
+        SimConfig cfg;
+        cfg.nodes = 6;
+        cfg.areaM = 5;
+        cfg.lossPct = 20;
+        cfg.seed = 11;
+        SwarmSim sim(cfg);
+        s_burst = Burst();
+        s_burst.count = 20;
+        s_burst.fecGroup = fecGroup;
+        runBurst(sim);
+        size_t firstPass = 0;
+        recovered = 0;
+        for (size_t r = 1; r < sim.size(); r++) {
+            for (long ms : s_burst.doneMs[r]) firstPass += (ms >= 0 && ms < 80);
+            recovered += statsOf(sim, r).rxFecRecovered;
+        }
+        return firstPass;
+    }
+
+    static void testFecRaisesFirstPassCompletion() {
+        uint32_t recOff = 0, recOn = 0;
+        const size_t off = firstPassWith(0, recOff);
+        const size_t on = firstPassWith(4, recOn);
+        printf("  20%% loss, first pass of 100: fec off %zu, fec 4 %zu (%lu recovered)\n", off, on, (unsigned long)recOn);
+        CHECK(recOff == 0);
+        CHECK(recOn > 0);
+        CHECK(off < 50);
+        CHECK(on >= 55);
+        CHECK(on >= off + 25);
+    }
+}
+
+int main() {
+    RUN_TEST(testNackCompletesUnderLoss);
+    RUN_TEST(testCompletedReceiverIgnoresRetransmits);
+    RUN_TEST(testFecRaisesFirstPassCompletion);
+    return testResult();
+}
@@ -0,0 +1,156 @@
+// 8x8 画像のコーデック（Image_Codec）のテスト
+#include <string.h>
+#include <random>
+#include <vector>
+#include "Host_Test.h"
+#include "Image_Fixtures.h"
+#include "../Image_Codec.h"
+
+namespace {
+    static std::vector<uint8_t> encode(const std::vector<uint8_t>& rgb) {
+        std::vector<uint8_t> out(IMAGE_CODEC_MAX_BYTES);
+        out.resize(ImageCodec_Encode(rgb.data(), rgb.size(), out.data(), out.size()));
+        return out;
+    }
+
+    static bool roundTrips(const std::vector<uint8_t>& rgb) {
+        const std::vector<uint8_t> packed = encode(rgb);
+        uint8_t back[IMAGE_CODEC_RGB_BYTES];
+        return !packed.empty() && ImageCodec_Decode(packed.data(), packed.size(), back) &&
+               memcmp(back, rgb.data(), sizeof(back)) == 0;
+    }
+
+    static std::vector<FixtureImage> emoji() {
+        std::vector<FixtureImage> v;
+        CHECK(Fixture_LoadEmoji(FIXTURE_DIR "/emoji8x8.txt", v));
+        CHECK(v.size() >= 10);
+        return v;
+    }
+
+    // 絵文字は色が少なくランが長いので、生データ（192 バイト）よりずっと小さい
+    static void testEmojiRoundTripWellBelow100Bytes() {
+        for (const FixtureImage& img : emoji()) {
+            const std::vector<uint8_t> packed = encode(img.rgb);
+            CHECK(roundTrips(img.rgb));
+            CHECK(packed.size() < 100);
+            CHECK(packed[0] != IMAGE_CODEC_RAW);
+            if (packed.size() >= 100) printf("  %s: %zu B\n", img.name.c_str(), packed.size());
+        }
+    }
+
+    static void testSolidColorIsTiny() {
+        const std::vector<uint8_t> rgb(IMAGE_CODEC_RGB_BYTES, 0x40);
+        const std::vector<uint8_t> packed = encode(rgb);
+        CHECK(roundTrips(rgb));
+        CHECK(packed.size() == 2 + 3 + 2);        // パレット1色 + 64画素のラン1つ（PAL4 は 16画素×4 で 9 バイト）
+        CHECK(packed[0] == IMAGE_CODEC_PAL8_RLE);
+    }
+
+    // 色の多い画像でも往復でき、生データ + 1 バイトを超えない
+    static void testPhotoLikeNeverExceedsRaw() {
+        FixtureImage json;
+        CHECK(Fixture_LoadJsonImage(DATA_DIR "/data.json", json));
+        std::vector<FixtureImage> photos = {json};
+        for (uint32_t s = 1; s <= 20; s++) photos.push_back(Fixture_Gradient(s));
+        for (const FixtureImage& img : photos) {
+            CHECK(roundTrips(img.rgb));
+            CHECK(encode(img.rgb).size() <= IMAGE_CODEC_MAX_BYTES);
+        }
+        const std::vector<uint8_t> noise = encode(Fixture_Noise(1).rgb);
+        CHECK(noise.size() == IMAGE_CODEC_MAX_BYTES);
+        CHECK(noise[0] == IMAGE_CODEC_RAW);
+        CHECK(roundTrips(Fixture_Noise(2).rgb));
+    }
+
+    // 17..64 色なら PAL8 を使う
+    static void testManyColorsUsePal8() {
+        std::vector<uint8_t> rgb(IMAGE_CODEC_RGB_BYTES);
+        for (size_t p = 0; p < IMAGE_CODEC_PIXELS; p++) {
+            rgb[p * 3] = (uint8_t)((p / 2) * 8);   // 32 色、2 画素ずつ
+        }
+        const std::vector<uint8_t> packed = encode(rgb);
+        CHECK(packed[0] == IMAGE_CODEC_PAL8_RLE);
+        CHECK(packed.size() < IMAGE_CODEC_MAX_BYTES);
+        CHECK(roundTrips(rgb));
+    }
+
+    static void testEncodeRejectsBadArguments() {
+        const std::vector<uint8_t> rgb(IMAGE_CODEC_RGB_BYTES, 1);
+        uint8_t out[IMAGE_CODEC_MAX_BYTES];
+        CHECK(ImageCodec_Encode(rgb.data(), rgb.size() - 3, out, sizeof(out)) == 0);
+        CHECK(ImageCodec_Encode(nullptr, rgb.size(), out, sizeof(out)) == 0);
+        CHECK(ImageCodec_Encode(rgb.data(), rgb.size(), out, 4) == 0);   // 入りきらない
+        const std::vector<uint8_t> noise = Fixture_Noise(3).rgb;
+        CHECK(ImageCodec_Encode(noise.data(), noise.size(), out, IMAGE_CODEC_MAX_BYTES - 1) == 0);
+    }
+
+    // 途中で切れたデータ・後ろに余計なバイトがあるデータは、どの長さでも受け付けない
+    static void testTruncatedOrPaddedInputIsRejected() {
+        std::vector<FixtureImage> all = emoji();
+        all.push_back(Fixture_Noise(4));
+        all.push_back(Fixture_Gradient(4));
+        uint8_t rgb[IMAGE_CODEC_RGB_BYTES];
+        for (const FixtureImage& img : all) {
+            std::vector<uint8_t> packed = encode(img.rgb);
+            for (size_t n = 0; n < packed.size(); n++) CHECK(!ImageCodec_Decode(packed.data(), n, rgb));
+            packed.push_back(0);
+            CHECK(!ImageCodec_Decode(packed.data(), packed.size(), rgb));
+        }
+    }
+
+    static void testCorruptHeadersAreRejected() {
+        uint8_t rgb[IMAGE_CODEC_RGB_BYTES];
+        const std::vector<uint8_t> solid = encode(std::vector<uint8_t>(IMAGE_CODEC_RGB_BYTES, 9));
+
+        std::vector<uint8_t> bad = solid;
+        bad[0] = 7;                                                  // 未知のモード
+        CHECK(!ImageCodec_Decode(bad.data(), bad.size(), rgb));
+        bad = solid;
+        bad[1] = 0;                                                  // 色数 0
+        CHECK(!ImageCodec_Decode(bad.data(), bad.size(), rgb));
+        bad = solid;
+        bad[1] = 17;                                                 // PAL4 の上限を超える
+        CHECK(!ImageCodec_Decode(bad.data(), bad.size(), rgb));
+        bad = solid;
+        bad[5] = 0xF1;                                               // パレットにない色番号
+        CHECK(!ImageCodec_Decode(bad.data(), bad.size(), rgb));
+
+        const uint8_t overrun[] = {IMAGE_CODEC_PAL8_RLE, 1, 1, 2, 3, 0, 63, 0, 1};   // 64 + 2 画素
+        CHECK(!ImageCodec_Decode(overrun, sizeof(overrun), rgb));
+        const uint8_t oddTail[] = {IMAGE_CODEC_PAL8_RLE, 1, 1, 2, 3, 0, 63, 0};      // ランが半分
+        CHECK(!ImageCodec_Decode(oddTail, sizeof(oddTail), rgb));
+        const uint8_t wholeRun[] = {IMAGE_CODEC_PAL8_RLE, 1, 1, 2, 3, 0, 63};
+        CHECK(ImageCodec_Decode(wholeRun, sizeof(wholeRun), rgb));
+        CHECK(rgb[189] == 1 && rgb[190] == 2 && rgb[191] == 3);
+    }
+
+    // でたらめなバイト列でも範囲外へ書かない（受け付けたなら必ず 64 画素が埋まっている）
+    static void testRandomInputIsSafe() {
+        std::mt19937 rng(5);
+        uint8_t in[IMAGE_CODEC_MAX_BYTES + 8];
+        uint8_t rgb[IMAGE_CODEC_RGB_BYTES + 16];
+        size_t accepted = 0;
+        for (int i = 0; i < 20000; i++) {
+            const size_t len = rng() % sizeof(in);
+            for (size_t k = 0; k < len; k++) in[k] = (uint8_t)rng();
+            in[0] = (uint8_t)(rng() % 4);
+            if (len > 1) in[1] = (uint8_t)(1 + rng() % 4);
+            memset(rgb, 0xA5, sizeof(rgb));
+            if (ImageCodec_Decode(in, len, rgb)) accepted++;
+            for (size_t k = IMAGE_CODEC_RGB_BYTES; k < sizeof(rgb); k++) CHECK(rgb[k] == 0xA5);
+        }
+        printf("  random input: %zu of 20000 accepted\n", accepted);
+    }
+}
+
+int main() {
+    RUN_TEST(testEmojiRoundTripWellBelow100Bytes);
+    RUN_TEST(testSolidColorIsTiny);
+    RUN_TEST(testPhotoLikeNeverExceedsRaw);
+    RUN_TEST(testManyColorsUsePal8);
+    RUN_TEST(testEncodeRejectsBadArguments);
+    RUN_TEST(testTruncatedOrPaddedInputIsRejected);
+    RUN_TEST(testCorruptHeadersAreRejected);
+    RUN_TEST(testRandomInputIsSafe);
+    return testResult();
+}
@@ -0,0 +1,174 @@
+// 分割メッセージの受信側の再構成のテスト（媒体を通さず、チャンクの順番・重複・混在を直接作る）
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "Host_Test.h"
+#include "Frame_Rig.h"
+
+namespace {
+    using Frame = FrameRig::Frame;
+
+    // 受け取ったメッセージ（受信側ごと）
+    static std::vector<std::string> s_got;
+
+    static void onMessage(const uint8_t* data, size_t len) {
+        if (FrameRig::current()->cur() == 0) s_got.emplace_back((const char*)data, len);
+    }
+
+    // 0 番が受信側、1.. 番が送信側
+    static void setup(FrameRig& rig) {
+        s_got.clear();
+        for (size_t i = 0; i < rig.size(); i++) {
+            rig.select(i);
+            Comm_SetOnMessage(onMessage);
+        }
+        rig.init();
+    }
+
+    static std::string message(size_t from, uint32_t seq, size_t bytes = 850) {
+        std::string json = "{\"from\":" + std::to_string(from) + ",\"seq\":" + std::to_string(seq) + ",\"rgbData\":\"";
+        while (json.size() < bytes - 2) json += "0123456789abcdef";
+        json.resize(bytes - 2);
+        return json + "\"}";
+    }
+
+    // from 番に送らせ、そのチャンクだけを返す
+    static std::vector<Frame> chunksOf(FrameRig& rig, size_t from, const std::string& json) {
+        rig.select(from);
+        Comm_SendJsonBroadcast(String(json.c_str()));
+        std::vector<Frame> chunks;
+        for (Frame& f : rig.drain(from)) {
+            if (FrameRig::isChunk(f)) chunks.push_back(std::move(f));
+        }
+        return chunks;
+    }
+
+    static size_t count(const std::string& json) {
+        return (size_t)std::count(s_got.begin(), s_got.end(), json);
+    }
+
+    static CommStats stats(FrameRig& rig) {
+        rig.select(0);
+        CommStats st;
+        Comm_GetStats(st);
+        return st;
+    }
+
+    // 逆順・ばらばらの順で届いても同じメッセージになる
+    static void testOutOfOrderChunksComplete() {
+        FrameRig rig(2);
+        setup(rig);
+        std::mt19937 rng(2);
+        for (uint32_t seq = 0; seq < 6; seq++) {
+            const std::string json = message(1, seq);
+            std::vector<Frame> chunks = chunksOf(rig, 1, json);
+            CHECK(chunks.size() >= 4);
+            if (seq == 0) std::reverse(chunks.begin(), chunks.end());
+            else std::shuffle(chunks.begin(), chunks.end(), rng);
+            for (const Frame& f : chunks) rig.deliver(0, 1, f);
+            rig.advance(5);
+            CHECK(count(json) == 1);
+        }
+        CHECK(s_got.size() == 6);
+        CHECK(stats(rig).rxChunkedCompleted == 6);
+    }
+
+    // 同じチャンクが何度届いても1回だけ。完成した後の再送（他の受信側の NACK への応答）でも出し直さない
+    static void testDuplicateChunksAreSuppressed() {
+        FrameRig rig(2);
+        setup(rig);
+        const std::string json = message(1, 0);
+        const std::vector<Frame> chunks = chunksOf(rig, 1, json);
+        for (const Frame& f : chunks) {
+            rig.deliver(0, 1, f);
+            rig.deliver(0, 1, f);
+        }
+        rig.advance(5);
+        CHECK(count(json) == 1);
+        for (const Frame& f : chunks) rig.deliver(0, 1, f);    // 再送
+        rig.advance(5);
+        CHECK(count(json) == 1);
+        const CommStats st = stats(rig);
+        CHECK(st.rxChunkedCompleted == 1);
+        CHECK(st.rxChunkedEvicted == 0);
+
+        // 同じ内容を新しい msgId で送り直しても、重複抑制の期間内なら通知しない
+        for (const Frame& f : chunksOf(rig, 1, json)) rig.deliver(0, 1, f);
+        rig.advance(5);
+        CHECK(count(json) == 1);
+    }
+
+    // 受信途中のスロットが埋まると、いちばん長く何も届いていないものを捨てる
+    static void testOldestPartialIsEvicted() {
+        const size_t senders = 13;                         // RX_SLOTS(12) + 1
+        FrameRig rig(1 + senders);
+        setup(rig);
+        std::vector<std::string> json(senders + 1);
+        std::vector<std::vector<Frame>> chunks(senders + 1);
+        for (size_t s = 1; s <= senders; s++) {
+            json[s] = message(s, 0);
+            chunks[s] = chunksOf(rig, s, json[s]);
+        }
+        // 1..12 番の最初のチャンクで12スロットを埋める。その後 1 番にもう1つ届けて、2 番をいちばん古くする
+        for (size_t s = 1; s < senders; s++) {
+            rig.deliver(0, s, chunks[s][0]);
+            rig.advance(10);
+        }
+        rig.deliver(0, 1, chunks[1][1]);
+        rig.advance(10);
+        rig.deliver(0, senders, chunks[senders][0]);       // 13 番: 2 番が追い出される
+        CHECK(stats(rig).rxChunkedEvicted == 1);
+
+        for (size_t s = 1; s <= senders; s++) {
+            for (size_t c = 1; c < chunks[s].size(); c++) rig.deliver(0, s, chunks[s][c]);
+        }
+        rig.advance(5);
+        for (size_t s = 1; s <= senders; s++) CHECK(count(json[s]) == (s == 2 ? 0u : 1u));
+
+        // 2 番は先頭のチャンクを失った。再送されれば（NACK への応答）完成する
+        rig.deliver(0, 2, chunks[2][0]);
+        rig.advance(5);
+        CHECK(count(json[2]) == 1);
+    }
+
+    // 同じ送信元の新しいメッセージは、その送信元の受信途中のものを置き換える（他の送信元は追い出さない）
+    static void testNewerMessageReplacesSameSender() {
+        FrameRig rig(3);
+        setup(rig);
+        const std::string a0 = message(1, 0), a1 = message(1, 1), b0 = message(2, 0);
+        const std::vector<Frame> ca0 = chunksOf(rig, 1, a0), ca1 = chunksOf(rig, 1, a1), cb0 = chunksOf(rig, 2, b0);
+        rig.deliver(0, 1, ca0[0]);
+        rig.deliver(0, 2, cb0[0]);
+        for (const Frame& f : ca1) rig.deliver(0, 1, f);
+        for (size_t c = 1; c < cb0.size(); c++) rig.deliver(0, 2, cb0[c]);
+        rig.advance(5);
+        CHECK(count(a1) == 1 && count(b0) == 1 && count(a0) == 0);
+        CHECK(stats(rig).rxChunkedEvicted == 0);
+    }
+
+    // チャンクが交互に届く2つの送信元は、どちらも完成する
+    static void testInterleavedSendersBothComplete() {
+        FrameRig rig(3);
+        setup(rig);
+        const std::string a = message(1, 0), b = message(2, 0);
+        const std::vector<Frame> ca = chunksOf(rig, 1, a), cb = chunksOf(rig, 2, b);
+        for (size_t c = 0; c < std::max(ca.size(), cb.size()); c++) {
+            if (c < ca.size()) rig.deliver(0, 1, ca[c]);
+            if (c < cb.size()) rig.deliver(0, 2, cb[c]);
+        }
+        rig.advance(5);
+        CHECK(count(a) == 1 && count(b) == 1);
+    }
+}
+
+int main() {
+    RUN_TEST(testOutOfOrderChunksComplete);
+    RUN_TEST(testDuplicateChunksAreSuppressed);
+    RUN_TEST(testOldestPartialIsEvicted);
+    RUN_TEST(testNewerMessageReplacesSameSender);
+    RUN_TEST(testInterleavedSendersBothComplete);
+    return testResult();
+}
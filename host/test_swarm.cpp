@@ -0,0 +1,452 @@
+// 仮想の媒体と複数台の動作のテスト
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "Host_Test.h"
+#include "Swarm_Sim.h"
+
+namespace {
+    // got[受信側][送信元] = 受け取った回数（重複を含む）
+    static std::vector<std::vector<uint32_t>> s_got;
+
+    static void onMessage(const uint8_t* data, size_t len) {
+        const std::string json((const char*)data, len);
+        const size_t at = json.find("\"id\":");
+        if (at == std::string::npos) return;
+        const size_t from = (size_t)atoi(json.c_str() + at + 5);
+        auto& row = s_got[SwarmSim::current()->cur()];
+        if (from < row.size()) row[from]++;
+    }
+
+    // 全台に ~600 バイト（分割送信になる大きさ）の自分のコンテンツを持たせる
+    static void setupExchange(SwarmSim& sim) {
+        s_got.assign(sim.size(), std::vector<uint32_t>(sim.size(), 0));
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            Comm_SetOnMessage(onMessage);
+        }
+        sim.init();
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            std::string json = "{\"id\":" + std::to_string(i) + ",\"rgbData\":\"";
+            while (json.size() < 600) json += "0123456789abcdef";
+            json += "\"}";
+            Comm_SetOwnContent(String(json.c_str()), 0, nullptr, 0);
+        }
+    }
+
+    static size_t delivered() {
+        size_t n = 0;
+        for (size_t r = 0; r < s_got.size(); r++)
+            for (size_t s = 0; s < s_got.size(); s++) n += (r != s && s_got[r][s]);
+        return n;
+    }
+
+    // 同じ相手から2回以上通知された組の数
+    static size_t repeated() {
+        size_t n = 0;
+        for (size_t r = 0; r < s_got.size(); r++)
+            for (size_t s = 0; s < s_got.size(); s++) n += (r != s && s_got[r][s] > 1);
+        return n;
+    }
+
+    static void testSmallSwarmExchangesEverything() {
+        SimConfig cfg;
+        cfg.nodes = 6;
+        cfg.areaM = 8;
+        SwarmSim sim(cfg);
+        setupExchange(sim);
+        sim.run(15000);
+        CHECK(delivered() == 6 * 5);
+        CHECK(sim.medium().frames > 0);
+        CHECK(sim.medium().receptions > 0);
+        for (size_t i = 0; i < sim.size(); i++) CHECK(sim.nodeStats(i).txFrames > 0);
+    }
+
+    static void testSameSeedIsDeterministic() {
+        SimConfig cfg;
+        cfg.nodes = 8;
+        cfg.areaM = 15;
+        cfg.lossPct = 10;
+        cfg.seed = 7;
+        uint32_t frames[2], receptions[2], collisions[2];
+        size_t got[2];
+        for (int run = 0; run < 2; run++) {
+            SwarmSim sim(cfg);
+            setupExchange(sim);
+            sim.run(5000);
+            frames[run] = sim.medium().frames;
+            receptions[run] = sim.medium().receptions;
+            collisions[run] = sim.medium().collisions;
+            got[run] = delivered();
+        }
+        CHECK(frames[0] == frames[1]);
+        CHECK(receptions[0] == receptions[1]);
+        CHECK(collisions[0] == collisions[1]);
+        CHECK(got[0] == got[1]);
+    }
+
+    static void testOutOfRangeNodeHearsNothing() {
+        SimConfig cfg;
+        cfg.nodes = 3;
+        cfg.areaM = 5;
+        SwarmSim sim(cfg);
+        sim.place(2, 2000, 2000);
+        CHECK(!sim.inRange(2, 0));
+        CHECK(sim.inRange(1, 0));
+        setupExchange(sim);
+        sim.run(8000);
+        CHECK(sim.nodeStats(2).rxFrames == 0);
+        CHECK(s_got[0][1] && s_got[1][0]);
+        CHECK(!s_got[0][2] && !s_got[2][0]);
+    }
+
+    static void testRssiFollowsDistance() {
+        SimConfig cfg;
+        cfg.nodes = 3;
+        cfg.shadowDb = 0;
+        SwarmSim sim(cfg);
+        sim.place(0, 0, 0);
+        sim.place(1, 1, 0);
+        sim.place(2, 10, 0);
+        CHECK(sim.linkRssi(1, 0) == cfg.txDbm - 40);   // 1m で refLossDb
+        CHECK(sim.linkRssi(2, 0) == cfg.txDbm - 70);   // 10m: + 10 * 3.0 dB
+        CHECK(sim.linkRssi(0, 2) == sim.linkRssi(2, 0));
+    }
+
+    static void testTotalLossDeliversNothing() {
+        SimConfig cfg;
+        cfg.nodes = 4;
+        cfg.areaM = 5;
+        cfg.lossPct = 100;
+        SwarmSim sim(cfg);
+        setupExchange(sim);
+        sim.run(3000);
+        CHECK(sim.medium().receptions == 0);
+        CHECK(sim.medium().lost > 0);
+        CHECK(delivered() == 0);
+    }
+
+    static uint32_t totalRequests(SwarmSim& sim) {
+        uint32_t n = 0;
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            n += st.txRequests;
+        }
+        return n;
+    }
+
+    // 交換が済んだ後は、内容の変わらない近隣を要求し直さない（受信済みの期限は広告を聞くたびに延びる）。
+    // 近隣が旧来の 32 件の LRU より多くても同じ
+    static void testKnownContentIsNotRequestedAgain() {
+        SimConfig cfg;
+        cfg.nodes = 40;
+        cfg.areaM = 20;
+        SwarmSim sim(cfg);
+        setupExchange(sim);
+        sim.run(30000);
+        CHECK(delivered() == 40 * 39);
+        const uint32_t settled = totalRequests(sim);
+        sim.run(150000);   // 受信済みの期限（60 秒）を2回越える
+        CHECK(totalRequests(sim) - settled <= 10);   // 衝突で聞き逃した分の取り直しが少しだけ
+    }
+
+    // 群れでは Trickle のほうが以前の 1.0-1.5 秒の固定間隔より広告（ビーコンと旧ファーム向けの全文）の
+    // エアタイムが少なく、交換はどちらでも済む。他の台の新しい内容を聞いても区間は短く戻さない
+    static uint64_t advertAirtimeUs(bool trickle) {
+        SimConfig cfg;
+        cfg.nodes = 50;
+        cfg.areaM = 20;
+        SwarmSim sim(cfg);
+        setupExchange(sim);
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            Comm_SetTrickle(trickle);
+        }
+        sim.run(40000);
+        CHECK(delivered() == 50 * 49);
+        return sim.medium().airtimeUsByType[2] + sim.medium().airtimeUsByType[0];
+    }
+
+    static void testTrickleAdvertisesLessThanFixedInACrowd() {
+        const uint64_t trickle = advertAirtimeUs(true);
+        const uint64_t fixed = advertAirtimeUs(false);
+        CHECK(trickle * 3 < fixed);
+    }
+
+    // ユニキャスト交換でも全台がそろう。応答は宛先の ACK で確かめている
+    static void testUnicastExchangeCompletes() {
+        SimConfig cfg;
+        cfg.nodes = 6;
+        cfg.areaM = 8;
+        SwarmSim sim(cfg);
+        setupExchange(sim);
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            Comm_SetUnicastExchange(true);
+        }
+        sim.run(15000);
+        CHECK(delivered() == 6 * 5);
+        uint32_t acked = 0;
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            acked += st.txUnicastAcked;
+        }
+        CHECK(acked > 0);
+    }
+
+    // v1 と v2 が混ざっても全台がそろう。v2 同士は1フレームで送り、v1 の相手へは分割に戻す
+    static void testMixedVersionsExchange() {
+        SimConfig cfg;
+        cfg.nodes = 6;
+        cfg.areaM = 8;
+        cfg.espNowVersion = {2, 1, 2, 1, 2, 1};
+        SwarmSim sim(cfg);
+        setupExchange(sim);
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            Comm_SetUnicastExchange(true);
+        }
+        sim.run(15000);
+        CHECK(delivered() == 6 * 5);
+        uint32_t large = 0;
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            CHECK(st.espNowVersion == cfg.espNowVersion[i]);
+            large += st.txLargeFrames;
+        }
+        CHECK(large > 0);
+        CHECK(sim.medium().oversize == 0);   // v1 の台へ大きなフレームを送っていない
+    }
+
+    // 内容の変わらない近隣は、旧ファーム向けの全文や他の台への応答で何度届いても1回だけ通知する
+    static void testUnchangedContentIsDeliveredOnce() {
+        SimConfig cfg;
+        cfg.nodes = 6;
+        cfg.areaM = 8;
+        SwarmSim sim(cfg);
+        setupExchange(sim);
+        sim.run(300000);
+        CHECK(delivered() == 6 * 5);
+        CHECK(repeated() == 0);
+        uint32_t hits = 0;
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            hits += st.dedupHits;
+        }
+        CHECK(hits > 0);   // 同じ内容は届いている（捨てられている）
+    }
+
+    // 混雑しても NACK は送ったメッセージより少ない（確率で見送り、窓ごとの上限、要求中の内容は再要求で取り直す）。
+    // ~600 バイトは 4 チャンクで、1通を 59 台が聞いても NACK は1通あたり1回に届かない
+    static void testNacksStayBoundedInACrowd() {
+        SimConfig cfg;
+        cfg.nodes = 60;
+        cfg.areaM = 20;
+        SwarmSim sim(cfg);
+        setupExchange(sim);
+        sim.run(20000);
+        const uint32_t nacks = sim.medium().framesByType[4], chunks = sim.medium().framesByType[6];
+        CHECK(chunks > 1000);
+        CHECK(nacks * 4 < chunks);
+        CHECK(delivered() > 0);
+    }
+
+    // 全台が ~850 バイト（5 チャンク）の別々のメッセージを 1.0-1.5 秒ごとにブロードキャストする
+    static std::vector<unsigned long> s_loadNextAt;
+    static std::vector<uint32_t> s_loadSent;
+    static unsigned long s_loadUntil;
+
+    static void loadLoop(SwarmSim& sim, size_t i) {
+        if (sim.now() < s_loadNextAt[i] || sim.now() >= s_loadUntil) return;
+        s_loadNextAt[i] = sim.now() + 1000 + sim.random() % 501;
+        std::string json = "{\"id\":" + std::to_string(i) + ",\"seq\":" + std::to_string(s_loadSent[i]++) + ",\"rgbData\":\"";
+        while (json.size() < 848) json += "0123456789abcdef";
+        json.resize(848);
+        Comm_SendJsonBroadcast(String((json + "\"}").c_str()));
+    }
+
+    static void setupLoad(SwarmSim& sim, bool slotting, unsigned long from, unsigned long until) {
+        s_got.assign(sim.size(), std::vector<uint32_t>(sim.size(), 0));
+        s_loadNextAt.resize(sim.size());
+        s_loadSent.assign(sim.size(), 0);
+        s_loadUntil = until;
+        for (size_t i = 0; i < sim.size(); i++) {
+            s_loadNextAt[i] = from + sim.random() % 1500;
+            sim.select(i);
+            Comm_SetOnMessage(onMessage);
+        }
+        sim.init();
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            Comm_SetOwnContent(String("{\"swarm\":true}"), 0, nullptr, 0);   // ビーコン（スロットの時計）用。id を持たないので数えない
+            Comm_SetSlotting(slotting);
+        }
+        sim.setLoop(loadLoop);
+    }
+
+    // 他の台と同じスロットを使っている台の数（reslots へ全台の移った回数の合計）
+    static size_t sharedSlots(SwarmSim& sim, uint32_t& reslots) {
+        std::vector<uint8_t> slot(sim.size());
+        reslots = 0;
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            slot[i] = st.slot;
+            reslots += st.slotReslots;
+        }
+        size_t n = 0;
+        for (size_t i = 0; i < sim.size(); i++) {
+            for (size_t j = 0; j < sim.size(); j++) {
+                if (i != j && slot[i] == slot[j]) {
+                    n++;
+                    break;
+                }
+            }
+        }
+        return n;
+    }
+
+    // MAC のハッシュで同じスロットに入った台は、聞こえた混み具合で空いたスロットへ散る（移り続けない）
+    static void testSharedSlotsDisperse() {
+        SimConfig cfg;
+        cfg.nodes = 40;
+        cfg.areaM = 10;
+        SwarmSim sim(cfg);
+        setupLoad(sim, true, 0, 60000);
+        uint32_t reslots = 0;
+        const size_t before = sharedSlots(sim, reslots);
+        sim.run(60000);
+        CHECK(before > 0);
+        CHECK(sharedSlots(sim, reslots) == 0);
+        CHECK(reslots <= before);                      // 同じスロットの組のうち片方ずつが移れば足りる
+        CHECK(delivered() == sim.size() * (sim.size() - 1));
+    }
+
+    // 50 台が同時に分割メッセージを送っても、混ざったチャンクから（NACK での補いを含めて）ほぼ全部組み上がる
+    static void testCrowdReassemblesInterleavedSenders() {
+        SimConfig cfg;
+        cfg.nodes = 50;
+        cfg.areaM = 20;
+        SwarmSim sim(cfg);
+        setupLoad(sim, false, 20000, 40000);   // 初対面のハンドシェイクが済んでから送り始める
+        sim.run(43000);
+        uint64_t sent = 0, got = 0, evicted = 0, completed = 0;
+        for (size_t i = 0; i < sim.size(); i++) {
+            sent += s_loadSent[i] * (sim.size() - 1);
+            for (size_t s = 0; s < sim.size(); s++) got += (s != i) ? s_got[i][s] : 0;
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            evicted += st.rxChunkedEvicted;
+            completed += st.rxChunkedCompleted;
+        }
+        CHECK(got * 1000 >= sent * 995);
+        CHECK(evicted * 100 <= completed);             // 同時に届く送信元より再構成スロットが多い
+    }
+
+    // コンテンツを持たない台は初対面のハンドシェイクを始めない（持っている台からは受け取る）
+    static void testNoContentStartsNoHandshake() {
+        SimConfig cfg;
+        cfg.nodes = 5;
+        cfg.areaM = 5;
+        SwarmSim sim(cfg);
+        s_got.assign(sim.size(), std::vector<uint32_t>(sim.size(), 0));
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            Comm_SetOnMessage(onMessage);
+        }
+        sim.init();
+        sim.select(0);
+        Comm_SetOwnContent(String("{\"id\":0}"), 0, nullptr, 0);
+        sim.run(10000);
+        uint32_t hello = sim.medium().framesByType[7];
+        CHECK(hello <= 4 * 4);                         // 0 番から各台へ（送り直しを含めても少し）
+        for (size_t i = 1; i < sim.size(); i++) CHECK(s_got[i][0]);
+        for (size_t i = 1; i < sim.size(); i++) {
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            CHECK(st.hsStarted <= 1);                  // 0 番からの HELLO に応えた分だけ
+        }
+    }
+
+    // 注目コンテンツ: 中継ありなら格子の角から全台へ届き、なしなら直接聞こえる台だけ
+    static std::vector<bool> s_featured;
+
+    static void onFeatured(uint8_t, uint8_t flags, uint32_t, const uint8_t*, size_t) {
+        if (flags & COMM_FLAG_FEATURED) s_featured[SwarmSim::current()->cur()] = true;
+    }
+
+    static size_t featuredReach(bool relay, uint32_t& forwarded) {
+        SimConfig cfg;
+        cfg.nodes = 36;
+        cfg.areaM = 100;
+        cfg.grid = true;
+        SwarmSim sim(cfg);
+        s_featured.assign(sim.size(), false);
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            Comm_SetOnContent(onFeatured);
+        }
+        sim.init();
+        for (size_t i = 0; i < sim.size(); i++) {
+            sim.select(i);
+            Comm_SetRelay(relay);
+        }
+        sim.run(500);
+        sim.select(0);
+        const uint8_t payload[100] = {1};
+        CHECK(Comm_SendFeatured(1, 0, 0x1234, payload, sizeof(payload), 8));
+        sim.run(3000);
+        size_t reached = 0;
+        forwarded = 0;
+        for (size_t i = 1; i < sim.size(); i++) {
+            reached += s_featured[i];
+            sim.select(i);
+            CommStats st;
+            Comm_GetStats(st);
+            forwarded += st.relayForwarded;
+        }
+        return reached;
+    }
+
+    static void testRelayCoversGrid() {
+        uint32_t fwdOff = 0, fwdOn = 0;
+        const size_t off = featuredReach(false, fwdOff);
+        const size_t on = featuredReach(true, fwdOn);
+        CHECK(off < 35 / 2);          // 角から直接届くのは一部だけ
+        CHECK(on == 35);
+        CHECK(fwdOff == 0);
+        CHECK(fwdOn > 0 && fwdOn < 35); // 重複を聞いた台は送らない
+    }
+}
+
+int main() {
+    RUN_TEST(testSmallSwarmExchangesEverything);
+    RUN_TEST(testSameSeedIsDeterministic);
+    RUN_TEST(testOutOfRangeNodeHearsNothing);
+    RUN_TEST(testRssiFollowsDistance);
+    RUN_TEST(testTotalLossDeliversNothing);
+    RUN_TEST(testKnownContentIsNotRequestedAgain);
+    RUN_TEST(testTrickleAdvertisesLessThanFixedInACrowd);
+    RUN_TEST(testUnicastExchangeCompletes);
+    RUN_TEST(testMixedVersionsExchange);
+    RUN_TEST(testUnchangedContentIsDeliveredOnce);
+    RUN_TEST(testNacksStayBoundedInACrowd);
+    RUN_TEST(testSharedSlotsDisperse);
+    RUN_TEST(testCrowdReassemblesInterleavedSenders);
+    RUN_TEST(testNoContentStartsNoHandshake);
+    RUN_TEST(testRelayCoversGrid);
+    return testResult();
+}
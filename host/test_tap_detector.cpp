@@ -0,0 +1,235 @@
+// タップ（RSSI の急な立ち上がり → 安定）検出のテスト: TapDetector 単体と、受信経路を通した近隣ごとの検出
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "Host_Test.h"
+#include "Swarm_Sim.h"
+#include "../Tap_Detector.h"
+
+namespace {
+    struct Sample {
+        unsigned long ms;
+        int rssi;
+    };
+
+    // 列を流して検出したタップの時刻を返す（最初のサンプルで Reset）
+    static std::vector<unsigned long> feed(const std::vector<Sample>& trace, const TapParams& p = TapParams()) {
+        std::vector<unsigned long> taps;
+        TapDetector d;
+        for (size_t i = 0; i < trace.size(); i++) {
+            if (i == 0) TapDetector_Reset(d, trace[i].rssi, trace[i].ms);
+            else if (TapDetector_Update(d, p, trace[i].rssi, trace[i].ms)) taps.push_back(trace[i].ms);
+        }
+        return taps;
+    }
+
+    // from から to まで rateDbPerSec で変化し、その後 holdMs 保持する（every ms ごとのサンプル）
+    static std::vector<Sample> ramp(int from, int to, float rateDbPerSec, unsigned long holdMs,
+                                    unsigned long every = 50, unsigned long startMs = 1000) {
+        std::vector<Sample> v;
+        for (unsigned long t = 0; t < startMs; t += every) v.push_back({t, from});
+        const unsigned long rampMs = (unsigned long)(fabsf((float)(to - from)) * 1000.0f / rateDbPerSec);
+        for (unsigned long t = 0; t < rampMs; t += every) {
+            v.push_back({startMs + t, from + (int)lroundf((float)(to - from) * t / rampMs)});
+        }
+        for (unsigned long t = 0; t <= holdMs; t += every) v.push_back({startMs + rampMs + t, to});
+        return v;
+    }
+
+    // ===== TapDetector 単体（合成した列） =====
+    static void testSharpRiseThenPlateauTapsOnce() {
+        const TapParams p;
+        const std::vector<Sample> trace = ramp(-80, -45, 200.0f, 1500);
+        const std::vector<unsigned long> taps = feed(trace);
+        CHECK(taps.size() == 1);
+        // 立ち上がり（~175ms）の途中で安定待ちに入り、plateauMs 保ったところで出る
+        if (!taps.empty()) CHECK(taps[0] >= 1000 + p.plateauMs && taps[0] <= 1000 + 175 + p.plateauMs + 100);
+    }
+
+    static void testSlowApproachNeverTaps() {
+        for (float rate : {3.0f, 8.0f, 15.0f}) CHECK(feed(ramp(-85, -45, rate, 2000)).empty());
+        CHECK(feed(ramp(-85, -45, 150.0f, 2000)).size() == 1);
+    }
+
+    static void testShortSpikeIsNotATap() {
+        std::vector<Sample> v = ramp(-80, -45, 400.0f, 50);    // 保持 50ms（plateauMs 未満）
+        const unsigned long end = v.back().ms;
+        for (unsigned long t = 50; t < 2000; t += 50) v.push_back({end + t, -80});
+        CHECK(feed(v).empty());
+    }
+
+    static void testRiseBelowPlateauIsNotATap() {
+        CHECK(feed(ramp(-92, -70, 200.0f, 2000)).empty());     // -65 dBm に届かない
+        TapParams p;
+        p.plateauDbm = -75;
+        CHECK(feed(ramp(-92, -70, 200.0f, 2000), p).size() == 1);
+    }
+
+    static void testCooldownSuppressesRepeat() {
+        std::vector<Sample> v;
+        auto tapAt = [&](unsigned long at) {
+            for (unsigned long t = 0; t < 600; t += 50) v.push_back({at + t, t < 100 ? -80 : -45});
+            for (unsigned long t = 600; t < 1000; t += 50) v.push_back({at + t, -80});
+        };
+        tapAt(1000);
+        tapAt(2000);                                             // 1s 後: クールダウン中
+        tapAt(5000);                                             // 4s 後: 出る
+        const std::vector<unsigned long> taps = feed(v);
+        CHECK(taps.size() == 2);
+        if (taps.size() == 2) CHECK(taps[1] >= 5000);
+    }
+
+    // 受信が長く途切れた後の値は立ち上がりとみなさない
+    static void testLongGapResetsBaseline() {
+        std::vector<Sample> v = {{0, -85}, {100, -85}, {200, -85}, {20000, -45}};
+        for (unsigned long t = 20050; t < 22000; t += 50) v.push_back({t, -45});
+        CHECK(feed(v).empty());
+    }
+
+    // ===== 記録形式の列（fixtures/tap_traces.csv） =====
+    static void testTraceFixtures() {
+        FILE* fp = fopen(FIXTURE_DIR "/tap_traces.csv", "rb");
+        CHECK(fp != nullptr);
+        if (!fp) return;
+        std::map<std::string, std::vector<Sample>> traces;
+        std::map<std::string, int> expect;
+        char line[256];
+        while (fgets(line, sizeof(line), fp)) {
+            char name[64];
+            int n;
+            unsigned long ms;
+            if (sscanf(line, "# expect %63s %d", name, &n) == 2) expect[name] = n;
+            else if (line[0] != '#' && sscanf(line, "%63[^,],%lu,%d", name, &ms, &n) == 3) traces[name].push_back({ms, n});
+        }
+        fclose(fp);
+        CHECK(expect.size() >= 5);
+        for (const auto& e : expect) {
+            CHECK(traces[e.first].size() > 10);
+            const size_t taps = feed(traces[e.first]).size();
+            if ((int)taps != e.second) printf("  %s: %zu taps, expected %d\n", e.first.c_str(), taps, e.second);
+            CHECK((int)taps == e.second);
+        }
+    }
+
+    // ===== 受信経路を通した検出（仮想の媒体: 0 番が 100ms ごとに送り、1 番の RSSI を見る） =====
+    static uint32_t s_taps;
+    static unsigned long s_nextSend;
+    static std::vector<int> s_beaconRssi, s_dataRssi;
+
+    static void onTap(const uint8_t*, int) {
+        if (SwarmSim::current()->cur() == 1) s_taps++;
+    }
+
+    static void onRaw(unsigned long, const uint8_t*, int rssi, const uint8_t* data, size_t len) {
+        if (SwarmSim::current()->cur() != 1 || len < 3 || data[0] != 0xE7) return;   // FRAME_MAGIC
+        if (data[2] == 2) s_beaconRssi.push_back(rssi);                             // FRAME_BEACON
+        else if (data[2] == 1) s_dataRssi.push_back(rssi);                          // FRAME_CONTENT
+    }
+
+    static void senderLoop(SwarmSim& sim, size_t i) {
+        if (i != 0 || sim.now() < s_nextSend) return;
+        s_nextSend = sim.now() + 100;
+        const uint8_t text[] = "hi";
+        Comm_SendContentBroadcast(COMM_CONTENT_TEXT, 0, 1, text, sizeof(text));
+    }
+
+    static void setupPair(SwarmSim& sim) {
+        s_taps = 0;
+        s_nextSend = 0;
+        s_beaconRssi.clear();
+        s_dataRssi.clear();
+        for (size_t i = 0; i < 2; i++) {
+            sim.select(i);
+            Comm_SetOnTap(onTap);
+            Comm_SetOnRawFrame(onRaw);
+        }
+        sim.init();
+        sim.select(0);
+        Comm_SetOwnContent(String("{\"id\":0}"), 0, nullptr, 0);
+        sim.setLoop(senderLoop);
+    }
+
+    // 1 番を (x0 → x1) へ ms かけて動かす
+    static void walk(SwarmSim& sim, float x0, float x1, unsigned long ms) {
+        const unsigned long steps = ms / 20;
+        for (unsigned long s = 1; s <= steps; s++) {
+            sim.place(1, x0 + (x1 - x0) * s / steps, 0);
+            sim.run(20);
+        }
+    }
+
+    static SimConfig pairConfig() {
+        SimConfig cfg;
+        cfg.nodes = 2;
+        cfg.shadowDb = 0;
+        cfg.bootSpreadMs = 0;
+        return cfg;
+    }
+
+    static void testApproachThroughReceivePath() {
+        for (int fast = 0; fast < 2; fast++) {
+            SwarmSim sim(pairConfig());
+            sim.place(0, 0, 0);
+            sim.place(1, 12, 0);
+            setupPair(sim);
+            sim.run(3000);
+            walk(sim, 12, 0.3f, fast ? 300 : 15000);   // 12m → 0.3m（-72 → -24 dBm）
+            sim.run(2000);
+            CHECK(s_taps == (fast ? 1u : 0u));
+        }
+    }
+
+    // 0 番がビーコンを 20 dBm、データを 2 dBm で送る（近くの相手だけに届ける設定）。
+    // 生の RSSI はフレームごとに 18 dB 上下するが、ビーコンの txPower / dataPower で換算するのでタップにならない。
+    // データを 2 秒送った後に止め、ビーコンだけになる（換算しなければ 18 dB の立ち上がり → 安定でタップになる形）
+    static void testTxPowerStepIsNotATap() {
+        SwarmSim sim(pairConfig());
+        sim.place(0, 0, 0);
+        sim.place(1, 2, 0);                              // ビーコン ~-29 dBm、データ ~-47 dBm
+        setupPair(sim);
+        sim.select(0);
+        CommTxPower txp;
+        txp.adaptive = false;
+        txp.beaconDbm = 20;
+        txp.maxDbm = 2;
+        Comm_SetTxPower(txp);
+        sim.run(4000);                                   // データとビーコンが混ざる
+        sim.setLoop(nullptr);
+        sim.select(0);
+        Comm_SetOwnContent(String("{\"id\":1}"), 0, nullptr, 0);   // 新しい内容: ビーコンをすぐ出し直す
+        sim.run(6000);                                   // ビーコンだけ
+
+        CHECK(s_beaconRssi.size() >= 3 && s_dataRssi.size() >= 10);
+        if (!s_beaconRssi.empty() && !s_dataRssi.empty()) {
+            long b = 0, d = 0;
+            for (int r : s_beaconRssi) b += r;
+            for (int r : s_dataRssi) d += r;
+            const long step = b / (long)s_beaconRssi.size() - d / (long)s_dataRssi.size();
+            CHECK(step >= 15);                           // 生の RSSI には段差がある
+        }
+        CHECK(s_taps == 0);
+
+        // 同じ段差を換算せずに TapDetector へ直接流すとタップになる（このテストが見ている形）
+        std::vector<Sample> raw;
+        for (unsigned long t = 0; t < 2000; t += 50) raw.push_back({t, -47});
+        for (unsigned long t = 2000; t < 5000; t += 50) raw.push_back({t, -29});
+        CHECK(feed(raw).size() == 1);
+    }
+}
+
+int main() {
+    RUN_TEST(testSharpRiseThenPlateauTapsOnce);
+    RUN_TEST(testSlowApproachNeverTaps);
+    RUN_TEST(testShortSpikeIsNotATap);
+    RUN_TEST(testRiseBelowPlateauIsNotATap);
+    RUN_TEST(testCooldownSuppressesRepeat);
+    RUN_TEST(testLongGapResetsBaseline);
+    RUN_TEST(testTraceFixtures);
+    RUN_TEST(testApproachThroughReceivePath);
+    RUN_TEST(testTxPowerStepIsNotATap);
+    return testResult();
+}
@@ -13,8 +13,11 @@
 #include "Motion.h"
 #include "Display_Manager.h"
 #include "Json_Handler.h"
+#include "Image_Codec.h"
 #include "BLE_Manager.h"
 #include "Comm_EspNow.h"
+#include "Comm_Capture.h"
+#include "Comm_Perf.h"
 #include "OTA_Handler.h"
 
 /***** LED MATRIX 設定 *****/
@@ -31,9 +34,7 @@ static OneButton g_btnBoot(0, true);
 static bool DisplayMode = false;
 
 /***** 受信制御 *****/
-String lastRxData = "";
-unsigned long lastRxTime = 0;
-const unsigned long IGNORE_MS = 4000;
+const unsigned long IGNORE_MS = 4000;  // 同じ内容の再表示を抑える期間（通信層で判定）
 const unsigned long RECEIVE_DISPLAY_HOLD_MS = 5000;
 const unsigned long RECEIVE_DISPLAY_GUARD_MS = 4500;
 
@@ -43,39 +44,169 @@ static const char* JSON_PATH = "/data.json";
 static int RSSI_THRESHOLD_DBM = -65;
 //金属-65
 //PLA-50
+static const uint8_t FEC_GROUP = 3; // 分割送信の3チャンクごとにXORパリティ（0で無効）
+static const bool UNICAST_EXCHANGE = true; // 相手が決まったら ACK 付きユニキャストで交換
+// 送信レート: ユニキャストの到達率で 11Mbps から上げ下げ（混んだ会場で1フレームの占有時間を減らす）
+// 会場が広く距離が足りなければ COMM_RATE_LR（LR 対応の相手にしか届かない）
+static const CommRateMode RATE_MODE = COMM_RATE_ADAPTIVE;
+static const wifi_phy_rate_t RATE_START = WIFI_PHY_RATE_11M_L;
+// 送信電力: データは受け入れ中の相手に届く最小まで下げる。ビーコンは接近を拾える程度に抑える
+static const int8_t TX_POWER_BEACON_DBM = 14;
+static const bool SLOTTED_TX = false; // 混雑した会場向け: ブロードキャストのデータを自分のスロットでだけ送る
+static const bool FEATURED_RELAY = false; // 他の端末の注目コンテンツを中継する（イベント時に有効化）
+static const uint8_t TAP_RISE_DB = 12;       // タップ: この dB 以上の急な立ち上がり
+static const uint16_t TAP_PLATEAU_MS = 120;  // のあと、しきい値以上をこの時間保つ
 
 /***** ランタイム状態 *****/
 String myJson;
 static size_t currentInboxIndex = 0;
 
-/***** 受信コールバック *****/
-static void OnMessageReceived(const uint8_t* data, size_t len) {
-  String incoming((const char*)data, len);
-
-  if (incoming.equals(lastRxData) && (millis() - lastRxTime < IGNORE_MS)) {
-    return;
+/***** 送信コンテンツ（myJson をバイナリ化したもの） *****/
+static uint32_t myContentHash = 0;
+
+// myJson が変わっていたら送信用バイナリを作り直して通信層へ登録する
+static void refreshMyContent() {
+  const uint32_t h = Comm_Hash32((const uint8_t*)myJson.c_str(), myJson.length());
+  if (h == myContentHash) return;
+  myContentHash = h;
+
+  uint8_t type = 0;  // 0 = バイナリ化できない（JSONで送る）
+  uint8_t content[COMM_CONTENT_MAX];
+  size_t len = 0;
+
+  String flag, text;
+  std::vector<uint8_t> rgb;
+  if (parseDisplayJson(myJson, flag, text, rgb)) {
+    if ((flag == "image" || flag == "emoji") && rgb.size() == IMAGE_CODEC_RGB_BYTES) {
+      len = ImageCodec_Encode(rgb.data(), rgb.size(), content, sizeof(content));
+      if (len > 0) type = COMM_CONTENT_IMAGE_PACKED;
+      debugPrintf("[TX] 画像 %uB -> %uB\n", (unsigned)rgb.size(), (unsigned)len);
+    } else if (flag == "text" && !text.isEmpty() && text.length() <= COMM_CONTENT_MAX) {
+      type = COMM_CONTENT_TEXT;
+      len = text.length();
+      memcpy(content, text.c_str(), len);
+    }
   }
+  Comm_SetOwnContent(myJson, type, content, len);
+}
 
-  lastRxData = incoming;
-  lastRxTime = millis();
+static_assert(IMAGE_CODEC_RGB_BYTES == DISP_W * DISP_H * 3, "codec and display sizes differ");
 
-  saveIncomingJson(data, len);
-  
+/***** 受信コールバック（loop の Comm_Tick から呼ばれるので表示に時間をかけてよい） *****/
+// 受信した表示データ（displayFlag 等へ反映済み）を演出付きで表示
+static void presentReceived() {
   DisplayManager::Clear(); 
 
   DisplayManager::BlockFor(RECEIVE_DISPLAY_GUARD_MS);
   Ripple_PlayOnce();
 
-  if (!loadDisplayFromJsonString(incoming)) {
-    debugPrintln("JSONパース失敗");
-  } else if (!performDisplay(true, RECEIVE_DISPLAY_HOLD_MS, false)) {
+  if (!performDisplay(true, RECEIVE_DISPLAY_HOLD_MS, false)) {
     debugPrintln("表示失敗");
   } else {
     debugPrintln("受信データを表示中");
   }
+}
+
+/***** 受信途中の画像を届いた分だけ描画 *****/
+static const unsigned long STREAM_STALE_MS = 3000;  // これより止まった描画中の受信は別の受信に譲る
+static const size_t STREAM_PIXELS = DISP_W * DISP_H;
+
+static RgbStreamDecoder s_stream;
+static uint32_t s_streamId = 0;
+static bool s_streamActive = false;
+static bool s_streamComplete = false;
+static size_t s_streamDrawn = 0;            // 描画済みピクセル数
+static unsigned long s_streamLastAt = 0;
+static unsigned long lastFirstPixelMs = 0;  // 最初のチャンク受信 → 最初のピクセル
+static unsigned long lastFullFrameMs = 0;   // 最初のチャンク受信 → 全ピクセル
+
+static void OnStreamProgress(const CommStreamProgress& p) {
+  const unsigned long now = millis();
+  if (!p.data) {
+    // 完成しなかった: 描きかけなら保持ガードをすぐ切って loop に自分の表示へ戻させる
+    if (s_streamActive && p.id == s_streamId) {
+      s_streamActive = false;
+      if (s_streamDrawn > 0) DisplayManager::BlockFor(1);
+    }
+    return;
+  }
+  if (!s_streamActive || p.id != s_streamId) {
+    if (s_streamActive && s_streamDrawn > 0 && now - s_streamLastAt < STREAM_STALE_MS) return;
+    rgbStreamReset(s_stream);
+    s_streamId = p.id;
+    s_streamActive = true;
+    s_streamDrawn = 0;
+  }
+  s_streamLastAt = now;
+  s_streamComplete = p.complete;
+
+  const size_t px = rgbStreamFeed(s_stream, p.data, p.len);
+  if (px <= s_streamDrawn) return;
+  if (s_streamDrawn == 0) {
+    DisplayManager::Clear();
+    DisplayManager::BlockFor(RECEIVE_DISPLAY_GUARD_MS);
+    lastFirstPixelMs = now - p.startedAt;
+  }
+  DisplayManager::DrawRGBRange(s_stream.rgb, s_streamDrawn, px);
+  s_streamDrawn = px;
+  if (px >= STREAM_PIXELS) lastFullFrameMs = now - p.startedAt;
+}
+
+// 重複は通信層（Comm_SetDedupWindow）で除かれてから呼ばれる
+static void OnMessageReceived(const uint8_t* data, size_t len) {
+  // 受信しながら全ピクセルを描き終えていれば演出は省いてそのまま保持する
+  const bool streamed = s_streamActive && s_streamComplete && s_streamDrawn >= STREAM_PIXELS;
+  s_streamActive = false;
+
+  saveIncomingJson(data, len);
+
+  String incoming((const char*)data, len);
+  if (!loadDisplayFromJsonString(incoming)) {
+    debugPrintln("JSONパース失敗");
+    DisplayManager::Clear();
+  } else if (streamed) {
+    debugPrintf("[RX] 逐次描画 first pixel %lu ms, full frame %lu ms\n",
+                lastFirstPixelMs, lastFullFrameMs);
+    performDisplay(false, RECEIVE_DISPLAY_HOLD_MS, false);
+  } else {
+    presentReceived();
+  }
   debugPrintln(incoming);
 }
 
+// バイナリ受信: JSONを介さずRGB/テキストをそのまま表示する
+static void OnContentReceived(uint8_t type, uint8_t flags, uint32_t hash,
+                              const uint8_t* payload, size_t len) {
+  (void)hash;
+  if (flags & COMM_FLAG_FEATURED) debugPrintln("[RX] 注目コンテンツ（中継）");
+
+  bool ok = false;
+  if (type == COMM_CONTENT_IMAGE_RGB) {
+    ok = loadDisplayFromRgb(payload, len);
+  } else if (type == COMM_CONTENT_IMAGE_PACKED) {
+    uint8_t rgb[IMAGE_CODEC_RGB_BYTES];
+    ok = ImageCodec_Decode(payload, len, rgb) && loadDisplayFromRgb(rgb, sizeof(rgb));
+  } else if (type == COMM_CONTENT_TEXT) {
+    ok = loadDisplayFromText((const char*)payload, len);
+  }
+  if (!ok) {
+    debugPrintf("未対応のコンテンツ type=%u len=%u\n", type, (unsigned)len);
+    return;
+  }
+
+  // インボックスは JSON で保持しているので戻して保存
+  String js = displayToJsonString();
+  saveIncomingJson((const uint8_t*)js.c_str(), js.length());
+
+  presentReceived();
+}
+
+// タップ（端末を近づけた）: 通信層が交換をやり直すので、ここではログだけ
+static void OnTap(const uint8_t mac[6], int rssi) {
+  debugPrintf("[RX] Tap %02X:%02X:%02X:%02X:%02X:%02X %d dBm\n",
+              mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], rssi);
+}
+
 /***** setup *****/
 void setup() {
   Serial.begin(115200);
@@ -152,13 +283,33 @@ void setup() {
   }
 
   Comm_SetOnMessage(OnMessageReceived);
+  Comm_SetOnContent(OnContentReceived);
+  Comm_SetOnProgress(OnStreamProgress);
+  Comm_SetOnTap(OnTap);
 
   WiFi.mode(WIFI_STA);
   esp_wifi_set_channel(WIFI_CH, WIFI_SECOND_CHAN_NONE);
   debugPrintf("強制的に CH %d を使用\n", WIFI_CH);
-  Comm_Init(WIFI_CH);
+  CommRatePolicy rate;
+  rate.mode = RATE_MODE;
+  rate.rate = RATE_START;
+  Comm_Init(WIFI_CH, rate);
 
   Comm_SetMinRssiToAccept(RSSI_THRESHOLD_DBM);
+  Comm_SetRssiAdapt(CommRssiAdapt()); // 近隣数でしきい値を上下（既定値）
+  CommTxPower txp;
+  txp.beaconDbm = TX_POWER_BEACON_DBM;
+  Comm_SetTxPower(txp);
+  Comm_SetSlotting(SLOTTED_TX);
+  Comm_SetRelay(FEATURED_RELAY);
+  Comm_SetFecGroup(FEC_GROUP);
+  Comm_SetDedupWindow(IGNORE_MS);
+  Comm_SetUnicastExchange(UNICAST_EXCHANGE);
+  TapParams tap;
+  tap.riseDb = TAP_RISE_DB;
+  tap.plateauDbm = (int8_t)RSSI_THRESHOLD_DBM;
+  tap.plateauMs = TAP_PLATEAU_MS;
+  Comm_SetTapParams(tap);
 
   BLE_Init();
 }
@@ -173,7 +324,6 @@ void loop() {
   g_btn.tick();
   g_btnBoot.tick();
 
-  static unsigned long nextSend = 0;
   unsigned long now = millis();
 
   static unsigned long lastStatusCheck = 0;
@@ -187,7 +337,66 @@ void loop() {
     debugPrintln("--- [RX STATUS CHECK] ---");
     debugPrintf("Time: %lu ms\n", now);
     debugPrintf("WiFi Channel: %d (Target: %d)\n", pCh, WIFI_CH);
-    debugPrintf("RSSI Threshold: %d dBm\n", RSSI_THRESHOLD_DBM);
+    CommStats st;
+    Comm_GetStats(st);
+    debugPrintf("RSSI Threshold: %d dBm (effective %d dBm, %u active, enter %lu / exit %lu)\n",
+                RSSI_THRESHOLD_DBM, st.rssiThreshold, st.activeNeighbors,
+                (unsigned long)st.rssiEnters, (unsigned long)st.rssiExits);
+    debugPrintf("RX Frames: %lu (Queue %u/%u, High-water %u, Drops %lu, Bad %lu)\n",
+                (unsigned long)st.rxFrames, st.rxQueueDepth, st.rxQueueSlots,
+                st.rxQueueHighWater, (unsigned long)st.rxQueueDrops,
+                (unsigned long)st.rxBadFrames);
+    debugPrintf("TX Frames: %lu (Queue %u, High-water %u, Drops %lu, Fail %lu, %lu pkt/s)\n",
+                (unsigned long)st.txFrames, st.txQueueDepth, st.txQueueHighWater,
+                (unsigned long)st.txQueueDrops, (unsigned long)st.txFailures,
+                (unsigned long)st.txPacketsPerSec);
+    debugPrintf("TX Rate: %u kbps (up %lu, down %lu, delivery %u%%), Power: data %d dBm, beacon %d dBm (%lu changes)\n",
+                st.txRateKbps, (unsigned long)st.txRateUps, (unsigned long)st.txRateDowns,
+                st.txRateDeliveryPct, st.txPowerDataDbm, st.txPowerBeaconDbm,
+                (unsigned long)st.txPowerChanges);
+    debugPrintf("TX Beacons: %lu (Suppressed %lu, Interval %lu ms), Requests: %lu, Served: %lu, Legacy: %lu\n",
+                (unsigned long)st.txBeacons, (unsigned long)st.txBeaconsSuppressed,
+                (unsigned long)st.beaconIntervalMs, (unsigned long)st.txRequests,
+                (unsigned long)st.txServed, (unsigned long)st.txLegacyFull);
+    debugPrintf("Chunked: Done %lu (last %lu ms), Timeout %lu, FEC %lu, NACK %lu (suppressed %lu), Retx %lu\n",
+                (unsigned long)st.rxChunkedCompleted, (unsigned long)st.rxChunkedLastMs,
+                (unsigned long)st.rxChunkedTimedOut, (unsigned long)st.rxFecRecovered,
+                (unsigned long)st.rxNacksSent, (unsigned long)st.rxNacksSuppressed,
+                (unsigned long)st.txRetransmits);
+    debugPrintf("ESP-NOW v%u: single-frame TX %lu, RX %lu\n",
+                st.espNowVersion, (unsigned long)st.txLargeFrames, (unsigned long)st.rxLargeFrames);
+    if (st.relayReceived || st.relay) {
+      debugPrintf("Relay (%s): received %lu (last %u hops), forwarded %lu, suppressed %lu, dup %lu, dropped %lu\n",
+                  st.relay ? "on" : "off", (unsigned long)st.relayReceived, st.relayLastHops,
+                  (unsigned long)st.relayForwarded, (unsigned long)st.relaySuppressed,
+                  (unsigned long)st.relayDuplicates, (unsigned long)st.relayDropped);
+    }
+    if (st.slotting) {
+      debugPrintf("Slot: %u (waits %lu, busy %lu, reslots %lu, clock syncs %lu)\n",
+                  st.slot, (unsigned long)st.slotWaits, (unsigned long)st.slotBusy,
+                  (unsigned long)st.slotReslots, (unsigned long)st.sfSyncs);
+    }
+    debugPrintf("Neighbors: %u (RSSI rejected %lu), Dedup hit %lu / miss %lu\n",
+                st.neighbors, (unsigned long)st.rxRssiRejected,
+                (unsigned long)st.dedupHits, (unsigned long)st.dedupMisses);
+    debugPrintf("Exchange (%s): %lu done, last %lu ms, avg %lu ms, ACK %lu, Retry %lu, Fallback %lu\n",
+                st.unicastExchange ? "unicast" : "broadcast", (unsigned long)st.exchanges,
+                (unsigned long)st.exchangeLastMs, (unsigned long)st.exchangeAvgMs,
+                (unsigned long)st.txUnicastAcked, (unsigned long)st.txUnicastRetries,
+                (unsigned long)st.txUnicastFallbacks);
+    debugPrintf("Handshake: %lu started, %lu done, %lu failed, last %lu ms, avg %lu ms, Taps %lu\n",
+                (unsigned long)st.hsStarted, (unsigned long)st.hsCompleted,
+                (unsigned long)st.hsFailed, (unsigned long)st.hsLastMs,
+                (unsigned long)st.hsAvgMs, (unsigned long)st.taps);
+    debugPrintf("Stream: first pixel %lu ms, full frame %lu ms\n", lastFirstPixelMs, lastFullFrameMs);
+    CaptureStats cap;
+    Capture_GetStats(cap);
+    if (cap.recording || cap.replaying) {
+      debugPrintf("Capture (%s): %lu frames, dropped %lu, written %lu B, replayed %lu\n",
+                  cap.recording ? "recording" : "replaying", (unsigned long)cap.frames,
+                  (unsigned long)cap.dropped, (unsigned long)cap.bytesWritten,
+                  (unsigned long)cap.replayed);
+    }
     debugPrintln("State: Listening for ESP-NOW packets...");
 
     if (pCh != WIFI_CH) {
@@ -218,10 +427,9 @@ void loop() {
 
   BLE_Tick();
 
-  if (!myJson.isEmpty() && now >= nextSend) {
-    Comm_SendJsonBroadcast(myJson);
-    nextSend = now + 1000 + (esp_random() % 500);
-  }
+  if (!myJson.isEmpty()) refreshMyContent();
+  Comm_Tick(); // 受信コールバック（表示の演出を含む）もここから呼ばれる
+  Capture_Tick();
 
   if (Serial.available() > 0) {
     String line = Serial.readStringUntil('\n');
@@ -234,6 +442,10 @@ void loop() {
         loadDisplayFromJsonString(myJson);
         performDisplay();
       }
+    } else if (Capture_HandleCommand(line)) {
+      // 受信フレームの記録/再生（cap start|stop|replay|clear|stat）
+    } else if (Perf_HandleCommand(line)) {
+      // 性能試験（perf sink on|off / perf run ... / perf stop / perf）
     }
   }
 }